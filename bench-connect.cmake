@@ -0,0 +1,26 @@
+# TCP connect benchmark executable configuration
+
+# Create bench_connect executable
+add_executable(bench_connect
+    src/bench_connect.c
+    src/transport_tcp.c
+    src/resolver.c
+    src/conn_metrics.c
+    src/latency_hist.c
+)
+
+# Include directories for bench_connect
+target_include_directories(bench_connect PRIVATE
+    ${CMAKE_CURRENT_SOURCE_DIR}/src
+    ${MBEDTLS_INCLUDE_DIRS}
+)
+
+# Link against mbedtls (transport_tcp maps EAGAIN to the mbedtls error codes)
+target_link_libraries(bench_connect PRIVATE
+    ${MBEDTLS_LIBRARIES}
+)
+
+# Set output directory
+set_target_properties(bench_connect PROPERTIES
+    RUNTIME_OUTPUT_DIRECTORY ${CMAKE_BINARY_DIR}/bin
+)
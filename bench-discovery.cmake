@@ -0,0 +1,29 @@
+# LAN discovery benchmark executable configuration
+
+# Create bench_discovery executable
+add_executable(bench_discovery
+    src/bench_discovery.c
+    src/lan_discovery.c
+    src/tuya_codec.c
+    src/crc32.c
+    src/json_tok.c
+    src/cpu_dispatch.c
+)
+
+# Include directories for bench_discovery
+target_include_directories(bench_discovery PRIVATE
+    ${CMAKE_CURRENT_SOURCE_DIR}/src
+    ${MBEDTLS_INCLUDE_DIRS}
+)
+
+# Link against mbedtls (AES, GCM for the broadcast frames) and pthreads
+# (kernel dispatch)
+target_link_libraries(bench_discovery PRIVATE
+    ${MBEDTLS_LIBRARIES}
+    Threads::Threads
+)
+
+# Set output directory
+set_target_properties(bench_discovery PROPERTIES
+    RUNTIME_OUTPUT_DIRECTORY ${CMAKE_BINARY_DIR}/bin
+)
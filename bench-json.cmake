@@ -0,0 +1,23 @@
+# JSON tokenizer benchmark executable configuration
+
+# Create bench_json executable
+add_executable(bench_json
+    src/bench_json.c
+    src/json_tok.c
+    src/cpu_dispatch.c
+)
+
+# Include directories for bench_json
+target_include_directories(bench_json PRIVATE
+    ${CMAKE_CURRENT_SOURCE_DIR}/src
+)
+
+# Link against pthreads (kernel dispatch is initialized with pthread_once)
+target_link_libraries(bench_json PRIVATE
+    Threads::Threads
+)
+
+# Set output directory
+set_target_properties(bench_json PROPERTIES
+    RUNTIME_OUTPUT_DIRECTORY ${CMAKE_BINARY_DIR}/bin
+)
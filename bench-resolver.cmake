@@ -0,0 +1,22 @@
+# DNS resolver benchmark executable configuration
+
+# Create bench_resolver executable
+add_executable(bench_resolver
+    src/bench_resolver.c
+    src/resolver.c
+)
+
+# Include directories for bench_resolver
+target_include_directories(bench_resolver PRIVATE
+    ${CMAKE_CURRENT_SOURCE_DIR}/src
+)
+
+# Link against pthreads (the stub server runs on its own thread)
+target_link_libraries(bench_resolver PRIVATE
+    Threads::Threads
+)
+
+# Set output directory
+set_target_properties(bench_resolver PROPERTIES
+    RUNTIME_OUTPUT_DIRECTORY ${CMAKE_BINARY_DIR}/bin
+)
@@ -0,0 +1,24 @@
+# RNG microbenchmark executable configuration
+
+# Create bench_rng executable
+add_executable(bench_rng
+    src/bench_rng.c
+    src/custom_rng.c
+)
+
+# Include directories for bench_rng
+target_include_directories(bench_rng PRIVATE
+    ${CMAKE_CURRENT_SOURCE_DIR}/src
+    ${MBEDTLS_INCLUDE_DIRS}
+)
+
+# Link against mbedtls (CTR_DRBG) and pthreads
+target_link_libraries(bench_rng PRIVATE
+    ${MBEDTLS_LIBRARIES}
+    Threads::Threads
+)
+
+# Set output directory
+set_target_properties(bench_rng PROPERTIES
+    RUNTIME_OUTPUT_DIRECTORY ${CMAKE_BINARY_DIR}/bin
+)
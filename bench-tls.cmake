@@ -0,0 +1,36 @@
+# TLS handshake and throughput benchmark executable configuration
+
+# Create bench_tls executable
+add_executable(bench_tls
+    src/bench_tls.c
+    src/transport_tcp.c
+    src/resolver.c
+    src/conn_metrics.c
+    src/latency_hist.c
+    src/custom_rng.c
+    src/session_cache.c
+    src/https_pool.c
+    src/tls_profile.c
+    src/http_parser.c
+    src/event_loop.c
+    src/timer_wheel.c
+    src/tls_arena.c
+    src/worker_pool.c
+)
+
+# Include directories for bench_tls
+target_include_directories(bench_tls PRIVATE
+    ${CMAKE_CURRENT_SOURCE_DIR}/src
+    ${MBEDTLS_INCLUDE_DIRS}
+)
+
+# Link against mbedtls (TLS client and server, X.509 writer) and pthreads
+target_link_libraries(bench_tls PRIVATE
+    ${MBEDTLS_LIBRARIES}
+    Threads::Threads
+)
+
+# Set output directory
+set_target_properties(bench_tls PROPERTIES
+    RUNTIME_OUTPUT_DIRECTORY ${CMAKE_BINARY_DIR}/bin
+)
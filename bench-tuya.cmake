@@ -0,0 +1,26 @@
+# Tuya local protocol codec benchmark executable configuration
+
+# Create bench_tuya executable
+add_executable(bench_tuya
+    src/bench_tuya.c
+    src/tuya_codec.c
+    src/crc32.c
+    src/cpu_dispatch.c
+)
+
+# Include directories for bench_tuya
+target_include_directories(bench_tuya PRIVATE
+    ${CMAKE_CURRENT_SOURCE_DIR}/src
+    ${MBEDTLS_INCLUDE_DIRS}
+)
+
+# Link against mbedtls (AES, GCM, HMAC-SHA256) and pthreads (kernel dispatch)
+target_link_libraries(bench_tuya PRIVATE
+    ${MBEDTLS_LIBRARIES}
+    Threads::Threads
+)
+
+# Set output directory
+set_target_properties(bench_tuya PROPERTIES
+    RUNTIME_OUTPUT_DIRECTORY ${CMAKE_BINARY_DIR}/bin
+)
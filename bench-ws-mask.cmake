@@ -0,0 +1,23 @@
+# WebSocket masking microbenchmark executable configuration
+
+# Create bench_ws_mask executable
+add_executable(bench_ws_mask
+    src/bench_ws_mask.c
+    src/ws_mask.c
+    src/cpu_dispatch.c
+)
+
+# Include directories for bench_ws_mask
+target_include_directories(bench_ws_mask PRIVATE
+    ${CMAKE_CURRENT_SOURCE_DIR}/src
+)
+
+# Link against pthreads (kernel dispatch is initialized with pthread_once)
+target_link_libraries(bench_ws_mask PRIVATE
+    Threads::Threads
+)
+
+# Set output directory
+set_target_properties(bench_ws_mask PROPERTIES
+    RUNTIME_OUTPUT_DIRECTORY ${CMAKE_BINARY_DIR}/bin
+)
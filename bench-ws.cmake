@@ -0,0 +1,37 @@
+# WebSocket echo/load server and latency harness executable configuration
+
+# Create bench_ws executable
+add_executable(bench_ws
+    src/bench_ws.c
+    src/ws_client.c
+    src/ws_handshake.c
+    src/ws_frame.c
+    src/ws_deflate.c
+    src/ws_mask.c
+    src/cpu_dispatch.c
+    src/transport_tcp.c
+    src/resolver.c
+    src/conn_metrics.c
+    src/latency_hist.c
+)
+
+# Include directories for bench_ws
+target_include_directories(bench_ws PRIVATE
+    ${CMAKE_CURRENT_SOURCE_DIR}/src
+    ${WEBSOCKET_PARSER_INCLUDE_DIRS}
+    ${MBEDTLS_INCLUDE_DIRS}
+)
+
+# Link against websocket-parser, mbedtls (handshake digest), zlib (ws_client
+# permessage-deflate) and pthreads
+target_link_libraries(bench_ws PRIVATE
+    ${WEBSOCKET_PARSER_LIBRARIES}
+    ${MBEDTLS_LIBRARIES}
+    ZLIB::ZLIB
+    Threads::Threads
+)
+
+# Set output directory
+set_target_properties(bench_ws PROPERTIES
+    RUNTIME_OUTPUT_DIRECTORY ${CMAKE_BINARY_DIR}/bin
+)
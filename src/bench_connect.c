@@ -0,0 +1,503 @@
+/*
+ * TCP connect benchmark
+ * Checks the connect paths of transport_tcp against loopback listeners:
+ *   - TCP Fast Open: once a connect fetched a cookie, the next one completes
+ *     at once and its first send rides on the SYN
+ *   - a cached cookie does not let a dead address win a race, neither with
+ *     several addresses of unknown family nor in the blocking race, where
+ *     fast open comes back once the winning family is remembered
+ *   - a blackholed first address (full accept queue, SYNs dropped) falls
+ *     back to the next one after attempt_delay_ms
+ * Then measures connects/s up to the first byte read by the server, per
+ * connect path, and the fallback latency.
+ *
+ * The fast open checks need client and server support in the kernel
+ * (net.ipv4.tcp_fastopen = 3) and are skipped otherwise.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include "transport_tcp.h"
+#include "resolver.h"
+
+/* Wall time spent per measurement */
+#define BENCH_DURATION_SEC 0.2
+
+/* Pinned to loopback addresses for the blocking race */
+#define BENCH_HOST "bench.test"
+
+/* Stagger of the fallback checks, short to keep the run short */
+#define BENCH_ATTEMPT_DELAY_MS 50
+
+#define BENCH_FALLBACKS 8
+
+#define BENCH_FASTOPEN_SYSCTL "/proc/sys/net/ipv4/tcp_fastopen"
+
+/* Pending connections the server queues before its first accept() */
+#define BENCH_FASTOPEN_QLEN 16
+
+static double bench_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/* Fast open enabled for clients and servers */
+static int bench_fastopen_supported(void)
+{
+    FILE *f = fopen(BENCH_FASTOPEN_SYSCTL, "r");
+    int value = 0;
+
+    if (f == NULL) {
+        return 0;
+    }
+    if (fscanf(f, "%d", &value) != 1) {
+        value = 0;
+    }
+    fclose(f);
+
+    return (value & 3) == 3;
+}
+
+/* Listening socket on ip:port (0 = ephemeral), with fast open if asked */
+static int bench_listen(const char *ip, uint16_t port, int backlog, int fastopen)
+{
+    struct sockaddr_in sin;
+    int fd, one = 1, qlen = BENCH_FASTOPEN_QLEN;
+
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_port = htons(port);
+    inet_pton(AF_INET, ip, &sin.sin_addr);
+
+    fd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (fd < 0) {
+        return -1;
+    }
+
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (bind(fd, (struct sockaddr *)&sin, sizeof(sin)) < 0 ||
+        (fastopen && setsockopt(fd, IPPROTO_TCP, TCP_FASTOPEN, &qlen, sizeof(qlen)) < 0) ||
+        listen(fd, backlog) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+static uint16_t bench_port(int fd)
+{
+    struct sockaddr_in sin;
+    socklen_t len = sizeof(sin);
+
+    if (getsockname(fd, (struct sockaddr *)&sin, &len) < 0) {
+        return 0;
+    }
+
+    return ntohs(sin.sin_port);
+}
+
+/* One or two IPv4 addresses in connect order */
+static void bench_addrs(resolver_addrs_t *out, const char *first, const char *second)
+{
+    memset(out, 0, sizeof(*out));
+    out->addrs[0].family = AF_INET;
+    inet_pton(AF_INET, first, out->addrs[0].addr);
+    out->count = 1;
+
+    if (second != NULL) {
+        out->addrs[1].family = AF_INET;
+        inet_pton(AF_INET, second, out->addrs[1].addr);
+        out->count = 2;
+    }
+}
+
+/* Drive a non-blocking connect the way the event loop does: wait on every
+ * attempt, start the next address once attempt_delay_ms passed in silence */
+static int bench_wait(transport_tcp_t *tcp, int ret)
+{
+    struct pollfd fds[RESOLVER_MAX_ADDRS];
+    double deadline = bench_now() + 2.0;
+    size_t i;
+    int n;
+
+    while (ret == TRANSPORT_TCP_IN_PROGRESS) {
+        if (bench_now() > deadline) {
+            return TRANSPORT_TCP_ERR_CONNECT_FAILED;
+        }
+
+        for (i = 0; i < tcp->attempt_count; i++) {
+            fds[i].fd = tcp->attempts[i].fd;
+            fds[i].events = POLLOUT;
+            fds[i].revents = 0;
+        }
+
+        n = poll(fds, tcp->attempt_count, (int)tcp->attempt_delay_ms);
+        if (n < 0 && errno != EINTR) {
+            return TRANSPORT_TCP_ERR_CONNECT_FAILED;
+        }
+        ret = n == 0 ? transport_tcp_connect_next(tcp) : transport_tcp_connect_finish(tcp);
+    }
+
+    return ret;
+}
+
+/* Address the socket connected to */
+static const char *bench_peer(const transport_tcp_t *tcp, char *buf, size_t len)
+{
+    struct sockaddr_in sin;
+    socklen_t sin_len = sizeof(sin);
+
+    if (getpeername(tcp->fd, (struct sockaddr *)&sin, &sin_len) < 0 ||
+        inet_ntop(AF_INET, &sin.sin_addr, buf, (socklen_t)len) == NULL) {
+        return "none";
+    }
+
+    return buf;
+}
+
+/* Accept one connection and read what it sent, closing the server side
+ * first so the TIME_WAIT sockets do not use up the client ports */
+static int bench_serve(int lfd, char *buf, size_t len)
+{
+    struct pollfd pfd;
+    ssize_t n = -1;
+    int fd;
+
+    pfd.fd = lfd;
+    pfd.events = POLLIN;
+    if (poll(&pfd, 1, 1000) <= 0) {
+        return -1;
+    }
+
+    fd = accept(lfd, NULL, NULL);
+    if (fd < 0) {
+        return -1;
+    }
+
+    pfd.fd = fd;
+    if (poll(&pfd, 1, 1000) > 0) {
+        n = recv(fd, buf, len, 0);
+    }
+    close(fd);
+
+    return (int)n;
+}
+
+/* The SYN carried data and the server acknowledged it */
+static int bench_syn_data(const transport_tcp_t *tcp)
+{
+    struct tcp_info info;
+    socklen_t len = sizeof(info);
+    struct pollfd pfd;
+
+    /* Established once the SYN-ACK is in */
+    pfd.fd = tcp->fd;
+    pfd.events = POLLOUT;
+    poll(&pfd, 1, 1000);
+
+    memset(&info, 0, sizeof(info));
+    if (getsockopt(tcp->fd, IPPROTO_TCP, TCP_INFO, &info, &len) < 0) {
+        return 0;
+    }
+
+    return (info.tcpi_options & TCPI_OPT_SYN_DATA) != 0;
+}
+
+/* fastopen as reported on the connected socket */
+static int bench_fastopen_used(const transport_tcp_t *tcp)
+{
+    transport_tcp_opts_t opts;
+
+    transport_tcp_get_opts(tcp, &opts);
+
+    return opts.fastopen == 1;
+}
+
+/* Send a request byte string and check the server got it */
+static int bench_exchange(transport_tcp_t *tcp, int lfd)
+{
+    char buf[16];
+
+    return transport_tcp_send(tcp, (const unsigned char *)"ping", 4) == 4 &&
+           bench_serve(lfd, buf, sizeof(buf)) == 4 ? 0 : -1;
+}
+
+/* TCP Fast Open: the cookie path, and cached cookies in races */
+static int bench_verify_fastopen(void)
+{
+    transport_tcp_t tcp;
+    resolver_addrs_t addrs;
+    resolver_t res;
+    char peer[INET_ADDRSTRLEN], port_str[8];
+    const char *who;
+    uint16_t port;
+    int lfd, lfd2 = -1, ret = -1, i, r;
+
+    lfd = bench_listen("127.0.0.1", 0, 64, 1);
+    if (lfd < 0) {
+        printf("cannot listen with fast open\n");
+        return -1;
+    }
+    port = bench_port(lfd);
+    snprintf(port_str, sizeof(port_str), "%u", port);
+
+    if (resolver_init(&res) != RESOLVER_OK) {
+        close(lfd);
+        return -1;
+    }
+
+    transport_tcp_init(&tcp);
+    tcp.opts.fastopen = 1;
+
+    /* The first connect fetches a cookie (unless an earlier run left one),
+     * the second completes without a round trip and sends on the SYN */
+    bench_addrs(&addrs, "127.0.0.1", NULL);
+    for (i = 0; i < 2; i++) {
+        r = transport_tcp_connect_addrs_async(&tcp, NULL, &addrs, port);
+        if (i == 1 && r != TRANSPORT_TCP_OK) {
+            printf("no immediate connect with a cached cookie (%d)\n", r);
+            goto exit;
+        }
+        if (bench_wait(&tcp, r) != TRANSPORT_TCP_OK || bench_exchange(&tcp, lfd) != 0) {
+            printf("fast open connect %d failed\n", i + 1);
+            goto exit;
+        }
+        if (i == 1 && (!bench_fastopen_used(&tcp) || !bench_syn_data(&tcp))) {
+            printf("cached cookie did not send data on the SYN\n");
+            goto exit;
+        }
+        transport_tcp_close(&tcp);
+    }
+
+    /* 127.0.0.1 is gone but its cookie is cached: with two addresses of
+     * unknown family the attempt must still go out and fail */
+    close(lfd);
+    lfd = -1;
+    lfd2 = bench_listen("127.0.0.2", port, 64, 0);
+    if (lfd2 < 0) {
+        printf("cannot listen on 127.0.0.2\n");
+        goto exit;
+    }
+
+    bench_addrs(&addrs, "127.0.0.1", "127.0.0.2");
+    r = bench_wait(&tcp, transport_tcp_connect_addrs_async(&tcp, NULL, &addrs, port));
+    who = bench_peer(&tcp, peer, sizeof(peer));
+    if (r != TRANSPORT_TCP_OK || strcmp(who, "127.0.0.2") != 0 ||
+        bench_fastopen_used(&tcp) || bench_exchange(&tcp, lfd2) != 0) {
+        printf("cached cookie of a dead address won the race (%d, %s)\n", r, who);
+        goto exit;
+    }
+    transport_tcp_close(&tcp);
+    close(lfd2);
+    lfd2 = -1;
+
+    /* Blocking race over a pinned name: no fast open while the family is
+     * unknown, then on the remembered family */
+    lfd = bench_listen("127.0.0.1", port, 64, 1);
+    if (lfd < 0 || resolver_pin(&res, BENCH_HOST, "::1 127.0.0.1") != RESOLVER_OK) {
+        printf("cannot set up the blocking race\n");
+        goto exit;
+    }
+    tcp.resolver = &res;
+
+    for (i = 0; i < 2; i++) {
+        if (transport_tcp_connect(&tcp, BENCH_HOST, port_str) != TRANSPORT_TCP_OK ||
+            bench_exchange(&tcp, lfd) != 0) {
+            printf("blocking connect %d failed\n", i + 1);
+            goto exit;
+        }
+        if (bench_fastopen_used(&tcp) != i || resolver_family(&res, BENCH_HOST) != AF_INET) {
+            printf("blocking connect %d: fast open %s\n", i + 1,
+                   i == 0 ? "raced an unknown family" : "not used on the remembered family");
+            goto exit;
+        }
+        transport_tcp_close(&tcp);
+    }
+
+    ret = 0;
+
+exit:
+    transport_tcp_close(&tcp);
+    resolver_free(&res);
+    if (lfd >= 0) {
+        close(lfd);
+    }
+    if (lfd2 >= 0) {
+        close(lfd2);
+    }
+
+    return ret;
+}
+
+/* Listener on ip:port that drops SYNs: accept queue full, never accepted.
+ * The sockets filling it are returned in fill[2]. */
+static int bench_blackhole(const char *ip, uint16_t port, int fill[2])
+{
+    struct sockaddr_in sin;
+    struct pollfd pfd;
+    int fd, i;
+
+    fd = bench_listen(ip, port, 0, 0);
+    if (fd < 0) {
+        return -1;
+    }
+
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_port = htons(port);
+    inet_pton(AF_INET, ip, &sin.sin_addr);
+
+    for (i = 0; i < 2; i++) {
+        fill[i] = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, IPPROTO_TCP);
+        connect(fill[i], (struct sockaddr *)&sin, sizeof(sin));
+        pfd.fd = fill[i];
+        pfd.events = POLLOUT;
+        poll(&pfd, 1, 100);
+    }
+
+    return fd;
+}
+
+/* A silent first address falls back to the second after the stagger */
+static int bench_verify_fallback(int lfd, uint16_t port)
+{
+    transport_tcp_t tcp;
+    resolver_addrs_t addrs;
+    char peer[INET_ADDRSTRLEN];
+    double start, elapsed;
+    int r;
+
+    transport_tcp_init(&tcp);
+    tcp.attempt_delay_ms = BENCH_ATTEMPT_DELAY_MS;
+    bench_addrs(&addrs, "127.0.0.3", "127.0.0.1");
+
+    start = bench_now();
+    r = bench_wait(&tcp, transport_tcp_connect_addrs_async(&tcp, NULL, &addrs, port));
+    elapsed = bench_now() - start;
+
+    if (r != TRANSPORT_TCP_OK || strcmp(bench_peer(&tcp, peer, sizeof(peer)), "127.0.0.1") != 0 ||
+        bench_exchange(&tcp, lfd) != 0 ||
+        elapsed < BENCH_ATTEMPT_DELAY_MS / 1000.0 || elapsed > 1.0) {
+        printf("fallback past a blackholed address failed (%d, %.0f ms)\n", r, elapsed * 1e3);
+        transport_tcp_close(&tcp);
+        return -1;
+    }
+
+    transport_tcp_close(&tcp);
+    return 0;
+}
+
+/* Connects/s up to the first byte read by the server: blocking race,
+ * non-blocking connect, or non-blocking with a fast open cookie */
+static double bench_connects(int lfd, uint16_t port, int async, int fastopen)
+{
+    double start = bench_now(), elapsed;
+    unsigned long connects = 0;
+    resolver_addrs_t addrs;
+    transport_tcp_t tcp;
+    char port_str[8];
+    int r;
+
+    transport_tcp_init(&tcp);
+    tcp.opts.fastopen = fastopen;
+    bench_addrs(&addrs, "127.0.0.1", NULL);
+    snprintf(port_str, sizeof(port_str), "%u", port);
+
+    do {
+        if (async) {
+            r = bench_wait(&tcp, transport_tcp_connect_addrs_async(&tcp, NULL, &addrs, port));
+        } else {
+            r = transport_tcp_connect(&tcp, "127.0.0.1", port_str);
+        }
+        if (r != TRANSPORT_TCP_OK || bench_exchange(&tcp, lfd) != 0) {
+            transport_tcp_close(&tcp);
+            return 0;
+        }
+        transport_tcp_close(&tcp);
+        connects++;
+        elapsed = bench_now() - start;
+    } while (elapsed < BENCH_DURATION_SEC);
+
+    return (double)connects / elapsed;
+}
+
+int main(void)
+{
+    int fastopen = bench_fastopen_supported();
+    int lfd, hole, fill[2], i, ret = EXIT_FAILURE;
+    double rate, start, fallback = 0;
+    uint16_t port;
+
+    if (fastopen) {
+        if (bench_verify_fastopen() != 0) {
+            printf("fast open check failed\n");
+            return EXIT_FAILURE;
+        }
+        printf("fast open check passed (cookie path, cached cookies in races)\n");
+    } else {
+        printf("fast open check skipped (%s is not 3)\n", BENCH_FASTOPEN_SYSCTL);
+    }
+
+    lfd = bench_listen("127.0.0.1", 0, 64, fastopen);
+    if (lfd < 0) {
+        return EXIT_FAILURE;
+    }
+    port = bench_port(lfd);
+
+    hole = bench_blackhole("127.0.0.3", port, fill);
+    if (hole < 0) {
+        close(lfd);
+        return EXIT_FAILURE;
+    }
+
+    if (bench_verify_fallback(lfd, port) != 0) {
+        goto exit;
+    }
+    printf("fallback check passed (blackholed first address)\n");
+
+    printf("%-28s  %12s  %12s\n", "connect", "connects/s", "mean (us)");
+    rate = bench_connects(lfd, port, 0, 0);
+    printf("%-28s  %12.0f  %12.1f\n", "blocking race", rate, rate > 0 ? 1e6 / rate : 0);
+    rate = bench_connects(lfd, port, 1, 0);
+    printf("%-28s  %12.0f  %12.1f\n", "non-blocking", rate, rate > 0 ? 1e6 / rate : 0);
+    if (fastopen) {
+        rate = bench_connects(lfd, port, 1, 1);
+        printf("%-28s  %12.0f  %12.1f\n", "non-blocking, fast open", rate,
+               rate > 0 ? 1e6 / rate : 0);
+    }
+
+    start = bench_now();
+    for (i = 0; i < BENCH_FALLBACKS; i++) {
+        if (bench_verify_fallback(lfd, port) != 0) {
+            goto exit;
+        }
+    }
+    fallback = (bench_now() - start) / BENCH_FALLBACKS;
+    printf("fallback past a blackhole: %.1f ms (attempt delay %d ms)\n", fallback * 1e3,
+           BENCH_ATTEMPT_DELAY_MS);
+
+    ret = EXIT_SUCCESS;
+
+exit:
+    close(fill[0]);
+    close(fill[1]);
+    close(hole);
+    close(lfd);
+
+    return ret;
+}
@@ -0,0 +1,497 @@
+/*
+ * LAN discovery benchmark
+ * Writes a pcap capture of a synthetic site (new devices, repeats, address
+ * changes, changed and corrupted announcements, unrelated traffic) and
+ * checks the device table lan_discovery_replay() builds from it. Then
+ * measures datagrams/s through lan_discovery_process() for changed and
+ * repeated announcements, and for loopback bursts drained with recvmmsg()
+ * against a recvfrom() loop.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "lan_discovery.h"
+#include "crc32.h"
+
+/* Wall time spent per measurement */
+#define BENCH_DURATION_SEC 0.2
+
+#define BENCH_DEVICES 1000
+
+/* Datagrams per loopback burst, below the default rmem_max */
+#define BENCH_BURST 128
+
+/* Loopback ports of the socket benchmark */
+#define BENCH_PORT_BASE 36000
+
+#define BENCH_T0_MS 1700000000000ULL
+
+typedef struct {
+    unsigned char data[LAN_DISCOVERY_DGRAM_MAX];
+    size_t len;
+    lan_discovery_kind_t kind;
+} bench_frame_t;
+
+typedef struct {
+    unsigned long events[3];
+} bench_events_t;
+
+static double bench_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/* IVs only need to differ */
+static int bench_rng(void *ctx, unsigned char *output, size_t len)
+{
+    static uint64_t state = 0x9e3779b97f4a7c15ULL;
+    size_t i;
+
+    (void)ctx;
+    for (i = 0; i < len; i++) {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        output[i] = (unsigned char) state;
+    }
+
+    return 0;
+}
+
+static void bench_put32(unsigned char *p, uint32_t v)
+{
+    p[0] = (unsigned char)(v >> 24);
+    p[1] = (unsigned char)(v >> 16);
+    p[2] = (unsigned char)(v >> 8);
+    p[3] = (unsigned char) v;
+}
+
+/* 10.subnet.x.y address of device i */
+static uint32_t bench_addr(int subnet, int i)
+{
+    return htonl(0x0a000000u | (uint32_t) subnet << 16 | (uint32_t)(i + 1));
+}
+
+static lan_discovery_kind_t bench_kind(int i)
+{
+    return (lan_discovery_kind_t)(i % LAN_DISCOVERY_KINDS);
+}
+
+/* Announcement of device i as its broadcast kind frames it */
+static void bench_announce(tuya_codec_t *ecb, tuya_codec_t *gcm, int i, int active,
+                           bench_frame_t *frame)
+{
+    lan_discovery_kind_t kind = bench_kind(i);
+    uint32_t addr = ntohl(bench_addr(1, i));
+    char json[320];
+    tuya_msg_t msg;
+    size_t len;
+
+    len = (size_t) snprintf(json, sizeof(json),
+        "{\"ip\":\"%u.%u.%u.%u\",\"gwId\":\"bf%020d\",\"active\":%d,\"ability\":0,"
+        "\"mode\":0,\"encrypt\":%s,\"productKey\":\"keyjup78v54myhan\",\"version\":\"%s\"}",
+        addr >> 24, (addr >> 16) & 0xff, (addr >> 8) & 0xff, addr & 0xff, i, active,
+        kind == LAN_DISCOVERY_PLAIN ? "false" : "true",
+        kind == LAN_DISCOVERY_PLAIN ? "3.1" : kind == LAN_DISCOVERY_ECB ? "3.3" : "3.5");
+
+    frame->kind = kind;
+
+    if (kind == LAN_DISCOVERY_PLAIN) {
+        bench_put32(frame->data, 0x000055aau);
+        bench_put32(frame->data + 4, 0);
+        bench_put32(frame->data + 8, TUYA_CMD_UDP_NEW);
+        bench_put32(frame->data + 12, (uint32_t)(4 + len + 8));
+        bench_put32(frame->data + 16, 0);
+        memcpy(frame->data + 20, json, len);
+        bench_put32(frame->data + 20 + len, crc32_compute(0, frame->data, 20 + len));
+        bench_put32(frame->data + 24 + len, 0x0000aa55u);
+        frame->len = 28 + len;
+        return;
+    }
+
+    memset(&msg, 0, sizeof(msg));
+    msg.cmd = TUYA_CMD_UDP_NEW;
+    msg.seq = 1;
+    msg.has_retcode = 1;
+    msg.payload = json;
+    msg.len = len;
+    tuya_codec_encode(kind == LAN_DISCOVERY_GCM ? gcm : ecb, &msg, frame->data,
+                      sizeof(frame->data), &frame->len);
+}
+
+/* One pcap record: Ethernet (optionally 802.1Q tagged), IPv4, UDP */
+static void bench_pcap_record(FILE *f, uint64_t t_ms, uint32_t src, uint16_t dport,
+                              const unsigned char *data, size_t len, int vlan)
+{
+    unsigned char hdr[16 + 18 + 20 + 8];
+    size_t l2 = vlan ? 18 : 14, caplen = l2 + 20 + 8 + len;
+    unsigned char *ip = hdr + 16 + l2;
+    unsigned char *udp = ip + 20;
+
+    memset(hdr, 0, sizeof(hdr));
+    /* Record header, little endian */
+    hdr[0] = (unsigned char)(t_ms / 1000);
+    hdr[1] = (unsigned char)(t_ms / 1000 >> 8);
+    hdr[2] = (unsigned char)(t_ms / 1000 >> 16);
+    hdr[3] = (unsigned char)(t_ms / 1000 >> 24);
+    hdr[4] = (unsigned char)(t_ms % 1000 * 1000);
+    hdr[5] = (unsigned char)(t_ms % 1000 * 1000 >> 8);
+    hdr[6] = (unsigned char)(t_ms % 1000 * 1000 >> 16);
+    hdr[8] = hdr[12] = (unsigned char) caplen;
+    hdr[9] = hdr[13] = (unsigned char)(caplen >> 8);
+
+    memset(hdr + 16, 0xff, 6);          /* Broadcast destination */
+    if (vlan) {
+        hdr[16 + 12] = 0x81;
+        hdr[16 + 14] = 0x00;
+        hdr[16 + 15] = 0x07;
+    }
+    hdr[16 + l2 - 2] = 0x08;            /* IPv4 */
+
+    ip[0] = 0x45;
+    ip[2] = (unsigned char)((20 + 8 + len) >> 8);
+    ip[3] = (unsigned char)(20 + 8 + len);
+    ip[8] = 64;
+    ip[9] = 17;
+    memcpy(ip + 12, &src, 4);
+    memset(ip + 16, 0xff, 4);
+
+    udp[0] = 0x31;                      /* Source port 12700 */
+    udp[1] = 0x9c;
+    udp[2] = (unsigned char)(dport >> 8);
+    udp[3] = (unsigned char) dport;
+    udp[4] = (unsigned char)((8 + len) >> 8);
+    udp[5] = (unsigned char)(8 + len);
+
+    fwrite(hdr, 1, 16 + l2 + 28, f);
+    fwrite(data, 1, len, f);
+}
+
+static void bench_count_event(const lan_discovery_device_t *dev, lan_discovery_event_t event,
+                              void *arg)
+{
+    bench_events_t *events = arg;
+
+    (void)dev;
+    events->events[event]++;
+}
+
+/* Replay a synthetic capture and check every device and counter */
+static int bench_verify(tuya_codec_t *ecb, tuya_codec_t *gcm, const char *path)
+{
+    static const uint16_t ports[LAN_DISCOVERY_KINDS] = {
+        LAN_DISCOVERY_PORT_PLAIN, LAN_DISCOVERY_PORT_ECB, LAN_DISCOVERY_PORT_GCM
+    };
+    static const unsigned char pcap_header[24] = {
+        0xd4, 0xc3, 0xb2, 0xa1, 2, 0, 4, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 1, 0, 0, 0
+    };
+    const lan_discovery_device_t *dev;
+    unsigned long moved = 0, changed = 0, corrupted = 0;
+    bench_events_t events;
+    lan_discovery_t disc;
+    bench_frame_t frame;
+    char gw_id[32];
+    long replayed;
+    FILE *f;
+    int i;
+
+    f = fopen(path, "wb");
+    if (f == NULL) {
+        return -1;
+    }
+    fwrite(pcap_header, 1, sizeof(pcap_header), f);
+
+    /* First announcements, then repeats (3.5 re-encrypted with new IVs) */
+    for (i = 0; i < BENCH_DEVICES; i++) {
+        bench_announce(ecb, gcm, i, 2, &frame);
+        bench_pcap_record(f, BENCH_T0_MS + (uint64_t) i, bench_addr(1, i), ports[frame.kind],
+                          frame.data, frame.len, 0);
+    }
+    for (i = 0; i < BENCH_DEVICES; i++) {
+        bench_announce(ecb, gcm, i, 2, &frame);
+        bench_pcap_record(f, BENCH_T0_MS + 5000 + (uint64_t) i, bench_addr(1, i),
+                          ports[frame.kind], frame.data, frame.len, i % 2);
+    }
+
+    /* Some move to another address, some change their announcement, some
+     * announcements arrive corrupted */
+    for (i = 0; i < BENCH_DEVICES; i++) {
+        if (i % 7 == 0) {
+            bench_announce(ecb, gcm, i, 2, &frame);
+            bench_pcap_record(f, BENCH_T0_MS + 10000, bench_addr(2, i), ports[frame.kind],
+                              frame.data, frame.len, 0);
+            moved++;
+        } else if (i % 5 == 0) {
+            bench_announce(ecb, gcm, i, 3, &frame);
+            bench_pcap_record(f, BENCH_T0_MS + 10000, bench_addr(1, i), ports[frame.kind],
+                              frame.data, frame.len, 1);
+            changed++;
+        } else if (i % 11 == 0) {
+            bench_announce(ecb, gcm, i, 4, &frame);
+            frame.data[frame.len / 2] ^= 0x40;
+            bench_pcap_record(f, BENCH_T0_MS + 10000, bench_addr(1, i), ports[frame.kind],
+                              frame.data, frame.len, 0);
+            corrupted++;
+        }
+    }
+
+    /* Unrelated traffic */
+    bench_pcap_record(f, BENCH_T0_MS + 11000, bench_addr(1, 0), 53, frame.data, frame.len, 0);
+    fclose(f);
+
+    memset(&events, 0, sizeof(events));
+    if (lan_discovery_init(&disc, BENCH_DEVICES, bench_count_event, &events) != LAN_DISCOVERY_OK) {
+        return -1;
+    }
+    replayed = lan_discovery_replay(&disc, path);
+    remove(path);
+
+    if (replayed != (long)(2 * BENCH_DEVICES + moved + changed + corrupted) ||
+        disc.count != BENCH_DEVICES ||
+        events.events[LAN_DISCOVERY_NEW] != BENCH_DEVICES ||
+        events.events[LAN_DISCOVERY_ADDR_CHANGED] != moved ||
+        events.events[LAN_DISCOVERY_UPDATED] != changed ||
+        disc.stats.duplicates != BENCH_DEVICES + moved ||
+        disc.stats.rejected != corrupted || disc.stats.skipped != 1) {
+        printf("replay: %ld datagrams, %zu devices, events %lu/%lu/%lu, "
+               "%llu duplicates, %llu rejected\n",
+               replayed, disc.count, events.events[0], events.events[1], events.events[2],
+               (unsigned long long) disc.stats.duplicates,
+               (unsigned long long) disc.stats.rejected);
+        lan_discovery_free(&disc);
+        return -1;
+    }
+
+    for (i = 0; i < BENCH_DEVICES; i++) {
+        snprintf(gw_id, sizeof(gw_id), "bf%020d", i);
+        dev = lan_discovery_find(&disc, gw_id);
+        if (dev == NULL || dev->kind != bench_kind(i) ||
+            strcmp(dev->product_key, "keyjup78v54myhan") != 0 ||
+            dev->version[2] != (bench_kind(i) == LAN_DISCOVERY_PLAIN ? '1' :
+                                bench_kind(i) == LAN_DISCOVERY_ECB ? '3' : '5') ||
+            dev->addr != bench_addr(i % 7 == 0 ? 2 : 1, i) ||
+            dev->prev_addr != (i % 7 == 0 ? bench_addr(1, i) : 0) ||
+            dev->addr_changes != (i % 7 == 0 ? 1u : 0u) ||
+            dev->announcements != (i % 7 == 0 || i % 5 == 0 ? 3u : 2u) ||
+            dev->first_seen_ms < BENCH_T0_MS || dev->first_seen_ms > BENCH_T0_MS + 1000 ||
+            dev->last_seen_ms < BENCH_T0_MS + 5000) {
+            printf("device %s recorded wrongly\n", gw_id);
+            lan_discovery_free(&disc);
+            return -1;
+        }
+    }
+
+    lan_discovery_free(&disc);
+    return 0;
+}
+
+/* Datagrams/s through lan_discovery_process() */
+static double bench_process(lan_discovery_t *disc, const lan_discovery_dgram_t *dgrams,
+                            size_t count)
+{
+    double start = bench_now(), elapsed;
+    unsigned long datagrams = 0;
+    size_t pos, n;
+
+    do {
+        for (pos = 0; pos < count; pos += n) {
+            n = count - pos < LAN_DISCOVERY_BATCH ? count - pos : LAN_DISCOVERY_BATCH;
+            lan_discovery_process(disc, dgrams + pos, n, 0);
+        }
+        datagrams += count;
+        elapsed = bench_now() - start;
+    } while (elapsed < BENCH_DURATION_SEC);
+
+    return (double) datagrams / elapsed;
+}
+
+/* Send a burst of frames to the loopback port with one sendmmsg() */
+static int bench_send_burst(int fd, const struct sockaddr_in *to, const bench_frame_t *frames,
+                            size_t count, size_t first)
+{
+    static struct mmsghdr msgs[BENCH_BURST];
+    static struct iovec iov[BENCH_BURST];
+    size_t i;
+
+    for (i = 0; i < BENCH_BURST; i++) {
+        iov[i].iov_base = (void *) frames[(first + i) % count].data;
+        iov[i].iov_len = frames[(first + i) % count].len;
+        memset(&msgs[i], 0, sizeof(msgs[i]));
+        msgs[i].msg_hdr.msg_iov = &iov[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+        msgs[i].msg_hdr.msg_name = (void *) to;
+        msgs[i].msg_hdr.msg_namelen = sizeof(*to);
+    }
+
+    return sendmmsg(fd, msgs, BENCH_BURST, 0) == BENCH_BURST ? 0 : -1;
+}
+
+/* Datagrams/s draining loopback bursts of ECB announcements, batched
+ * (lan_discovery_recv()) or one recvfrom() per datagram */
+static double bench_socket(lan_discovery_t *disc, int out_fd, const struct sockaddr_in *to,
+                           const bench_frame_t *frames, size_t count, int batched)
+{
+    static unsigned char buf[LAN_DISCOVERY_DGRAM_MAX];
+    double start = bench_now(), spent = 0, t;
+    unsigned long datagrams = 0;
+    lan_discovery_dgram_t d;
+    struct sockaddr_in from;
+    socklen_t from_len;
+    size_t first = 0;
+    ssize_t n;
+    int got;
+
+    do {
+        if (bench_send_burst(out_fd, to, frames, count, first) != 0) {
+            return 0;
+        }
+        first += BENCH_BURST;
+
+        t = bench_now();
+        got = 0;
+        if (batched) {
+            while (got < BENCH_BURST) {
+                n = lan_discovery_recv(disc, 0);
+                if (n < 0 || bench_now() - t > 1.0) {
+                    return 0;
+                }
+                got += (int) n;
+            }
+        } else {
+            while (got < BENCH_BURST) {
+                from_len = sizeof(from);
+                n = recvfrom(disc->fds[LAN_DISCOVERY_ECB], buf, sizeof(buf), MSG_DONTWAIT,
+                             (struct sockaddr *) &from, &from_len);
+                if (n < 0) {
+                    if (bench_now() - t > 1.0) {
+                        return 0;
+                    }
+                    continue;
+                }
+                d.data = buf;
+                d.len = (size_t) n;
+                d.addr = from.sin_addr.s_addr;
+                d.kind = LAN_DISCOVERY_ECB;
+                lan_discovery_process(disc, &d, 1, 0);
+                got++;
+            }
+        }
+        spent += bench_now() - t;
+        datagrams += BENCH_BURST;
+    } while (bench_now() - start < BENCH_DURATION_SEC);
+
+    return (double) datagrams / spent;
+}
+
+int main(void)
+{
+    static bench_frame_t frames[2][BENCH_DEVICES];
+    static lan_discovery_dgram_t dgrams[2][BENCH_DEVICES];
+    static lan_discovery_dgram_t alternating[2 * BENCH_DEVICES];
+    static bench_frame_t ecb_frames[BENCH_DEVICES];
+    static const char *const names[] = { "3.1 clear", "3.3 ECB", "3.5 GCM" };
+    uint16_t ports[LAN_DISCOVERY_KINDS] = { 0, BENCH_PORT_BASE + 667, 0 };
+    char path[] = "/tmp/bench_discovery_XXXXXX";
+    tuya_codec_t ecb, gcm;
+    lan_discovery_t disc;
+    struct sockaddr_in to;
+    double changed_rate, dup_rate;
+    size_t n, n_ecb = 0;
+    int kind, i, k, fd;
+
+    if (tuya_codec_init(&ecb, TUYA_PROTO_33, lan_discovery_key, NULL, NULL) != TUYA_CODEC_OK ||
+        tuya_codec_init(&gcm, TUYA_PROTO_35, lan_discovery_key, bench_rng, NULL) != TUYA_CODEC_OK) {
+        return EXIT_FAILURE;
+    }
+
+    fd = mkstemp(path);
+    if (fd < 0) {
+        return EXIT_FAILURE;
+    }
+    close(fd);
+
+    if (bench_verify(&ecb, &gcm, path) != 0) {
+        printf("replay check failed\n");
+        return EXIT_FAILURE;
+    }
+    printf("replay check passed (%d devices, CRC-32 kernel %s)\n", BENCH_DEVICES,
+           crc32_impl_name(crc32_get_impl()));
+
+    /* Two versions of every announcement; alternating them defeats the
+     * deduplication, repeating one exercises it */
+    for (k = 0; k < 2; k++) {
+        for (i = 0; i < BENCH_DEVICES; i++) {
+            bench_announce(&ecb, &gcm, i, 2 + k, &frames[k][i]);
+        }
+    }
+
+    if (lan_discovery_init(&disc, BENCH_DEVICES, NULL, NULL) != LAN_DISCOVERY_OK) {
+        return EXIT_FAILURE;
+    }
+
+    printf("%-10s  %14s  %14s   (datagrams/s)\n", "broadcast", "changed", "repeated");
+    for (kind = 0; kind < LAN_DISCOVERY_KINDS; kind++) {
+        n = 0;
+        for (i = kind; i < BENCH_DEVICES; i += LAN_DISCOVERY_KINDS) {
+            for (k = 0; k < 2; k++) {
+                dgrams[k][n].data = frames[k][i].data;
+                dgrams[k][n].len = frames[k][i].len;
+                dgrams[k][n].addr = bench_addr(1, i);
+                dgrams[k][n].kind = frames[k][i].kind;
+                alternating[2 * n + k] = dgrams[k][n];
+            }
+            n++;
+        }
+
+        changed_rate = bench_process(&disc, alternating, 2 * n);
+        dup_rate = bench_process(&disc, dgrams[0], n);
+        printf("%-10s  %14.0f  %14.0f\n", names[kind], changed_rate, dup_rate);
+    }
+    lan_discovery_free(&disc);
+
+    /* Socket receive: one kind is enough, the processing is the same */
+    for (i = 0; i < BENCH_DEVICES; i++) {
+        if (frames[0][i].kind == LAN_DISCOVERY_ECB) {
+            ecb_frames[n_ecb++] = frames[0][i];
+        }
+    }
+
+    if (lan_discovery_init(&disc, BENCH_DEVICES, NULL, NULL) != LAN_DISCOVERY_OK) {
+        return EXIT_FAILURE;
+    }
+    if (lan_discovery_listen(&disc, ports) != LAN_DISCOVERY_OK) {
+        printf("\nloopback port %u unavailable, socket benchmark skipped\n", ports[1]);
+        lan_discovery_free(&disc);
+        return EXIT_SUCCESS;
+    }
+
+    fd = socket(AF_INET, SOCK_DGRAM, 0);
+    memset(&to, 0, sizeof(to));
+    to.sin_family = AF_INET;
+    to.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    to.sin_port = htons(ports[1]);
+
+    printf("\n%-10s  %14s  %14s   (datagrams/s, bursts of %d)\n", "receive", "recvmmsg",
+           "recvfrom", BENCH_BURST);
+    printf("%-10s  %14.0f  %14.0f\n", "loopback",
+           bench_socket(&disc, fd, &to, ecb_frames, n_ecb, 1),
+           bench_socket(&disc, fd, &to, ecb_frames, n_ecb, 0));
+
+    close(fd);
+    lan_discovery_free(&disc);
+    tuya_codec_free(&ecb);
+    tuya_codec_free(&gcm);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,271 @@
+/*
+ * JSON tokenizer throughput benchmark
+ * Tokenizes the message shapes the cloud sends (pong, dps report, device
+ * snapshot, log line) with every json_tok kernel this CPU supports, fed
+ * whole and in the pieces on_frame_body would deliver, with all tokens
+ * reported and with only type/devId/dps watched.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "json_tok.h"
+
+/* Wall time spent per measurement */
+#define BENCH_DURATION_SEC 0.2
+
+#define BENCH_MSG_MAX 8192
+
+typedef struct {
+    const char *name;
+    char data[BENCH_MSG_MAX];
+    size_t len;
+} bench_msg_t;
+
+static const char *const bench_fields[] = { "type", "devId", "dps" };
+
+static double bench_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/* Order-sensitive digest of the token stream, pieces joined */
+static int bench_digest_cb(const json_token_t *token, void *arg)
+{
+    uint64_t *h = arg;
+    size_t i;
+
+    for (i = 0; i < token->len; i++) {
+        *h = (*h ^ (unsigned char) token->data[i]) * 1099511628211ULL;
+    }
+
+    if (!token->partial) {
+        *h = (*h ^ ((uint64_t) token->type << 16 | (uint64_t) token->depth << 8 |
+                    (uint64_t)(token->field + 1))) * 1099511628211ULL;
+    }
+
+    return 0;
+}
+
+/* What a router does per token: look at it, nothing more */
+static int bench_count_cb(const json_token_t *token, void *arg)
+{
+    uint64_t *n = arg;
+
+    *n += token->len + 1;
+
+    return 0;
+}
+
+static int bench_feed(json_tok_t *tok, const bench_msg_t *msg, size_t chunk)
+{
+    size_t pos, n;
+    int ret;
+
+    json_tok_reset(tok);
+
+    for (pos = 0; pos < msg->len; pos += n) {
+        n = msg->len - pos < chunk ? msg->len - pos : chunk;
+        ret = json_tok_feed(tok, msg->data + pos, n);
+        if (ret != JSON_TOK_OK) {
+            return ret;
+        }
+    }
+
+    return json_tok_finish(tok);
+}
+
+/* Tokenize msg repeatedly for BENCH_DURATION_SEC; returns messages/s */
+static double bench_run(const bench_msg_t *msg, size_t chunk, int watched)
+{
+    double start = bench_now(), elapsed;
+    unsigned long calls = 0;
+    uint64_t sink = 0;
+    json_tok_t tok;
+    int i;
+
+    json_tok_init(&tok, bench_count_cb, &sink);
+    json_tok_watch(&tok, bench_fields, 3);
+    tok.watched_only = watched;
+
+    do {
+        /* Check the clock every 64 calls to keep its cost out of the loop */
+        for (i = 0; i < 64; i++) {
+            if (bench_feed(&tok, msg, chunk) != JSON_TOK_OK) {
+                return 0;
+            }
+        }
+        calls += 64;
+        elapsed = bench_now() - start;
+    } while (elapsed < BENCH_DURATION_SEC);
+
+    return (double) calls / elapsed;
+}
+
+/* Every chunk size must give the token stream of the whole message */
+static int bench_verify(const bench_msg_t *msg, uint64_t expect, int watched)
+{
+    static const size_t chunks[] = { 1, 2, 3, 7, 16, 31, 64, 1460, BENCH_MSG_MAX };
+    json_tok_t tok;
+    uint64_t h;
+    size_t i;
+
+    for (i = 0; i < sizeof(chunks) / sizeof(chunks[0]); i++) {
+        h = 14695981039346656037ULL;
+        json_tok_init(&tok, bench_digest_cb, &h);
+        json_tok_watch(&tok, bench_fields, 3);
+        tok.watched_only = watched;
+        if (bench_feed(&tok, msg, chunks[i]) != JSON_TOK_OK || h != expect) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/* Application-level pong */
+static void bench_msg_pong(bench_msg_t *msg)
+{
+    msg->name = "pong";
+    msg->len = (size_t) snprintf(msg->data, sizeof(msg->data), "{\"type\":\"pong\"}");
+}
+
+/* Data point report of one device */
+static void bench_msg_report(bench_msg_t *msg)
+{
+    msg->name = "report";
+    msg->len = (size_t) snprintf(msg->data, sizeof(msg->data),
+        "{\"type\":\"report\",\"devId\":\"bf3a9c1e2d4f5a6b7c8d9e\","
+        "\"dps\":{\"1\":true,\"2\":\"colour\",\"3\":255,\"5\":\"00ff00003e803e8\","
+        "\"20\":false,\"21\":\"white\",\"22\":1000,\"23\":-1},"
+        "\"t\":1700000000,\"ver\":\"3.3\"}");
+}
+
+/* Device list snapshot: many members nobody routes on */
+static void bench_msg_snapshot(bench_msg_t *msg)
+{
+    size_t len;
+    int i;
+
+    msg->name = "snapshot";
+    len = (size_t) snprintf(msg->data, sizeof(msg->data),
+                            "{\"type\":\"devices\",\"t\":1700000000,\"data\":[");
+
+    for (i = 0; i < 16; i++) {
+        len += (size_t) snprintf(msg->data + len, sizeof(msg->data) - len,
+            "%s{\"devId\":\"bf3a9c1e2d4f5a6b7c8d%02d\",\"name\":\"Living room lamp %d\","
+            "\"online\":%s,\"category\":\"dj\",\"productId\":\"keyjup78v54myhan\","
+            "\"icon\":\"https://images.tuyaus.com/smart/icon/1542255350wz07kvb3gm.png\","
+            "\"localKey\":\"a1b2c3d4e5f6a7b8\",\"ip\":\"192.168.1.%d\","
+            "\"status\":[{\"code\":\"switch_led\",\"value\":true},"
+            "{\"code\":\"bright_value\",\"value\":%d}]}",
+            i == 0 ? "" : ",", i, i, (i & 1) ? "true" : "false", 20 + i, 10 * i);
+    }
+
+    len += (size_t) snprintf(msg->data + len, sizeof(msg->data) - len, "]}");
+    msg->len = len;
+}
+
+/* Long string value, e.g. a diagnostic log line */
+static void bench_msg_log(bench_msg_t *msg)
+{
+    size_t len;
+    int i;
+
+    msg->name = "log";
+    len = (size_t) snprintf(msg->data, sizeof(msg->data),
+                            "{\"type\":\"log\",\"devId\":\"bf3a9c1e2d4f5a6b7c8d9e\",\"msg\":\"");
+
+    for (i = 0; i < 48; i++) {
+        len += (size_t) snprintf(msg->data + len, sizeof(msg->data) - len,
+                                 "%s[%06d] mqtt keepalive ok, rssi -%d dBm, heap 41%02d bytes free",
+                                 i == 0 ? "" : "\\n", i * 250, 40 + i % 30, i);
+    }
+
+    len += (size_t) snprintf(msg->data + len, sizeof(msg->data) - len, "\"}");
+    msg->len = len;
+}
+
+int main(void)
+{
+    static const json_tok_impl_t impls[] = {
+        JSON_TOK_IMPL_SCALAR, JSON_TOK_IMPL_SSE2, JSON_TOK_IMPL_AVX2, JSON_TOK_IMPL_NEON
+    };
+    static const size_t chunks[] = { BENCH_MSG_MAX, 64 };
+    static bench_msg_t msgs[4];
+    uint64_t expect[2];
+    json_tok_t tok;
+    double rate = 0;
+    size_t m, c, i;
+    int watched;
+
+    bench_msg_pong(&msgs[0]);
+    bench_msg_report(&msgs[1]);
+    bench_msg_snapshot(&msgs[2]);
+    bench_msg_log(&msgs[3]);
+
+    json_tok_set_impl(JSON_TOK_IMPL_AUTO);
+    printf("auto-selected kernel: %s\n", json_tok_impl_name(json_tok_get_impl()));
+
+    /* Reference digests from the scalar kernel, whole messages */
+    for (m = 0; m < sizeof(msgs) / sizeof(msgs[0]); m++) {
+        for (watched = 0; watched < 2; watched++) {
+            json_tok_set_impl(JSON_TOK_IMPL_SCALAR);
+            expect[watched] = 14695981039346656037ULL;
+            json_tok_init(&tok, bench_digest_cb, &expect[watched]);
+            json_tok_watch(&tok, bench_fields, 3);
+            tok.watched_only = watched;
+            if (bench_feed(&tok, &msgs[m], BENCH_MSG_MAX) != JSON_TOK_OK) {
+                printf("%s message does not parse\n", msgs[m].name);
+                return EXIT_FAILURE;
+            }
+
+            for (i = 0; i < sizeof(impls) / sizeof(impls[0]); i++) {
+                if (json_tok_set_impl(impls[i]) == JSON_TOK_OK &&
+                    bench_verify(&msgs[m], expect[watched], watched) != 0) {
+                    printf("%s kernel tokenized %s wrongly\n",
+                           json_tok_impl_name(impls[i]), msgs[m].name);
+                    return EXIT_FAILURE;
+                }
+            }
+        }
+    }
+
+    printf("%-9s %6s %6s %-8s", "message", "bytes", "chunk", "tokens");
+    for (i = 0; i < sizeof(impls) / sizeof(impls[0]); i++) {
+        if (json_tok_set_impl(impls[i]) == JSON_TOK_OK) {
+            printf("  %8s", json_tok_impl_name(impls[i]));
+        }
+    }
+    printf("   (MB/s)  %10s\n", "msgs/s");
+
+    for (m = 0; m < sizeof(msgs) / sizeof(msgs[0]); m++) {
+        for (c = 0; c < sizeof(chunks) / sizeof(chunks[0]); c++) {
+            for (watched = 0; watched < 2; watched++) {
+                if (chunks[c] >= msgs[m].len && c > 0) {
+                    continue;
+                }
+
+                printf("%-9s %6zu %6s %-8s", msgs[m].name, msgs[m].len,
+                       chunks[c] >= msgs[m].len ? "whole" : "64", watched ? "watched" : "all");
+
+                for (i = 0; i < sizeof(impls) / sizeof(impls[0]); i++) {
+                    if (json_tok_set_impl(impls[i]) == JSON_TOK_OK) {
+                        rate = bench_run(&msgs[m], chunks[c], watched);
+                        printf("  %8.0f", rate * (double) msgs[m].len / 1e6);
+                    }
+                }
+
+                /* Messages/s of the last (widest) kernel */
+                printf("           %10.0f\n", rate);
+            }
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
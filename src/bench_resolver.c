@@ -0,0 +1,537 @@
+/*
+ * DNS resolver benchmark
+ * Checks the resolver against a loopback UDP stub server and a temporary
+ * hosts file:
+ *   - hosts file lookups, names and aliases, without a query
+ *   - positive answers cached for their TTL and queried again once expired
+ *   - NXDOMAIN cached for the SOA minimum, below and above the no-SOA
+ *     default and past RESOLVER_MAX_NEGATIVE_TTL (negative caching)
+ *   - an expired answer served stale while the server is silent, and no
+ *     longer after RESOLVER_STALE_TTL
+ *   - SERVFAIL and truncated (TC) answers fail and are not cached, unless
+ *     another nameserver answers
+ *   - each query sends from its own source port
+ * Expiry is simulated by moving cache deadlines back rather than waiting.
+ * Then measures lookups/s from the cache, the hosts file and the stub.
+ *
+ * The stubs answer by the first label of the name: "nx<n>-..." NXDOMAIN
+ * with an SOA minimum of n seconds, "nosoa-..." NXDOMAIN without an SOA,
+ * anything else an A record (AAAA: no data). A faulty stub answers
+ * "sf-..." with SERVFAIL and "tc-..." truncated.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "resolver.h"
+
+/* Wall time spent per measurement */
+#define BENCH_DURATION_SEC 0.2
+
+/* Stub answers */
+#define BENCH_TTL          60
+
+/* Short query timeout and one attempt, so silent-server checks are quick */
+#define BENCH_TIMEOUT_MS   50
+
+/* Filler lines ahead of the entries in the hosts file */
+#define BENCH_HOSTS_FILLER 2000
+
+/* Queries whose source port the stub records */
+#define BENCH_PORTS        64
+
+/* Loopback UDP stub server */
+typedef struct {
+    int fd;
+    uint16_t port;
+    volatile int stopping;
+    int faulty;                         /* SERVFAIL "sf-", truncate "tc-" */
+    volatile int drop;                  /* Ignore queries (server down) */
+    volatile unsigned long queries;     /* Datagrams received */
+    uint16_t ports[BENCH_PORTS];        /* Source port per received datagram */
+} bench_stub_t;
+
+static double bench_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static void bench_put16(unsigned char *p, uint16_t v)
+{
+    p[0] = (unsigned char)(v >> 8);
+    p[1] = (unsigned char)v;
+}
+
+static void bench_put32(unsigned char *p, uint32_t v)
+{
+    bench_put16(p, (uint16_t)(v >> 16));
+    bench_put16(p + 2, (uint16_t)v);
+}
+
+/* Resource record owned by the question name (compression pointer to 12) */
+static size_t bench_rr(unsigned char *p, uint16_t type, uint32_t ttl,
+                       const unsigned char *rdata, uint16_t rdlen)
+{
+    bench_put16(p, 0xC00C);
+    bench_put16(p + 2, type);
+    bench_put16(p + 4, 1);
+    bench_put32(p + 6, ttl);
+    bench_put16(p + 10, rdlen);
+    memcpy(p + 12, rdata, rdlen);
+
+    return 12 + (size_t)rdlen;
+}
+
+/* Whether the first label of the question starts with prefix */
+static int bench_label(const unsigned char *buf, const char *prefix)
+{
+    size_t n = strlen(prefix);
+
+    return buf[12] >= n && memcmp(buf + 13, prefix, n) == 0;
+}
+
+/* Answer for the query in buf[0..len), built in place; 0 if malformed */
+static size_t bench_stub_answer(const bench_stub_t *stub, unsigned char *buf, size_t len)
+{
+    static const unsigned char a[4] = { 192, 0, 2, 1 };
+    unsigned char soa[22];
+    size_t pos = 12, end;
+    uint16_t type;
+
+    while (pos < len && buf[pos] != 0) {
+        pos += 1 + (size_t)buf[pos];
+    }
+    if (len < 12 || pos + 5 > len) {
+        return 0;
+    }
+    type = (uint16_t)((buf[pos + 1] << 8) | buf[pos + 2]);
+    end = pos + 5;
+
+    /* QR, RD, RA; one question, no other records yet */
+    bench_put16(buf + 2, 0x8180);
+    memset(buf + 6, 0, 6);
+
+    if (bench_label(buf, "nx")) {
+        /* Root mname and rname, serial..expire, then the minimum from the
+         * label ("nx120-" = 120 s); the SOA record itself lives longer */
+        memset(soa, 0, sizeof(soa));
+        bench_put32(soa + 18, (uint32_t)strtoul((const char *)buf + 15, NULL, 10));
+        buf[3] |= 3;
+        bench_put16(buf + 8, 1);
+        end += bench_rr(buf + end, 6, 3600, soa, sizeof(soa));
+    } else if (bench_label(buf, "nosoa-")) {
+        buf[3] |= 3;
+    } else if (stub->faulty && bench_label(buf, "sf-")) {
+        buf[3] |= 2;
+    } else if (type == 1) {
+        if (stub->faulty && bench_label(buf, "tc-")) {
+            buf[2] |= 0x02;
+        }
+        bench_put16(buf + 6, 1);
+        end += bench_rr(buf + end, 1, BENCH_TTL, a, sizeof(a));
+    }
+
+    return end;
+}
+
+static void *bench_stub_run(void *arg)
+{
+    bench_stub_t *stub = (bench_stub_t *)arg;
+    unsigned char buf[512];
+    struct sockaddr_in from;
+    socklen_t from_len;
+    ssize_t n;
+    size_t len;
+
+    while (!stub->stopping) {
+        from_len = sizeof(from);
+        n = recvfrom(stub->fd, buf, 256, 0, (struct sockaddr *)&from, &from_len);
+        if (n <= 0) {
+            continue;
+        }
+
+        if (stub->queries < BENCH_PORTS) {
+            stub->ports[stub->queries] = ntohs(from.sin_port);
+        }
+        stub->queries++;
+
+        len = bench_stub_answer(stub, buf, (size_t)n);
+        if (!stub->drop && len > 0) {
+            sendto(stub->fd, buf, len, 0, (struct sockaddr *)&from, from_len);
+        }
+    }
+
+    return NULL;
+}
+
+static int bench_stub_start(bench_stub_t *stub, int faulty, pthread_t *thread)
+{
+    struct sockaddr_in sin;
+    socklen_t len = sizeof(sin);
+    struct timeval tv = { 0, 100000 };
+
+    memset(stub, 0, sizeof(*stub));
+    stub->faulty = faulty;
+
+    memset(&sin, 0, sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    stub->fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (stub->fd < 0) {
+        return -1;
+    }
+
+    /* The timeout lets the thread notice bench_stub_stop() */
+    setsockopt(stub->fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    if (bind(stub->fd, (struct sockaddr *)&sin, sizeof(sin)) < 0 ||
+        getsockname(stub->fd, (struct sockaddr *)&sin, &len) < 0 ||
+        pthread_create(thread, NULL, bench_stub_run, stub) != 0) {
+        close(stub->fd);
+        return -1;
+    }
+    stub->port = ntohs(sin.sin_port);
+
+    return 0;
+}
+
+static void bench_stub_stop(bench_stub_t *stub, pthread_t thread)
+{
+    stub->stopping = 1;
+    pthread_join(thread, NULL);
+    close(stub->fd);
+}
+
+/* Cache entry of name (lowercase), NULL if none */
+static resolver_entry_t *bench_entry(resolver_t *res, const char *name)
+{
+    size_t i;
+
+    for (i = 0; i < RESOLVER_MAX_ENTRIES; i++) {
+        if (strcmp(res->cache[i].name, name) == 0) {
+            return &res->cache[i];
+        }
+    }
+
+    return NULL;
+}
+
+/* Seconds until the cached answer for name expires, -1 if not cached */
+static double bench_ttl_left(resolver_t *res, const char *name)
+{
+    resolver_entry_t *entry = bench_entry(res, name);
+
+    if (entry == NULL) {
+        return -1;
+    }
+
+    return ((double)entry->expires_ms - (double)resolver_now_ms()) / 1e3;
+}
+
+/* Make the cached answer for name expired sec seconds ago */
+static void bench_expire(resolver_t *res, const char *name, unsigned int sec)
+{
+    resolver_entry_t *entry = bench_entry(res, name);
+
+    if (entry != NULL) {
+        entry->expires_ms = resolver_now_ms() - (uint64_t)sec * 1000 - 1;
+    }
+}
+
+/* Temporary hosts file with filler ahead of the entries; path is updated
+ * with the name of the file */
+static int bench_hosts_file(char *path)
+{
+    FILE *f;
+    int fd, i;
+
+    fd = mkstemp(path);
+    if (fd < 0 || (f = fdopen(fd, "w")) == NULL) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        return -1;
+    }
+
+    for (i = 0; i < BENCH_HOSTS_FILLER; i++) {
+        fprintf(f, "# filler line %d to push the entries past the first buffer\n", i);
+    }
+    fprintf(f, "192.0.2.10\thosts.test alias.test  # comment\n");
+    fprintf(f, "2001:db8::10 hosts.test\n");
+
+    return fclose(f) == 0 ? 0 : -1;
+}
+
+/* Hosts file entries answer without a query */
+static int bench_verify_hosts(resolver_t *res, bench_stub_t *stub)
+{
+    char path[] = "/tmp/bench_resolver_hostsXXXXXX";
+    resolver_addrs_t addrs;
+    unsigned long queries = stub->queries;
+    int ok;
+
+    if (bench_hosts_file(path) != 0) {
+        printf("cannot write a hosts file\n");
+        return -1;
+    }
+
+    ok = resolver_load_hosts(res, path) == RESOLVER_OK &&
+         resolver_resolve(res, "alias.test", &addrs) == RESOLVER_OK &&
+         addrs.count == 1 && addrs.addrs[0].family == AF_INET &&
+         resolver_resolve(res, "HOSTS.test.", &addrs) == RESOLVER_OK &&
+         addrs.count == 2 && addrs.addrs[0].family == AF_INET6 &&
+         bench_entry(res, "hosts.test")->source == RESOLVER_SOURCE_HOSTS &&
+         stub->queries == queries;
+    unlink(path);
+
+    if (!ok) {
+        printf("hosts file lookup failed\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Positive and negative caching, TTL expiry and stale answers */
+static int bench_verify_cache(resolver_t *res, bench_stub_t *stub)
+{
+    resolver_addrs_t addrs;
+    unsigned long queries = stub->queries;
+    unsigned long stale = res->stale;
+    static const struct {
+        const char *name;
+        int ttl;
+    } negative[] = {
+        { "nx10-1.test", 10 },
+        { "nx120-1.test", 120 },            /* Above the no-SOA default */
+        { "nx900-1.test", RESOLVER_MAX_NEGATIVE_TTL },
+        { "nosoa-1.test", RESOLVER_NEGATIVE_TTL }
+    };
+    double left;
+    size_t i;
+    int r;
+
+    /* A and AAAA go out once, the answer then comes from the cache */
+    if (resolver_resolve(res, "ok-1.test", &addrs) != RESOLVER_OK || addrs.count != 1 ||
+        stub->queries != queries + 2 ||
+        resolver_resolve(res, "ok-1.test", &addrs) != RESOLVER_OK || stub->queries != queries + 2) {
+        printf("positive answer not cached\n");
+        return -1;
+    }
+
+    left = bench_ttl_left(res, "ok-1.test");
+    if (left < BENCH_TTL - 5 || left > BENCH_TTL) {
+        printf("positive answer cached for %.1f s, expected %d\n", left, BENCH_TTL);
+        return -1;
+    }
+
+    bench_expire(res, "ok-1.test", 0);
+    if (resolver_resolve(res, "ok-1.test", &addrs) != RESOLVER_OK || stub->queries != queries + 4) {
+        printf("expired answer not queried again\n");
+        return -1;
+    }
+
+    /* NXDOMAIN is cached for the SOA minimum, clamped */
+    for (i = 0; i < sizeof(negative) / sizeof(negative[0]); i++) {
+        queries = stub->queries;
+        if (resolver_resolve(res, negative[i].name, &addrs) != RESOLVER_ERR_NOT_FOUND ||
+            resolver_resolve(res, negative[i].name, &addrs) != RESOLVER_ERR_NOT_FOUND ||
+            stub->queries != queries + 2) {
+            printf("%s: negative answer not cached\n", negative[i].name);
+            return -1;
+        }
+
+        left = bench_ttl_left(res, negative[i].name);
+        if (left < negative[i].ttl - 5 || left > negative[i].ttl) {
+            printf("%s: negative answer cached for %.1f s, expected %d\n",
+                   negative[i].name, left, negative[i].ttl);
+            return -1;
+        }
+    }
+
+    /* Server down: the expired answer is served stale, within limits */
+    stub->drop = 1;
+    bench_expire(res, "ok-1.test", 1);
+    r = resolver_resolve(res, "ok-1.test", &addrs);
+    if (r != RESOLVER_OK || addrs.count != 1 || res->stale != stale + 1) {
+        printf("stale answer not served (%d)\n", r);
+        stub->drop = 0;
+        return -1;
+    }
+
+    bench_expire(res, "ok-1.test", RESOLVER_STALE_TTL + 1);
+    r = resolver_resolve(res, "ok-1.test", &addrs);
+    stub->drop = 0;
+    if (r != RESOLVER_ERR_TIMEOUT) {
+        printf("answer served past the stale limit (%d)\n", r);
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Truncated answers fail and are not cached */
+static int bench_verify_truncated(resolver_t *res, bench_stub_t *stub)
+{
+    resolver_addrs_t addrs;
+    unsigned long queries = stub->queries;
+    int r;
+
+    r = resolver_resolve(res, "tc-1.test", &addrs);
+    if (r != RESOLVER_ERR_SERVER_FAILED) {
+        printf("truncated answer accepted (%d)\n", r);
+        return -1;
+    }
+
+    if (resolver_resolve(res, "tc-1.test", &addrs) != RESOLVER_ERR_SERVER_FAILED ||
+        stub->queries != queries + 4) {
+        printf("truncated answer cached\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+/* SERVFAIL and truncated answers move on to the next nameserver; with a
+ * single faulty one they fail and are not cached */
+static int bench_verify_failures(resolver_t *res, bench_stub_t *stub, uint16_t healthy_port)
+{
+    resolver_addrs_t addrs;
+    resolver_t two;
+    int r1, r2;
+
+    if (resolver_init(&two) != RESOLVER_OK ||
+        resolver_set_server(&two, "127.0.0.1", stub->port) != RESOLVER_OK ||
+        resolver_add_server(&two, "127.0.0.1", healthy_port) != RESOLVER_OK) {
+        resolver_free(&two);
+        printf("cannot set up two nameservers\n");
+        return -1;
+    }
+    two.timeout_ms = BENCH_TIMEOUT_MS;
+    two.attempts = 1;
+
+    r1 = resolver_resolve(&two, "sf-1.test", &addrs);
+    r2 = resolver_resolve(&two, "tc-2.test", &addrs);
+    resolver_free(&two);
+    if (r1 != RESOLVER_OK || r2 != RESOLVER_OK || addrs.count != 1) {
+        printf("no fallback to the next nameserver (SERVFAIL %d, truncated %d)\n", r1, r2);
+        return -1;
+    }
+
+    return bench_verify_truncated(res, stub);
+}
+
+/* Source ports of the queries recorded so far: more than one in use */
+static int bench_verify_ports(const bench_stub_t *stub)
+{
+    size_t i, n = stub->queries < BENCH_PORTS ? stub->queries : BENCH_PORTS;
+
+    for (i = 1; i < n; i++) {
+        if (stub->ports[i] != stub->ports[0]) {
+            return 0;
+        }
+    }
+
+    printf("%zu queries all sent from port %u\n", n, (unsigned int)stub->ports[0]);
+    return -1;
+}
+
+/* Lookups/s: 0 = cache hit, 1 = hosts file, 2 = stub query */
+static double bench_lookups(resolver_t *res, int source)
+{
+    static const char *const names[] = { "ok-1.test", "hosts.test", "ok-2.test" };
+    double start = bench_now(), elapsed;
+    unsigned long lookups = 0;
+    resolver_addrs_t addrs;
+
+    do {
+        if (source != 0) {
+            resolver_flush(res);
+        }
+        if (resolver_resolve(res, names[source], &addrs) != RESOLVER_OK) {
+            return 0;
+        }
+        lookups++;
+        elapsed = bench_now() - start;
+    } while (elapsed < BENCH_DURATION_SEC);
+
+    return (double)lookups / elapsed;
+}
+
+int main(void)
+{
+    static const char *const labels[] = { "cache hit", "hosts file", "stub query" };
+    char path[] = "/tmp/bench_resolver_hostsXXXXXX";
+    bench_stub_t stub, healthy;
+    pthread_t thread, healthy_thread;
+    resolver_t res;
+    double rate;
+    int i, ret = EXIT_FAILURE;
+
+    if (bench_stub_start(&stub, 1, &thread) != 0) {
+        printf("cannot start the stub server\n");
+        return EXIT_FAILURE;
+    }
+    if (bench_stub_start(&healthy, 0, &healthy_thread) != 0) {
+        printf("cannot start the stub server\n");
+        bench_stub_stop(&stub, thread);
+        return EXIT_FAILURE;
+    }
+
+    if (resolver_init(&res) != RESOLVER_OK ||
+        resolver_set_server(&res, "127.0.0.1", stub.port) != RESOLVER_OK ||
+        resolver_load_hosts(&res, NULL) != RESOLVER_OK) {
+        printf("resolver setup failed\n");
+        bench_stub_stop(&healthy, healthy_thread);
+        bench_stub_stop(&stub, thread);
+        return EXIT_FAILURE;
+    }
+    res.timeout_ms = BENCH_TIMEOUT_MS;
+    res.attempts = 1;
+
+    if (bench_verify_hosts(&res, &stub) != 0 || bench_verify_cache(&res, &stub) != 0 ||
+        bench_verify_failures(&res, &stub, healthy.port) != 0 ||
+        bench_verify_ports(&stub) != 0) {
+        goto exit;
+    }
+    printf("resolver check passed (hosts file, TTL expiry, negative caching, stale "
+           "answers, SERVFAIL and truncation, source ports)\n");
+
+    /* Keep the hosts file for its measurement */
+    if (bench_hosts_file(path) != 0 || resolver_load_hosts(&res, path) != RESOLVER_OK) {
+        printf("cannot load a hosts file\n");
+        goto exit;
+    }
+    unlink(path);
+
+    printf("%-28s  %12s  %12s\n", "lookup", "lookups/s", "mean (us)");
+    for (i = 0; i < 3; i++) {
+        rate = bench_lookups(&res, i);
+        if (rate == 0) {
+            printf("%s lookup failed\n", labels[i]);
+            goto exit;
+        }
+        printf("%-28s  %12.0f  %12.2f\n", labels[i], rate, 1e6 / rate);
+    }
+
+    ret = EXIT_SUCCESS;
+
+exit:
+    resolver_free(&res);
+    bench_stub_stop(&healthy, healthy_thread);
+    bench_stub_stop(&stub, thread);
+
+    return ret;
+}
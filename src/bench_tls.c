@@ -0,0 +1,1167 @@
+/*
+ * TLS handshake and throughput benchmark
+ * Starts a local mbedtls server on 127.0.0.1 with a freshly generated
+ * ECDSA P-256 certificate and drives the tuya-client stack (transport_tcp,
+ * custom_rng, session_cache, https_pool, http_parser) against it, per TLS
+ * version and ciphersuite:
+ *   - full handshakes/sec and latency percentiles
+ *   - resumed handshakes/sec (session ID / ticket / TLS 1.3 PSK)
+ *   - time to first byte on a kept-alive connection
+ *   - bulk download throughput
+ *   - chunked and close-delimited responses through https_pool (checked)
+ * and per TLS profile (tls_profile.h): latency, round trips and client CPU
+ * of a new connection plus one request, full, resumed and resumed with the
+ * request sent as 0-RTT early data, plus the heap held by idle event_loop
+ * sessions (tls_arena.h) at the handshake peak and once settled; finally
+ * full handshakes/sec through worker_pool with one worker and one per CPU.
+ *
+ * Usage: bench_tls [handshakes] [requests] [bulk_mib]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "custom_rng.h"
+#include "https_pool.h"
+#include "session_cache.h"
+#include "transport_tcp.h"
+#include "conn_metrics.h"
+#include "tls_profile.h"
+#include "tls_arena.h"
+#include "event_loop.h"
+#include "worker_pool.h"
+#include "mbedtls/ssl.h"
+#include "mbedtls/ssl_ciphersuites.h"
+#include "mbedtls/ssl_cache.h"
+#include "mbedtls/ssl_ticket.h"
+#include "mbedtls/x509_crt.h"
+#include "mbedtls/x509_csr.h"
+#include "mbedtls/pk.h"
+#include "mbedtls/ecp.h"
+#if defined(MBEDTLS_PSA_CRYPTO_C)
+#include "psa/crypto.h"
+#endif
+
+#define BENCH_HOST "127.0.0.1"
+
+/* Defaults, overridable on the command line */
+#define BENCH_HANDSHAKES 200
+#define BENCH_REQUESTS 1000
+#define BENCH_BULK_MIB 64
+
+/* Request path "/<n>" asks the server for an n byte body */
+#define BENCH_SMALL_BODY 64
+
+/* Early data the server accepts per connection */
+#define BENCH_EARLY_DATA_MAX 1024
+
+/* Idle sessions opened per profile for the memory figures */
+#define BENCH_MEMORY_SESSIONS 32
+
+/* One benchmarked protocol/ciphersuite combination */
+typedef struct {
+    const char *name;
+    mbedtls_ssl_protocol_version version;
+    int ciphersuites[2];
+} bench_suite_t;
+
+static const bench_suite_t bench_suites[] = {
+    { "TLS1.2 ECDHE-ECDSA-AES128-GCM", MBEDTLS_SSL_VERSION_TLS1_2,
+      { MBEDTLS_TLS_ECDHE_ECDSA_WITH_AES_128_GCM_SHA256, 0 } },
+    { "TLS1.2 ECDHE-ECDSA-AES256-GCM", MBEDTLS_SSL_VERSION_TLS1_2,
+      { MBEDTLS_TLS_ECDHE_ECDSA_WITH_AES_256_GCM_SHA384, 0 } },
+    { "TLS1.2 ECDHE-ECDSA-CHACHA20", MBEDTLS_SSL_VERSION_TLS1_2,
+      { MBEDTLS_TLS_ECDHE_ECDSA_WITH_CHACHA20_POLY1305_SHA256, 0 } },
+#if defined(MBEDTLS_SSL_PROTO_TLS1_3)
+    { "TLS1.3 AES128-GCM", MBEDTLS_SSL_VERSION_TLS1_3,
+      { MBEDTLS_TLS1_3_AES_128_GCM_SHA256, 0 } },
+    { "TLS1.3 AES256-GCM", MBEDTLS_SSL_VERSION_TLS1_3,
+      { MBEDTLS_TLS1_3_AES_256_GCM_SHA384, 0 } },
+    { "TLS1.3 CHACHA20", MBEDTLS_SSL_VERSION_TLS1_3,
+      { MBEDTLS_TLS1_3_CHACHA20_POLY1305_SHA256, 0 } },
+#endif
+};
+
+/* Server state shared by all connection threads. The client drives one
+ * handshake at a time, so the session cache and ticket keys need no lock;
+ * the worker pool run overlaps handshakes and relies on the locks mbedtls
+ * takes with MBEDTLS_THREADING_C, which the pool requires anyway. */
+typedef struct {
+    mbedtls_ssl_config conf;
+    mbedtls_x509_crt cert;
+    mbedtls_pk_context key;
+    mbedtls_ssl_cache_context cache;
+    mbedtls_ssl_ticket_context ticket;
+    custom_rng_context rng;
+    int listen_fd;
+    char port[8];
+    volatile int stopping;
+    volatile int threads;               /* Connection threads still running */
+} bench_server_t;
+
+typedef struct {
+    bench_server_t *server;
+    int fd;
+} bench_server_conn_t;
+
+static double bench_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/* CPU time of the calling thread; the server runs on other threads */
+static double bench_cpu_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static int bench_cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+/* Sort samples (seconds) and print rate and p50/p90/p99/max in ms */
+static void bench_report(const char *what, double *samples, size_t n, double elapsed)
+{
+    if (n == 0) {
+        printf("    %-22s no samples\n", what);
+        return;
+    }
+
+    qsort(samples, n, sizeof(samples[0]), bench_cmp_double);
+
+    printf("    %-22s %9.1f/s  p50 %7.3f  p90 %7.3f  p99 %7.3f  max %7.3f ms\n",
+           what, (double)n / elapsed,
+           samples[n / 2] * 1e3, samples[n * 90 / 100] * 1e3,
+           samples[n * 99 / 100] * 1e3, samples[n - 1] * 1e3);
+}
+
+/* ---- Server ---------------------------------------------------------- */
+
+/* Self-signed ECDSA P-256 certificate for CN=localhost */
+static int bench_server_make_cert(bench_server_t *server)
+{
+    mbedtls_x509write_cert crt;
+    unsigned char der[2048];
+    int ret, len;
+
+    ret = mbedtls_pk_setup(&server->key, mbedtls_pk_info_from_type(MBEDTLS_PK_ECKEY));
+    if (ret == 0) {
+        ret = mbedtls_ecp_gen_key(MBEDTLS_ECP_DP_SECP256R1, mbedtls_pk_ec(server->key),
+                                  custom_rng_random, &server->rng);
+    }
+    if (ret != 0) {
+        return ret;
+    }
+
+    mbedtls_x509write_crt_init(&crt);
+    mbedtls_x509write_crt_set_version(&crt, MBEDTLS_X509_CRT_VERSION_3);
+    mbedtls_x509write_crt_set_md_alg(&crt, MBEDTLS_MD_SHA256);
+    mbedtls_x509write_crt_set_subject_key(&crt, &server->key);
+    mbedtls_x509write_crt_set_issuer_key(&crt, &server->key);
+
+#if MBEDTLS_VERSION_NUMBER >= 0x03040000
+    {
+        unsigned char serial[1] = { 1 };
+        ret = mbedtls_x509write_crt_set_serial_raw(&crt, serial, sizeof(serial));
+    }
+#else
+    {
+        mbedtls_mpi serial;
+        mbedtls_mpi_init(&serial);
+        ret = mbedtls_mpi_lset(&serial, 1);
+        if (ret == 0) {
+            ret = mbedtls_x509write_crt_set_serial(&crt, &serial);
+        }
+        mbedtls_mpi_free(&serial);
+    }
+#endif
+
+    if (ret == 0) {
+        ret = mbedtls_x509write_crt_set_subject_name(&crt, "CN=localhost");
+    }
+    if (ret == 0) {
+        ret = mbedtls_x509write_crt_set_issuer_name(&crt, "CN=localhost");
+    }
+    if (ret == 0) {
+        ret = mbedtls_x509write_crt_set_validity(&crt, "20240101000000", "20991231235959");
+    }
+
+    /* DER is written at the end of the buffer */
+    len = ret == 0 ? mbedtls_x509write_crt_der(&crt, der, sizeof(der),
+                                               custom_rng_random, &server->rng)
+                   : ret;
+    mbedtls_x509write_crt_free(&crt);
+
+    if (len < 0) {
+        return len;
+    }
+
+    return mbedtls_x509_crt_parse_der(&server->cert, der + sizeof(der) - len, (size_t)len);
+}
+
+/* Write a whole buffer on a blocking TLS session */
+static int bench_ssl_write_all(mbedtls_ssl_context *ssl, const unsigned char *buf, size_t len)
+{
+    int ret;
+
+    while (len > 0) {
+        ret = mbedtls_ssl_write(ssl, buf, len);
+        if (ret == MBEDTLS_ERR_SSL_WANT_READ || ret == MBEDTLS_ERR_SSL_WANT_WRITE) {
+            continue;
+        }
+        if (ret < 0) {
+            return ret;
+        }
+        buf += ret;
+        len -= (size_t)ret;
+    }
+
+    return 0;
+}
+
+/* Write an n byte body as chunks of up to sizeof(zeros) bytes */
+static int bench_write_chunked(mbedtls_ssl_context *ssl, unsigned long long body)
+{
+    static const unsigned char zeros[16384];
+    char size[32];
+    size_t chunk;
+    int n;
+
+    while (body > 0) {
+        chunk = body < sizeof(zeros) ? (size_t)body : sizeof(zeros);
+        n = snprintf(size, sizeof(size), "%zx\r\n", chunk);
+        if (bench_ssl_write_all(ssl, (const unsigned char *)size, (size_t)n) != 0 ||
+            bench_ssl_write_all(ssl, zeros, chunk) != 0 ||
+            bench_ssl_write_all(ssl, (const unsigned char *)"\r\n", 2) != 0) {
+            return -1;
+        }
+        body -= chunk;
+    }
+
+    return bench_ssl_write_all(ssl, (const unsigned char *)"0\r\n\r\n", 5);
+}
+
+/* Serve "GET /<n>" requests with n byte bodies until the client leaves.
+ * "/chunked/<n>" sends the body chunked, "/close/<n>" without a length,
+ * delimited by closing the connection. */
+static void *bench_server_conn(void *arg)
+{
+    bench_server_conn_t *sc = (bench_server_conn_t *)arg;
+    bench_server_t *server = sc->server;
+    static const unsigned char zeros[16384];
+    transport_tcp_t transport;
+    mbedtls_ssl_context ssl;
+    char req[2048], head[128];
+    size_t req_len = 0;
+    int ret;
+
+    transport_tcp_init(&transport);
+    transport.fd = sc->fd;
+    transport.connected = 1;
+    free(sc);
+
+    mbedtls_ssl_init(&ssl);
+    if (mbedtls_ssl_setup(&ssl, &server->conf) != 0) {
+        goto done;
+    }
+    mbedtls_ssl_set_bio(&ssl, &transport, transport_tcp_send, transport_tcp_recv, NULL);
+
+    for (;;) {
+        ret = mbedtls_ssl_handshake(&ssl);
+#if defined(MBEDTLS_SSL_EARLY_DATA)
+        /* 0-RTT request: keep it, it is answered once the handshake is done */
+        if (ret == MBEDTLS_ERR_SSL_RECEIVED_EARLY_DATA) {
+            ret = mbedtls_ssl_read_early_data(&ssl, (unsigned char *)req + req_len,
+                                              sizeof(req) - 1 - req_len);
+            if (ret > 0) {
+                req_len += (size_t)ret;
+                req[req_len] = '\0';
+            }
+            continue;
+        }
+#endif
+        if (ret != MBEDTLS_ERR_SSL_WANT_READ && ret != MBEDTLS_ERR_SSL_WANT_WRITE) {
+            break;
+        }
+    }
+
+    if (ret != 0) {
+        goto done;
+    }
+
+    for (;;) {
+        char *end;
+        unsigned long long body;
+        size_t head_len;
+        int n, chunked = 0, close_after = 0;
+
+        end = req_len > 0 ? strstr(req, "\r\n\r\n") : NULL;
+        if (end == NULL) {
+            if (req_len == sizeof(req) - 1) {
+                break;
+            }
+            ret = mbedtls_ssl_read(&ssl, (unsigned char *)req + req_len,
+                                   sizeof(req) - 1 - req_len);
+            if (ret == MBEDTLS_ERR_SSL_WANT_READ || ret == MBEDTLS_ERR_SSL_WANT_WRITE) {
+                continue;
+            }
+            if (ret <= 0) {
+                break;
+            }
+            req_len += (size_t)ret;
+            req[req_len] = '\0';
+            continue;
+        }
+
+        if (sscanf(req, "GET /chunked/%llu", &body) == 1) {
+            chunked = 1;
+        } else if (sscanf(req, "GET /close/%llu", &body) == 1) {
+            close_after = 1;
+        } else if (sscanf(req, "GET /%llu", &body) != 1) {
+            body = 0;
+        }
+
+        if (chunked) {
+            n = snprintf(head, sizeof(head),
+                         "HTTP/1.1 200 OK\r\n"
+                         "Transfer-Encoding: chunked\r\n"
+                         "\r\n");
+        } else if (close_after) {
+            n = snprintf(head, sizeof(head),
+                         "HTTP/1.1 200 OK\r\n"
+                         "Connection: close\r\n"
+                         "\r\n");
+        } else {
+            n = snprintf(head, sizeof(head),
+                         "HTTP/1.1 200 OK\r\n"
+                         "Content-Length: %llu\r\n"
+                         "Connection: keep-alive\r\n"
+                         "\r\n", body);
+        }
+        if (bench_ssl_write_all(&ssl, (const unsigned char *)head, (size_t)n) != 0) {
+            break;
+        }
+
+        if (chunked) {
+            if (bench_write_chunked(&ssl, body) != 0) {
+                break;
+            }
+            body = 0;
+        }
+
+        while (body > 0) {
+            size_t chunk = body < sizeof(zeros) ? (size_t)body : sizeof(zeros);
+            if (bench_ssl_write_all(&ssl, zeros, chunk) != 0) {
+                goto done;
+            }
+            body -= chunk;
+        }
+
+        if (close_after) {
+            mbedtls_ssl_close_notify(&ssl);
+            break;
+        }
+
+        /* Keep any pipelined bytes */
+        head_len = (size_t)(end + 4 - req);
+        memmove(req, req + head_len, req_len - head_len + 1);
+        req_len -= head_len;
+    }
+
+done:
+    mbedtls_ssl_free(&ssl);
+    transport_tcp_close(&transport);
+    __sync_fetch_and_sub(&server->threads, 1);
+
+    return NULL;
+}
+
+static void *bench_server_accept(void *arg)
+{
+    bench_server_t *server = (bench_server_t *)arg;
+    bench_server_conn_t *sc;
+    pthread_t thread;
+    int fd;
+
+    while (!server->stopping) {
+        fd = accept(server->listen_fd, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+
+        sc = malloc(sizeof(*sc));
+        if (sc == NULL) {
+            close(fd);
+            continue;
+        }
+        sc->server = server;
+        sc->fd = fd;
+
+        __sync_fetch_and_add(&server->threads, 1);
+        if (pthread_create(&thread, NULL, bench_server_conn, sc) != 0) {
+            __sync_fetch_and_sub(&server->threads, 1);
+            close(fd);
+            free(sc);
+            continue;
+        }
+        pthread_detach(thread);
+    }
+
+    return NULL;
+}
+
+/* Generate the certificate, configure TLS and listen on an ephemeral port */
+static int bench_server_start(bench_server_t *server, pthread_t *thread)
+{
+    const char *pers = "bench_tls_server";
+    struct sockaddr_in addr;
+    socklen_t addr_len = sizeof(addr);
+    int one = 1, ret;
+
+    memset(server, 0, sizeof(*server));
+    server->listen_fd = -1;
+    mbedtls_ssl_config_init(&server->conf);
+    mbedtls_x509_crt_init(&server->cert);
+    mbedtls_pk_init(&server->key);
+    mbedtls_ssl_cache_init(&server->cache);
+    mbedtls_ssl_ticket_init(&server->ticket);
+    custom_rng_init(&server->rng);
+
+    if ((ret = custom_rng_seed(&server->rng, (const unsigned char *)pers, strlen(pers))) != 0 ||
+        (ret = bench_server_make_cert(server)) != 0 ||
+        (ret = mbedtls_ssl_config_defaults(&server->conf, MBEDTLS_SSL_IS_SERVER,
+                                           MBEDTLS_SSL_TRANSPORT_STREAM,
+                                           MBEDTLS_SSL_PRESET_DEFAULT)) != 0 ||
+        (ret = mbedtls_ssl_conf_own_cert(&server->conf, &server->cert, &server->key)) != 0 ||
+        (ret = mbedtls_ssl_ticket_setup(&server->ticket, custom_rng_random, &server->rng,
+                                        MBEDTLS_CIPHER_AES_256_GCM, 86400)) != 0) {
+        printf("  ! server setup failed: -0x%04x\n", (unsigned int)-ret);
+        return -1;
+    }
+
+    mbedtls_ssl_conf_rng(&server->conf, custom_rng_random, &server->rng);
+    mbedtls_ssl_conf_session_cache(&server->conf, &server->cache,
+                                   mbedtls_ssl_cache_get, mbedtls_ssl_cache_set);
+    mbedtls_ssl_conf_session_tickets_cb(&server->conf, mbedtls_ssl_ticket_write,
+                                        mbedtls_ssl_ticket_parse, &server->ticket);
+#if defined(MBEDTLS_SSL_EARLY_DATA)
+    mbedtls_ssl_conf_early_data(&server->conf, MBEDTLS_SSL_EARLY_DATA_ENABLED);
+    mbedtls_ssl_conf_max_early_data_size(&server->conf, BENCH_EARLY_DATA_MAX);
+#endif
+
+    server->listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (server->listen_fd < 0) {
+        return -1;
+    }
+    setsockopt(server->listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = 0;
+
+    if (bind(server->listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        listen(server->listen_fd, 128) < 0 ||
+        getsockname(server->listen_fd, (struct sockaddr *)&addr, &addr_len) < 0) {
+        return -1;
+    }
+
+    snprintf(server->port, sizeof(server->port), "%u", (unsigned int)ntohs(addr.sin_port));
+
+    if (pthread_create(thread, NULL, bench_server_accept, server) != 0) {
+        close(server->listen_fd);
+        server->listen_fd = -1;
+        return -1;
+    }
+
+    return 0;
+}
+
+static void bench_server_stop(bench_server_t *server, pthread_t thread)
+{
+    server->stopping = 1;
+
+    if (server->listen_fd >= 0) {
+        shutdown(server->listen_fd, SHUT_RDWR);
+        pthread_join(thread, NULL);
+        close(server->listen_fd);
+    }
+
+    /* Connection threads exit once the client has closed its sockets */
+    while (server->threads > 0) {
+        usleep(1000);
+    }
+
+    mbedtls_ssl_ticket_free(&server->ticket);
+    mbedtls_ssl_cache_free(&server->cache);
+    mbedtls_ssl_config_free(&server->conf);
+    mbedtls_x509_crt_free(&server->cert);
+    mbedtls_pk_free(&server->key);
+    custom_rng_free(&server->rng);
+}
+
+/* ---- Client ---------------------------------------------------------- */
+
+static int bench_discard(void *ctx, const unsigned char *data, size_t len)
+{
+    (void)ctx;
+    (void)data;
+    (void)len;
+    return 0;
+}
+
+/* Record the time the first body byte arrives */
+static int bench_first_byte(void *ctx, const unsigned char *data, size_t len)
+{
+    double *first = (double *)ctx;
+
+    (void)data;
+    (void)len;
+
+    if (*first == 0.0) {
+        *first = bench_now();
+    }
+
+    return 0;
+}
+
+/* Connect + handshake + close, n times; sessions NULL forces full handshakes */
+static int bench_handshakes(const mbedtls_ssl_config *conf, session_cache_t *sessions,
+                            const char *port, double *samples, size_t n,
+                            size_t *resumed, double *elapsed)
+{
+    https_pool_t pool;
+    https_response_t resp;
+    https_conn_t *conn;
+    double start, t0;
+    size_t i;
+    int ret;
+
+    *resumed = 0;
+
+    if (sessions != NULL) {
+        /* Prime the cache; TLS 1.3 tickets only arrive with the first response */
+        https_pool_init(&pool, conf, sessions);
+        ret = https_pool_request(&pool, BENCH_HOST, port, "GET", "/0", &resp, NULL, NULL);
+        https_pool_free(&pool);
+        if (ret != HTTPS_POOL_OK) {
+            return ret;
+        }
+    }
+
+    https_pool_init(&pool, conf, sessions);
+    start = bench_now();
+
+    for (i = 0; i < n; i++) {
+        t0 = bench_now();
+        ret = https_pool_acquire(&pool, BENCH_HOST, port, &conn);
+        if (ret != HTTPS_POOL_OK) {
+            https_pool_free(&pool);
+            return ret;
+        }
+        samples[i] = bench_now() - t0;
+        *resumed += !conn->full_handshake;
+        https_pool_release(&pool, conn, 0);
+    }
+
+    *elapsed = bench_now() - start;
+    https_pool_free(&pool);
+
+    return HTTPS_POOL_OK;
+}
+
+/* Small requests on one kept-alive connection: time to first body byte */
+static int bench_ttfb(const mbedtls_ssl_config *conf, const char *port,
+                      double *samples, size_t n, double *elapsed)
+{
+    https_pool_t pool;
+    https_response_t resp;
+    char path[32];
+    double start, t0, first;
+    size_t i;
+    int ret;
+
+    snprintf(path, sizeof(path), "/%d", BENCH_SMALL_BODY);
+    https_pool_init(&pool, conf, NULL);
+
+    /* Open the connection outside the measurement */
+    ret = https_pool_request(&pool, BENCH_HOST, port, "GET", path, &resp, NULL, NULL);
+
+    start = bench_now();
+    for (i = 0; ret == HTTPS_POOL_OK && i < n; i++) {
+        first = 0.0;
+        t0 = bench_now();
+        ret = https_pool_request(&pool, BENCH_HOST, port, "GET", path, &resp,
+                                 bench_first_byte, &first);
+        samples[i] = (first != 0.0 ? first : bench_now()) - t0;
+    }
+    *elapsed = bench_now() - start;
+
+    https_pool_free(&pool);
+
+    return ret;
+}
+
+/* Responses without a Content-Length: chunked ones keep the connection,
+ * one delimited by close ends when the server closes and is not reused */
+static int bench_framing(const mbedtls_ssl_config *conf, const char *port)
+{
+    static const char *const paths[] = { "/chunked/40000", "/chunked/40000", "/close/40000" };
+    https_pool_t pool;
+    https_response_t resp;
+    size_t i;
+    int ret = HTTPS_POOL_OK;
+
+    https_pool_init(&pool, conf, NULL);
+
+    for (i = 0; ret == HTTPS_POOL_OK && i < sizeof(paths) / sizeof(paths[0]); i++) {
+        ret = https_pool_request(&pool, BENCH_HOST, port, "GET", paths[i], &resp, NULL, NULL);
+        if (ret == HTTPS_POOL_OK &&
+            (resp.body_len != 40000 || resp.reused != (i > 0) || resp.keep_alive != (i < 2))) {
+            printf("    ! %s: %zu bytes, reused %d, keep-alive %d\n", paths[i],
+                   resp.body_len, resp.reused, resp.keep_alive);
+            ret = HTTPS_POOL_ERR_BAD_RESPONSE;
+        }
+    }
+
+    /* The connection the server closed must not be handed out again */
+    if (ret == HTTPS_POOL_OK) {
+        ret = https_pool_request(&pool, BENCH_HOST, port, "GET", "/64", &resp, NULL, NULL);
+        if (ret == HTTPS_POOL_OK && resp.reused) {
+            ret = HTTPS_POOL_ERR_BAD_RESPONSE;
+        }
+    }
+
+    https_pool_free(&pool);
+
+    return ret;
+}
+
+/* One large download; returns MB/s or a negative value on failure */
+static double bench_bulk(const mbedtls_ssl_config *conf, const char *port, size_t mib)
+{
+    https_pool_t pool;
+    https_response_t resp;
+    char path[32];
+    double t0, elapsed;
+    int ret;
+
+    snprintf(path, sizeof(path), "/%zu", mib * 1024 * 1024);
+    https_pool_init(&pool, conf, NULL);
+
+    /* Handshake first so only the transfer is timed */
+    ret = https_pool_request(&pool, BENCH_HOST, port, "GET", "/0", &resp, NULL, NULL);
+    t0 = bench_now();
+    if (ret == HTTPS_POOL_OK) {
+        ret = https_pool_request(&pool, BENCH_HOST, port, "GET", path, &resp,
+                                 bench_discard, NULL);
+    }
+    elapsed = bench_now() - t0;
+
+    https_pool_free(&pool);
+
+    if (ret != HTTPS_POOL_OK || resp.body_len != mib * 1024 * 1024) {
+        return -1.0;
+    }
+
+    return (double)resp.body_len / elapsed / 1e6;
+}
+
+/* Client configuration restricted to one version and ciphersuite */
+static int bench_client_conf(mbedtls_ssl_config *conf, custom_rng_context *rng,
+                             const bench_suite_t *suite)
+{
+    int ret;
+
+    ret = mbedtls_ssl_config_defaults(conf, MBEDTLS_SSL_IS_CLIENT,
+                                      MBEDTLS_SSL_TRANSPORT_STREAM,
+                                      MBEDTLS_SSL_PRESET_DEFAULT);
+    if (ret != 0) {
+        return ret;
+    }
+
+    mbedtls_ssl_conf_authmode(conf, MBEDTLS_SSL_VERIFY_NONE);
+    mbedtls_ssl_conf_rng(conf, custom_rng_random, rng);
+    mbedtls_ssl_conf_min_tls_version(conf, suite->version);
+    mbedtls_ssl_conf_max_tls_version(conf, suite->version);
+    mbedtls_ssl_conf_ciphersuites(conf, suite->ciphersuites);
+
+#if defined(MBEDTLS_SSL_SESSION_TICKETS)
+    mbedtls_ssl_conf_session_tickets(conf, MBEDTLS_SSL_SESSION_TICKETS_ENABLED);
+#if defined(MBEDTLS_SSL_PROTO_TLS1_3) && MBEDTLS_VERSION_NUMBER >= 0x03060100
+    mbedtls_ssl_conf_tls13_enable_signal_new_session_tickets(
+        conf, MBEDTLS_SSL_TLS1_3_SIGNAL_NEW_SESSION_TICKETS_ENABLED);
+#endif
+#endif
+
+    return 0;
+}
+
+/* New connection + one small request, n times. Reports client CPU and round
+ * trips per connect and how many requests went out as accepted 0-RTT data. */
+static int bench_connects(const mbedtls_ssl_config *conf, session_cache_t *sessions,
+                          int early_data, const char *port, double *samples, size_t n,
+                          double *elapsed, double *cpu, double *round_trips, size_t *early)
+{
+    conn_metrics_registry_t metrics;
+    https_pool_t pool;
+    https_response_t resp;
+    char path[32];
+    double start, t0, cpu0, first;
+    size_t i;
+    int ret = HTTPS_POOL_OK;
+
+    snprintf(path, sizeof(path), "/%d", BENCH_SMALL_BODY);
+    *cpu = 0.0;
+    *round_trips = 0.0;
+    *early = 0;
+
+    if (sessions != NULL) {
+        https_pool_init(&pool, conf, sessions);
+        ret = https_pool_request(&pool, BENCH_HOST, port, "GET", "/0", &resp, NULL, NULL);
+        https_pool_free(&pool);
+        if (ret != HTTPS_POOL_OK) {
+            return ret;
+        }
+    }
+
+    conn_metrics_registry_init(&metrics);
+    https_pool_init(&pool, conf, sessions);
+    pool.metrics = &metrics;
+    pool.early_data = early_data;
+    start = bench_now();
+
+    for (i = 0; i < n; i++) {
+        first = 0.0;
+        t0 = bench_now();
+        cpu0 = bench_cpu_now();
+        ret = https_pool_request(&pool, BENCH_HOST, port, "GET", path, &resp,
+                                 bench_first_byte, &first);
+        *cpu += bench_cpu_now() - cpu0;
+        samples[i] = (first != 0.0 ? first : bench_now()) - t0;
+        if (ret != HTTPS_POOL_OK) {
+            break;
+        }
+        *early += (size_t)resp.early_data;
+
+        /* Drop the connection so the next request opens a new one */
+        https_pool_free(&pool);
+    }
+
+    *elapsed = bench_now() - start;
+    https_pool_free(&pool);
+
+    if (metrics.closed > 0) {
+        *round_trips = (double)metrics.closed_totals.round_trips / (double)metrics.closed;
+    }
+    *cpu /= (double)n;
+    conn_metrics_registry_free(&metrics);
+
+    return ret;
+}
+
+/* Client configuration for a TLS profile */
+static int bench_profile_conf(mbedtls_ssl_config *conf, custom_rng_context *rng,
+                              const tls_profile_t *profile)
+{
+    int ret;
+
+    ret = mbedtls_ssl_config_defaults(conf, MBEDTLS_SSL_IS_CLIENT,
+                                      MBEDTLS_SSL_TRANSPORT_STREAM,
+                                      MBEDTLS_SSL_PRESET_DEFAULT);
+    if (ret != 0) {
+        return ret;
+    }
+
+    if ((ret = tls_profile_apply(conf, profile)) != TLS_PROFILE_OK) {
+        return ret;
+    }
+
+    mbedtls_ssl_conf_authmode(conf, MBEDTLS_SSL_VERIFY_NONE);
+    mbedtls_ssl_conf_rng(conf, custom_rng_random, rng);
+
+#if defined(MBEDTLS_SSL_SESSION_TICKETS)
+    mbedtls_ssl_conf_session_tickets(conf, MBEDTLS_SSL_SESSION_TICKETS_ENABLED);
+#if defined(MBEDTLS_SSL_PROTO_TLS1_3) && MBEDTLS_VERSION_NUMBER >= 0x03060100
+    mbedtls_ssl_conf_tls13_enable_signal_new_session_tickets(
+        conf, MBEDTLS_SSL_TLS1_3_SIGNAL_NEW_SESSION_TICKETS_ENABLED);
+#endif
+#endif
+
+    return 0;
+}
+
+/* Post-handshake messages (TLS 1.3 tickets) of an idle session */
+static void bench_memory_drain(event_conn_t *conn)
+{
+    unsigned char buf[256];
+
+    while (mbedtls_ssl_read(&conn->ssl, buf, sizeof(buf)) > 0) {
+    }
+}
+
+/* Open BENCH_MEMORY_SESSIONS idle sessions on an event loop, one handshake
+ * at a time, and report their arena figures in bytes per session */
+static void bench_memory(const mbedtls_ssl_config *conf, const char *port)
+{
+    event_loop_t loop;
+    event_conn_t *conns;
+    size_t i, open = 0, established = 0, peak_max = 0;
+    double peak_sum = 0.0, current_sum = 0.0;
+
+    if (!tls_arena_installed()) {
+        printf("    %-22s not measured (mbedtls without MBEDTLS_PLATFORM_MEMORY)\n",
+               "session memory");
+        return;
+    }
+
+    conns = calloc(BENCH_MEMORY_SESSIONS, sizeof(*conns));
+    if (conns == NULL || event_loop_init(&loop) != EVENT_LOOP_OK) {
+        free(conns);
+        printf("    ! session memory: setup failed\n");
+        return;
+    }
+
+    for (i = 0; i < BENCH_MEMORY_SESSIONS; i++) {
+        if (event_conn_init(&conns[i], conf) != EVENT_LOOP_OK) {
+            break;
+        }
+        conns[i].on_readable = bench_memory_drain;
+        open++;
+
+        if (event_conn_start(&loop, &conns[i], BENCH_HOST, port) != EVENT_LOOP_OK) {
+            break;
+        }
+        while (conns[i].state != EVENT_CONN_ESTABLISHED &&
+               conns[i].state != EVENT_CONN_CLOSED) {
+            event_loop_run_once(&loop, 100);
+        }
+        if (conns[i].state != EVENT_CONN_ESTABLISHED) {
+            break;
+        }
+    }
+
+    /* Let session tickets arrive and the record buffers shrink */
+    for (i = 0; i < 5; i++) {
+        event_loop_run_once(&loop, 10);
+    }
+
+    for (i = 0; i < open; i++) {
+        if (conns[i].state == EVENT_CONN_ESTABLISHED) {
+            established++;
+            peak_sum += (double)conns[i].arena.peak;
+            current_sum += (double)conns[i].arena.current;
+            if (conns[i].arena.peak > peak_max) {
+                peak_max = conns[i].arena.peak;
+            }
+        }
+    }
+
+    if (established == BENCH_MEMORY_SESSIONS) {
+        printf("    %-22s %9.0f B idle, peak %.0f B avg / %zu B max (%d sessions)\n",
+               "session memory", current_sum / (double)established,
+               peak_sum / (double)established, peak_max, BENCH_MEMORY_SESSIONS);
+    } else {
+        printf("    ! session memory: only %zu of %d sessions established\n",
+               established, BENCH_MEMORY_SESSIONS);
+    }
+
+    for (i = 0; i < open; i++) {
+        event_conn_close(&conns[i]);
+        event_conn_free(&conns[i]);
+    }
+    event_loop_free(&loop);
+    free(conns);
+}
+
+static void bench_profile(const tls_profile_t *profile, custom_rng_context *rng,
+                          const char *port, size_t handshakes, double *samples)
+{
+    static const struct {
+        const char *what;
+        int resume;
+        int early_data;
+    } runs[] = {
+        { "full connect", 0, 0 },
+        { "resumed connect", 1, 0 },
+        { "resumed + 0-RTT", 1, 1 },
+    };
+    mbedtls_ssl_config conf;
+    session_cache_t sessions;
+    double elapsed, cpu, round_trips;
+    size_t i, early;
+    int ret;
+
+    printf("\n  profile %s\n", profile->name);
+
+    mbedtls_ssl_config_init(&conf);
+
+    if ((ret = bench_profile_conf(&conf, rng, profile)) != 0) {
+        printf("    ! client config failed: -0x%04x\n", (unsigned int)-ret);
+        mbedtls_ssl_config_free(&conf);
+        return;
+    }
+
+    for (i = 0; i < sizeof(runs) / sizeof(runs[0]); i++) {
+        if (runs[i].early_data && !tls_profile_early_data(profile)) {
+            continue;
+        }
+
+        session_cache_init(&sessions, NULL);
+        ret = bench_connects(&conf, runs[i].resume ? &sessions : NULL, runs[i].early_data,
+                             port, samples, handshakes, &elapsed, &cpu, &round_trips, &early);
+        session_cache_free(&sessions);
+
+        if (ret != HTTPS_POOL_OK) {
+            printf("    ! %s failed: %d\n", runs[i].what, ret);
+            break;
+        }
+
+        bench_report(runs[i].what, samples, handshakes, elapsed);
+        printf("    %-22s %9.2f round trips, %7.1f us client CPU per connect",
+               "", round_trips, cpu * 1e6);
+        if (runs[i].early_data) {
+            printf(", %zu/%zu 0-RTT", early, handshakes);
+        }
+        printf("\n");
+    }
+
+    bench_memory(&conf, port);
+
+    mbedtls_ssl_config_free(&conf);
+}
+
+/* Worker pool handler: close as soon as the handshake is done */
+static void bench_workers_connected(event_conn_t *conn)
+{
+    event_conn_close(conn);
+}
+
+static const worker_pool_handler_t bench_workers_handler = {
+    bench_workers_connected, NULL, NULL, NULL
+};
+
+/* n full handshakes submitted at once to a pool of workers (0 = per CPU) */
+static void bench_workers(custom_rng_context *rng, const char *port,
+                          size_t n, unsigned int workers)
+{
+    mbedtls_ssl_config conf;
+    worker_pool_t pool;
+    worker_pool_stats_t totals, stats;
+    double start, elapsed;
+    unsigned int i;
+    size_t j;
+    int ret;
+
+    /* Shared by all workers: custom_rng_random() is per thread */
+    mbedtls_ssl_config_init(&conf);
+    if ((ret = bench_profile_conf(&conf, rng, tls_profile_get(TLS_PROFILE_COMPAT))) != 0) {
+        printf("    ! client config failed: -0x%04x\n", (unsigned int)-ret);
+        mbedtls_ssl_config_free(&conf);
+        return;
+    }
+
+    if ((ret = worker_pool_init(&pool, &conf, NULL, workers)) != WORKER_POOL_OK ||
+        (ret = worker_pool_start(&pool)) != WORKER_POOL_OK) {
+        printf("    ! worker pool setup failed: %d\n", ret);
+        worker_pool_free(&pool);
+        mbedtls_ssl_config_free(&conf);
+        return;
+    }
+
+    start = bench_now();
+    for (j = 0; j < n; j++) {
+        if (worker_pool_connect(&pool, BENCH_HOST, port, &bench_workers_handler,
+                                NULL) != WORKER_POOL_OK) {
+            break;
+        }
+    }
+
+    do {
+        usleep(1000);
+        worker_pool_totals(&pool, &totals);
+    } while (totals.closed + totals.failed < j);
+    elapsed = bench_now() - start;
+
+    printf("    %2u worker%s %9.1f handshakes/s, %llu failed, per worker:",
+           pool.count, pool.count == 1 ? " " : "s", (double)totals.established / elapsed,
+           (unsigned long long)totals.failed);
+    for (i = 0; i < pool.count; i++) {
+        worker_pool_stats(&pool, i, &stats);
+        printf(" %llu", (unsigned long long)stats.established);
+    }
+    printf("\n");
+
+    worker_pool_free(&pool);
+    mbedtls_ssl_config_free(&conf);
+}
+
+static void bench_suite(const bench_suite_t *suite, custom_rng_context *rng,
+                        const char *port, size_t handshakes, size_t requests,
+                        size_t bulk_mib, double *samples)
+{
+    mbedtls_ssl_config conf;
+    session_cache_t sessions;
+    double elapsed, mbps;
+    size_t resumed;
+    int ret;
+
+    printf("\n  %s\n", suite->name);
+
+    if (mbedtls_ssl_ciphersuite_from_id(suite->ciphersuites[0]) == NULL) {
+        printf("    not compiled in, skipped\n");
+        return;
+    }
+
+    mbedtls_ssl_config_init(&conf);
+    session_cache_init(&sessions, NULL);
+
+    if ((ret = bench_client_conf(&conf, rng, suite)) != 0) {
+        printf("    ! client config failed: -0x%04x\n", (unsigned int)-ret);
+        goto cleanup;
+    }
+
+    ret = bench_handshakes(&conf, NULL, port, samples, handshakes, &resumed, &elapsed);
+    if (ret != HTTPS_POOL_OK) {
+        printf("    ! full handshakes failed: %d\n", ret);
+        goto cleanup;
+    }
+    bench_report("full handshake", samples, handshakes, elapsed);
+
+    ret = bench_handshakes(&conf, &sessions, port, samples, handshakes, &resumed, &elapsed);
+    if (ret != HTTPS_POOL_OK) {
+        printf("    ! resumed handshakes failed: %d\n", ret);
+        goto cleanup;
+    }
+    bench_report("resumed handshake", samples, handshakes, elapsed);
+    if (resumed != handshakes) {
+        printf("    (only %zu of %zu handshakes were actually resumed)\n", resumed, handshakes);
+    }
+
+    ret = bench_ttfb(&conf, port, samples, requests, &elapsed);
+    if (ret != HTTPS_POOL_OK) {
+        printf("    ! keep-alive requests failed: %d\n", ret);
+        goto cleanup;
+    }
+    bench_report("ttfb (keep-alive)", samples, requests, elapsed);
+
+    ret = bench_framing(&conf, port);
+    if (ret != HTTPS_POOL_OK) {
+        printf("    ! chunked / close-delimited responses failed: %d\n", ret);
+        goto cleanup;
+    }
+
+    mbps = bench_bulk(&conf, port, bulk_mib);
+    if (mbps < 0) {
+        printf("    ! bulk transfer failed\n");
+    } else {
+        printf("    %-22s %9.1f MB/s (%zu MiB)\n", "bulk throughput", mbps, bulk_mib);
+    }
+
+cleanup:
+    session_cache_free(&sessions);
+    mbedtls_ssl_config_free(&conf);
+}
+
+int main(int argc, char *argv[])
+{
+    const char *pers = "bench_tls";
+    size_t handshakes = BENCH_HANDSHAKES, requests = BENCH_REQUESTS, bulk_mib = BENCH_BULK_MIB;
+    custom_rng_context rng;
+    bench_server_t server;
+    pthread_t server_thread;
+    double *samples;
+    size_t i;
+
+    if (argc > 1) {
+        handshakes = strtoul(argv[1], NULL, 10);
+    }
+    if (argc > 2) {
+        requests = strtoul(argv[2], NULL, 10);
+    }
+    if (argc > 3) {
+        bulk_mib = strtoul(argv[3], NULL, 10);
+    }
+    if (handshakes == 0 || requests == 0 || bulk_mib == 0) {
+        printf("Usage: %s [handshakes] [requests] [bulk_mib]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    /* Before any other mbedtls call, see tls_arena.h */
+    tls_arena_install();
+
+#if defined(MBEDTLS_PSA_CRYPTO_C)
+    if (psa_crypto_init() != PSA_SUCCESS) {
+        printf("psa_crypto_init failed; TLS 1.3 will not work\n");
+    }
+#endif
+
+    samples = malloc(sizeof(double) * (handshakes > requests ? handshakes : requests));
+    if (samples == NULL) {
+        return EXIT_FAILURE;
+    }
+
+    custom_rng_init(&rng);
+    if (custom_rng_seed(&rng, (const unsigned char *)pers, strlen(pers)) != 0) {
+        printf("custom_rng_seed failed\n");
+        free(samples);
+        return EXIT_FAILURE;
+    }
+
+    if (bench_server_start(&server, &server_thread) != 0) {
+        printf("Failed to start the loopback server\n");
+        bench_server_stop(&server, server_thread);
+        custom_rng_free(&rng);
+        free(samples);
+        return EXIT_FAILURE;
+    }
+
+    printf("Loopback TLS server on %s:%s (ECDSA P-256, self-signed)\n",
+           BENCH_HOST, server.port);
+    printf("%zu handshakes, %zu keep-alive requests, %zu MiB bulk per suite\n",
+           handshakes, requests, bulk_mib);
+
+    for (i = 0; i < sizeof(bench_suites) / sizeof(bench_suites[0]); i++) {
+        bench_suite(&bench_suites[i], &rng, server.port, handshakes, requests,
+                    bulk_mib, samples);
+    }
+
+    printf("\nTLS profiles: new connection + GET of %d bytes, until the first body byte\n",
+           BENCH_SMALL_BODY);
+    for (i = 0; i < TLS_PROFILE_COUNT; i++) {
+        bench_profile(tls_profile_get((tls_profile_id_t)i), &rng, server.port,
+                      handshakes, samples);
+    }
+
+    printf("\nWorker pool: %zu full handshakes (profile compat) submitted at once\n",
+           handshakes);
+    bench_workers(&rng, server.port, handshakes, 1);
+    bench_workers(&rng, server.port, handshakes, 0);
+
+    bench_server_stop(&server, server_thread);
+    custom_rng_free(&rng);
+    free(samples);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,996 @@
+/*
+ * WebSocket echo/load server and latency harness
+ * Runs a local ws:// server built on websocket-parser and drives N
+ * concurrent ws_client sessions against it from one poll() loop, so the
+ * client receive path can be tuned without the production host.
+ *
+ * The request path selects the server behaviour:
+ *   /echo           echo every data frame as received (fragments stay fragments)
+ *   /flood/<size>   stream <size> byte binary frames as fast as the socket takes them
+ *   /ping/<ms>      echo, plus a ping every <ms> milliseconds
+ *
+ * Reports round-trip (echo, ping) or one-way (flood) latency as an
+ * HDR-style histogram, messages/sec and bytes/sec.
+ *
+ * Usage: bench_ws [-m echo|flood|ping] [-c clients] [-n messages]
+ *                 [-s size] [-f fragments] [-d seconds] [-i ping_ms]
+ *        bench_ws -l port        (server only)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <websocket_parser.h>
+#include "ws_client.h"
+#include "ws_handshake.h"
+#include "ws_mask.h"
+#include "latency_hist.h"
+
+#define BENCH_WS_HOST "127.0.0.1"
+
+/* Defaults, overridable on the command line */
+#define BENCH_WS_CLIENTS 16
+#define BENCH_WS_MESSAGES 10000
+#define BENCH_WS_SIZE 128
+#define BENCH_WS_FRAGMENTS 1
+#define BENCH_WS_DURATION_SEC 5
+#define BENCH_WS_PING_MS 100
+
+/* Largest message either side accepts */
+#define BENCH_WS_MAX_PAYLOAD (16 * 1024 * 1024)
+
+/* Flood frames start with the send time so the client can measure delay */
+#define BENCH_WS_STAMP_LEN 8
+
+typedef enum {
+    BENCH_WS_ECHO = 0,
+    BENCH_WS_FLOOD,
+    BENCH_WS_PING
+} bench_ws_mode_t;
+
+static const char *const bench_ws_mode_names[] = { "echo", "flood", "ping" };
+
+/* Server state shared by all connection threads */
+typedef struct {
+    int listen_fd;
+    char port[8];
+    volatile int stopping;
+    volatile int threads;               /* Connection threads still running */
+    pthread_mutex_t lock;               /* Protects ping_hist */
+    latency_hist_t ping_hist;           /* Ping to pong round trips */
+    unsigned long pings;
+} bench_ws_server_t;
+
+/* One server-side connection */
+typedef struct {
+    bench_ws_server_t *server;
+    int fd;
+    bench_ws_mode_t mode;
+    size_t flood_size;
+    unsigned int ping_ms;
+    websocket_parser parser;            /* parser.data points to the session */
+    int opcode;                         /* Frame being received */
+    int fin;
+    unsigned char *payload;             /* Unmasked payload of that frame */
+    size_t payload_len;
+    size_t payload_cap;
+    unsigned char *out;                 /* Outgoing frame */
+    size_t out_cap;
+    int closing;                        /* Close frame exchanged */
+    int failed;
+} bench_ws_session_t;
+
+/* One benchmark client */
+typedef struct {
+    ws_client_t ws;
+    const unsigned char *message;       /* Payload sent each round */
+    size_t fragment;                    /* Next fragment to send */
+    int waiting;                        /* Message sent, echo outstanding */
+    uint64_t sent_at;
+    size_t rx_bytes;                    /* Bytes of the message being received */
+    unsigned char stamp[BENCH_WS_STAMP_LEN];
+    unsigned long done;                 /* Messages completed */
+    unsigned char ping[125];            /* Last ping payload */
+    size_t ping_len;
+    int pong_pending;
+    unsigned char pong[125];            /* Pong being sent */
+    ws_frame_pool_t pool;               /* Own pool: a blocked send keeps its chunk */
+    int closed;                         /* Server sent a close frame */
+    int finished;                       /* Connection released */
+} bench_ws_client_t;
+
+/* Harness parameters and totals */
+typedef struct {
+    bench_ws_mode_t mode;
+    size_t clients;
+    unsigned long messages;
+    size_t size;
+    size_t fragments;
+    unsigned int duration_sec;
+    unsigned int ping_ms;
+    latency_hist_t hist;
+    unsigned long long bytes;
+} bench_ws_run_t;
+
+static websocket_parser_settings bench_ws_server_settings;
+static websocket_parser_settings bench_ws_client_settings;
+static bench_ws_run_t *bench_ws_current;
+
+static uint64_t bench_ws_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static void bench_ws_put_stamp(unsigned char *out, uint64_t value)
+{
+    int i;
+
+    for (i = 0; i < BENCH_WS_STAMP_LEN; i++) {
+        out[i] = (unsigned char)(value >> (56 - 8 * i));
+    }
+}
+
+static uint64_t bench_ws_get_stamp(const unsigned char *in)
+{
+    uint64_t value = 0;
+    int i;
+
+    for (i = 0; i < BENCH_WS_STAMP_LEN; i++) {
+        value = (value << 8) | in[i];
+    }
+
+    return value;
+}
+
+/* ---- Server ---------------------------------------------------------- */
+
+/* Blocking send of a whole buffer */
+static int bench_ws_send_all(int fd, const unsigned char *buf, size_t len)
+{
+    ssize_t n;
+
+    while (len > 0) {
+        n = send(fd, buf, len, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        buf += n;
+        len -= (size_t)n;
+    }
+
+    return 0;
+}
+
+/* Make room for an n byte buffer */
+static int bench_ws_reserve(unsigned char **buf, size_t *cap, size_t n)
+{
+    unsigned char *grown;
+
+    if (n <= *cap) {
+        return 0;
+    }
+
+    grown = realloc(*buf, n);
+    if (grown == NULL) {
+        return -1;
+    }
+    *buf = grown;
+    *cap = n;
+
+    return 0;
+}
+
+/* Build an unmasked server frame in s->out; returns its length or 0 */
+static size_t bench_ws_build(bench_ws_session_t *s, int opcode, int fin,
+                             const unsigned char *payload, size_t len)
+{
+    websocket_flags flags = (websocket_flags)(opcode | (fin ? WS_FIN : 0));
+    size_t frame_len = websocket_calc_frame_size(flags, len);
+
+    if (bench_ws_reserve(&s->out, &s->out_cap, frame_len) != 0) {
+        return 0;
+    }
+
+    return websocket_build_frame((char *)s->out, flags, NULL, (const char *)payload, len);
+}
+
+static int bench_ws_server_send(bench_ws_session_t *s, int opcode, int fin,
+                                const unsigned char *payload, size_t len)
+{
+    size_t frame_len = bench_ws_build(s, opcode, fin, payload, len);
+
+    if (frame_len == 0 || bench_ws_send_all(s->fd, s->out, frame_len) != 0) {
+        s->failed = 1;
+        return -1;
+    }
+
+    return 0;
+}
+
+static int bench_ws_server_on_header(websocket_parser *p)
+{
+    bench_ws_session_t *s = (bench_ws_session_t *)p->data;
+
+    if (p->length > BENCH_WS_MAX_PAYLOAD ||
+        bench_ws_reserve(&s->payload, &s->payload_cap, p->length) != 0) {
+        s->failed = 1;
+        return 1;
+    }
+
+    s->opcode = websocket_parser_get_opcode(p);
+    s->fin = websocket_parser_has_final(p) != 0;
+    s->payload_len = 0;
+
+    return 0;
+}
+
+static int bench_ws_server_on_body(websocket_parser *p, const char *data, size_t len)
+{
+    bench_ws_session_t *s = (bench_ws_session_t *)p->data;
+
+    if (s->payload_len + len > s->payload_cap) {
+        s->failed = 1;
+        return 1;
+    }
+
+    /* Client frames are always masked */
+    p->mask_offset = (uint8_t)ws_mask_apply(s->payload + s->payload_len, data, len,
+                                            (const unsigned char *)p->mask,
+                                            p->mask_offset);
+    s->payload_len += len;
+
+    return 0;
+}
+
+static int bench_ws_server_on_end(websocket_parser *p)
+{
+    bench_ws_session_t *s = (bench_ws_session_t *)p->data;
+    bench_ws_server_t *server = s->server;
+
+    switch (s->opcode) {
+    case WS_OP_CLOSE:
+        bench_ws_server_send(s, WS_OP_CLOSE, 1, s->payload, s->payload_len);
+        s->closing = 1;
+        return 1;
+    case WS_OP_PING:
+        return bench_ws_server_send(s, WS_OP_PONG, 1, s->payload, s->payload_len) != 0;
+    case WS_OP_PONG:
+        if (s->payload_len == BENCH_WS_STAMP_LEN) {
+            uint64_t rtt = bench_ws_now_ns() - bench_ws_get_stamp(s->payload);
+            pthread_mutex_lock(&server->lock);
+            latency_hist_record(&server->ping_hist, rtt);
+            pthread_mutex_unlock(&server->lock);
+        }
+        return 0;
+    default:
+        if (s->mode == BENCH_WS_FLOOD) {
+            return 0;
+        }
+        /* Echo fragment by fragment, keeping opcode and FIN */
+        return bench_ws_server_send(s, s->opcode, s->fin, s->payload, s->payload_len) != 0;
+    }
+}
+
+/* Read the Upgrade request, pick the mode from its path and answer 101.
+ * Bytes after the request are run through the parser. */
+static int bench_ws_server_upgrade(bench_ws_session_t *s)
+{
+    char req[4096], accept[WS_HANDSHAKE_ACCEPT_LEN + 1], key[WS_HANDSHAKE_KEY_LEN + 1];
+    char resp[256], path[128];
+    size_t len = 0, header_len;
+    char *end, *line;
+    unsigned long arg;
+    ssize_t n;
+    int resp_len;
+
+    key[0] = '\0';
+
+    for (;;) {
+        n = recv(s->fd, req + len, sizeof(req) - 1 - len, 0);
+        if (n <= 0) {
+            return -1;
+        }
+        len += (size_t)n;
+        req[len] = '\0';
+
+        end = strstr(req, "\r\n\r\n");
+        if (end != NULL) {
+            break;
+        }
+        if (len == sizeof(req) - 1) {
+            return -1;
+        }
+    }
+    header_len = (size_t)(end + 4 - req);
+
+    if (sscanf(req, "GET %127s HTTP/1.1", path) != 1) {
+        return -1;
+    }
+
+    for (line = strstr(req, "\r\n"); line != NULL && line < end; line = strstr(line, "\r\n")) {
+        line += 2;
+        if (strncasecmp(line, "Sec-WebSocket-Key:", 18) == 0) {
+            sscanf(line + 18, " %24s", key);
+        }
+    }
+
+    if (ws_handshake_accept_key(key, accept, sizeof(accept)) < 0) {
+        return -1;
+    }
+
+    if (sscanf(path, "/flood/%lu", &arg) == 1) {
+        s->mode = BENCH_WS_FLOOD;
+        s->flood_size = arg < BENCH_WS_STAMP_LEN ? BENCH_WS_STAMP_LEN
+                      : arg > BENCH_WS_MAX_PAYLOAD ? BENCH_WS_MAX_PAYLOAD : (size_t)arg;
+    } else if (sscanf(path, "/ping/%lu", &arg) == 1 && arg > 0) {
+        s->mode = BENCH_WS_PING;
+        s->ping_ms = (unsigned int)arg;
+    } else {
+        s->mode = BENCH_WS_ECHO;
+    }
+
+    resp_len = snprintf(resp, sizeof(resp),
+                        "HTTP/1.1 101 Switching Protocols\r\n"
+                        "Upgrade: websocket\r\n"
+                        "Connection: Upgrade\r\n"
+                        "Sec-WebSocket-Accept: %s\r\n"
+                        "\r\n", accept);
+    if (bench_ws_send_all(s->fd, (const unsigned char *)resp, (size_t)resp_len) != 0) {
+        return -1;
+    }
+
+    if (len > header_len &&
+        websocket_parser_execute(&s->parser, &bench_ws_server_settings,
+                                 req + header_len, len - header_len) != len - header_len) {
+        return -1;
+    }
+
+    return 0;
+}
+
+static void *bench_ws_server_conn(void *arg)
+{
+    bench_ws_session_t *s = (bench_ws_session_t *)arg;
+    bench_ws_server_t *server = s->server;
+    char buf[16384];
+    unsigned char *flood = NULL;
+    size_t flood_len = 0, flood_hdr = 0;
+    uint64_t now, next_ping = 0;
+    ssize_t n;
+
+    websocket_parser_init(&s->parser);
+    s->parser.data = s;
+
+    if (bench_ws_server_upgrade(s) != 0) {
+        goto done;
+    }
+
+    if (s->mode == BENCH_WS_FLOOD) {
+        /* Built once; only the stamp changes between frames */
+        unsigned char *body = calloc(1, s->flood_size);
+        if (body != NULL) {
+            flood_len = bench_ws_build(s, WS_OP_BINARY, 1, body, s->flood_size);
+            flood_hdr = flood_len - s->flood_size;
+            free(body);
+        }
+        /* Keep it apart from s->out, which close and pong replies reuse */
+        flood = s->out;
+        s->out = NULL;
+        s->out_cap = 0;
+        if (flood_len == 0) {
+            goto done;
+        }
+    }
+
+    if (s->mode == BENCH_WS_PING) {
+        next_ping = bench_ws_now_ns() + (uint64_t)s->ping_ms * 1000000ULL;
+    }
+
+    while (!s->closing && !s->failed) {
+        struct pollfd pfd;
+        int timeout = -1;
+
+        pfd.fd = s->fd;
+        pfd.events = POLLIN | (s->mode == BENCH_WS_FLOOD ? POLLOUT : 0);
+        pfd.revents = 0;
+
+        if (s->mode == BENCH_WS_PING) {
+            now = bench_ws_now_ns();
+            timeout = next_ping > now ? (int)((next_ping - now) / 1000000ULL) + 1 : 0;
+        }
+
+        if (poll(&pfd, 1, timeout) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+
+        if (pfd.revents & (POLLIN | POLLHUP | POLLERR)) {
+            n = recv(s->fd, buf, sizeof(buf), 0);
+            if (n <= 0) {
+                break;
+            }
+            websocket_parser_execute(&s->parser, &bench_ws_server_settings, buf, (size_t)n);
+        }
+
+        if (s->closing || s->failed) {
+            break;
+        }
+
+        if (s->mode == BENCH_WS_FLOOD && (pfd.revents & POLLOUT)) {
+            bench_ws_put_stamp(flood + flood_hdr, bench_ws_now_ns());
+            if (bench_ws_send_all(s->fd, flood, flood_len) != 0) {
+                break;
+            }
+        }
+
+        if (s->mode == BENCH_WS_PING && bench_ws_now_ns() >= next_ping) {
+            unsigned char stamp[BENCH_WS_STAMP_LEN];
+
+            bench_ws_put_stamp(stamp, bench_ws_now_ns());
+            if (bench_ws_server_send(s, WS_OP_PING, 1, stamp, sizeof(stamp)) != 0) {
+                break;
+            }
+            __sync_fetch_and_add(&server->pings, 1);
+            next_ping += (uint64_t)s->ping_ms * 1000000ULL;
+        }
+    }
+
+done:
+    close(s->fd);
+    free(flood);
+    free(s->payload);
+    free(s->out);
+    free(s);
+    __sync_fetch_and_sub(&server->threads, 1);
+
+    return NULL;
+}
+
+static void *bench_ws_server_accept(void *arg)
+{
+    bench_ws_server_t *server = (bench_ws_server_t *)arg;
+    bench_ws_session_t *s;
+    pthread_t thread;
+    int fd, one = 1;
+
+    while (!server->stopping) {
+        fd = accept(server->listen_fd, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+
+        /* Keep Nagle on the server from showing up in client latencies */
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        s = calloc(1, sizeof(*s));
+        if (s == NULL) {
+            close(fd);
+            continue;
+        }
+        s->server = server;
+        s->fd = fd;
+
+        __sync_fetch_and_add(&server->threads, 1);
+        if (pthread_create(&thread, NULL, bench_ws_server_conn, s) != 0) {
+            __sync_fetch_and_sub(&server->threads, 1);
+            close(fd);
+            free(s);
+            continue;
+        }
+        pthread_detach(thread);
+    }
+
+    return NULL;
+}
+
+/* Listen on 127.0.0.1:port (0 for an ephemeral port) */
+static int bench_ws_server_start(bench_ws_server_t *server, unsigned int port,
+                                 pthread_t *thread)
+{
+    struct sockaddr_in addr;
+    socklen_t addr_len = sizeof(addr);
+    int one = 1;
+
+    memset(server, 0, sizeof(*server));
+    pthread_mutex_init(&server->lock, NULL);
+
+    websocket_parser_settings_init(&bench_ws_server_settings);
+    bench_ws_server_settings.on_frame_header = bench_ws_server_on_header;
+    bench_ws_server_settings.on_frame_body = bench_ws_server_on_body;
+    bench_ws_server_settings.on_frame_end = bench_ws_server_on_end;
+
+    server->listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (server->listen_fd < 0) {
+        return -1;
+    }
+    setsockopt(server->listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons((uint16_t)port);
+
+    if (bind(server->listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        listen(server->listen_fd, 1024) < 0 ||
+        getsockname(server->listen_fd, (struct sockaddr *)&addr, &addr_len) < 0 ||
+        pthread_create(thread, NULL, bench_ws_server_accept, server) != 0) {
+        close(server->listen_fd);
+        server->listen_fd = -1;
+        return -1;
+    }
+
+    snprintf(server->port, sizeof(server->port), "%u", (unsigned int)ntohs(addr.sin_port));
+
+    return 0;
+}
+
+static void bench_ws_server_stop(bench_ws_server_t *server, pthread_t thread)
+{
+    server->stopping = 1;
+
+    if (server->listen_fd >= 0) {
+        shutdown(server->listen_fd, SHUT_RDWR);
+        pthread_join(thread, NULL);
+        close(server->listen_fd);
+    }
+
+    /* Connection threads exit once their client has gone */
+    while (server->threads > 0) {
+        usleep(1000);
+    }
+
+    pthread_mutex_destroy(&server->lock);
+}
+
+/* ---- Client harness -------------------------------------------------- */
+
+static int bench_ws_client_on_header(websocket_parser *p)
+{
+    (void)p;
+    return 0;
+}
+
+static int bench_ws_client_on_body(websocket_parser *p, const char *data, size_t len)
+{
+    ws_client_t *ws = (ws_client_t *)p->data;
+    bench_ws_client_t *c = (bench_ws_client_t *)ws->user_data;
+    int opcode = websocket_parser_get_opcode(p);
+
+    if (opcode == WS_OP_PING) {
+        size_t n = len < sizeof(c->ping) - c->ping_len ? len : sizeof(c->ping) - c->ping_len;
+        memcpy(c->ping + c->ping_len, data, n);
+        c->ping_len += n;
+        return 0;
+    }
+
+    if (opcode == WS_OP_BINARY || opcode == WS_OP_TEXT || opcode == WS_OP_CONTINUE) {
+        /* Keep the stamp that opens a flood message */
+        if (c->rx_bytes < BENCH_WS_STAMP_LEN) {
+            size_t n = BENCH_WS_STAMP_LEN - c->rx_bytes;
+            memcpy(c->stamp + c->rx_bytes, data, len < n ? len : n);
+        }
+        c->rx_bytes += len;
+    }
+
+    return 0;
+}
+
+static int bench_ws_client_on_end(websocket_parser *p)
+{
+    ws_client_t *ws = (ws_client_t *)p->data;
+    bench_ws_client_t *c = (bench_ws_client_t *)ws->user_data;
+    bench_ws_run_t *run = bench_ws_current;
+    int opcode = websocket_parser_get_opcode(p);
+    uint64_t now;
+
+    switch (opcode) {
+    case WS_OP_PING:
+        c->pong_pending = 1;
+        return 0;
+    case WS_OP_CLOSE:
+        c->closed = 1;
+        return 0;
+    case WS_OP_PONG:
+        return 0;
+    default:
+        break;
+    }
+
+    if (!websocket_parser_has_final(p)) {
+        return 0;
+    }
+
+    now = bench_ws_now_ns();
+
+    if (run->mode == BENCH_WS_FLOOD) {
+        if (c->rx_bytes >= BENCH_WS_STAMP_LEN) {
+            latency_hist_record(&run->hist, now - bench_ws_get_stamp(c->stamp));
+        }
+        c->done++;
+    } else if (c->waiting) {
+        if (c->rx_bytes == run->size) {
+            latency_hist_record(&run->hist, now - c->sent_at);
+        }
+        c->done++;
+        c->waiting = 0;
+    }
+
+    run->bytes += c->rx_bytes;
+    c->rx_bytes = 0;
+
+    return 0;
+}
+
+/* Push pending sends as far as the socket allows. Returns 0, or -1 on error. */
+static int bench_ws_client_pump(bench_ws_client_t *c, const bench_ws_run_t *run)
+{
+    size_t frag_len = (run->size + run->fragments - 1) / run->fragments;
+    int ret;
+
+    for (;;) {
+        if (c->ws.sending) {
+            ret = ws_client_flush(&c->ws);
+            if (ret == WS_CLIENT_IN_PROGRESS) {
+                return 0;
+            }
+            if (ret != WS_CLIENT_OK) {
+                return -1;
+            }
+        }
+
+        if (c->pong_pending) {
+            /* Own copy: another ping may arrive while this pong is queued */
+            memcpy(c->pong, c->ping, c->ping_len);
+            ret = ws_client_send(&c->ws, WS_FRAME_OP_PONG, c->pong, c->ping_len);
+            c->pong_pending = 0;
+            c->ping_len = 0;
+        } else if (run->mode != BENCH_WS_FLOOD && !c->waiting && c->done < run->messages) {
+            size_t off = c->fragment * frag_len;
+            size_t len = off >= run->size ? 0
+                       : run->size - off < frag_len ? run->size - off : frag_len;
+            int last = c->fragment + 1 == run->fragments;
+
+            if (c->fragment == 0) {
+                c->sent_at = bench_ws_now_ns();
+            }
+
+            ret = ws_client_send_fragment(&c->ws,
+                                          c->fragment == 0 ? WS_FRAME_OP_BINARY
+                                                           : WS_FRAME_OP_CONTINUE,
+                                          last, c->message + (off < run->size ? off : 0), len);
+
+            if (last) {
+                c->fragment = 0;
+                c->waiting = 1;
+            } else {
+                c->fragment++;
+            }
+        } else {
+            return 0;
+        }
+
+        if (ret == WS_CLIENT_IN_PROGRESS) {
+            return 0;
+        }
+        if (ret != WS_CLIENT_OK) {
+            return -1;
+        }
+    }
+}
+
+/* Send a close frame (blocking) and drop the connection */
+static void bench_ws_client_finish(bench_ws_client_t *c)
+{
+    int ret = WS_CLIENT_OK;
+
+    transport_tcp_set_nonblocking(&c->ws.transport, 0);
+
+    while (c->ws.sending && ret == WS_CLIENT_OK) {
+        ret = ws_client_flush(&c->ws);
+    }
+    if (ret == WS_CLIENT_OK) {
+        ret = ws_client_send(&c->ws, WS_FRAME_OP_CLOSE, NULL, 0);
+        while (ret == WS_CLIENT_IN_PROGRESS) {
+            ret = ws_client_flush(&c->ws);
+        }
+    }
+
+    ws_client_free(&c->ws);
+    c->finished = 1;
+}
+
+static void bench_ws_print_hist(const char *what, const latency_hist_t *hist)
+{
+    if (hist->count == 0) {
+        printf("  %-10s no samples\n", what);
+        return;
+    }
+
+    printf("  %-10s mean %8.1f  p50 %8.1f  p90 %8.1f  p99 %8.1f  p99.9 %8.1f  max %8.1f us\n",
+           what, latency_hist_mean(hist) / 1e3,
+           (double)latency_hist_percentile(hist, 50.0) / 1e3,
+           (double)latency_hist_percentile(hist, 90.0) / 1e3,
+           (double)latency_hist_percentile(hist, 99.0) / 1e3,
+           (double)latency_hist_percentile(hist, 99.9) / 1e3,
+           (double)hist->max / 1e3);
+}
+
+static int bench_ws_run(bench_ws_run_t *run, bench_ws_server_t *server,
+                        websocket_parser_settings *settings)
+{
+    bench_ws_client_t *clients;
+    struct pollfd *pfds;
+    size_t *index;
+    unsigned char *message;
+    unsigned long total = 0;
+    char path[64];
+    size_t i, active;
+    uint64_t start, deadline;
+    double elapsed;
+    int ret = -1;
+
+    switch (run->mode) {
+    case BENCH_WS_FLOOD:
+        snprintf(path, sizeof(path), "/flood/%zu", run->size);
+        break;
+    case BENCH_WS_PING:
+        snprintf(path, sizeof(path), "/ping/%u", run->ping_ms);
+        break;
+    default:
+        snprintf(path, sizeof(path), "/echo");
+        break;
+    }
+
+    clients = calloc(run->clients, sizeof(*clients));
+    pfds = calloc(run->clients, sizeof(*pfds));
+    index = calloc(run->clients, sizeof(*index));
+    message = malloc(run->size > 0 ? run->size : 1);
+    if (clients == NULL || pfds == NULL || index == NULL || message == NULL) {
+        goto cleanup;
+    }
+
+    memset(message, 'x', run->size);
+    latency_hist_init(&run->hist);
+    run->bytes = 0;
+    bench_ws_current = run;
+
+    for (i = 0; i < run->clients; i++) {
+        bench_ws_client_t *c = &clients[i];
+
+        c->message = message;
+        ws_frame_pool_init(&c->pool);
+        if (ws_client_init(&c->ws, NULL, &c->pool, settings, c) != WS_CLIENT_OK ||
+            ws_client_connect(&c->ws, BENCH_WS_HOST, server->port, path, NULL) != WS_CLIENT_OK ||
+            transport_tcp_set_nonblocking(&c->ws.transport, 1) != TRANSPORT_TCP_OK) {
+            printf("client %zu failed to connect\n", i);
+            while (i > 0) {
+                ws_client_free(&clients[--i].ws);
+            }
+            ws_client_free(&c->ws);
+            goto cleanup;
+        }
+    }
+
+    start = bench_ws_now_ns();
+    deadline = start + (uint64_t)run->duration_sec * 1000000000ULL;
+
+    for (;;) {
+        int timeout = 100;
+
+        active = 0;
+        for (i = 0; i < run->clients; i++) {
+            bench_ws_client_t *c = &clients[i];
+
+            if (c->finished) {
+                continue;
+            }
+            if (c->closed || (run->mode != BENCH_WS_FLOOD && c->done >= run->messages)) {
+                bench_ws_client_finish(c);
+                continue;
+            }
+            if (bench_ws_client_pump(c, run) != 0) {
+                printf("client %zu: send failed\n", i);
+                bench_ws_client_finish(c);
+                continue;
+            }
+
+            pfds[active].fd = ws_client_fd(&c->ws);
+            pfds[active].events = POLLIN | (c->ws.sending ? POLLOUT : 0);
+            pfds[active].revents = 0;
+            index[active++] = i;
+        }
+
+        if (active == 0) {
+            break;
+        }
+
+        if (run->mode == BENCH_WS_FLOOD && bench_ws_now_ns() >= deadline) {
+            for (i = 0; i < active; i++) {
+                bench_ws_client_finish(&clients[index[i]]);
+            }
+            break;
+        }
+
+        if (poll(pfds, active, timeout) < 0 && errno != EINTR) {
+            perror("poll");
+            break;
+        }
+
+        for (i = 0; i < active; i++) {
+            bench_ws_client_t *c = &clients[index[i]];
+            int status;
+
+            if (!(pfds[i].revents & (POLLIN | POLLHUP | POLLERR))) {
+                continue;
+            }
+
+            status = ws_client_read(&c->ws);
+            if (status != WS_CLIENT_OK && status != WS_CLIENT_IN_PROGRESS) {
+                if (status != WS_CLIENT_ERR_CLOSED) {
+                    printf("client %zu: read failed (%d)\n", index[i], status);
+                }
+                bench_ws_client_finish(c);
+            }
+        }
+    }
+
+    elapsed = (double)(bench_ws_now_ns() - start) / 1e9;
+
+    for (i = 0; i < run->clients; i++) {
+        if (!clients[i].finished) {
+            bench_ws_client_finish(&clients[i]);
+        }
+        total += clients[i].done;
+    }
+
+    printf("  messages   %lu in %.2f s: %.0f msg/s, %.1f MB/s received\n",
+           total, elapsed, (double)total / elapsed, (double)run->bytes / elapsed / 1e6);
+    bench_ws_print_hist(run->mode == BENCH_WS_FLOOD ? "one-way" : "rtt", &run->hist);
+    ret = 0;
+
+cleanup:
+    free(message);
+    free(index);
+    free(pfds);
+    free(clients);
+
+    return ret;
+}
+
+static void bench_ws_usage(const char *prog)
+{
+    printf("Usage: %s [-m echo|flood|ping] [-c clients] [-n messages] [-s size]\n"
+           "          [-f fragments] [-d seconds] [-i ping_ms]\n"
+           "       %s -l port     (server only: /echo, /flood/<size>, /ping/<ms>)\n",
+           prog, prog);
+}
+
+int main(int argc, char *argv[])
+{
+    bench_ws_run_t run;
+    bench_ws_server_t server;
+    pthread_t server_thread;
+    unsigned int listen_port = 0;
+    int server_only = 0, opt, ret;
+
+    memset(&run, 0, sizeof(run));
+    run.mode = BENCH_WS_ECHO;
+    run.clients = BENCH_WS_CLIENTS;
+    run.messages = BENCH_WS_MESSAGES;
+    run.size = BENCH_WS_SIZE;
+    run.fragments = BENCH_WS_FRAGMENTS;
+    run.duration_sec = BENCH_WS_DURATION_SEC;
+    run.ping_ms = BENCH_WS_PING_MS;
+
+    while ((opt = getopt(argc, argv, "m:c:n:s:f:d:i:l:h")) != -1) {
+        switch (opt) {
+        case 'm':
+            if (strcmp(optarg, "flood") == 0) {
+                run.mode = BENCH_WS_FLOOD;
+            } else if (strcmp(optarg, "ping") == 0) {
+                run.mode = BENCH_WS_PING;
+            } else if (strcmp(optarg, "echo") == 0) {
+                run.mode = BENCH_WS_ECHO;
+            } else {
+                bench_ws_usage(argv[0]);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'c':
+            run.clients = strtoul(optarg, NULL, 10);
+            break;
+        case 'n':
+            run.messages = strtoul(optarg, NULL, 10);
+            break;
+        case 's':
+            run.size = strtoul(optarg, NULL, 10);
+            break;
+        case 'f':
+            run.fragments = strtoul(optarg, NULL, 10);
+            break;
+        case 'd':
+            run.duration_sec = (unsigned int)strtoul(optarg, NULL, 10);
+            break;
+        case 'i':
+            run.ping_ms = (unsigned int)strtoul(optarg, NULL, 10);
+            break;
+        case 'l':
+            listen_port = (unsigned int)strtoul(optarg, NULL, 10);
+            server_only = 1;
+            break;
+        default:
+            bench_ws_usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (run.clients == 0 || run.messages == 0 || run.fragments == 0 ||
+        run.size > BENCH_WS_MAX_PAYLOAD || run.duration_sec == 0 || run.ping_ms == 0 ||
+        (run.mode == BENCH_WS_FLOOD && run.size < BENCH_WS_STAMP_LEN)) {
+        bench_ws_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+
+    if (bench_ws_server_start(&server, listen_port, &server_thread) != 0) {
+        printf("Failed to start the WebSocket server\n");
+        return EXIT_FAILURE;
+    }
+
+    printf("WebSocket server on ws://%s:%s\n", BENCH_WS_HOST, server.port);
+
+    if (server_only) {
+        for (;;) {
+            pause();
+        }
+    }
+
+    websocket_parser_settings_init(&bench_ws_client_settings);
+    bench_ws_client_settings.on_frame_header = bench_ws_client_on_header;
+    bench_ws_client_settings.on_frame_body = bench_ws_client_on_body;
+    bench_ws_client_settings.on_frame_end = bench_ws_client_on_end;
+
+    printf("Mode %s, %zu clients, %zu byte messages", bench_ws_mode_names[run.mode],
+           run.clients, run.size);
+    if (run.mode == BENCH_WS_FLOOD) {
+        printf(" for %u s\n", run.duration_sec);
+    } else {
+        printf(" in %zu fragment(s), %lu per client\n", run.fragments, run.messages);
+    }
+    printf("Mask kernel: %s\n", ws_mask_impl_name(ws_mask_get_impl()));
+
+    ret = bench_ws_run(&run, &server, &bench_ws_client_settings);
+
+    bench_ws_server_stop(&server, server_thread);
+
+    if (run.mode == BENCH_WS_PING) {
+        printf("  pings      %lu sent\n", server.pings);
+        bench_ws_print_hist("ping-pong", &server.ping_hist);
+    }
+
+    return ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,143 @@
+/*
+ * WebSocket masking microbenchmark
+ * Compares every ws_mask kernel this CPU supports against the byte-by-byte
+ * loop used by websocket_build_frame() / websocket_parser_decode().
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "ws_mask.h"
+
+/* Wall time spent per measurement */
+#define BENCH_DURATION_SEC 0.2
+
+#define BENCH_MAX_LEN (1024 * 1024)
+
+typedef size_t (*bench_mask_fn)(void *dst, const void *src, size_t len,
+                                const unsigned char mask[4], size_t offset);
+
+/* The byte-at-a-time loop of the vendored websocket-parser */
+static size_t bytewise_mask(void *dst, const void *src, size_t len,
+                            const unsigned char mask[4], size_t offset)
+{
+    unsigned char *d = (unsigned char *)dst;
+    const unsigned char *s = (const unsigned char *)src;
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        d[i] = s[i] ^ mask[(offset + i) & 3];
+    }
+
+    return (offset + len) & 3;
+}
+
+static double bench_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/* Mask len bytes repeatedly for BENCH_DURATION_SEC; returns MB/s */
+static double bench_run(bench_mask_fn fn, unsigned char *dst, const unsigned char *src,
+                        size_t len)
+{
+    static const unsigned char mask[4] = { 0x12, 0x34, 0x56, 0x78 };
+    double start = bench_now(), elapsed;
+    unsigned long calls = 0;
+    size_t offset = 0;
+    int i;
+
+    do {
+        /* Check the clock every 64 calls to keep its cost out of the loop */
+        for (i = 0; i < 64; i++) {
+            offset = fn(dst, src, len, mask, offset);
+        }
+        calls += 64;
+        elapsed = bench_now() - start;
+    } while (elapsed < BENCH_DURATION_SEC);
+
+    return (double)calls * (double)len / elapsed / 1e6;
+}
+
+/* Fragmented masking at odd offsets must match the bytewise reference */
+static int bench_verify(const unsigned char *src, unsigned char *a, unsigned char *b)
+{
+    static const unsigned char mask[4] = { 0xde, 0xad, 0xbe, 0xef };
+    size_t len = 70001, pos, step, off_a, off_b;
+
+    for (step = 1; step < 300; step += 37) {
+        off_a = off_b = 0;
+        for (pos = 0; pos < len; pos += step) {
+            size_t n = len - pos < step ? len - pos : step;
+            off_a = ws_mask_apply(a + pos, src + pos + 1, n, mask, off_a);
+            off_b = bytewise_mask(b + pos, src + pos + 1, n, mask, off_b);
+        }
+        if (off_a != off_b || memcmp(a, b, len) != 0) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+int main(void)
+{
+    static const ws_mask_impl_t impls[] = {
+        WS_MASK_IMPL_SCALAR, WS_MASK_IMPL_SSE2, WS_MASK_IMPL_AVX2,
+        WS_MASK_IMPL_AVX512, WS_MASK_IMPL_NEON
+    };
+    unsigned char *src, *dst, *ref;
+    size_t len, i;
+
+    src = malloc(BENCH_MAX_LEN + 1);
+    dst = malloc(BENCH_MAX_LEN + 1);
+    ref = malloc(BENCH_MAX_LEN + 1);
+    if (src == NULL || dst == NULL || ref == NULL) {
+        free(src);
+        free(dst);
+        free(ref);
+        return EXIT_FAILURE;
+    }
+
+    for (i = 0; i < BENCH_MAX_LEN + 1; i++) {
+        src[i] = (unsigned char)(i * 131 + 7);
+    }
+
+    ws_mask_set_impl(WS_MASK_IMPL_AUTO);
+    printf("auto-selected kernel: %s\n", ws_mask_impl_name(ws_mask_get_impl()));
+
+    printf("%8s  %10s", "bytes", "bytewise");
+    for (i = 0; i < sizeof(impls) / sizeof(impls[0]); i++) {
+        if (ws_mask_set_impl(impls[i]) == WS_MASK_OK) {
+            if (bench_verify(src, dst, ref) != 0) {
+                printf("\n%s kernel produced wrong output\n", ws_mask_impl_name(impls[i]));
+                return EXIT_FAILURE;
+            }
+            printf("  %10s", ws_mask_impl_name(impls[i]));
+        }
+    }
+    printf("   (MB/s)\n");
+
+    for (len = 16; len <= BENCH_MAX_LEN; len *= 4) {
+        printf("%8zu  %10.0f", len, bench_run(bytewise_mask, dst, src, len));
+
+        for (i = 0; i < sizeof(impls) / sizeof(impls[0]); i++) {
+            if (ws_mask_set_impl(impls[i]) == WS_MASK_OK) {
+                /* Source one byte off to measure the unaligned case */
+                printf("  %10.0f", bench_run(ws_mask_apply, dst, src + 1, len));
+            }
+        }
+        printf("\n");
+    }
+
+    free(src);
+    free(dst);
+    free(ref);
+
+    return EXIT_SUCCESS;
+}
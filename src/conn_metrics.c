@@ -0,0 +1,801 @@
+/*
+ * Connection metrics implementation
+ */
+
+#include "conn_metrics.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+/* Snapshot buffer: first guess, doubled until the snapshot fits */
+#define CONN_METRICS_SNAPSHOT_SIZE         8192
+
+static const char *const conn_metrics_phase_names[CONN_METRICS_PHASES] = {
+    "dns", "connect", "tls_handshake", "ws_upgrade"
+};
+
+static const char *const conn_metrics_opcode_names[CONN_METRICS_OPCODES] = {
+    "continuation", "text", "binary", "op3", "op4", "op5", "op6", "op7",
+    "close", "ping", "pong", "op11", "op12", "op13", "op14", "op15"
+};
+
+/* Scalar counters: Prometheus family, optional label and JSON key */
+static const struct {
+    const char *family;
+    const char *help;
+    const char *label;
+    const char *value;
+    const char *json;
+    size_t offset;
+} conn_metrics_fields[] = {
+    { "bytes", "Socket bytes transferred", "direction", "in", "bytes_in",
+      offsetof(conn_metrics_counters_t, bytes_in) },
+    { "bytes", NULL, "direction", "out", "bytes_out",
+      offsetof(conn_metrics_counters_t, bytes_out) },
+    { "tls_records", "TLS records transferred", "direction", "in", "records_in",
+      offsetof(conn_metrics_counters_t, records_in) },
+    { "tls_records", NULL, "direction", "out", "records_out",
+      offsetof(conn_metrics_counters_t, records_out) },
+    { "syscalls", "Socket send/recv syscalls", "call", "recv", "recv_calls",
+      offsetof(conn_metrics_counters_t, recv_calls) },
+    { "syscalls", NULL, "call", "send", "send_calls",
+      offsetof(conn_metrics_counters_t, send_calls) },
+    { "would_block", "Socket calls that returned WANT_READ/WANT_WRITE", "want", "read",
+      "want_read", offsetof(conn_metrics_counters_t, want_read) },
+    { "would_block", NULL, "want", "write", "want_write",
+      offsetof(conn_metrics_counters_t, want_write) },
+    { "round_trips", "Receives that followed a send, plus one per TCP connect", NULL, NULL,
+      "round_trips", offsetof(conn_metrics_counters_t, round_trips) },
+    { "connect_attempts", "TCP connects started, one per address tried", NULL, NULL,
+      "connect_attempts", offsetof(conn_metrics_counters_t, connect_attempts) },
+    { "heartbeat_misses", "Heartbeat pings that got no answer in time", NULL, NULL,
+      "heartbeat_misses", offsetof(conn_metrics_counters_t, heartbeat_misses) },
+    { "phase_failures", "Connection setup phases that ended in an error", "phase", "dns",
+      "dns_failures", offsetof(conn_metrics_counters_t, phase_failures[CONN_METRICS_PHASE_DNS]) },
+    { "phase_failures", NULL, "phase", "connect", "connect_failures",
+      offsetof(conn_metrics_counters_t, phase_failures[CONN_METRICS_PHASE_CONNECT]) },
+    { "phase_failures", NULL, "phase", "tls_handshake", "tls_handshake_failures",
+      offsetof(conn_metrics_counters_t, phase_failures[CONN_METRICS_PHASE_TLS_HANDSHAKE]) },
+    { "phase_failures", NULL, "phase", "ws_upgrade", "ws_upgrade_failures",
+      offsetof(conn_metrics_counters_t, phase_failures[CONN_METRICS_PHASE_WS_UPGRADE]) },
+    { "deflate_raw_bytes", "permessage-deflate message bytes before compression / after decompression",
+      "direction", "in", "deflate_raw_in", offsetof(conn_metrics_counters_t, deflate_raw_in) },
+    { "deflate_raw_bytes", NULL, "direction", "out", "deflate_raw_out",
+      offsetof(conn_metrics_counters_t, deflate_raw_out) },
+    { "deflate_wire_bytes", "permessage-deflate compressed payload bytes", "direction", "in",
+      "deflate_wire_in", offsetof(conn_metrics_counters_t, deflate_wire_in) },
+    { "deflate_wire_bytes", NULL, "direction", "out", "deflate_wire_out",
+      offsetof(conn_metrics_counters_t, deflate_wire_out) },
+    { "deflate_cpu_ns", "Nanoseconds spent in zlib", "op", "compress", "deflate_ns",
+      offsetof(conn_metrics_counters_t, deflate_ns) },
+    { "deflate_cpu_ns", NULL, "op", "decompress", "inflate_ns",
+      offsetof(conn_metrics_counters_t, inflate_ns) },
+};
+
+#define CONN_METRICS_FIELDS (sizeof(conn_metrics_fields) / sizeof(conn_metrics_fields[0]))
+#define CONN_METRICS_WORDS  (sizeof(conn_metrics_counters_t) / sizeof(uint64_t))
+
+/* Bounded text output */
+typedef struct {
+    char *buf;
+    size_t len;
+    size_t pos;
+    int overflow;
+} conn_metrics_out_t;
+
+static uint64_t conn_metrics_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static void conn_metrics_printf(conn_metrics_out_t *o, const char *fmt, ...)
+{
+    va_list ap;
+    int n;
+
+    if (o->overflow) {
+        return;
+    }
+
+    va_start(ap, fmt);
+    n = vsnprintf(o->buf + o->pos, o->len - o->pos, fmt, ap);
+    va_end(ap);
+
+    if (n < 0 || (size_t)n >= o->len - o->pos) {
+        o->overflow = 1;
+        return;
+    }
+    o->pos += (size_t)n;
+}
+
+/* Consistent copy of a live connection's counters */
+static void conn_metrics_load(const conn_metrics_t *m, conn_metrics_counters_t *out)
+{
+    const uint64_t *src = (const uint64_t *)&m->c;
+    uint64_t *dst = (uint64_t *)out;
+    size_t i;
+
+    for (i = 0; i < CONN_METRICS_WORDS; i++) {
+        dst[i] = __atomic_load_n(&src[i], __ATOMIC_RELAXED);
+    }
+}
+
+static void conn_metrics_sum(conn_metrics_counters_t *dst, const conn_metrics_counters_t *src)
+{
+    const uint64_t *s = (const uint64_t *)src;
+    uint64_t *d = (uint64_t *)dst;
+    size_t i;
+
+    for (i = 0; i < CONN_METRICS_WORDS; i++) {
+        d[i] += s[i];
+    }
+}
+
+static uint64_t conn_metrics_field(const conn_metrics_counters_t *c, size_t i)
+{
+    return *(const uint64_t *)((const char *)c + conn_metrics_fields[i].offset);
+}
+
+/* Initialize a registry */
+int conn_metrics_registry_init(conn_metrics_registry_t *reg)
+{
+    if (reg == NULL) {
+        return CONN_METRICS_ERR_INVALID_PARAM;
+    }
+
+    memset(reg, 0, sizeof(*reg));
+    reg->next_id = 1;
+
+    if (pthread_mutex_init(&reg->lock, NULL) != 0) {
+        return CONN_METRICS_ERR_ALLOC_FAILED;
+    }
+
+    return CONN_METRICS_OK;
+}
+
+/* Release a registry */
+void conn_metrics_registry_free(conn_metrics_registry_t *reg)
+{
+    if (reg == NULL) {
+        return;
+    }
+
+    pthread_mutex_destroy(&reg->lock);
+}
+
+/* Reset a connection's metrics */
+void conn_metrics_init(conn_metrics_t *m, const char *label)
+{
+    size_t i;
+
+    if (m == NULL) {
+        return;
+    }
+
+    memset(m, 0, sizeof(*m));
+
+    /* Sanitized once so exporters can print it without escaping */
+    if (label != NULL) {
+        for (i = 0; label[i] != '\0' && i < sizeof(m->label) - 1; i++) {
+            char ch = label[i];
+            m->label[i] = (ch == '"' || ch == '\\' || (unsigned char)ch < 0x20) ? '_' : ch;
+        }
+    }
+}
+
+/* Add a connection to the registry */
+int conn_metrics_register(conn_metrics_registry_t *reg, conn_metrics_t *m)
+{
+    if (reg == NULL || m == NULL || m->registry != NULL) {
+        return CONN_METRICS_ERR_INVALID_PARAM;
+    }
+
+    pthread_mutex_lock(&reg->lock);
+
+    m->id = reg->next_id++;
+    m->registry = reg;
+    m->next = reg->live;
+    if (m->next != NULL) {
+        m->next->pprev = &m->next;
+    }
+    m->pprev = &reg->live;
+    reg->live = m;
+    reg->active++;
+
+    pthread_mutex_unlock(&reg->lock);
+
+    return CONN_METRICS_OK;
+}
+
+/* Remove a connection, keeping its counters in the aggregates */
+void conn_metrics_unregister(conn_metrics_t *m)
+{
+    conn_metrics_registry_t *reg;
+
+    if (m == NULL || m->registry == NULL) {
+        return;
+    }
+
+    reg = m->registry;
+    pthread_mutex_lock(&reg->lock);
+
+    *m->pprev = m->next;
+    if (m->next != NULL) {
+        m->next->pprev = m->pprev;
+    }
+    m->next = NULL;
+    m->pprev = NULL;
+    m->registry = NULL;
+    reg->active--;
+    reg->closed++;
+    conn_metrics_sum(&reg->closed_totals, &m->c);
+
+    pthread_mutex_unlock(&reg->lock);
+}
+
+/* Start timing a phase */
+void conn_metrics_phase_begin(conn_metrics_t *m, conn_metrics_phase_t phase)
+{
+    if (m == NULL || phase >= CONN_METRICS_PHASES) {
+        return;
+    }
+
+    m->phase_start[phase] = conn_metrics_now_ns();
+    __atomic_store_n(&m->phase_ns[phase], 0, __ATOMIC_RELAXED);
+}
+
+/* Finish timing a phase */
+void conn_metrics_phase_end(conn_metrics_t *m, conn_metrics_phase_t phase)
+{
+    uint64_t ns;
+
+    if (m == NULL || phase >= CONN_METRICS_PHASES || m->phase_start[phase] == 0) {
+        return;
+    }
+
+    /* Never 0, so a finished phase is distinguishable from a pending one */
+    ns = conn_metrics_now_ns() - m->phase_start[phase];
+    if (ns == 0) {
+        ns = 1;
+    }
+    m->phase_start[phase] = 0;
+    __atomic_store_n(&m->phase_ns[phase], ns, __ATOMIC_RELAXED);
+
+    /* SYN / SYN-ACK never passes through send()/recv() */
+    if (phase == CONN_METRICS_PHASE_CONNECT) {
+        CONN_METRICS_ADD(m, round_trips, 1);
+    }
+
+    if (m->registry != NULL) {
+        pthread_mutex_lock(&m->registry->lock);
+        latency_hist_record(&m->registry->phases[phase], ns);
+        pthread_mutex_unlock(&m->registry->lock);
+    }
+}
+
+/* Abandon timing a phase */
+void conn_metrics_phase_fail(conn_metrics_t *m, conn_metrics_phase_t phase)
+{
+    if (m == NULL || phase >= CONN_METRICS_PHASES || m->phase_start[phase] == 0) {
+        return;
+    }
+
+    m->phase_start[phase] = 0;
+    CONN_METRICS_ADD(m, phase_failures[phase], 1);
+}
+
+/* Record a heartbeat round trip */
+void conn_metrics_pong(conn_metrics_t *m, uint64_t rtt_ns)
+{
+    if (m == NULL) {
+        return;
+    }
+
+    __atomic_store_n(&m->pong_rtt_ns, rtt_ns, __ATOMIC_RELAXED);
+
+    if (m->registry != NULL) {
+        pthread_mutex_lock(&m->registry->lock);
+        latency_hist_record(&m->registry->pong_rtt, rtt_ns);
+        pthread_mutex_unlock(&m->registry->lock);
+    }
+}
+
+/* Count record headers: 5 byte header (type, version, length) + body */
+void conn_metrics_tls_stream(conn_metrics_t *m, int out, const unsigned char *buf, size_t len)
+{
+    conn_metrics_records_t *st;
+    uint64_t records = 0;
+    size_t n;
+
+    if (m == NULL || !m->tls) {
+        return;
+    }
+
+    st = out ? &m->rec_out : &m->rec_in;
+
+    while (len > 0) {
+        if (st->remaining > 0) {
+            n = len < st->remaining ? len : st->remaining;
+            st->remaining -= (uint32_t)n;
+            buf += n;
+            len -= n;
+            continue;
+        }
+
+        n = sizeof(st->header) - st->header_len;
+        if (n > len) {
+            n = len;
+        }
+        memcpy(st->header + st->header_len, buf, n);
+        st->header_len += (uint8_t)n;
+        buf += n;
+        len -= n;
+
+        if (st->header_len == sizeof(st->header)) {
+            st->remaining = ((uint32_t)st->header[3] << 8) | st->header[4];
+            st->header_len = 0;
+            records++;
+        }
+    }
+
+    if (records > 0) {
+        if (out) {
+            CONN_METRICS_ADD(m, records_out, records);
+        } else {
+            CONN_METRICS_ADD(m, records_in, records);
+        }
+    }
+}
+
+/* Prometheus text exposition format */
+static void conn_metrics_prometheus(conn_metrics_registry_t *reg,
+                                    const conn_metrics_counters_t *totals,
+                                    conn_metrics_out_t *o)
+{
+    static const double quantiles[] = { 50.0, 90.0, 99.0, 99.9 };
+    const conn_metrics_t *m;
+    conn_metrics_counters_t c;
+    size_t i, q;
+    int op;
+
+    conn_metrics_printf(o, "# HELP tuya_connections_active Connections currently registered\n"
+                           "# TYPE tuya_connections_active gauge\n"
+                           "tuya_connections_active %zu\n", reg->active);
+    conn_metrics_printf(o, "# HELP tuya_connections_closed_total Connections closed\n"
+                           "# TYPE tuya_connections_closed_total counter\n"
+                           "tuya_connections_closed_total %lu\n", reg->closed);
+
+    conn_metrics_printf(o, "# HELP tuya_phase_seconds Connection setup phase durations\n"
+                           "# TYPE tuya_phase_seconds summary\n");
+    for (i = 0; i < CONN_METRICS_PHASES; i++) {
+        const latency_hist_t *h = &reg->phases[i];
+
+        for (q = 0; q < sizeof(quantiles) / sizeof(quantiles[0]); q++) {
+            conn_metrics_printf(o, "tuya_phase_seconds{phase=\"%s\",quantile=\"%g\"} %.9f\n",
+                                conn_metrics_phase_names[i], quantiles[q] / 100.0,
+                                (double)latency_hist_percentile(h, quantiles[q]) / 1e9);
+        }
+        conn_metrics_printf(o, "tuya_phase_seconds_sum{phase=\"%s\"} %.9f\n"
+                               "tuya_phase_seconds_count{phase=\"%s\"} %llu\n",
+                            conn_metrics_phase_names[i], (double)h->sum / 1e9,
+                            conn_metrics_phase_names[i], (unsigned long long)h->count);
+    }
+
+    conn_metrics_printf(o, "# HELP tuya_ws_pong_rtt_seconds Heartbeat ping to pong round trips\n"
+                           "# TYPE tuya_ws_pong_rtt_seconds summary\n");
+    for (q = 0; q < sizeof(quantiles) / sizeof(quantiles[0]); q++) {
+        conn_metrics_printf(o, "tuya_ws_pong_rtt_seconds{quantile=\"%g\"} %.9f\n",
+                            quantiles[q] / 100.0,
+                            (double)latency_hist_percentile(&reg->pong_rtt, quantiles[q]) / 1e9);
+    }
+    conn_metrics_printf(o, "tuya_ws_pong_rtt_seconds_sum %.9f\n"
+                           "tuya_ws_pong_rtt_seconds_count %llu\n",
+                        (double)reg->pong_rtt.sum / 1e9,
+                        (unsigned long long)reg->pong_rtt.count);
+
+    /* Aggregates over live and closed connections */
+    for (i = 0; i < CONN_METRICS_FIELDS; i++) {
+        if (conn_metrics_fields[i].help != NULL) {
+            conn_metrics_printf(o, "# HELP tuya_%s_total %s\n# TYPE tuya_%s_total counter\n",
+                                conn_metrics_fields[i].family, conn_metrics_fields[i].help,
+                                conn_metrics_fields[i].family);
+        }
+        if (conn_metrics_fields[i].label == NULL) {
+            conn_metrics_printf(o, "tuya_%s_total %llu\n", conn_metrics_fields[i].family,
+                                (unsigned long long)conn_metrics_field(totals, i));
+            continue;
+        }
+        conn_metrics_printf(o, "tuya_%s_total{%s=\"%s\"} %llu\n",
+                            conn_metrics_fields[i].family, conn_metrics_fields[i].label,
+                            conn_metrics_fields[i].value,
+                            (unsigned long long)conn_metrics_field(totals, i));
+    }
+
+    conn_metrics_printf(o, "# HELP tuya_ws_frames_total WebSocket frames by opcode\n"
+                           "# TYPE tuya_ws_frames_total counter\n");
+    for (op = 0; op < CONN_METRICS_OPCODES; op++) {
+        if (totals->frames_in[op] > 0) {
+            conn_metrics_printf(o, "tuya_ws_frames_total{direction=\"in\",opcode=\"%s\"} %llu\n",
+                                conn_metrics_opcode_names[op],
+                                (unsigned long long)totals->frames_in[op]);
+        }
+        if (totals->frames_out[op] > 0) {
+            conn_metrics_printf(o, "tuya_ws_frames_total{direction=\"out\",opcode=\"%s\"} %llu\n",
+                                conn_metrics_opcode_names[op],
+                                (unsigned long long)totals->frames_out[op]);
+        }
+    }
+
+    /* Per connection */
+    conn_metrics_printf(o, "# HELP tuya_conn_phase_seconds Setup phase durations per connection\n"
+                           "# TYPE tuya_conn_phase_seconds gauge\n");
+    for (m = reg->live; m != NULL; m = m->next) {
+        for (i = 0; i < CONN_METRICS_PHASES; i++) {
+            uint64_t ns = __atomic_load_n(&m->phase_ns[i], __ATOMIC_RELAXED);
+            if (ns > 0) {
+                conn_metrics_printf(o, "tuya_conn_phase_seconds{id=\"%lu\",conn=\"%s\",phase=\"%s\"} %.9f\n",
+                                    m->id, m->label, conn_metrics_phase_names[i],
+                                    (double)ns / 1e9);
+            }
+        }
+    }
+
+    conn_metrics_printf(o, "# HELP tuya_conn_ws_pong_rtt_seconds Last heartbeat round trip per connection\n"
+                           "# TYPE tuya_conn_ws_pong_rtt_seconds gauge\n");
+    for (m = reg->live; m != NULL; m = m->next) {
+        uint64_t ns = __atomic_load_n(&m->pong_rtt_ns, __ATOMIC_RELAXED);
+        if (ns > 0) {
+            conn_metrics_printf(o, "tuya_conn_ws_pong_rtt_seconds{id=\"%lu\",conn=\"%s\"} %.9f\n",
+                                m->id, m->label, (double)ns / 1e9);
+        }
+    }
+
+    for (i = 0; i < CONN_METRICS_FIELDS; i++) {
+        if (conn_metrics_fields[i].help != NULL) {
+            conn_metrics_printf(o, "# TYPE tuya_conn_%s_total counter\n",
+                                conn_metrics_fields[i].family);
+        }
+        for (m = reg->live; m != NULL; m = m->next) {
+            conn_metrics_load(m, &c);
+            if (conn_metrics_fields[i].label == NULL) {
+                conn_metrics_printf(o, "tuya_conn_%s_total{id=\"%lu\",conn=\"%s\"} %llu\n",
+                                    conn_metrics_fields[i].family, m->id, m->label,
+                                    (unsigned long long)conn_metrics_field(&c, i));
+                continue;
+            }
+            conn_metrics_printf(o, "tuya_conn_%s_total{id=\"%lu\",conn=\"%s\",%s=\"%s\"} %llu\n",
+                                conn_metrics_fields[i].family, m->id, m->label,
+                                conn_metrics_fields[i].label, conn_metrics_fields[i].value,
+                                (unsigned long long)conn_metrics_field(&c, i));
+        }
+    }
+
+    conn_metrics_printf(o, "# TYPE tuya_conn_ws_frames_total counter\n");
+    for (m = reg->live; m != NULL; m = m->next) {
+        conn_metrics_load(m, &c);
+        for (op = 0; op < CONN_METRICS_OPCODES; op++) {
+            if (c.frames_in[op] > 0) {
+                conn_metrics_printf(o, "tuya_conn_ws_frames_total{id=\"%lu\",conn=\"%s\","
+                                       "direction=\"in\",opcode=\"%s\"} %llu\n",
+                                    m->id, m->label, conn_metrics_opcode_names[op],
+                                    (unsigned long long)c.frames_in[op]);
+            }
+            if (c.frames_out[op] > 0) {
+                conn_metrics_printf(o, "tuya_conn_ws_frames_total{id=\"%lu\",conn=\"%s\","
+                                       "direction=\"out\",opcode=\"%s\"} %llu\n",
+                                    m->id, m->label, conn_metrics_opcode_names[op],
+                                    (unsigned long long)c.frames_out[op]);
+            }
+        }
+    }
+}
+
+/* Counters as JSON members, frames as nested objects */
+static void conn_metrics_json_counters(const conn_metrics_counters_t *c, conn_metrics_out_t *o)
+{
+    size_t i;
+    int op, dir, first;
+
+    for (i = 0; i < CONN_METRICS_FIELDS; i++) {
+        conn_metrics_printf(o, "%s\"%s\":%llu", i > 0 ? "," : "", conn_metrics_fields[i].json,
+                            (unsigned long long)conn_metrics_field(c, i));
+    }
+
+    for (dir = 0; dir < 2; dir++) {
+        const uint64_t *frames = dir == 0 ? c->frames_in : c->frames_out;
+
+        conn_metrics_printf(o, ",\"%s\":{", dir == 0 ? "frames_in" : "frames_out");
+        first = 1;
+        for (op = 0; op < CONN_METRICS_OPCODES; op++) {
+            if (frames[op] > 0) {
+                conn_metrics_printf(o, "%s\"%s\":%llu", first ? "" : ",",
+                                    conn_metrics_opcode_names[op],
+                                    (unsigned long long)frames[op]);
+                first = 0;
+            }
+        }
+        conn_metrics_printf(o, "}");
+    }
+}
+
+static void conn_metrics_json(conn_metrics_registry_t *reg,
+                              const conn_metrics_counters_t *totals,
+                              conn_metrics_out_t *o)
+{
+    const conn_metrics_t *m;
+    conn_metrics_counters_t c;
+    size_t i;
+    int first;
+
+    conn_metrics_printf(o, "{\"active\":%zu,\"closed\":%lu,\"totals\":{", reg->active, reg->closed);
+    conn_metrics_json_counters(totals, o);
+    conn_metrics_printf(o, "},\"phases\":{");
+
+    for (i = 0; i < CONN_METRICS_PHASES; i++) {
+        const latency_hist_t *h = &reg->phases[i];
+
+        conn_metrics_printf(o, "%s\"%s\":{\"count\":%llu,\"mean_ms\":%.3f,\"p50_ms\":%.3f,"
+                               "\"p90_ms\":%.3f,\"p99_ms\":%.3f,\"max_ms\":%.3f}",
+                            i > 0 ? "," : "", conn_metrics_phase_names[i],
+                            (unsigned long long)h->count, latency_hist_mean(h) / 1e6,
+                            (double)latency_hist_percentile(h, 50.0) / 1e6,
+                            (double)latency_hist_percentile(h, 90.0) / 1e6,
+                            (double)latency_hist_percentile(h, 99.0) / 1e6,
+                            (double)h->max / 1e6);
+    }
+
+    conn_metrics_printf(o, "},\"pong_rtt\":{\"count\":%llu,\"mean_ms\":%.3f,\"p50_ms\":%.3f,"
+                           "\"p90_ms\":%.3f,\"p99_ms\":%.3f,\"max_ms\":%.3f",
+                        (unsigned long long)reg->pong_rtt.count, latency_hist_mean(&reg->pong_rtt) / 1e6,
+                        (double)latency_hist_percentile(&reg->pong_rtt, 50.0) / 1e6,
+                        (double)latency_hist_percentile(&reg->pong_rtt, 90.0) / 1e6,
+                        (double)latency_hist_percentile(&reg->pong_rtt, 99.0) / 1e6,
+                        (double)reg->pong_rtt.max / 1e6);
+    conn_metrics_printf(o, "},\"connections\":[");
+
+    for (m = reg->live; m != NULL; m = m->next) {
+        conn_metrics_printf(o, "%s{\"id\":%lu,\"label\":\"%s\",\"phases_ms\":{",
+                            m == reg->live ? "" : ",", m->id, m->label);
+        first = 1;
+        for (i = 0; i < CONN_METRICS_PHASES; i++) {
+            uint64_t ns = __atomic_load_n(&m->phase_ns[i], __ATOMIC_RELAXED);
+            if (ns > 0) {
+                conn_metrics_printf(o, "%s\"%s\":%.3f", first ? "" : ",",
+                                    conn_metrics_phase_names[i], (double)ns / 1e6);
+                first = 0;
+            }
+        }
+        conn_metrics_printf(o, "},\"pong_rtt_ms\":%.3f,",
+                            (double)__atomic_load_n(&m->pong_rtt_ns, __ATOMIC_RELAXED) / 1e6);
+        conn_metrics_load(m, &c);
+        conn_metrics_json_counters(&c, o);
+        conn_metrics_printf(o, "}");
+    }
+
+    conn_metrics_printf(o, "]}\n");
+}
+
+/* Write a snapshot into buf */
+int conn_metrics_format(conn_metrics_registry_t *reg, conn_metrics_format_t format,
+                        char *buf, size_t len)
+{
+    conn_metrics_counters_t totals, c;
+    conn_metrics_out_t o;
+    const conn_metrics_t *m;
+
+    if (reg == NULL || buf == NULL || len == 0) {
+        return CONN_METRICS_ERR_INVALID_PARAM;
+    }
+
+    o.buf = buf;
+    o.len = len;
+    o.pos = 0;
+    o.overflow = 0;
+    buf[0] = '\0';
+
+    pthread_mutex_lock(&reg->lock);
+
+    totals = reg->closed_totals;
+    for (m = reg->live; m != NULL; m = m->next) {
+        conn_metrics_load(m, &c);
+        conn_metrics_sum(&totals, &c);
+    }
+
+    if (format == CONN_METRICS_FORMAT_JSON) {
+        conn_metrics_json(reg, &totals, &o);
+    } else {
+        conn_metrics_prometheus(reg, &totals, &o);
+    }
+
+    pthread_mutex_unlock(&reg->lock);
+
+    if (o.overflow) {
+        return CONN_METRICS_ERR_BUFFER_TOO_SMALL;
+    }
+
+    return (int)o.pos;
+}
+
+/* Format into a heap buffer large enough for the snapshot */
+static char *conn_metrics_snapshot(conn_metrics_registry_t *reg, conn_metrics_format_t format,
+                                   int *out_len)
+{
+    size_t size = CONN_METRICS_SNAPSHOT_SIZE;
+    char *buf = NULL, *grown;
+    int ret;
+
+    for (;;) {
+        grown = realloc(buf, size);
+        if (grown == NULL) {
+            free(buf);
+            return NULL;
+        }
+        buf = grown;
+
+        ret = conn_metrics_format(reg, format, buf, size);
+        if (ret != CONN_METRICS_ERR_BUFFER_TOO_SMALL) {
+            break;
+        }
+        size *= 2;
+    }
+
+    if (ret < 0) {
+        free(buf);
+        return NULL;
+    }
+
+    *out_len = ret;
+    return buf;
+}
+
+/* Replace path with a snapshot */
+int conn_metrics_write_file(conn_metrics_registry_t *reg, conn_metrics_format_t format,
+                            const char *path)
+{
+    char tmp[512];
+    char *snapshot;
+    FILE *fp;
+    int len, ret = CONN_METRICS_OK;
+
+    if (reg == NULL || path == NULL ||
+        snprintf(tmp, sizeof(tmp), "%s.tmp", path) >= (int)sizeof(tmp)) {
+        return CONN_METRICS_ERR_INVALID_PARAM;
+    }
+
+    snapshot = conn_metrics_snapshot(reg, format, &len);
+    if (snapshot == NULL) {
+        return CONN_METRICS_ERR_ALLOC_FAILED;
+    }
+
+    /* Readers never see a half written file */
+    fp = fopen(tmp, "w");
+    if (fp == NULL) {
+        free(snapshot);
+        return CONN_METRICS_ERR_IO_FAILED;
+    }
+
+    if (fwrite(snapshot, 1, (size_t)len, fp) != (size_t)len) {
+        ret = CONN_METRICS_ERR_IO_FAILED;
+    }
+    if (fclose(fp) != 0) {
+        ret = CONN_METRICS_ERR_IO_FAILED;
+    }
+    if (ret == CONN_METRICS_OK && rename(tmp, path) != 0) {
+        ret = CONN_METRICS_ERR_IO_FAILED;
+    }
+    if (ret != CONN_METRICS_OK) {
+        unlink(tmp);
+    }
+
+    free(snapshot);
+
+    return ret;
+}
+
+/* Accept loop: one snapshot per connection, then close */
+static void *conn_metrics_exporter_thread(void *arg)
+{
+    conn_metrics_exporter_t *exp = (conn_metrics_exporter_t *)arg;
+    char *snapshot;
+    ssize_t n;
+    size_t sent;
+    int fd, len;
+
+    while (exp->running) {
+        fd = accept(exp->fd, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+
+        snapshot = conn_metrics_snapshot(exp->registry, exp->format, &len);
+        for (sent = 0; snapshot != NULL && sent < (size_t)len; sent += (size_t)n) {
+            n = send(fd, snapshot + sent, (size_t)len - sent, MSG_NOSIGNAL);
+            if (n < 0) {
+                if (errno == EINTR) {
+                    n = 0;
+                    continue;
+                }
+                break;
+            }
+        }
+
+        free(snapshot);
+        close(fd);
+    }
+
+    return NULL;
+}
+
+/* Serve snapshots on a UNIX socket */
+int conn_metrics_exporter_start(conn_metrics_exporter_t *exp, conn_metrics_registry_t *reg,
+                                const char *path, conn_metrics_format_t format)
+{
+    struct sockaddr_un addr;
+
+    if (exp == NULL || reg == NULL || path == NULL || strlen(path) >= sizeof(addr.sun_path)) {
+        return CONN_METRICS_ERR_INVALID_PARAM;
+    }
+
+    memset(exp, 0, sizeof(*exp));
+    exp->registry = reg;
+    exp->format = format;
+    snprintf(exp->path, sizeof(exp->path), "%s", path);
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path, path, strlen(path));
+
+    exp->fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (exp->fd < 0) {
+        return CONN_METRICS_ERR_IO_FAILED;
+    }
+
+    /* A stale socket file from a previous run would make bind() fail */
+    unlink(path);
+
+    if (bind(exp->fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        listen(exp->fd, 8) < 0) {
+        close(exp->fd);
+        exp->fd = -1;
+        return CONN_METRICS_ERR_IO_FAILED;
+    }
+
+    exp->running = 1;
+    if (pthread_create(&exp->thread, NULL, conn_metrics_exporter_thread, exp) != 0) {
+        exp->running = 0;
+        close(exp->fd);
+        exp->fd = -1;
+        unlink(path);
+        return CONN_METRICS_ERR_ALLOC_FAILED;
+    }
+
+    return CONN_METRICS_OK;
+}
+
+/* Stop the exporter */
+void conn_metrics_exporter_stop(conn_metrics_exporter_t *exp)
+{
+    if (exp == NULL || !exp->running) {
+        return;
+    }
+
+    exp->running = 0;
+    shutdown(exp->fd, SHUT_RDWR);
+    pthread_join(exp->thread, NULL);
+    close(exp->fd);
+    exp->fd = -1;
+    unlink(exp->path);
+}
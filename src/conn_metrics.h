@@ -0,0 +1,196 @@
+/*
+ * Connection metrics
+ * Per-connection counters (bytes, TLS records, socket calls, WANT_READ /
+ * WANT_WRITE returns, WebSocket frames by opcode, permessage-deflate
+ * savings and cost), setup phase timings (DNS, TCP connect, TLS
+ * handshake, WebSocket upgrade) and heartbeat round trips, collected in a
+ * registry that keeps aggregates and exports Prometheus text or JSON
+ * snapshots to a file or a local UNIX socket.
+ *
+ * Counters are written only by the thread that owns the connection, with
+ * plain relaxed stores (no locked instructions); exporters read them with
+ * relaxed loads. The registry lock is taken per connection event, never
+ * per byte.
+ */
+
+#ifndef CONN_METRICS_H
+#define CONN_METRICS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "latency_hist.h"
+
+/* Error codes */
+#define CONN_METRICS_OK                     0
+#define CONN_METRICS_ERR_INVALID_PARAM     -1
+#define CONN_METRICS_ERR_BUFFER_TOO_SMALL  -2
+#define CONN_METRICS_ERR_ALLOC_FAILED      -3
+#define CONN_METRICS_ERR_IO_FAILED         -4
+
+#define CONN_METRICS_LABEL_LEN             64
+
+/* WebSocket opcodes are 4 bits */
+#define CONN_METRICS_OPCODES               16
+
+/* Connection setup phases */
+typedef enum {
+    CONN_METRICS_PHASE_DNS = 0,
+    CONN_METRICS_PHASE_CONNECT,
+    CONN_METRICS_PHASE_TLS_HANDSHAKE,
+    CONN_METRICS_PHASE_WS_UPGRADE,
+    CONN_METRICS_PHASES
+} conn_metrics_phase_t;
+
+/* Snapshot formats */
+typedef enum {
+    CONN_METRICS_FORMAT_PROMETHEUS = 0,
+    CONN_METRICS_FORMAT_JSON
+} conn_metrics_format_t;
+
+/* Monotonic counters; only uint64_t members so they can be summed as an array */
+typedef struct {
+    uint64_t bytes_in;                  /* Socket bytes received */
+    uint64_t bytes_out;                 /* Socket bytes sent */
+    uint64_t records_in;                /* TLS records received */
+    uint64_t records_out;               /* TLS records sent */
+    uint64_t recv_calls;                /* recv() syscalls */
+    uint64_t send_calls;                /* send()/sendmsg() syscalls */
+    uint64_t want_read;                 /* recv() would have blocked */
+    uint64_t want_write;                /* send() would have blocked */
+    uint64_t round_trips;               /* TCP connect plus each receive that followed a send */
+    uint64_t connect_attempts;          /* Addresses a TCP connect was started to */
+    uint64_t heartbeat_misses;          /* Heartbeat pings left unanswered */
+    uint64_t phase_failures[CONN_METRICS_PHASES];  /* Setup phases that ended in an error */
+    uint64_t deflate_raw_in;            /* Decompressed message bytes received */
+    uint64_t deflate_raw_out;           /* Message bytes sent, before compression */
+    uint64_t deflate_wire_in;           /* Compressed payload bytes received */
+    uint64_t deflate_wire_out;          /* Compressed payload bytes sent */
+    uint64_t deflate_ns;                /* Time spent compressing */
+    uint64_t inflate_ns;                /* Time spent decompressing */
+    uint64_t frames_in[CONN_METRICS_OPCODES];
+    uint64_t frames_out[CONN_METRICS_OPCODES];
+} conn_metrics_counters_t;
+
+/* TLS record boundary tracker for one direction of the byte stream */
+typedef struct {
+    uint32_t remaining;                 /* Body bytes left in the current record */
+    uint8_t header[5];
+    uint8_t header_len;
+} conn_metrics_records_t;
+
+typedef struct conn_metrics_registry conn_metrics_registry_t;
+
+/* Metrics of one connection */
+typedef struct conn_metrics {
+    char label[CONN_METRICS_LABEL_LEN]; /* Usually host:port */
+    unsigned long id;                   /* Assigned on registration */
+    int tls;                            /* Count TLS records on the stream */
+    int awaiting;                       /* Sent since the last receive */
+    conn_metrics_counters_t c;
+    uint64_t phase_start[CONN_METRICS_PHASES];  /* Monotonic ns, 0 = not started */
+    uint64_t phase_ns[CONN_METRICS_PHASES];     /* Duration, 0 = not finished */
+    uint64_t pong_rtt_ns;               /* Last heartbeat round trip, 0 = none */
+    conn_metrics_records_t rec_in;
+    conn_metrics_records_t rec_out;
+    conn_metrics_registry_t *registry;  /* NULL when not registered */
+    struct conn_metrics *next;
+    struct conn_metrics **pprev;
+} conn_metrics_t;
+
+/* Registry of live connections plus aggregates of closed ones */
+struct conn_metrics_registry {
+    pthread_mutex_t lock;
+    conn_metrics_t *live;               /* Registered connections */
+    size_t active;
+    unsigned long next_id;
+    unsigned long closed;               /* Connections unregistered so far */
+    conn_metrics_counters_t closed_totals;
+    latency_hist_t phases[CONN_METRICS_PHASES];  /* Every finished phase */
+    latency_hist_t pong_rtt;            /* Heartbeat ping to pong round trips */
+};
+
+/* UNIX socket exporter: each client that connects receives one snapshot */
+typedef struct {
+    conn_metrics_registry_t *registry;
+    conn_metrics_format_t format;
+    int fd;                             /* Listening socket */
+    char path[108];                     /* sun_path */
+    pthread_t thread;
+    volatile int running;
+} conn_metrics_exporter_t;
+
+/* Add n to a counter of m (m may be NULL). Single writer per connection. */
+#define CONN_METRICS_ADD(m, field, n)                                       \
+    do {                                                                    \
+        if ((m) != NULL) {                                                  \
+            __atomic_store_n(&(m)->c.field, (m)->c.field + (uint64_t)(n),   \
+                             __ATOMIC_RELAXED);                             \
+        }                                                                   \
+    } while (0)
+
+/* Count one WebSocket frame (dir is frames_in or frames_out) */
+#define CONN_METRICS_FRAME(m, dir, opcode) \
+    CONN_METRICS_ADD(m, dir[(opcode) & (CONN_METRICS_OPCODES - 1)], 1)
+
+/* Note data sent (out != 0) or received; a receive after a send completes
+ * a round trip */
+#define CONN_METRICS_FLIGHT(m, out)                                         \
+    do {                                                                    \
+        if ((m) != NULL) {                                                  \
+            if (out) {                                                      \
+                (m)->awaiting = 1;                                          \
+            } else if ((m)->awaiting) {                                     \
+                (m)->awaiting = 0;                                          \
+                CONN_METRICS_ADD(m, round_trips, 1);                        \
+            }                                                               \
+        }                                                                   \
+    } while (0)
+
+/* Initialize a registry */
+int conn_metrics_registry_init(conn_metrics_registry_t *reg);
+
+/* Release a registry (connections must be unregistered first) */
+void conn_metrics_registry_free(conn_metrics_registry_t *reg);
+
+/* Reset m; label may be NULL */
+void conn_metrics_init(conn_metrics_t *m, const char *label);
+
+/* Add m to the registry and assign its id */
+int conn_metrics_register(conn_metrics_registry_t *reg, conn_metrics_t *m);
+
+/* Remove m from its registry, folding its counters into the aggregates */
+void conn_metrics_unregister(conn_metrics_t *m);
+
+/* Start / finish timing a phase (m may be NULL). A finished phase is also
+ * recorded in the registry histogram. */
+void conn_metrics_phase_begin(conn_metrics_t *m, conn_metrics_phase_t phase);
+void conn_metrics_phase_end(conn_metrics_t *m, conn_metrics_phase_t phase);
+
+/* Stop timing a phase that failed: counted in phase_failures, no duration
+ * recorded (m may be NULL) */
+void conn_metrics_phase_fail(conn_metrics_t *m, conn_metrics_phase_t phase);
+
+/* Record a heartbeat ping to pong round trip (m may be NULL) */
+void conn_metrics_pong(conn_metrics_t *m, uint64_t rtt_ns);
+
+/* Count TLS records in len bytes that went out (out != 0) or came in */
+void conn_metrics_tls_stream(conn_metrics_t *m, int out, const unsigned char *buf, size_t len);
+
+/* Write a snapshot into buf (NUL terminated). Returns the length or
+ * CONN_METRICS_ERR_BUFFER_TOO_SMALL. */
+int conn_metrics_format(conn_metrics_registry_t *reg, conn_metrics_format_t format,
+                        char *buf, size_t len);
+
+/* Replace path with a snapshot (written to path.tmp, then renamed) */
+int conn_metrics_write_file(conn_metrics_registry_t *reg, conn_metrics_format_t format,
+                            const char *path);
+
+/* Serve snapshots on a UNIX stream socket at path from a background thread */
+int conn_metrics_exporter_start(conn_metrics_exporter_t *exp, conn_metrics_registry_t *reg,
+                                const char *path, conn_metrics_format_t format);
+
+/* Stop the exporter thread and remove the socket file */
+void conn_metrics_exporter_stop(conn_metrics_exporter_t *exp);
+
+#endif /* CONN_METRICS_H */
@@ -0,0 +1,36 @@
+/*
+ * Runtime kernel dispatch implementation
+ * Release stores pair with the acquire load in cpu_dispatch_get(), so the
+ * entry is published together with everything the probe wrote before it.
+ */
+
+#include "cpu_dispatch.h"
+#include <stddef.h>
+
+/* Entry in use, probing the CPU on first use */
+const void *cpu_dispatch_get(cpu_dispatch_t *slot, void (*probe)(void))
+{
+    const void *entry = __atomic_load_n(&slot->selected, __ATOMIC_ACQUIRE);
+
+    if (entry == NULL) {
+        pthread_once(&slot->once, probe);
+        entry = __atomic_load_n(&slot->selected, __ATOMIC_ACQUIRE);
+    }
+
+    return entry;
+}
+
+/* Use entry from now on */
+void cpu_dispatch_set(cpu_dispatch_t *slot, const void *entry)
+{
+    __atomic_store_n(&slot->selected, entry, __ATOMIC_RELEASE);
+}
+
+/* Use entry unless one was already set */
+void cpu_dispatch_offer(cpu_dispatch_t *slot, const void *entry)
+{
+    const void *expected = NULL;
+
+    __atomic_compare_exchange_n(&slot->selected, &expected, entry, 0,
+                                __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,35 @@
+/*
+ * Runtime kernel dispatch
+ * For modules with CPU-specific kernels (ws_mask, json_tok, crc32). A
+ * module describes each implementation with one const entry holding all of
+ * its kernels, and publishes the selected entry through a single pointer,
+ * so a reader always sees one complete set even while another thread
+ * forces a different one. The first reader probes the CPU, once, under
+ * pthread_once().
+ */
+
+#ifndef CPU_DISPATCH_H
+#define CPU_DISPATCH_H
+
+#include <pthread.h>
+
+/* Dispatch slot of one module */
+typedef struct {
+    pthread_once_t once;                /* Guards the CPU probe */
+    const void *selected;               /* Entry in use; atomic access only */
+} cpu_dispatch_t;
+
+#define CPU_DISPATCH_INIT { PTHREAD_ONCE_INIT, NULL }
+
+/* Entry in use. The first call runs probe() once; probe() must pass the
+ * best entry for this CPU to cpu_dispatch_offer(). */
+const void *cpu_dispatch_get(cpu_dispatch_t *slot, void (*probe)(void));
+
+/* Use entry from now on (replaces any earlier choice) */
+void cpu_dispatch_set(cpu_dispatch_t *slot, const void *entry);
+
+/* Use entry unless one was already set (the default from the probe must
+ * not undo a cpu_dispatch_set() that came first) */
+void cpu_dispatch_offer(cpu_dispatch_t *slot, const void *entry);
+
+#endif /* CPU_DISPATCH_H */
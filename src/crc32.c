@@ -0,0 +1,296 @@
+/*
+ * Table-free CRC-32 implementation
+ * Kernels work on the inverted CRC register; crc32_compute() does the
+ * pre/post inversion. Folding constants are the bit-reflected ones from
+ * Intel's "Fast CRC Computation for Generic Polynomials Using PCLMULQDQ"
+ * (k1..k5, P' and mu for polynomial 0x04C11DB7).
+ */
+
+#include "crc32.h"
+#include "cpu_dispatch.h"
+#include <string.h>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define CRC32_X86
+#include <immintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#define CRC32_ARMV8
+#include <arm_acle.h>
+#endif
+
+/* Reflected polynomial */
+#define CRC32_POLY 0xedb88320u
+
+typedef uint32_t (*crc32_kernel)(uint32_t reg, const unsigned char *p, size_t len);
+
+/* Portable kernel: one bit per step, the mask replaces the branch */
+static uint32_t crc32_scalar(uint32_t reg, const unsigned char *p, size_t len)
+{
+    int k;
+
+    while (len-- > 0) {
+        reg ^= *p++;
+        for (k = 0; k < 8; k++) {
+            reg = (reg >> 1) ^ (CRC32_POLY & (0u - (reg & 1)));
+        }
+    }
+
+    return reg;
+}
+
+#if defined(CRC32_X86)
+
+/* Reduce the 64 bit reflected remainder in the low half of x to 32 bits */
+__attribute__((target("pclmul")))
+static uint32_t crc32_barrett(__m128i x)
+{
+    const __m128i poly = _mm_set_epi64x(0x1f7011641LL, 0x1db710641LL);  /* mu, P' */
+    const __m128i low32 = _mm_setr_epi32(~0, 0, ~0, 0);
+    __m128i t;
+
+    t = _mm_clmulepi64_si128(_mm_and_si128(x, low32), poly, 0x10);
+    t = _mm_clmulepi64_si128(_mm_and_si128(t, low32), poly, 0x00);
+    x = _mm_xor_si128(x, t);
+
+    return (uint32_t) _mm_cvtsi128_si32(_mm_srli_si128(x, 4));
+}
+
+/* Tail under 16 bytes: 4 bytes, then single bytes, one reduction each */
+__attribute__((target("pclmul")))
+static uint32_t crc32_pclmul_tail(uint32_t reg, const unsigned char *p, size_t len)
+{
+    uint32_t word;
+
+    while (len >= 4) {
+        memcpy(&word, p, sizeof(word));
+        reg = crc32_barrett(_mm_cvtsi32_si128((int)(reg ^ word)));
+        p += 4;
+        len -= 4;
+    }
+
+    while (len-- > 0) {
+        uint64_t v = (uint64_t)((reg ^ *p++) & 0xff) << 24;
+        reg = (reg >> 8) ^ crc32_barrett(_mm_cvtsi64_si128((long long) v));
+    }
+
+    return reg;
+}
+
+/* Fold x forward over 128 bits and add the next block */
+__attribute__((target("pclmul")))
+static __m128i crc32_fold(__m128i x, __m128i k, __m128i next)
+{
+    __m128i lo = _mm_clmulepi64_si128(x, k, 0x00);
+    __m128i hi = _mm_clmulepi64_si128(x, k, 0x11);
+
+    return _mm_xor_si128(_mm_xor_si128(hi, lo), next);
+}
+
+__attribute__((target("pclmul")))
+static uint32_t crc32_pclmul(uint32_t reg, const unsigned char *p, size_t len)
+{
+    const __m128i k1k2 = _mm_set_epi64x(0x1c6e41596LL, 0x154442bd4LL);
+    const __m128i k3k4 = _mm_set_epi64x(0x0ccaa009eLL, 0x1751997d0LL);
+    const __m128i k5 = _mm_set_epi64x(0, 0x163cd6124LL);
+    const __m128i low32 = _mm_setr_epi32(~0, 0, ~0, 0);
+    __m128i x1, x2, x3, x4;
+
+    if (len < 16) {
+        return crc32_pclmul_tail(reg, p, len);
+    }
+
+    x1 = _mm_xor_si128(_mm_loadu_si128((const __m128i *) p), _mm_cvtsi32_si128((int) reg));
+
+    /* Four independent lanes hide the multiplier latency */
+    if (len >= 64) {
+        x2 = _mm_loadu_si128((const __m128i *)(p + 16));
+        x3 = _mm_loadu_si128((const __m128i *)(p + 32));
+        x4 = _mm_loadu_si128((const __m128i *)(p + 48));
+        p += 64;
+        len -= 64;
+
+        while (len >= 64) {
+            x1 = crc32_fold(x1, k1k2, _mm_loadu_si128((const __m128i *) p));
+            x2 = crc32_fold(x2, k1k2, _mm_loadu_si128((const __m128i *)(p + 16)));
+            x3 = crc32_fold(x3, k1k2, _mm_loadu_si128((const __m128i *)(p + 32)));
+            x4 = crc32_fold(x4, k1k2, _mm_loadu_si128((const __m128i *)(p + 48)));
+            p += 64;
+            len -= 64;
+        }
+
+        x1 = crc32_fold(x1, k3k4, x2);
+        x1 = crc32_fold(x1, k3k4, x3);
+        x1 = crc32_fold(x1, k3k4, x4);
+    } else {
+        p += 16;
+        len -= 16;
+    }
+
+    while (len >= 16) {
+        x1 = crc32_fold(x1, k3k4, _mm_loadu_si128((const __m128i *) p));
+        p += 16;
+        len -= 16;
+    }
+
+    /* 128 -> 96 -> 64 bits, then Barrett down to 32 */
+    x2 = _mm_clmulepi64_si128(x1, k3k4, 0x10);
+    x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+    x2 = _mm_srli_si128(x1, 4);
+    x1 = _mm_clmulepi64_si128(_mm_and_si128(x1, low32), k5, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    reg = crc32_barrett(x1);
+
+    return crc32_pclmul_tail(reg, p, len);
+}
+
+#endif /* CRC32_X86 */
+
+#if defined(CRC32_ARMV8)
+
+static uint32_t crc32_armv8(uint32_t reg, const unsigned char *p, size_t len)
+{
+    uint64_t word;
+
+    while (len >= 8) {
+        memcpy(&word, p, sizeof(word));
+        reg = __crc32d(reg, word);
+        p += 8;
+        len -= 8;
+    }
+
+    while (len-- > 0) {
+        reg = __crc32b(reg, *p++);
+    }
+
+    return reg;
+}
+
+#endif /* CRC32_ARMV8 */
+
+/* Kernel of one implementation */
+typedef struct {
+    crc32_impl_t impl;
+    crc32_kernel fn;
+} crc32_kernels_t;
+
+static const crc32_kernels_t crc32_kernels[] = {
+    { CRC32_IMPL_SCALAR, crc32_scalar },
+#if defined(CRC32_X86)
+    { CRC32_IMPL_PCLMUL, crc32_pclmul },
+#endif
+#if defined(CRC32_ARMV8)
+    { CRC32_IMPL_ARMV8, crc32_armv8 },
+#endif
+};
+
+static cpu_dispatch_t crc32_dispatch = CPU_DISPATCH_INIT;
+
+/* Whether the CPU and build support an implementation */
+static int crc32_supported(crc32_impl_t impl)
+{
+    switch (impl) {
+    case CRC32_IMPL_SCALAR:
+        return 1;
+#if defined(CRC32_X86)
+    case CRC32_IMPL_PCLMUL:
+        return __builtin_cpu_supports("pclmul");
+#endif
+#if defined(CRC32_ARMV8)
+    case CRC32_IMPL_ARMV8:
+        return 1;
+#endif
+    default:
+        return 0;
+    }
+}
+
+/* Kernel of a supported implementation */
+static const crc32_kernels_t *crc32_kernels_for(crc32_impl_t impl)
+{
+    size_t i;
+
+    for (i = 0; i < sizeof(crc32_kernels) / sizeof(crc32_kernels[0]); i++) {
+        if (crc32_kernels[i].impl == impl) {
+            return &crc32_kernels[i];
+        }
+    }
+
+    return &crc32_kernels[0];
+}
+
+/* Best implementation for this CPU */
+static crc32_impl_t crc32_detect(void)
+{
+#if defined(CRC32_X86)
+    __builtin_cpu_init();
+#endif
+
+    if (crc32_supported(CRC32_IMPL_PCLMUL)) {
+        return CRC32_IMPL_PCLMUL;
+    }
+    if (crc32_supported(CRC32_IMPL_ARMV8)) {
+        return CRC32_IMPL_ARMV8;
+    }
+
+    return CRC32_IMPL_SCALAR;
+}
+
+/* First use: default to the fastest kernel */
+static void crc32_probe(void)
+{
+    cpu_dispatch_offer(&crc32_dispatch, crc32_kernels_for(crc32_detect()));
+}
+
+/* Kernel in use */
+static const crc32_kernels_t *crc32_kernels_get(void)
+{
+    return (const crc32_kernels_t *) cpu_dispatch_get(&crc32_dispatch, crc32_probe);
+}
+
+/* Force a kernel */
+int crc32_set_impl(crc32_impl_t impl)
+{
+    if (impl == CRC32_IMPL_AUTO) {
+        impl = crc32_detect();
+    } else if (!crc32_supported(impl)) {
+        return CRC32_ERR_UNSUPPORTED;
+    }
+
+    cpu_dispatch_set(&crc32_dispatch, crc32_kernels_for(impl));
+
+    return CRC32_OK;
+}
+
+/* Kernel currently in use */
+crc32_impl_t crc32_get_impl(void)
+{
+    return crc32_kernels_get()->impl;
+}
+
+/* Printable kernel name */
+const char *crc32_impl_name(crc32_impl_t impl)
+{
+    switch (impl) {
+    case CRC32_IMPL_AUTO:
+        return "auto";
+    case CRC32_IMPL_SCALAR:
+        return "scalar";
+    case CRC32_IMPL_PCLMUL:
+        return "pclmul";
+    case CRC32_IMPL_ARMV8:
+        return "armv8";
+    default:
+        return "unknown";
+    }
+}
+
+/* Continue a CRC */
+uint32_t crc32_compute(uint32_t crc, const void *data, size_t len)
+{
+    if (data == NULL || len == 0) {
+        return crc;
+    }
+
+    return ~crc32_kernels_get()->fn(~crc, (const unsigned char *) data, len);
+}
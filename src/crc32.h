@@ -0,0 +1,47 @@
+/*
+ * Table-free CRC-32
+ * The IEEE 802.3 / zlib CRC (reflected 0x04C11DB7) used by the Tuya 3.3
+ * frame trailer, computed without lookup tables so it does not compete
+ * with packet data for L1 cache.
+ *
+ * x86: PCLMULQDQ folding, four 128 bit lanes per 64 byte step, then a
+ * Barrett reduction; the under-16-byte tail goes through the same
+ * carry-less Barrett step 4 bytes (or 1 byte) at a time.
+ * AArch64 with the CRC extension: the CRC32X/CRC32B instructions.
+ * Elsewhere: a branch-free bitwise loop.
+ */
+
+#ifndef CRC32_H
+#define CRC32_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Error codes */
+#define CRC32_OK                            0
+#define CRC32_ERR_UNSUPPORTED              -1
+
+/* Kernel variants */
+typedef enum {
+    CRC32_IMPL_AUTO = 0,                /* Carry-less multiply or CRC instructions, else scalar */
+    CRC32_IMPL_SCALAR,
+    CRC32_IMPL_PCLMUL,
+    CRC32_IMPL_ARMV8
+} crc32_impl_t;
+
+/* Continue a CRC (start with 0); same results as zlib's crc32() */
+uint32_t crc32_compute(uint32_t crc, const void *data, size_t len);
+
+/* Compute every later CRC with impl, e.g. to cross-check the folding code
+ * against the bitwise loop; CRC32_IMPL_AUTO reverts to the detected kernel.
+ * Takes effect atomically for concurrent callers. CRC32_ERR_UNSUPPORTED if
+ * the CPU or build cannot run impl. */
+int crc32_set_impl(crc32_impl_t impl);
+
+/* Kernel currently in use */
+crc32_impl_t crc32_get_impl(void);
+
+/* Printable kernel name */
+const char *crc32_impl_name(crc32_impl_t impl);
+
+#endif /* CRC32_H */
@@ -1,92 +1,220 @@
 /*
  * Custom Random Number Generator Implementation
- * This is a simple example - replace with your actual RNG implementation
+ * Per-thread CTR_DRBG seeded from getrandom() (or a cached /dev/urandom fd
+ * on systems without it). There is deliberately no non-cryptographic
+ * fallback: if the kernel cannot provide entropy, generation fails.
  */
 
 #include "custom_rng.h"
+#include "mbedtls/ctr_drbg.h"
 #include <string.h>
 #include <stdlib.h>
-#include <time.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <pthread.h>
+#if defined(__linux__)
+#include <sys/random.h>
+#endif
+
+/* Per-thread generator state */
+typedef struct {
+    mbedtls_ctr_drbg_context drbg;
+    unsigned long fork_generation;  /* Value of custom_rng_forks when seeded */
+    int seeded;
+} custom_rng_thread_t;
+
+static pthread_once_t custom_rng_once = PTHREAD_ONCE_INIT;
+static pthread_key_t custom_rng_key;
+static __thread custom_rng_thread_t *custom_rng_state = NULL;
+
+/* Bumped in the child after fork(): every DRBG state copied from the parent
+ * must be reseeded before it produces output again */
+static volatile unsigned long custom_rng_forks = 0;
+
+#if !defined(__linux__)
+static int custom_rng_urandom_fd = -1;
+#endif
+
+static void custom_rng_atfork_child(void)
+{
+    custom_rng_forks++;
+}
+
+/* Thread exit destructor */
+static void custom_rng_thread_free(void *arg)
+{
+    custom_rng_thread_t *state = (custom_rng_thread_t *)arg;
+
+    if (state == NULL) {
+        return;
+    }
+
+    mbedtls_ctr_drbg_free(&state->drbg);
+    free(state);
+}
+
+static void custom_rng_global_init(void)
+{
+    pthread_key_create(&custom_rng_key, custom_rng_thread_free);
+    pthread_atfork(NULL, NULL, custom_rng_atfork_child);
+#if !defined(__linux__)
+    custom_rng_urandom_fd = open("/dev/urandom", O_RDONLY | O_CLOEXEC);
+#endif
+}
+
+/* Fill output straight from the kernel CSPRNG */
+int custom_rng_entropy(void *ctx, unsigned char *output, size_t len)
+{
+    ssize_t n;
+
+    (void)ctx;
+
+    while (len > 0) {
+#if defined(__linux__)
+        n = getrandom(output, len, 0);
+#else
+        pthread_once(&custom_rng_once, custom_rng_global_init);
+        n = custom_rng_urandom_fd >= 0 ? read(custom_rng_urandom_fd, output, len) : -1;
+#endif
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return CUSTOM_RNG_ERR_ENTROPY_FAILED;
+        }
+
+        output += n;
+        len -= (size_t)n;
+    }
+
+    return CUSTOM_RNG_OK;
+}
+
+/* Get the calling thread's DRBG, creating or reseeding it if needed */
+static int custom_rng_thread(const custom_rng_context *ctx, custom_rng_thread_t **out)
+{
+    custom_rng_thread_t *state = custom_rng_state;
+    unsigned long forks = custom_rng_forks;
+
+    if (state != NULL && state->seeded && state->fork_generation == forks) {
+        *out = state;
+        return CUSTOM_RNG_OK;
+    }
+
+    pthread_once(&custom_rng_once, custom_rng_global_init);
+
+    if (state == NULL) {
+        state = calloc(1, sizeof(*state));
+        if (state == NULL) {
+            return CUSTOM_RNG_ERR_ALLOC_FAILED;
+        }
+        if (pthread_setspecific(custom_rng_key, state) != 0) {
+            free(state);
+            return CUSTOM_RNG_ERR_ALLOC_FAILED;
+        }
+        mbedtls_ctr_drbg_init(&state->drbg);
+        custom_rng_state = state;
+    } else {
+        /* Forked child or earlier seeding failure: start over */
+        mbedtls_ctr_drbg_free(&state->drbg);
+        mbedtls_ctr_drbg_init(&state->drbg);
+    }
+
+    state->seeded = 0;
+
+    if (mbedtls_ctr_drbg_seed(&state->drbg, custom_rng_entropy, NULL,
+                              ctx->pers, ctx->pers_len) != 0) {
+        return CUSTOM_RNG_ERR_DRBG_FAILED;
+    }
+
+    mbedtls_ctr_drbg_set_reseed_interval(&state->drbg, CUSTOM_RNG_RESEED_INTERVAL);
+    state->fork_generation = forks;
+    state->seeded = 1;
+
+    *out = state;
+    return CUSTOM_RNG_OK;
+}
 
 /* Initialize custom RNG */
 int custom_rng_init(custom_rng_context *ctx)
 {
     if (ctx == NULL) {
-        return -1;
+        return CUSTOM_RNG_ERR_INVALID_PARAM;
     }
-    
-    ctx->initialized = 0;
-    ctx->seed = 0;
-    
-    return 0;
+
+    memset(ctx, 0, sizeof(*ctx));
+
+    return CUSTOM_RNG_OK;
 }
 
 /* Seed the custom RNG */
 int custom_rng_seed(custom_rng_context *ctx, const unsigned char *seed_data, size_t seed_len)
 {
+    custom_rng_thread_t *state;
+    int ret;
+
     if (ctx == NULL) {
-        return -1;
+        return CUSTOM_RNG_ERR_INVALID_PARAM;
     }
-    
-    /* Simple seeding - combine seed data into a single value */
-    /* In production, use a proper seeding mechanism */
-    unsigned int seed = (unsigned int)time(NULL);
-    
+
+    /* The secret seed material always comes from the kernel; seed_data only
+     * personalizes the DRBG instances created for this context */
+    if (seed_len > CUSTOM_RNG_PERS_MAX) {
+        seed_len = CUSTOM_RNG_PERS_MAX;
+    }
+
     if (seed_data != NULL && seed_len > 0) {
-        for (size_t i = 0; i < seed_len; i++) {
-            seed = seed * 31 + seed_data[i];
-        }
+        memcpy(ctx->pers, seed_data, seed_len);
+    } else {
+        seed_len = 0;
+    }
+
+    ctx->pers_len = seed_len;
+
+    /* Seed the calling thread now so the first handshake does not pay for it */
+    if ((ret = custom_rng_thread(ctx, &state)) != CUSTOM_RNG_OK) {
+        return ret;
     }
-    
-    ctx->seed = seed;
+
     ctx->initialized = 1;
-    
-    return 0;
+
+    return CUSTOM_RNG_OK;
 }
 
-/* Generate random data using /dev/urandom (Unix/Linux) */
+/* Generate random data from the calling thread's DRBG */
 int custom_rng_random(void *ctx, unsigned char *output, size_t len)
 {
     custom_rng_context *rng_ctx = (custom_rng_context *)ctx;
-    
-    if (rng_ctx == NULL || output == NULL || len == 0) {
-        return -1;
+    custom_rng_thread_t *state;
+    size_t chunk;
+    int ret;
+
+    if (rng_ctx == NULL || (output == NULL && len > 0)) {
+        return CUSTOM_RNG_ERR_INVALID_PARAM;
     }
-    
+
     if (!rng_ctx->initialized) {
-        return -1;
-    }
-    
-#ifdef __unix__
-    /* Use /dev/urandom for Unix/Linux systems */
-    int fd = open("/dev/urandom", O_RDONLY);
-    if (fd < 0) {
-        /* Fallback to weak random if /dev/urandom not available */
-        for (size_t i = 0; i < len; i++) {
-            output[i] = (unsigned char)(rand() & 0xFF);
-        }
-        return 0;
+        return CUSTOM_RNG_ERR_INVALID_PARAM;
     }
-    
-    ssize_t bytes_read = read(fd, output, len);
-    close(fd);
-    
-    if (bytes_read != (ssize_t)len) {
-        return -1;
+
+    if ((ret = custom_rng_thread(rng_ctx, &state)) != CUSTOM_RNG_OK) {
+        return ret;
     }
-#else
-    /* Simple fallback for non-Unix systems */
-    /* WARNING: This is not cryptographically secure! */
-    srand(rng_ctx->seed);
-    for (size_t i = 0; i < len; i++) {
-        output[i] = (unsigned char)(rand() & 0xFF);
-        rng_ctx->seed = rng_ctx->seed * 1103515245 + 12345; /* LCG */
+
+    while (len > 0) {
+        chunk = len < MBEDTLS_CTR_DRBG_MAX_REQUEST ? len : MBEDTLS_CTR_DRBG_MAX_REQUEST;
+
+        if (mbedtls_ctr_drbg_random(&state->drbg, output, chunk) != 0) {
+            state->seeded = 0;
+            return CUSTOM_RNG_ERR_DRBG_FAILED;
+        }
+
+        output += chunk;
+        len -= chunk;
     }
-#endif
-    
-    return 0;
+
+    return CUSTOM_RNG_OK;
 }
 
 /* Free custom RNG resources */
@@ -95,8 +223,8 @@ void custom_rng_free(custom_rng_context *ctx)
     if (ctx == NULL) {
         return;
     }
-    
-    ctx->initialized = 0;
-    ctx->seed = 0;
-    /* Clean up any additional resources here */
-}
\ No newline at end of file
+
+    /* The thread DRBGs are shared by every context used on a thread and
+     * are released by the thread exit destructor, not here */
+    memset(ctx, 0, sizeof(*ctx));
+}
@@ -1,6 +1,11 @@
 /*
  * Custom Random Number Generator
  * Alternative RNG implementation for mbedtls
+ *
+ * Each thread owns a CTR_DRBG seeded from the kernel CSPRNG (getrandom()),
+ * so custom_rng_random() needs no syscall and no lock on the hot path.
+ * The DRBG reseeds itself every CUSTOM_RNG_RESEED_INTERVAL requests and is
+ * reseeded from scratch in a child process after fork().
  */
 
 #ifndef CUSTOM_RNG_H
@@ -8,23 +13,40 @@
 
 #include <stddef.h>
 
+/* Error codes */
+#define CUSTOM_RNG_OK                       0
+#define CUSTOM_RNG_ERR_INVALID_PARAM       -1
+#define CUSTOM_RNG_ERR_ENTROPY_FAILED      -2
+#define CUSTOM_RNG_ERR_DRBG_FAILED         -3
+#define CUSTOM_RNG_ERR_ALLOC_FAILED        -4
+
+/* Longest personalization string kept from custom_rng_seed() */
+#define CUSTOM_RNG_PERS_MAX                32
+
+/* DRBG requests between automatic reseeds from the kernel */
+#define CUSTOM_RNG_RESEED_INTERVAL         4096
+
 /* Custom RNG context structure */
 typedef struct {
     int initialized;
-    unsigned int seed;
-    /* Add more fields as needed for your RNG implementation */
+    unsigned char pers[CUSTOM_RNG_PERS_MAX];    /* Personalization string */
+    size_t pers_len;
 } custom_rng_context;
 
 /* Initialize custom RNG */
 int custom_rng_init(custom_rng_context *ctx);
 
-/* Seed the custom RNG */
+/* Seed the custom RNG; seed_data is used as DRBG personalization string */
 int custom_rng_seed(custom_rng_context *ctx, const unsigned char *seed_data, size_t seed_len);
 
 /* Generate random data (compatible with mbedtls callback) */
 int custom_rng_random(void *ctx, unsigned char *output, size_t len);
 
-/* Free custom RNG resources */
+/* Fill output straight from the kernel CSPRNG (used for DRBG seeding) */
+int custom_rng_entropy(void *ctx, unsigned char *output, size_t len);
+
+/* Forget the context; the per-thread DRBGs stay for the other contexts
+ * and are freed when their thread exits */
 void custom_rng_free(custom_rng_context *ctx);
 
-#endif /* CUSTOM_RNG_H */
\ No newline at end of file
+#endif /* CUSTOM_RNG_H */
@@ -0,0 +1,649 @@
+/*
+ * Event loop implementation
+ * Level-triggered epoll reactor: every connection is registered for exactly
+ * the readiness event its current TCP or TLS operation is waiting on.
+ */
+
+#include "event_loop.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+/* Monotonic clock for the timer wheel */
+uint64_t event_loop_now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000u + (uint64_t)ts.tv_nsec / 1000000u;
+}
+
+/* Register or update the epoll interest set of a connection */
+static int event_conn_arm(event_conn_t *conn, uint32_t events)
+{
+    struct epoll_event ev;
+    int op;
+
+    if (conn->registered && conn->events == events) {
+        return EVENT_LOOP_OK;
+    }
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = events;
+    ev.data.ptr = conn;
+
+    op = conn->registered ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+
+    if (epoll_ctl(conn->loop->epfd, op, conn->transport.fd, &ev) < 0) {
+        return EVENT_LOOP_ERR_EPOLL_FAILED;
+    }
+
+    conn->registered = 1;
+    conn->events = events;
+
+    return EVENT_LOOP_OK;
+}
+
+/* Remove the connection from the epoll set and close the socket */
+static void event_conn_detach(event_conn_t *conn, int reason)
+{
+    event_loop_t *loop = conn->loop;
+    int phase;
+
+    if (conn->state == EVENT_CONN_CLOSED) {
+        return;
+    }
+
+    if (conn->registered && loop != NULL) {
+        epoll_ctl(loop->epfd, EPOLL_CTL_DEL, conn->transport.fd, NULL);
+    }
+
+    if (loop != NULL) {
+        timer_wheel_cancel(&loop->timers, &conn->timer);
+        timer_wheel_cancel(&loop->timers, &conn->attempt_timer);
+        resolver_cancel(loop->resolver, &conn->resolve);
+    }
+
+    /* A setup phase still running failed along with the connection */
+    for (phase = 0; phase < CONN_METRICS_PHASES; phase++) {
+        conn_metrics_phase_fail(conn->metrics, (conn_metrics_phase_t)phase);
+    }
+
+    conn->registered = 0;
+    conn->events = 0;
+    conn->state = EVENT_CONN_CLOSED;
+    transport_tcp_close(&conn->transport);
+
+    if (loop != NULL && loop->active > 0) {
+        loop->active--;
+    }
+
+    if (conn->on_close != NULL) {
+        conn->on_close(conn, reason);
+    }
+}
+
+/* Deadline expired: hung peer or idle connection */
+static void event_conn_timeout(timer_wheel_timer_t *timer, void *arg)
+{
+    (void)timer;
+    event_conn_detach((event_conn_t *)arg, EVENT_LOOP_ERR_TIMEOUT);
+}
+
+/* (Re)arm the connection deadline, or cancel it for timeout_ms 0 */
+static void event_conn_deadline(event_conn_t *conn, uint32_t timeout_ms)
+{
+    if (timeout_ms == 0) {
+        timer_wheel_cancel(&conn->loop->timers, &conn->timer);
+        return;
+    }
+
+    timer_wheel_schedule(&conn->loop->timers, &conn->timer,
+                         event_loop_now_ms(), timeout_ms);
+}
+
+/* Interest set for an established connection */
+static uint32_t event_conn_idle_events(const event_conn_t *conn)
+{
+    return EPOLLIN | (conn->want_write ? EPOLLOUT : 0);
+}
+
+/* Advance the TLS handshake as far as the socket allows */
+static void event_conn_handshake(event_conn_t *conn)
+{
+    int ret = mbedtls_ssl_handshake(&conn->ssl);
+
+    if (ret == MBEDTLS_ERR_SSL_WANT_READ) {
+        ret = event_conn_arm(conn, EPOLLIN);
+    } else if (ret == MBEDTLS_ERR_SSL_WANT_WRITE) {
+        ret = event_conn_arm(conn, EPOLLOUT);
+    } else if (ret == 0) {
+        conn_metrics_phase_end(conn->metrics, CONN_METRICS_PHASE_TLS_HANDSHAKE);
+        conn->state = EVENT_CONN_ESTABLISHED;
+        event_conn_deadline(conn, conn->idle_timeout_ms);
+        ret = event_conn_arm(conn, event_conn_idle_events(conn));
+        if (ret == EVENT_LOOP_OK && conn->on_connected != NULL) {
+            conn->on_connected(conn);
+        }
+    }
+
+    if (ret != 0) {
+        event_conn_detach(conn, ret);
+    }
+}
+
+/* Add a connect attempt to the epoll set, unless it is there already */
+static int event_conn_watch(event_conn_t *conn, int fd)
+{
+    struct epoll_event ev;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLOUT;
+    ev.data.ptr = conn;
+
+    if (epoll_ctl(conn->loop->epfd, EPOLL_CTL_ADD, fd, &ev) < 0 && errno != EEXIST) {
+        return EVENT_LOOP_ERR_EPOLL_FAILED;
+    }
+
+    return EVENT_LOOP_OK;
+}
+
+/* Continue after a transport_tcp_connect_*() call returned ret */
+static void event_conn_connecting(event_conn_t *conn, int ret)
+{
+    transport_tcp_t *tcp = &conn->transport;
+    size_t i;
+
+    if (ret < 0) {
+        event_conn_detach(conn, ret);
+        return;
+    }
+
+    /* Every attempt in flight waits for EPOLLOUT; closed ones left the
+     * set with their socket. The next address gets its turn after
+     * attempt_delay_ms unless an answer comes first. */
+    if (ret == TRANSPORT_TCP_IN_PROGRESS) {
+        conn->state = EVENT_CONN_CONNECTING;
+        for (i = 0; i < tcp->attempt_count; i++) {
+            ret = event_conn_watch(conn, tcp->attempts[i].fd);
+            if (ret != EVENT_LOOP_OK) {
+                event_conn_detach(conn, ret);
+                return;
+            }
+        }
+        if (tcp->pending_next < tcp->pending.count) {
+            timer_wheel_schedule(&conn->loop->timers, &conn->attempt_timer,
+                                 event_loop_now_ms(), tcp->attempt_delay_ms);
+        }
+        return;
+    }
+
+    /* The winner keeps its registration, or gets one if it connected at once */
+    timer_wheel_cancel(&conn->loop->timers, &conn->attempt_timer);
+    ret = event_conn_watch(conn, tcp->fd);
+    if (ret != EVENT_LOOP_OK) {
+        event_conn_detach(conn, ret);
+        return;
+    }
+    conn->registered = 1;
+    conn->events = EPOLLOUT;
+
+    conn->state = EVENT_CONN_HANDSHAKING;
+    conn_metrics_phase_begin(conn->metrics, CONN_METRICS_PHASE_TLS_HANDSHAKE);
+    event_conn_handshake(conn);
+}
+
+/* No answer within attempt_delay_ms: race the next address */
+static void event_conn_attempt(timer_wheel_timer_t *timer, void *arg)
+{
+    event_conn_t *conn = (event_conn_t *)arg;
+    tls_arena_t *prev;
+
+    (void)timer;
+
+    if (conn->state != EVENT_CONN_CONNECTING) {
+        return;
+    }
+
+    prev = tls_arena_enter(&conn->arena);
+    event_conn_connecting(conn, transport_tcp_connect_next(&conn->transport));
+    tls_arena_leave(prev);
+}
+
+/* Lookup of a resolving connection finished */
+static void event_conn_resolved(resolver_waiter_t *waiter, int status,
+                                const resolver_addrs_t *addrs)
+{
+    event_conn_t *conn = (event_conn_t *)waiter->arg;
+    tls_arena_t *prev;
+    int ret;
+
+    if (status != RESOLVER_OK) {
+        event_conn_detach(conn, TRANSPORT_TCP_ERR_UNKNOWN_HOST);
+        return;
+    }
+
+    conn_metrics_phase_end(conn->metrics, CONN_METRICS_PHASE_DNS);
+
+    ret = transport_tcp_connect_addrs_async(&conn->transport, conn->transport.host,
+                                            addrs, conn->port);
+
+    prev = tls_arena_enter(&conn->arena);
+    event_conn_connecting(conn, ret);
+    tls_arena_leave(prev);
+}
+
+/* Dispatch one readiness event according to the connection state */
+static void event_conn_dispatch(event_conn_t *conn, uint32_t events)
+{
+
+    switch (conn->state) {
+    case EVENT_CONN_CONNECTING:
+        event_conn_connecting(conn, transport_tcp_connect_finish(&conn->transport));
+        break;
+
+    case EVENT_CONN_HANDSHAKING:
+        event_conn_handshake(conn);
+        break;
+
+    case EVENT_CONN_ESTABLISHED:
+        /* Errors without pending input; with EPOLLIN the read reports EOF */
+        if ((events & (EPOLLERR | EPOLLHUP)) && !(events & EPOLLIN)) {
+            event_conn_detach(conn, TRANSPORT_TCP_ERR_RECV_FAILED);
+            return;
+        }
+        if ((events & EPOLLOUT) && conn->on_writable != NULL) {
+            conn->on_writable(conn);
+        }
+        if (conn->state == EVENT_CONN_ESTABLISHED && (events & EPOLLIN)) {
+            if (conn->idle_timeout_ms != 0) {
+                event_conn_deadline(conn, conn->idle_timeout_ms);
+            }
+            if (conn->on_readable != NULL) {
+                conn->on_readable(conn);
+            }
+        }
+        break;
+
+    default:
+        break;
+    }
+}
+
+/* Initialize the loop */
+int event_loop_init(event_loop_t *loop)
+{
+    if (loop == NULL) {
+        return EVENT_LOOP_ERR_INVALID_PARAM;
+    }
+
+    loop->running = 0;
+    loop->active = 0;
+    loop->resolver = NULL;
+    loop->wake_fd = -1;
+    loop->on_wake = NULL;
+    loop->wake_arg = NULL;
+    timer_wheel_init(&loop->timers, TIMER_WHEEL_TICK_MS, event_loop_now_ms());
+    loop->epfd = epoll_create1(EPOLL_CLOEXEC);
+
+    if (loop->epfd < 0) {
+        return EVENT_LOOP_ERR_EPOLL_FAILED;
+    }
+
+    return EVENT_LOOP_OK;
+}
+
+/* Run one epoll_wait() round and dispatch events */
+int event_loop_run_once(event_loop_t *loop, int timeout_ms)
+{
+    struct epoll_event events[EVENT_LOOP_MAX_EVENTS];
+    event_conn_t *conn;
+    tls_arena_t *prev;
+    int n, i, timer_ms;
+
+    if (loop == NULL || loop->epfd < 0) {
+        return EVENT_LOOP_ERR_INVALID_PARAM;
+    }
+
+    timer_ms = timer_wheel_next_timeout(&loop->timers, event_loop_now_ms());
+    if (timer_ms >= 0 && (timeout_ms < 0 || timer_ms < timeout_ms)) {
+        timeout_ms = timer_ms;
+    }
+
+    /* DNS retransmissions run on their own clock */
+    timer_ms = resolver_next_timeout(loop->resolver, resolver_now_ms());
+    if (timer_ms >= 0 && (timeout_ms < 0 || timer_ms < timeout_ms)) {
+        timeout_ms = timer_ms;
+    }
+
+    n = epoll_wait(loop->epfd, events, EVENT_LOOP_MAX_EVENTS, timeout_ms);
+    if (n < 0) {
+        if (errno != EINTR) {
+            return EVENT_LOOP_ERR_EPOLL_FAILED;
+        }
+        n = 0;
+    }
+
+    for (i = 0; i < n; i++) {
+        if (loop->resolver != NULL && events[i].data.ptr == (void *)loop->resolver) {
+            resolver_process(loop->resolver);
+            continue;
+        }
+        if (events[i].data.ptr == (void *)&loop->wake_fd) {
+            uint64_t count;
+            if (read(loop->wake_fd, &count, sizeof(count)) == sizeof(count) &&
+                loop->on_wake != NULL) {
+                loop->on_wake(loop, loop->wake_arg);
+            }
+            continue;
+        }
+        conn = (event_conn_t *)events[i].data.ptr;
+        prev = tls_arena_enter(&conn->arena);
+        event_conn_dispatch(conn, events[i].events);
+        tls_arena_leave(prev);
+    }
+
+    resolver_tick(loop->resolver, resolver_now_ms());
+    timer_wheel_advance(&loop->timers, event_loop_now_ms());
+
+    return n;
+}
+
+/* Run until stopped or idle */
+int event_loop_run(event_loop_t *loop)
+{
+    int ret;
+
+    if (loop == NULL) {
+        return EVENT_LOOP_ERR_INVALID_PARAM;
+    }
+
+    loop->running = 1;
+
+    while (loop->running && loop->active > 0) {
+        ret = event_loop_run_once(loop, -1);
+        if (ret < 0) {
+            loop->running = 0;
+            return ret;
+        }
+    }
+
+    loop->running = 0;
+
+    return EVENT_LOOP_OK;
+}
+
+/* Resolve host names on the loop */
+int event_loop_set_resolver(event_loop_t *loop, resolver_t *res)
+{
+    struct epoll_event ev;
+
+    if (loop == NULL || loop->epfd < 0 || loop->resolver != NULL ||
+        res == NULL || resolver_fd(res) < 0) {
+        return EVENT_LOOP_ERR_INVALID_PARAM;
+    }
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.ptr = res;
+
+    if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, resolver_fd(res), &ev) < 0) {
+        return EVENT_LOOP_ERR_EPOLL_FAILED;
+    }
+
+    loop->resolver = res;
+
+    return EVENT_LOOP_OK;
+}
+
+/* Create and register the wakeup eventfd */
+int event_loop_set_wakeup(event_loop_t *loop, event_loop_wake_cb cb, void *arg)
+{
+    struct epoll_event ev;
+
+    if (loop == NULL || loop->epfd < 0 || loop->wake_fd >= 0) {
+        return EVENT_LOOP_ERR_INVALID_PARAM;
+    }
+
+    loop->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (loop->wake_fd < 0) {
+        return EVENT_LOOP_ERR_EPOLL_FAILED;
+    }
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.ptr = &loop->wake_fd;
+
+    if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, loop->wake_fd, &ev) < 0) {
+        close(loop->wake_fd);
+        loop->wake_fd = -1;
+        return EVENT_LOOP_ERR_EPOLL_FAILED;
+    }
+
+    loop->on_wake = cb;
+    loop->wake_arg = arg;
+
+    return EVENT_LOOP_OK;
+}
+
+/* Interrupt the wait from any thread */
+int event_loop_wake(event_loop_t *loop)
+{
+    uint64_t one = 1;
+
+    if (loop == NULL || loop->wake_fd < 0) {
+        return EVENT_LOOP_ERR_INVALID_PARAM;
+    }
+
+    /* EAGAIN: the counter is saturated, a wakeup is pending anyway */
+    if (write(loop->wake_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+        return EVENT_LOOP_ERR_EPOLL_FAILED;
+    }
+
+    return EVENT_LOOP_OK;
+}
+
+/* Ask event_loop_run() to return */
+void event_loop_stop(event_loop_t *loop)
+{
+    if (loop != NULL) {
+        loop->running = 0;
+    }
+}
+
+/* Release the loop */
+void event_loop_free(event_loop_t *loop)
+{
+    if (loop == NULL) {
+        return;
+    }
+
+    if (loop->wake_fd >= 0) {
+        close(loop->wake_fd);
+        loop->wake_fd = -1;
+    }
+
+    if (loop->epfd >= 0) {
+        close(loop->epfd);
+        loop->epfd = -1;
+    }
+
+    loop->active = 0;
+}
+
+/* Initialize a connection */
+int event_conn_init(event_conn_t *conn, const mbedtls_ssl_config *conf)
+{
+    tls_arena_t *prev;
+    int ret;
+
+    if (conn == NULL || conf == NULL) {
+        return EVENT_LOOP_ERR_INVALID_PARAM;
+    }
+
+    memset(conn, 0, sizeof(*conn));
+    transport_tcp_init(&conn->transport);
+    mbedtls_ssl_init(&conn->ssl);
+    conn->state = EVENT_CONN_IDLE;
+    conn->handshake_timeout_ms = EVENT_LOOP_HANDSHAKE_TIMEOUT_MS;
+    timer_wheel_timer_init(&conn->timer, event_conn_timeout, conn);
+    timer_wheel_timer_init(&conn->attempt_timer, event_conn_attempt, conn);
+    conn->resolve.cb = event_conn_resolved;
+    conn->resolve.arg = conn;
+    tls_arena_init(&conn->arena, 0);
+
+    /* The record buffers, the largest part of an idle session */
+    prev = tls_arena_enter(&conn->arena);
+    ret = mbedtls_ssl_setup(&conn->ssl, conf);
+    tls_arena_leave(prev);
+
+    if (ret != 0) {
+        mbedtls_ssl_free(&conn->ssl);
+        tls_arena_free(&conn->arena);
+        return EVENT_LOOP_ERR_SSL_SETUP_FAILED;
+    }
+
+    mbedtls_ssl_set_bio(&conn->ssl, &conn->transport,
+                        transport_tcp_send, transport_tcp_recv, NULL);
+
+    return EVENT_LOOP_OK;
+}
+
+/* Start an asynchronous lookup + connect + handshake */
+int event_conn_start(event_loop_t *loop, event_conn_t *conn,
+                     const char *host, const char *port)
+{
+    resolver_addrs_t addrs;
+    unsigned long port_num;
+    tls_arena_t *prev;
+    char *end;
+    int ret, resolving = 0;
+
+    if (loop == NULL || conn == NULL || host == NULL || port == NULL ||
+        conn->state != EVENT_CONN_IDLE) {
+        return EVENT_LOOP_ERR_INVALID_PARAM;
+    }
+
+    if (mbedtls_ssl_set_hostname(&conn->ssl, host) != 0) {
+        return EVENT_LOOP_ERR_SSL_SETUP_FAILED;
+    }
+
+    conn->transport.metrics = conn->metrics;
+    if (conn->metrics != NULL) {
+        conn->metrics->tls = 1;
+    }
+
+    if (loop->resolver == NULL) {
+        ret = transport_tcp_connect_async(&conn->transport, host, port);
+    } else {
+        port_num = strtoul(port, &end, 10);
+        if (*port == '\0' || *end != '\0' || port_num > 65535) {
+            return EVENT_LOOP_ERR_INVALID_PARAM;
+        }
+        conn->port = (uint16_t)port_num;
+
+        /* Kept for the lookup and the family that connects */
+        conn->transport.resolver = loop->resolver;
+        snprintf(conn->transport.host, sizeof(conn->transport.host), "%s", host);
+
+        /* Cache hits connect right away, misses wait in EVENT_CONN_RESOLVING */
+        conn_metrics_phase_begin(conn->metrics, CONN_METRICS_PHASE_DNS);
+        ret = resolver_query(loop->resolver, host, &addrs, &conn->resolve);
+        if (ret == RESOLVER_IN_PROGRESS) {
+            resolving = 1;
+        } else if (ret == RESOLVER_OK) {
+            conn_metrics_phase_end(conn->metrics, CONN_METRICS_PHASE_DNS);
+            ret = transport_tcp_connect_addrs_async(&conn->transport, conn->transport.host,
+                                                    &addrs, conn->port);
+        }
+    }
+    if (ret < 0) {
+        conn_metrics_phase_fail(conn->metrics, CONN_METRICS_PHASE_DNS);
+        return EVENT_LOOP_ERR_CONNECT_FAILED;
+    }
+
+    conn->loop = loop;
+    loop->active++;
+    event_conn_deadline(conn, conn->handshake_timeout_ms);
+
+    if (resolving) {
+        conn->state = EVENT_CONN_RESOLVING;
+        return EVENT_LOOP_OK;
+    }
+
+    prev = tls_arena_enter(&conn->arena);
+    event_conn_connecting(conn, ret);
+    tls_arena_leave(prev);
+
+    return conn->state == EVENT_CONN_CLOSED ? EVENT_LOOP_ERR_CONNECT_FAILED
+                                            : EVENT_LOOP_OK;
+}
+
+/* Set the idle deadline of an established connection */
+int event_conn_set_idle_timeout(event_conn_t *conn, uint32_t timeout_ms)
+{
+    if (conn == NULL) {
+        return EVENT_LOOP_ERR_INVALID_PARAM;
+    }
+
+    conn->idle_timeout_ms = timeout_ms;
+
+    if (conn->state != EVENT_CONN_ESTABLISHED) {
+        return conn->state == EVENT_CONN_CLOSED ? EVENT_LOOP_ERR_CLOSED
+                                                : EVENT_LOOP_OK;
+    }
+
+    event_conn_deadline(conn, timeout_ms);
+
+    return EVENT_LOOP_OK;
+}
+
+/* Request or cancel on_writable notifications */
+int event_conn_want_write(event_conn_t *conn, int enable)
+{
+    if (conn == NULL) {
+        return EVENT_LOOP_ERR_INVALID_PARAM;
+    }
+
+    conn->want_write = enable ? 1 : 0;
+
+    if (conn->state != EVENT_CONN_ESTABLISHED) {
+        return conn->state == EVENT_CONN_CLOSED ? EVENT_LOOP_ERR_CLOSED
+                                                : EVENT_LOOP_OK;
+    }
+
+    return event_conn_arm(conn, event_conn_idle_events(conn));
+}
+
+/* Close the connection */
+void event_conn_close(event_conn_t *conn)
+{
+    if (conn == NULL || conn->state == EVENT_CONN_CLOSED) {
+        return;
+    }
+
+    if (conn->state == EVENT_CONN_ESTABLISHED) {
+        mbedtls_ssl_close_notify(&conn->ssl);
+    }
+
+    event_conn_detach(conn, 0);
+}
+
+/* Free the ssl context */
+void event_conn_free(event_conn_t *conn)
+{
+    if (conn == NULL) {
+        return;
+    }
+
+    event_conn_close(conn);
+    mbedtls_ssl_free(&conn->ssl);
+    tls_arena_free(&conn->arena);
+    conn->loop = NULL;
+}
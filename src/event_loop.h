@@ -0,0 +1,154 @@
+/*
+ * Event loop
+ * epoll reactor driving many non-blocking transport_tcp_t + mbedtls sessions
+ */
+
+#ifndef EVENT_LOOP_H
+#define EVENT_LOOP_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "transport_tcp.h"
+#include "resolver.h"
+#include "timer_wheel.h"
+#include "tls_arena.h"
+#include "mbedtls/ssl.h"
+
+/* Error codes */
+#define EVENT_LOOP_OK                       0
+#define EVENT_LOOP_ERR_EPOLL_FAILED        -1
+#define EVENT_LOOP_ERR_INVALID_PARAM       -2
+#define EVENT_LOOP_ERR_CONNECT_FAILED      -3
+#define EVENT_LOOP_ERR_SSL_SETUP_FAILED    -4
+#define EVENT_LOOP_ERR_CLOSED              -5
+#define EVENT_LOOP_ERR_TIMEOUT             -6
+
+/* Maximum number of readiness events handled per epoll_wait() */
+#define EVENT_LOOP_MAX_EVENTS              256
+
+/* Default deadline for TCP connect + TLS handshake */
+#define EVENT_LOOP_HANDSHAKE_TIMEOUT_MS    10000
+
+/* Connection states */
+typedef enum {
+    EVENT_CONN_IDLE = 0,        /* Initialized, not started */
+    EVENT_CONN_RESOLVING,       /* Waiting for the loop's resolver */
+    EVENT_CONN_CONNECTING,      /* Non-blocking TCP connect pending */
+    EVENT_CONN_HANDSHAKING,     /* TLS handshake in progress */
+    EVENT_CONN_ESTABLISHED,     /* Handshake done, application data flows */
+    EVENT_CONN_CLOSED           /* Closed or failed */
+} event_conn_state_t;
+
+typedef struct event_loop event_loop_t;
+typedef struct event_conn event_conn_t;
+
+/* Called on the loop thread after event_loop_wake() */
+typedef void (*event_loop_wake_cb)(event_loop_t *loop, void *arg);
+
+/* Called once the handshake completes (status 0) */
+typedef void (*event_conn_connected_cb)(event_conn_t *conn);
+
+/* Called when the socket is ready; the callee should drain mbedtls_ssl_read()
+ * or mbedtls_ssl_write() until it returns WANT_READ/WANT_WRITE */
+typedef void (*event_conn_io_cb)(event_conn_t *conn);
+
+/* Called once when the connection is closed; reason is 0 for a local close,
+ * EVENT_LOOP_ERR_TIMEOUT for an expired deadline, a TRANSPORT_TCP_ or
+ * mbedtls error code otherwise */
+typedef void (*event_conn_close_cb)(event_conn_t *conn, int reason);
+
+/* One TCP + TLS session owned by the loop. The structure must not move in
+ * memory between event_conn_init() and event_conn_free(): the ssl context
+ * keeps a pointer to the embedded transport. */
+struct event_conn {
+    transport_tcp_t transport;      /* Non-blocking TCP socket */
+    mbedtls_ssl_context ssl;        /* TLS session */
+    event_conn_state_t state;       /* Current state */
+    event_loop_t *loop;             /* Owning loop, NULL when detached */
+    uint32_t events;                /* Currently registered epoll events */
+    int registered;                 /* fd is in the epoll set */
+    int want_write;                 /* Application wants EPOLLOUT */
+    uint32_t handshake_timeout_ms;  /* Connect + handshake deadline, 0 = none */
+    uint32_t idle_timeout_ms;       /* Close after this long without input, 0 = none */
+    timer_wheel_timer_t timer;      /* Current deadline */
+    timer_wheel_timer_t attempt_timer; /* Happy Eyeballs: start of the next connect attempt */
+    conn_metrics_t *metrics;        /* Optional, set before event_conn_start() */
+    resolver_waiter_t resolve;      /* Pending lookup in EVENT_CONN_RESOLVING */
+    tls_arena_t arena;              /* TLS heap use; arena.limit may be set after init */
+    uint16_t port;                  /* Remote port once the lookup completes */
+
+    event_conn_connected_cb on_connected;
+    event_conn_io_cb on_readable;
+    event_conn_io_cb on_writable;
+    event_conn_close_cb on_close;
+    void *user_data;                /* Opaque pointer for callbacks */
+};
+
+/* Event loop context */
+struct event_loop {
+    int epfd;                       /* epoll instance */
+    int running;                    /* Cleared by event_loop_stop() */
+    size_t active;                  /* Connections not yet closed */
+    timer_wheel_t timers;           /* Connection and user deadlines */
+    resolver_t *resolver;           /* Non-blocking lookups, NULL = blocking */
+    int wake_fd;                    /* eventfd of event_loop_wake(), -1 = none */
+    event_loop_wake_cb on_wake;
+    void *wake_arg;
+};
+
+/* Initialize the loop (creates the epoll instance) */
+int event_loop_init(event_loop_t *loop);
+
+/* Monotonic clock used for loop->timers, in milliseconds */
+uint64_t event_loop_now_ms(void);
+
+/* Run one epoll_wait() round, dispatch events and fire due timers. The wait
+ * is shortened to the next timer deadline when that comes first.
+ * Returns the number of events handled or a negative error code. */
+int event_loop_run_once(event_loop_t *loop, int timeout_ms);
+
+/* Run until event_loop_stop() is called or no active connections remain */
+int event_loop_run(event_loop_t *loop);
+
+/* Ask event_loop_run() to return after the current round */
+void event_loop_stop(event_loop_t *loop);
+
+/* Resolve host names of event_conn_start() on the loop with res (owned by
+ * the caller, not shared with another thread) instead of blocking in
+ * getaddrinfo(); registers resolver_fd() with the loop */
+int event_loop_set_resolver(event_loop_t *loop, resolver_t *res);
+
+/* Create the wakeup eventfd of the loop; cb(loop, arg) runs on the loop
+ * thread once per round in which event_loop_wake() was called */
+int event_loop_set_wakeup(event_loop_t *loop, event_loop_wake_cb cb, void *arg);
+
+/* Interrupt the loop's wait; the only call that is safe from other threads */
+int event_loop_wake(event_loop_t *loop);
+
+/* Release the loop (connections must be closed by the caller) */
+void event_loop_free(event_loop_t *loop);
+
+/* Initialize a connection and bind its ssl context to conf. Every mbedtls
+ * allocation of the connection, from here to event_conn_free(), is charged
+ * to conn->arena once tls_arena_install() has run. */
+int event_conn_init(event_conn_t *conn, const mbedtls_ssl_config *conf);
+
+/* Start an asynchronous lookup (with a loop resolver) + connect + handshake
+ * to host:port on the loop; port must be numeric with a resolver */
+int event_conn_start(event_loop_t *loop, event_conn_t *conn,
+                     const char *host, const char *port);
+
+/* Set the idle deadline of an established connection (0 disables it);
+ * the timer restarts whenever input arrives */
+int event_conn_set_idle_timeout(event_conn_t *conn, uint32_t timeout_ms);
+
+/* Request or cancel on_writable notifications for an established connection */
+int event_conn_want_write(event_conn_t *conn, int enable);
+
+/* Send close_notify (best effort), deregister and close the socket */
+void event_conn_close(event_conn_t *conn);
+
+/* Free the ssl context of a closed connection */
+void event_conn_free(event_conn_t *conn);
+
+#endif /* EVENT_LOOP_H */
@@ -0,0 +1,398 @@
+/*
+ * Incremental HTTP/1.1 response parser implementation
+ */
+
+#include "http_parser.h"
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+
+/* Parser states */
+enum {
+    HTTP_STATE_STATUS_LINE = 0,
+    HTTP_STATE_HEADER_LINE,
+    HTTP_STATE_BODY_IDENTITY,
+    HTTP_STATE_BODY_UNTIL_CLOSE,
+    HTTP_STATE_CHUNK_SIZE,
+    HTTP_STATE_CHUNK_DATA,
+    HTTP_STATE_CHUNK_DATA_END,
+    HTTP_STATE_TRAILER,
+    HTTP_STATE_COMPLETE,
+    HTTP_STATE_ERROR
+};
+
+/* Record an error and stop */
+static int http_fail(http_parser_t *p, int error)
+{
+    p->error = error;
+    p->state = HTTP_STATE_ERROR;
+    return error;
+}
+
+/* Mark the message complete */
+static int http_complete(http_parser_t *p, const http_parser_settings_t *s)
+{
+    p->state = HTTP_STATE_COMPLETE;
+
+    if (s->on_message_complete != NULL && s->on_message_complete(p) != 0) {
+        return http_fail(p, HTTP_PARSER_ERR_CALLBACK);
+    }
+
+    return HTTP_PARSER_OK;
+}
+
+/* Case-insensitive search for token in a header value */
+static int http_value_has(const char *value, size_t len, const char *token)
+{
+    size_t tlen = strlen(token), i;
+
+    for (i = 0; i + tlen <= len; i++) {
+        if (strncasecmp(value + i, token, tlen) == 0) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/* "HTTP/1.1 200 OK" */
+static int http_parse_status(http_parser_t *p, const http_parser_settings_t *s,
+                             const char *line, size_t len)
+{
+    int code = 0;
+    size_t i;
+
+    if (len < 12 || memcmp(line, "HTTP/", 5) != 0 || !isdigit((unsigned char) line[5]) ||
+        line[6] != '.' || !isdigit((unsigned char) line[7]) || line[8] != ' ') {
+        return http_fail(p, HTTP_PARSER_ERR_INVALID_STATUS);
+    }
+
+    for (i = 9; i < 12; i++) {
+        if (!isdigit((unsigned char) line[i])) {
+            return http_fail(p, HTTP_PARSER_ERR_INVALID_STATUS);
+        }
+        code = code * 10 + (line[i] - '0');
+    }
+
+    p->http_major = line[5] - '0';
+    p->http_minor = line[7] - '0';
+    p->status_code = code;
+    p->keep_alive = (p->http_major == 1 && p->http_minor >= 1);
+    p->state = HTTP_STATE_HEADER_LINE;
+
+    if (s->on_status != NULL && s->on_status(p) != 0) {
+        return http_fail(p, HTTP_PARSER_ERR_CALLBACK);
+    }
+
+    return HTTP_PARSER_OK;
+}
+
+/* Decide how the body is framed once all headers are in */
+static int http_headers_done(http_parser_t *p, const http_parser_settings_t *s)
+{
+    /* Interim responses (100 Continue, ...) are followed by the real one */
+    if (p->status_code / 100 == 1 && p->status_code != 101) {
+        p->state = HTTP_STATE_STATUS_LINE;
+        p->chunked = 0;
+        p->content_length = -1;
+        return HTTP_PARSER_OK;
+    }
+
+    if (s->on_headers_complete != NULL && s->on_headers_complete(p) != 0) {
+        return http_fail(p, HTTP_PARSER_ERR_CALLBACK);
+    }
+
+    if (p->head_response || p->status_code / 100 == 1 ||
+        p->status_code == 204 || p->status_code == 304) {
+        return http_complete(p, s);
+    }
+
+    if (p->chunked) {
+        p->state = HTTP_STATE_CHUNK_SIZE;
+    } else if (p->content_length >= 0) {
+        p->remaining = (uint64_t) p->content_length;
+        if (p->remaining == 0) {
+            return http_complete(p, s);
+        }
+        p->state = HTTP_STATE_BODY_IDENTITY;
+    } else {
+        p->keep_alive = 0;
+        p->state = HTTP_STATE_BODY_UNTIL_CLOSE;
+    }
+
+    return HTTP_PARSER_OK;
+}
+
+/* "Name: value" or the empty line ending the header block */
+static int http_parse_header(http_parser_t *p, const http_parser_settings_t *s,
+                             const char *line, size_t len)
+{
+    const char *colon, *value;
+    size_t name_len, value_len;
+
+    if (len == 0) {
+        return http_headers_done(p, s);
+    }
+
+    colon = memchr(line, ':', len);
+    if (colon == NULL || colon == line) {
+        return http_fail(p, HTTP_PARSER_ERR_INVALID_HEADER);
+    }
+
+    name_len = (size_t)(colon - line);
+    value = colon + 1;
+    value_len = len - name_len - 1;
+
+    while (value_len > 0 && (*value == ' ' || *value == '\t')) {
+        value++;
+        value_len--;
+    }
+    while (value_len > 0 && (value[value_len - 1] == ' ' || value[value_len - 1] == '\t')) {
+        value_len--;
+    }
+
+    if (name_len == 14 && strncasecmp(line, "Content-Length", 14) == 0) {
+        uint64_t n = 0;
+        size_t i;
+
+        if (value_len == 0) {
+            return http_fail(p, HTTP_PARSER_ERR_INVALID_HEADER);
+        }
+        for (i = 0; i < value_len; i++) {
+            if (!isdigit((unsigned char) value[i]) || n > (UINT64_MAX - 9) / 10) {
+                return http_fail(p, HTTP_PARSER_ERR_INVALID_HEADER);
+            }
+            n = n * 10 + (uint64_t)(value[i] - '0');
+        }
+        p->content_length = (int64_t) n;
+    } else if (name_len == 17 && strncasecmp(line, "Transfer-Encoding", 17) == 0) {
+        p->chunked = http_value_has(value, value_len, "chunked");
+    } else if (name_len == 10 && strncasecmp(line, "Connection", 10) == 0) {
+        if (http_value_has(value, value_len, "close")) {
+            p->keep_alive = 0;
+        } else if (http_value_has(value, value_len, "keep-alive")) {
+            p->keep_alive = 1;
+        }
+    }
+
+    if (s->on_header != NULL && s->on_header(p, line, name_len, value, value_len) != 0) {
+        return http_fail(p, HTTP_PARSER_ERR_CALLBACK);
+    }
+
+    return HTTP_PARSER_OK;
+}
+
+/* Hex chunk size, optionally followed by ";extensions" */
+static int http_parse_chunk_size(http_parser_t *p, const http_parser_settings_t *s,
+                                 const char *line, size_t len)
+{
+    uint64_t size = 0;
+    size_t i;
+    int digits = 0;
+
+    for (i = 0; i < len; i++) {
+        char c = line[i];
+        int v;
+
+        if (c >= '0' && c <= '9') {
+            v = c - '0';
+        } else if (c >= 'a' && c <= 'f') {
+            v = c - 'a' + 10;
+        } else if (c >= 'A' && c <= 'F') {
+            v = c - 'A' + 10;
+        } else if (c == ';' || c == ' ' || c == '\t') {
+            break;
+        } else {
+            return http_fail(p, HTTP_PARSER_ERR_INVALID_CHUNK);
+        }
+
+        if (size > (UINT64_MAX >> 4)) {
+            return http_fail(p, HTTP_PARSER_ERR_INVALID_CHUNK);
+        }
+        size = (size << 4) | (uint64_t) v;
+        digits++;
+    }
+
+    if (digits == 0) {
+        return http_fail(p, HTTP_PARSER_ERR_INVALID_CHUNK);
+    }
+
+    (void) s;
+    p->remaining = size;
+    p->state = size == 0 ? HTTP_STATE_TRAILER : HTTP_STATE_CHUNK_DATA;
+
+    return HTTP_PARSER_OK;
+}
+
+/* Dispatch one complete line (CRLF stripped) */
+static int http_parse_line(http_parser_t *p, const http_parser_settings_t *s,
+                           const char *line, size_t len)
+{
+    switch (p->state) {
+    case HTTP_STATE_STATUS_LINE:
+        /* Tolerate stray empty lines between responses */
+        return len == 0 ? HTTP_PARSER_OK : http_parse_status(p, s, line, len);
+    case HTTP_STATE_HEADER_LINE:
+        return http_parse_header(p, s, line, len);
+    case HTTP_STATE_CHUNK_SIZE:
+        return http_parse_chunk_size(p, s, line, len);
+    case HTTP_STATE_CHUNK_DATA_END:
+        if (len != 0) {
+            return http_fail(p, HTTP_PARSER_ERR_INVALID_CHUNK);
+        }
+        p->state = HTTP_STATE_CHUNK_SIZE;
+        return HTTP_PARSER_OK;
+    case HTTP_STATE_TRAILER:
+        return len == 0 ? http_complete(p, s) : HTTP_PARSER_OK;
+    default:
+        return http_fail(p, HTTP_PARSER_ERR_INVALID_HEADER);
+    }
+}
+
+/* Consume one line from data; returns bytes consumed (0 if it needs more) */
+static size_t http_consume_line(http_parser_t *p, const http_parser_settings_t *s,
+                                const char *data, size_t len)
+{
+    const char *nl = memchr(data, '\n', len);
+    const char *line;
+    size_t take, line_len;
+
+    if (nl == NULL) {
+        /* Partial line: keep it for the next call */
+        if (p->line_len + len > sizeof(p->line)) {
+            http_fail(p, HTTP_PARSER_ERR_LINE_TOO_LONG);
+            return 0;
+        }
+        memcpy(p->line + p->line_len, data, len);
+        p->line_len += len;
+        return len;
+    }
+
+    take = (size_t)(nl - data) + 1;
+
+    if (p->line_len == 0) {
+        /* Whole line is in the caller's buffer: parse it in place */
+        line = data;
+        line_len = take - 1;
+    } else {
+        if (p->line_len + take > sizeof(p->line)) {
+            http_fail(p, HTTP_PARSER_ERR_LINE_TOO_LONG);
+            return 0;
+        }
+        memcpy(p->line + p->line_len, data, take);
+        line = p->line;
+        line_len = p->line_len + take - 1;
+    }
+
+    p->line_len = 0;
+
+    if (line_len > 0 && line[line_len - 1] == '\r') {
+        line_len--;
+    }
+
+    http_parse_line(p, s, line, line_len);
+
+    return take;
+}
+
+/* Prepare for a new response */
+void http_parser_init(http_parser_t *p, int head_response, void *data)
+{
+    if (p == NULL) {
+        return;
+    }
+
+    memset(p, 0, offsetof(http_parser_t, line));
+    p->data = data;
+    p->state = HTTP_STATE_STATUS_LINE;
+    p->head_response = head_response;
+    p->content_length = -1;
+}
+
+/* Feed data */
+size_t http_parser_execute(http_parser_t *p, const http_parser_settings_t *settings,
+                           const char *data, size_t len)
+{
+    static const http_parser_settings_t no_settings;
+    const http_parser_settings_t *s = settings != NULL ? settings : &no_settings;
+    size_t pos = 0, n;
+
+    if (p == NULL || data == NULL) {
+        return 0;
+    }
+
+    while (pos < len && p->state != HTTP_STATE_COMPLETE && p->state != HTTP_STATE_ERROR) {
+        switch (p->state) {
+        case HTTP_STATE_BODY_IDENTITY:
+        case HTTP_STATE_CHUNK_DATA:
+            n = len - pos;
+            if ((uint64_t) n > p->remaining) {
+                n = (size_t) p->remaining;
+            }
+            if (s->on_body != NULL && s->on_body(p, data + pos, n) != 0) {
+                http_fail(p, HTTP_PARSER_ERR_CALLBACK);
+                break;
+            }
+            pos += n;
+            p->remaining -= n;
+            if (p->remaining == 0) {
+                if (p->state == HTTP_STATE_CHUNK_DATA) {
+                    p->state = HTTP_STATE_CHUNK_DATA_END;
+                } else {
+                    http_complete(p, s);
+                }
+            }
+            break;
+
+        case HTTP_STATE_BODY_UNTIL_CLOSE:
+            n = len - pos;
+            if (s->on_body != NULL && s->on_body(p, data + pos, n) != 0) {
+                http_fail(p, HTTP_PARSER_ERR_CALLBACK);
+                break;
+            }
+            pos += n;
+            break;
+
+        default:
+            n = http_consume_line(p, s, data + pos, len - pos);
+            pos += n;
+            break;
+        }
+    }
+
+    return pos;
+}
+
+/* Signal that the peer closed the connection */
+int http_parser_finish(http_parser_t *p, const http_parser_settings_t *settings)
+{
+    static const http_parser_settings_t no_settings;
+    const http_parser_settings_t *s = settings != NULL ? settings : &no_settings;
+
+    if (p == NULL) {
+        return HTTP_PARSER_ERR_UNEXPECTED_EOF;
+    }
+
+    switch (p->state) {
+    case HTTP_STATE_COMPLETE:
+        return HTTP_PARSER_OK;
+    case HTTP_STATE_ERROR:
+        return p->error;
+    case HTTP_STATE_BODY_UNTIL_CLOSE:
+        return http_complete(p, s);
+    default:
+        return http_fail(p, HTTP_PARSER_ERR_UNEXPECTED_EOF);
+    }
+}
+
+/* Response fully parsed */
+int http_parser_is_complete(const http_parser_t *p)
+{
+    return p != NULL && p->state == HTTP_STATE_COMPLETE;
+}
+
+/* Parsing failed */
+int http_parser_has_error(const http_parser_t *p)
+{
+    return p == NULL || p->state == HTTP_STATE_ERROR;
+}
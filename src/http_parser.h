@@ -0,0 +1,79 @@
+/*
+ * Incremental HTTP/1.1 response parser
+ * Callback driven, fed with whatever chunks the transport returns. Body data
+ * is passed to on_body as pointers into the caller's buffer (never copied);
+ * only header lines split across reads are assembled in a small line buffer.
+ */
+
+#ifndef HTTP_PARSER_H
+#define HTTP_PARSER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Error codes */
+#define HTTP_PARSER_OK                      0
+#define HTTP_PARSER_ERR_INVALID_STATUS     -1
+#define HTTP_PARSER_ERR_INVALID_HEADER     -2
+#define HTTP_PARSER_ERR_INVALID_CHUNK      -3
+#define HTTP_PARSER_ERR_LINE_TOO_LONG      -4
+#define HTTP_PARSER_ERR_CALLBACK           -5
+#define HTTP_PARSER_ERR_UNEXPECTED_EOF     -6
+
+/* Longest status, header, chunk-size or trailer line */
+#define HTTP_PARSER_LINE_MAX               2048
+
+typedef struct http_parser http_parser_t;
+
+typedef int (*http_parser_cb)(http_parser_t *p);
+typedef int (*http_parser_data_cb)(http_parser_t *p, const char *at, size_t len);
+typedef int (*http_parser_header_cb)(http_parser_t *p, const char *name, size_t name_len,
+                                     const char *value, size_t value_len);
+
+/* Callbacks; any of them may be NULL. A non-zero return aborts parsing. */
+typedef struct {
+    http_parser_cb on_status;               /* Status line parsed (status_code set) */
+    http_parser_header_cb on_header;        /* One header field, value trimmed */
+    http_parser_cb on_headers_complete;     /* Body framing known */
+    http_parser_data_cb on_body;            /* Body bytes, de-chunked */
+    http_parser_cb on_message_complete;     /* Response fully received */
+} http_parser_settings_t;
+
+/* Parser context */
+struct http_parser {
+    int state;                      /* Internal state */
+    int error;                      /* HTTP_PARSER_ERR_* once failed */
+    int head_response;              /* Response to HEAD: never has a body */
+    int http_major;
+    int http_minor;
+    int status_code;
+    int keep_alive;                 /* Connection may be reused afterwards */
+    int chunked;                    /* Transfer-Encoding: chunked */
+    int64_t content_length;         /* -1 if absent */
+    uint64_t remaining;             /* Bytes left in the body or current chunk */
+    size_t line_len;                /* Bytes buffered in line */
+    char line[HTTP_PARSER_LINE_MAX];
+    void *data;                     /* Opaque pointer for callbacks */
+};
+
+/* Prepare for a new response; head_response is set for replies to HEAD,
+ * data is handed to the callbacks as p->data */
+void http_parser_init(http_parser_t *p, int head_response, void *data);
+
+/* Feed data. Returns the number of bytes consumed: parsing stops right after
+ * the end of a message (remaining bytes belong to the next response) or on
+ * error (check http_parser_has_error()). */
+size_t http_parser_execute(http_parser_t *p, const http_parser_settings_t *settings,
+                           const char *data, size_t len);
+
+/* Signal that the peer closed the connection. Completes bodies delimited by
+ * close; returns HTTP_PARSER_ERR_UNEXPECTED_EOF if the message was cut short. */
+int http_parser_finish(http_parser_t *p, const http_parser_settings_t *settings);
+
+/* Response fully parsed */
+int http_parser_is_complete(const http_parser_t *p);
+
+/* Parsing failed */
+int http_parser_has_error(const http_parser_t *p);
+
+#endif /* HTTP_PARSER_H */
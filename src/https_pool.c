@@ -0,0 +1,532 @@
+/*
+ * HTTPS keep-alive connection pool implementation
+ */
+
+#include "https_pool.h"
+#include "http_parser.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/socket.h>
+
+/* Monotonic clock in milliseconds */
+static uint64_t https_now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+/* Tear down one connection and free its slot */
+static void https_conn_close(https_conn_t *conn)
+{
+    if (conn->open) {
+        mbedtls_ssl_close_notify(&conn->ssl);
+    }
+
+    if (conn->host[0] != '\0') {
+        transport_tcp_close(&conn->transport);
+        mbedtls_ssl_free(&conn->ssl);
+    }
+
+    conn_metrics_unregister(&conn->metrics);
+    memset(conn, 0, sizeof(*conn));
+    conn->transport.fd = -1;
+}
+
+/* Check that an idle connection was not closed by the server.
+ * An idle HTTP/1.1 connection must have nothing to read: EOF means the peer
+ * closed it, and pending bytes are almost always a close_notify alert. */
+static int https_conn_alive(https_conn_t *conn)
+{
+    char c;
+    ssize_t n;
+
+    if (!conn->open || conn->transport.fd < 0) {
+        return 0;
+    }
+
+    if (mbedtls_ssl_get_bytes_avail(&conn->ssl) > 0) {
+        return 0;
+    }
+
+    n = recv(conn->transport.fd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        return 1;
+    }
+
+    return 0;
+}
+
+/* Connect and handshake a fresh connection in the given slot. If early is
+ * set and a session is cached, it is offered as TLS 1.3 early data and
+ * conn->early_sent tells how much of it the server accepted. */
+static int https_conn_open(https_pool_t *pool, https_conn_t *conn,
+                           const char *host, const char *port,
+                           const unsigned char *early, size_t early_len)
+{
+    int ret, cached = 0;
+
+    memset(conn, 0, sizeof(*conn));
+    snprintf(conn->host, sizeof(conn->host), "%s", host);
+    snprintf(conn->port, sizeof(conn->port), "%s", port);
+    transport_tcp_init(&conn->transport);
+    mbedtls_ssl_init(&conn->ssl);
+
+    if (pool->metrics != NULL) {
+        char label[CONN_METRICS_LABEL_LEN];
+
+        snprintf(label, sizeof(label), "%s:%s", host, port);
+        conn_metrics_init(&conn->metrics, label);
+        conn->metrics.tls = 1;
+        conn_metrics_register(pool->metrics, &conn->metrics);
+        conn->transport.metrics = &conn->metrics;
+    }
+
+    conn->transport.resolver = pool->resolver;
+    conn->transport.opts = pool->tcp_opts;
+
+    if (mbedtls_ssl_setup(&conn->ssl, pool->conf) != 0 ||
+        mbedtls_ssl_set_hostname(&conn->ssl, host) != 0) {
+        https_conn_close(conn);
+        return HTTPS_POOL_ERR_HANDSHAKE_FAILED;
+    }
+
+    mbedtls_ssl_set_bio(&conn->ssl, &conn->transport,
+                        transport_tcp_send, transport_tcp_recv, NULL);
+
+    if (transport_tcp_connect(&conn->transport, host, port) != TRANSPORT_TCP_OK) {
+        https_conn_close(conn);
+        return HTTPS_POOL_ERR_CONNECT_FAILED;
+    }
+
+    if (pool->sessions != NULL) {
+        cached = session_cache_load(pool->sessions, host, port, &conn->ssl) == SESSION_CACHE_OK;
+    }
+
+    conn_metrics_phase_begin(conn->transport.metrics, CONN_METRICS_PHASE_TLS_HANDSHAKE);
+
+#if defined(MBEDTLS_SSL_EARLY_DATA)
+    /* Writes the ClientHello, then the early data right behind it. The
+     * ticket may not allow 0-RTT; the request then goes out after the
+     * handshake as usual. */
+    if (cached && early != NULL && early_len > 0) {
+        do {
+            ret = mbedtls_ssl_write_early_data(&conn->ssl, early, early_len);
+        } while (ret == MBEDTLS_ERR_SSL_WANT_READ || ret == MBEDTLS_ERR_SSL_WANT_WRITE);
+
+        if (ret > 0) {
+            conn->early_sent = (size_t) ret;
+        } else if (ret != MBEDTLS_ERR_SSL_CANNOT_WRITE_EARLY_DATA) {
+            conn_metrics_phase_fail(conn->transport.metrics, CONN_METRICS_PHASE_TLS_HANDSHAKE);
+            session_cache_remove(pool->sessions, host, port);
+            https_conn_close(conn);
+            return HTTPS_POOL_ERR_HANDSHAKE_FAILED;
+        }
+    }
+#else
+    (void) cached;
+    (void) early;
+    (void) early_len;
+#endif
+
+    while ((ret = session_cache_handshake(&conn->ssl, &conn->full_handshake)) != 0) {
+        if (ret != MBEDTLS_ERR_SSL_WANT_READ && ret != MBEDTLS_ERR_SSL_WANT_WRITE) {
+            conn_metrics_phase_fail(conn->transport.metrics, CONN_METRICS_PHASE_TLS_HANDSHAKE);
+            if (pool->sessions != NULL) {
+                session_cache_remove(pool->sessions, host, port);
+            }
+            https_conn_close(conn);
+            return HTTPS_POOL_ERR_HANDSHAKE_FAILED;
+        }
+    }
+
+    conn_metrics_phase_end(conn->transport.metrics, CONN_METRICS_PHASE_TLS_HANDSHAKE);
+
+#if defined(MBEDTLS_SSL_EARLY_DATA)
+    /* A rejecting server discarded the early data; it has to be resent */
+    if (conn->early_sent > 0 &&
+        mbedtls_ssl_get_early_data_status(&conn->ssl) != MBEDTLS_SSL_EARLY_DATA_STATUS_ACCEPTED) {
+        conn->early_sent = 0;
+    }
+#endif
+
+    if (pool->sessions != NULL) {
+        session_cache_record(pool->sessions, conn->full_handshake);
+        session_cache_store(pool->sessions, host, port, &conn->ssl);
+    }
+
+    conn->open = 1;
+    pool->connects++;
+
+    return HTTPS_POOL_OK;
+}
+
+/* Initialize the pool */
+int https_pool_init(https_pool_t *pool, const mbedtls_ssl_config *conf,
+                    session_cache_t *sessions)
+{
+    size_t i;
+
+    if (pool == NULL || conf == NULL) {
+        return HTTPS_POOL_ERR_INVALID_PARAM;
+    }
+
+    memset(pool, 0, sizeof(*pool));
+    pool->conf = conf;
+    pool->sessions = sessions;
+    pool->idle_timeout_ms = HTTPS_POOL_IDLE_TIMEOUT_MS;
+    transport_tcp_opts_init(&pool->tcp_opts);
+
+    for (i = 0; i < HTTPS_POOL_MAX_CONNS; i++) {
+        pool->conns[i].transport.fd = -1;
+    }
+
+    return HTTPS_POOL_OK;
+}
+
+/* Close idle connections that exceeded the idle timeout */
+void https_pool_expire(https_pool_t *pool)
+{
+    uint64_t now = https_now_ms();
+    size_t i;
+
+    if (pool == NULL) {
+        return;
+    }
+
+    for (i = 0; i < HTTPS_POOL_MAX_CONNS; i++) {
+        https_conn_t *conn = &pool->conns[i];
+
+        if (conn->open && !conn->in_use &&
+            now - conn->last_used_ms >= pool->idle_timeout_ms) {
+            https_conn_close(conn);
+        }
+    }
+}
+
+/* Lease a live connection to host:port; early is passed on to a new connection */
+static int https_pool_lease(https_pool_t *pool, const char *host, const char *port,
+                            const unsigned char *early, size_t early_len,
+                            https_conn_t **out)
+{
+    https_conn_t *free_slot = NULL, *lru = NULL;
+    size_t i, per_host = 0;
+    int ret;
+
+    if (pool == NULL || host == NULL || port == NULL || out == NULL) {
+        return HTTPS_POOL_ERR_INVALID_PARAM;
+    }
+
+    https_pool_expire(pool);
+
+    for (i = 0; i < HTTPS_POOL_MAX_CONNS; i++) {
+        https_conn_t *conn = &pool->conns[i];
+        int same_host = conn->open && strcmp(conn->host, host) == 0 &&
+                        strcmp(conn->port, port) == 0;
+
+        if (same_host && !conn->in_use) {
+            if (https_conn_alive(conn)) {
+                conn->in_use = 1;
+                pool->reuses++;
+                *out = conn;
+                return HTTPS_POOL_OK;
+            }
+            pool->stale++;
+            https_conn_close(conn);
+        }
+
+        if (!conn->open) {
+            if (free_slot == NULL) {
+                free_slot = conn;
+            }
+            continue;
+        }
+
+        if (same_host) {
+            per_host++;
+        }
+        if (!conn->in_use && (lru == NULL || conn->last_used_ms < lru->last_used_ms)) {
+            lru = conn;
+        }
+    }
+
+    if (per_host >= HTTPS_POOL_MAX_PER_HOST) {
+        return HTTPS_POOL_ERR_EXHAUSTED;
+    }
+
+    /* Evict the least recently used idle connection to another host */
+    if (free_slot == NULL) {
+        if (lru == NULL) {
+            return HTTPS_POOL_ERR_EXHAUSTED;
+        }
+        https_conn_close(lru);
+        free_slot = lru;
+    }
+
+    if ((ret = https_conn_open(pool, free_slot, host, port, early, early_len)) != HTTPS_POOL_OK) {
+        return ret;
+    }
+
+    free_slot->in_use = 1;
+    *out = free_slot;
+
+    return HTTPS_POOL_OK;
+}
+
+/* Lease a live connection to host:port */
+int https_pool_acquire(https_pool_t *pool, const char *host, const char *port,
+                       https_conn_t **out)
+{
+    return https_pool_lease(pool, host, port, NULL, 0, out);
+}
+
+/* Return a leased connection */
+void https_pool_release(https_pool_t *pool, https_conn_t *conn, int reusable)
+{
+    if (pool == NULL || conn == NULL) {
+        return;
+    }
+
+    conn->in_use = 0;
+
+    if (!reusable || !conn->open) {
+        https_conn_close(conn);
+        return;
+    }
+
+    conn->last_used_ms = https_now_ms();
+}
+
+/* Read decrypted bytes; 0 on orderly close, negative on error */
+static int https_conn_read(https_pool_t *pool, https_conn_t *conn,
+                           unsigned char *buf, size_t len)
+{
+    int ret;
+
+    for (;;) {
+        ret = mbedtls_ssl_read(&conn->ssl, buf, len);
+
+        if (ret > 0) {
+            return ret;
+        }
+
+        if (ret == MBEDTLS_ERR_SSL_WANT_READ || ret == MBEDTLS_ERR_SSL_WANT_WRITE) {
+            continue;
+        }
+
+#if defined(MBEDTLS_SSL_PROTO_TLS1_3) && defined(MBEDTLS_SSL_SESSION_TICKETS)
+        if (ret == MBEDTLS_ERR_SSL_RECEIVED_NEW_SESSION_TICKET) {
+            if (pool->sessions != NULL) {
+                session_cache_store(pool->sessions, conn->host, conn->port, &conn->ssl);
+            }
+            continue;
+        }
+#else
+        (void) pool;
+#endif
+
+        if (ret == 0 || ret == MBEDTLS_ERR_SSL_PEER_CLOSE_NOTIFY) {
+            return 0;
+        }
+
+        return ret;
+    }
+}
+
+/* Write the whole buffer */
+static int https_conn_write(https_conn_t *conn, const unsigned char *buf, size_t len)
+{
+    int ret;
+
+    while (len > 0) {
+        ret = mbedtls_ssl_write(&conn->ssl, buf, len);
+
+        if (ret == MBEDTLS_ERR_SSL_WANT_READ || ret == MBEDTLS_ERR_SSL_WANT_WRITE) {
+            continue;
+        }
+
+        if (ret <= 0) {
+            return HTTPS_POOL_ERR_SEND_FAILED;
+        }
+
+        buf += ret;
+        len -= (size_t) ret;
+    }
+
+    return HTTPS_POOL_OK;
+}
+
+/* Per-request state handed to the parser callbacks */
+typedef struct {
+    https_response_t *resp;
+    https_body_cb on_body;
+    void *ctx;
+} https_read_ctx_t;
+
+/* Forward de-chunked body bytes straight from the read buffer */
+static int https_on_body(http_parser_t *p, const char *at, size_t len)
+{
+    https_read_ctx_t *rc = (https_read_ctx_t *) p->data;
+
+    rc->resp->body_len += len;
+
+    if (rc->on_body != NULL) {
+        return rc->on_body(rc->ctx, (const unsigned char *) at, len);
+    }
+
+    return 0;
+}
+
+/* Read one response. *received is set once any byte arrived. */
+static int https_read_response(https_pool_t *pool, https_conn_t *conn, int head_only,
+                               https_response_t *resp, https_body_cb on_body, void *ctx,
+                               int *received)
+{
+    static const http_parser_settings_t settings = {
+        NULL, NULL, NULL, https_on_body, NULL
+    };
+    unsigned char buf[HTTPS_POOL_READ_BUF];
+    https_read_ctx_t rc;
+    http_parser_t parser;
+    size_t n;
+    int ret;
+
+    rc.resp = resp;
+    rc.on_body = on_body;
+    rc.ctx = ctx;
+    http_parser_init(&parser, head_only, &rc);
+
+    while (!http_parser_is_complete(&parser)) {
+        ret = https_conn_read(pool, conn, buf, sizeof(buf));
+
+        if (ret == 0) {
+            /* Peer closed: fine only for bodies delimited by close */
+            if (http_parser_finish(&parser, &settings) != HTTP_PARSER_OK) {
+                return *received ? HTTPS_POOL_ERR_BAD_RESPONSE : HTTPS_POOL_ERR_RECV_FAILED;
+            }
+            break;
+        }
+
+        if (ret < 0) {
+            return HTTPS_POOL_ERR_RECV_FAILED;
+        }
+
+        *received = 1;
+        n = http_parser_execute(&parser, &settings, (const char *) buf, (size_t) ret);
+
+        if (http_parser_has_error(&parser)) {
+            return parser.error == HTTP_PARSER_ERR_CALLBACK ? HTTPS_POOL_ERR_ABORTED
+                                                            : HTTPS_POOL_ERR_BAD_RESPONSE;
+        }
+
+        if (n < (size_t) ret) {
+            /* Bytes past the end of the response we did not ask for */
+            parser.keep_alive = 0;
+        }
+    }
+
+    resp->status = parser.status_code;
+    resp->keep_alive = parser.keep_alive;
+
+    return HTTPS_POOL_OK;
+}
+
+/* Methods that are safe to replay, the only ones allowed in 0-RTT data (RFC 8470) */
+static int https_method_is_safe(const char *method)
+{
+    return strcmp(method, "GET") == 0 || strcmp(method, "HEAD") == 0 ||
+           strcmp(method, "OPTIONS") == 0;
+}
+
+/* Perform one request over a pooled connection */
+int https_pool_request(https_pool_t *pool, const char *host, const char *port,
+                       const char *method, const char *path,
+                       https_response_t *resp, https_body_cb on_body, void *ctx)
+{
+    char request[1024];
+    const unsigned char *early = NULL;
+    https_conn_t *conn;
+    int len, ret, attempt, received;
+
+    if (pool == NULL || host == NULL || port == NULL || method == NULL ||
+        path == NULL || resp == NULL) {
+        return HTTPS_POOL_ERR_INVALID_PARAM;
+    }
+
+    len = snprintf(request, sizeof(request),
+                   "%s %s HTTP/1.1\r\n"
+                   "Host: %s\r\n"
+                   "User-Agent: " HTTPS_POOL_USER_AGENT "\r\n"
+                   "Connection: keep-alive\r\n"
+                   "\r\n",
+                   method, path, host);
+    if (len < 0 || len >= (int) sizeof(request)) {
+        return HTTPS_POOL_ERR_INVALID_PARAM;
+    }
+
+    if (pool->early_data && https_method_is_safe(method)) {
+        early = (const unsigned char *) request;
+    }
+
+    /* A pooled connection can be closed by the server at any moment; if it
+     * fails before the first response byte, retry once on a fresh one. */
+    for (attempt = 0; attempt < 2; attempt++) {
+        if ((ret = https_pool_lease(pool, host, port, early, early != NULL ? (size_t) len : 0,
+                                    &conn)) != HTTPS_POOL_OK) {
+            return ret;
+        }
+
+        memset(resp, 0, sizeof(*resp));
+        resp->reused = conn->requests > 0;
+        resp->resumed = !conn->full_handshake;
+        resp->tls_version = mbedtls_ssl_get_version(&conn->ssl);
+        resp->ciphersuite = mbedtls_ssl_get_ciphersuite(&conn->ssl);
+        resp->early_data = conn->early_sent > 0;
+        received = 0;
+
+        /* Skip what the server already accepted as early data */
+        ret = https_conn_write(conn, (const unsigned char *) request + conn->early_sent,
+                               (size_t) len - conn->early_sent);
+        conn->early_sent = 0;
+        if (ret == HTTPS_POOL_OK) {
+            ret = https_read_response(pool, conn, strcmp(method, "HEAD") == 0,
+                                      resp, on_body, ctx, &received);
+        }
+
+        conn->requests++;
+
+        /* TLS 1.3 tickets arrive after the handshake, usually with the first response */
+        if (ret == HTTPS_POOL_OK && conn->requests == 1 && pool->sessions != NULL) {
+            session_cache_store(pool->sessions, host, port, &conn->ssl);
+        }
+
+        if (ret != HTTPS_POOL_OK && resp->reused && !received) {
+            pool->stale++;
+            https_pool_release(pool, conn, 0);
+            continue;
+        }
+
+        https_pool_release(pool, conn, ret == HTTPS_POOL_OK && resp->keep_alive);
+        return ret;
+    }
+
+    return HTTPS_POOL_ERR_RECV_FAILED;
+}
+
+/* Close all connections */
+void https_pool_free(https_pool_t *pool)
+{
+    size_t i;
+
+    if (pool == NULL) {
+        return;
+    }
+
+    for (i = 0; i < HTTPS_POOL_MAX_CONNS; i++) {
+        https_conn_close(&pool->conns[i]);
+    }
+}
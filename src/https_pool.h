@@ -0,0 +1,106 @@
+/*
+ * HTTPS keep-alive connection pool
+ * Small HTTP/1.1 client on top of transport_tcp_t + mbedtls that keeps
+ * connections open per host:port and reuses idle ones for later requests.
+ */
+
+#ifndef HTTPS_POOL_H
+#define HTTPS_POOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "transport_tcp.h"
+#include "session_cache.h"
+#include "conn_metrics.h"
+#include "mbedtls/ssl.h"
+
+/* Error codes */
+#define HTTPS_POOL_OK                       0
+#define HTTPS_POOL_ERR_INVALID_PARAM       -1
+#define HTTPS_POOL_ERR_EXHAUSTED           -2
+#define HTTPS_POOL_ERR_CONNECT_FAILED      -3
+#define HTTPS_POOL_ERR_HANDSHAKE_FAILED    -4
+#define HTTPS_POOL_ERR_SEND_FAILED         -5
+#define HTTPS_POOL_ERR_RECV_FAILED         -6
+#define HTTPS_POOL_ERR_BAD_RESPONSE        -7
+#define HTTPS_POOL_ERR_ABORTED             -8
+
+/* Pool limits */
+#define HTTPS_POOL_MAX_CONNS               16
+#define HTTPS_POOL_MAX_PER_HOST            4
+#define HTTPS_POOL_IDLE_TIMEOUT_MS         30000
+#define HTTPS_POOL_HOST_LEN                128
+#define HTTPS_POOL_PORT_LEN                8
+#define HTTPS_POOL_READ_BUF                4096
+#define HTTPS_POOL_USER_AGENT              "mbedtls-client/1.0"
+
+/* One pooled connection */
+typedef struct {
+    char host[HTTPS_POOL_HOST_LEN];     /* Empty when the slot is unused */
+    char port[HTTPS_POOL_PORT_LEN];
+    transport_tcp_t transport;          /* TCP socket */
+    mbedtls_ssl_context ssl;            /* TLS session bound to transport */
+    int in_use;                         /* Leased by a request */
+    int open;                           /* Handshake completed, socket open */
+    int full_handshake;                 /* Last handshake was not resumed */
+    uint64_t last_used_ms;              /* Monotonic time of last release */
+    unsigned long requests;             /* Requests served on this connection */
+    size_t early_sent;                  /* Request bytes accepted as 0-RTT data at open */
+    conn_metrics_t metrics;             /* Registered while open if the pool has a registry */
+} https_conn_t;
+
+/* Called for each piece of response body; non-zero aborts the request */
+typedef int (*https_body_cb)(void *ctx, const unsigned char *data, size_t len);
+
+/* Response summary */
+typedef struct {
+    int status;                         /* HTTP status code */
+    int keep_alive;                     /* Connection may be reused */
+    size_t body_len;                    /* Body bytes delivered */
+    int reused;                         /* Served on an already open connection */
+    int resumed;                        /* New connection used TLS resumption */
+    int early_data;                     /* Request went out as accepted 0-RTT data */
+    const char *tls_version;            /* Negotiated protocol */
+    const char *ciphersuite;            /* Negotiated ciphersuite */
+} https_response_t;
+
+/* Pool context */
+typedef struct {
+    https_conn_t conns[HTTPS_POOL_MAX_CONNS];
+    const mbedtls_ssl_config *conf;     /* Shared TLS configuration */
+    session_cache_t *sessions;          /* Optional resumption cache */
+    conn_metrics_registry_t *metrics;   /* Optional, set after https_pool_init() */
+    resolver_t *resolver;               /* Optional cached DNS, set after https_pool_init() */
+    transport_tcp_opts_t tcp_opts;      /* Socket options of new connections */
+    uint32_t idle_timeout_ms;           /* Idle connections older than this are closed */
+    int early_data;                     /* Send safe requests as 0-RTT data on resumed connects */
+    unsigned long connects;             /* New connections opened */
+    unsigned long reuses;               /* Requests served on a pooled connection */
+    unsigned long stale;                /* Pooled connections found closed by the peer */
+} https_pool_t;
+
+/* Initialize the pool (sessions may be NULL) */
+int https_pool_init(https_pool_t *pool, const mbedtls_ssl_config *conf,
+                    session_cache_t *sessions);
+
+/* Lease a live connection to host:port, opening one if none is idle */
+int https_pool_acquire(https_pool_t *pool, const char *host, const char *port,
+                       https_conn_t **out);
+
+/* Return a leased connection; it is closed unless reusable is set */
+void https_pool_release(https_pool_t *pool, https_conn_t *conn, int reusable);
+
+/* Perform one request over a pooled connection. on_body may be NULL.
+ * With early_data set, a safe request that needs a new connection to a host
+ * with a cached session rides along with the ClientHello (0-RTT). */
+int https_pool_request(https_pool_t *pool, const char *host, const char *port,
+                       const char *method, const char *path,
+                       https_response_t *resp, https_body_cb on_body, void *ctx);
+
+/* Close idle connections that exceeded the idle timeout */
+void https_pool_expire(https_pool_t *pool);
+
+/* Close all connections */
+void https_pool_free(https_pool_t *pool);
+
+#endif /* HTTPS_POOL_H */
@@ -0,0 +1,1090 @@
+/*
+ * Streaming JSON tokenizer implementation
+ * A byte-level state machine that can stop anywhere: between tokens, inside
+ * a string or escape, inside a number or literal, or inside a skipped
+ * value. Vector kernels only answer "where is the next interesting byte",
+ * so the state machine stays the same for every instruction set.
+ */
+
+#include "json_tok.h"
+#include "cpu_dispatch.h"
+#include <string.h>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define JSON_TOK_X86
+#include <immintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#define JSON_TOK_NEON
+#include <arm_neon.h>
+#endif
+
+/* Lexer states */
+#define JSON_LEX_TOKEN                      0
+#define JSON_LEX_STRING                     1
+#define JSON_LEX_NUMBER                     2
+#define JSON_LEX_LITERAL                    3
+#define JSON_LEX_SKIP                       4
+
+/* Grammar states */
+#define JSON_EXPECT_VALUE                   0
+#define JSON_EXPECT_VALUE_OR_END            1   /* After '[' */
+#define JSON_EXPECT_KEY                     2   /* After ',' in an object */
+#define JSON_EXPECT_KEY_OR_END              3   /* After '{' */
+#define JSON_EXPECT_COLON                   4
+#define JSON_EXPECT_COMMA_OR_END            5
+#define JSON_EXPECT_NOTHING                 6   /* Top-level value complete */
+
+/* Returns the first interesting byte in [p, end), or end */
+typedef const char *(*json_tok_scan_fn)(const char *p, const char *end);
+
+/* Inside a string: quote, backslash or control character */
+static const char *json_tok_string_scalar(const char *p, const char *end)
+{
+    for (; p < end; p++) {
+        unsigned char c = (unsigned char) *p;
+
+        if (c == '"' || c == '\\' || c < 0x20) {
+            break;
+        }
+    }
+
+    return p;
+}
+
+/* Inside a skipped value: quote or bracket ('[' | 0x20 == '{', ']' | 0x20 == '}') */
+static const char *json_tok_skip_scalar(const char *p, const char *end)
+{
+    for (; p < end; p++) {
+        unsigned char c = (unsigned char) *p | 0x20;
+
+        if (*p == '"' || c == '{' || c == '}') {
+            break;
+        }
+    }
+
+    return p;
+}
+
+#if defined(JSON_TOK_X86)
+
+__attribute__((target("sse2")))
+static const char *json_tok_string_sse2(const char *p, const char *end)
+{
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i bslash = _mm_set1_epi8('\\');
+    const __m128i ctrl = _mm_set1_epi8(0x1f);
+
+    while (end - p >= 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *) p);
+        __m128i m = _mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, bslash));
+        unsigned int bits;
+
+        /* Unsigned v <= 0x1f */
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(_mm_min_epu8(v, ctrl), v));
+        bits = (unsigned int) _mm_movemask_epi8(m);
+        if (bits != 0) {
+            return p + __builtin_ctz(bits);
+        }
+        p += 16;
+    }
+
+    return json_tok_string_scalar(p, end);
+}
+
+__attribute__((target("sse2")))
+static const char *json_tok_skip_sse2(const char *p, const char *end)
+{
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i open = _mm_set1_epi8('{');
+    const __m128i close = _mm_set1_epi8('}');
+    const __m128i fold = _mm_set1_epi8(0x20);
+
+    while (end - p >= 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *) p);
+        __m128i f = _mm_or_si128(v, fold);
+        __m128i m = _mm_or_si128(_mm_cmpeq_epi8(f, open), _mm_cmpeq_epi8(f, close));
+        unsigned int bits;
+
+        m = _mm_or_si128(m, _mm_cmpeq_epi8(v, quote));
+        bits = (unsigned int) _mm_movemask_epi8(m);
+        if (bits != 0) {
+            return p + __builtin_ctz(bits);
+        }
+        p += 16;
+    }
+
+    return json_tok_skip_scalar(p, end);
+}
+
+__attribute__((target("avx2")))
+static const char *json_tok_string_avx2(const char *p, const char *end)
+{
+    const __m256i quote = _mm256_set1_epi8('"');
+    const __m256i bslash = _mm256_set1_epi8('\\');
+    const __m256i ctrl = _mm256_set1_epi8(0x1f);
+
+    while (end - p >= 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *) p);
+        __m256i m = _mm256_or_si256(_mm256_cmpeq_epi8(v, quote), _mm256_cmpeq_epi8(v, bslash));
+        unsigned int bits;
+
+        m = _mm256_or_si256(m, _mm256_cmpeq_epi8(_mm256_min_epu8(v, ctrl), v));
+        bits = (unsigned int) _mm256_movemask_epi8(m);
+        if (bits != 0) {
+            return p + __builtin_ctz(bits);
+        }
+        p += 32;
+    }
+
+    /* Tail call below may skip the compiler's vzeroupper */
+    _mm256_zeroupper();
+    return json_tok_string_sse2(p, end);
+}
+
+__attribute__((target("avx2")))
+static const char *json_tok_skip_avx2(const char *p, const char *end)
+{
+    const __m256i quote = _mm256_set1_epi8('"');
+    const __m256i open = _mm256_set1_epi8('{');
+    const __m256i close = _mm256_set1_epi8('}');
+    const __m256i fold = _mm256_set1_epi8(0x20);
+
+    while (end - p >= 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *) p);
+        __m256i f = _mm256_or_si256(v, fold);
+        __m256i m = _mm256_or_si256(_mm256_cmpeq_epi8(f, open), _mm256_cmpeq_epi8(f, close));
+        unsigned int bits;
+
+        m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, quote));
+        bits = (unsigned int) _mm256_movemask_epi8(m);
+        if (bits != 0) {
+            return p + __builtin_ctz(bits);
+        }
+        p += 32;
+    }
+
+    _mm256_zeroupper();
+    return json_tok_skip_sse2(p, end);
+}
+
+#endif /* JSON_TOK_X86 */
+
+#if defined(JSON_TOK_NEON)
+
+/* Index of the first set byte of a compare result, 16 if none: narrowing
+ * shift keeps 4 bits per byte, so the first set nibble gives the position */
+static inline unsigned int json_tok_neon_first(uint8x16_t m)
+{
+    uint64_t bits = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(m), 4)), 0);
+
+    return bits != 0 ? (unsigned int) __builtin_ctzll(bits) >> 2 : 16;
+}
+
+static const char *json_tok_string_neon(const char *p, const char *end)
+{
+    const uint8x16_t quote = vdupq_n_u8('"');
+    const uint8x16_t bslash = vdupq_n_u8('\\');
+    const uint8x16_t ctrl = vdupq_n_u8(0x20);
+
+    while (end - p >= 16) {
+        uint8x16_t v = vld1q_u8((const uint8_t *) p);
+        uint8x16_t m = vorrq_u8(vceqq_u8(v, quote), vceqq_u8(v, bslash));
+        unsigned int i;
+
+        m = vorrq_u8(m, vcltq_u8(v, ctrl));
+        i = json_tok_neon_first(m);
+        if (i < 16) {
+            return p + i;
+        }
+        p += 16;
+    }
+
+    return json_tok_string_scalar(p, end);
+}
+
+static const char *json_tok_skip_neon(const char *p, const char *end)
+{
+    const uint8x16_t quote = vdupq_n_u8('"');
+    const uint8x16_t open = vdupq_n_u8('{');
+    const uint8x16_t close = vdupq_n_u8('}');
+    const uint8x16_t fold = vdupq_n_u8(0x20);
+
+    while (end - p >= 16) {
+        uint8x16_t v = vld1q_u8((const uint8_t *) p);
+        uint8x16_t f = vorrq_u8(v, fold);
+        uint8x16_t m = vorrq_u8(vceqq_u8(f, open), vceqq_u8(f, close));
+        unsigned int i;
+
+        m = vorrq_u8(m, vceqq_u8(v, quote));
+        i = json_tok_neon_first(m);
+        if (i < 16) {
+            return p + i;
+        }
+        p += 16;
+    }
+
+    return json_tok_skip_scalar(p, end);
+}
+
+#endif /* JSON_TOK_NEON */
+
+/* Scanners of one implementation */
+typedef struct {
+    json_tok_impl_t impl;
+    json_tok_scan_fn string_fn;         /* Inside strings */
+    json_tok_scan_fn skip_fn;           /* Inside skipped containers */
+} json_tok_kernels_t;
+
+static const json_tok_kernels_t json_tok_kernels[] = {
+    { JSON_TOK_IMPL_SCALAR, json_tok_string_scalar, json_tok_skip_scalar },
+#if defined(JSON_TOK_X86)
+    { JSON_TOK_IMPL_SSE2, json_tok_string_sse2, json_tok_skip_sse2 },
+    { JSON_TOK_IMPL_AVX2, json_tok_string_avx2, json_tok_skip_avx2 },
+#endif
+#if defined(JSON_TOK_NEON)
+    { JSON_TOK_IMPL_NEON, json_tok_string_neon, json_tok_skip_neon },
+#endif
+};
+
+static cpu_dispatch_t json_tok_dispatch = CPU_DISPATCH_INIT;
+
+/* Whether the CPU and build support an implementation */
+static int json_tok_supported(json_tok_impl_t impl)
+{
+    switch (impl) {
+    case JSON_TOK_IMPL_SCALAR:
+        return 1;
+#if defined(JSON_TOK_X86)
+    case JSON_TOK_IMPL_SSE2:
+        return __builtin_cpu_supports("sse2");
+    case JSON_TOK_IMPL_AVX2:
+        return __builtin_cpu_supports("avx2");
+#endif
+#if defined(JSON_TOK_NEON)
+    case JSON_TOK_IMPL_NEON:
+        return 1;
+#endif
+    default:
+        return 0;
+    }
+}
+
+/* Scanners of a supported implementation */
+static const json_tok_kernels_t *json_tok_kernels_for(json_tok_impl_t impl)
+{
+    size_t i;
+
+    for (i = 0; i < sizeof(json_tok_kernels) / sizeof(json_tok_kernels[0]); i++) {
+        if (json_tok_kernels[i].impl == impl) {
+            return &json_tok_kernels[i];
+        }
+    }
+
+    return &json_tok_kernels[0];
+}
+
+/* Best implementation for this CPU */
+static json_tok_impl_t json_tok_detect(void)
+{
+    static const json_tok_impl_t order[] = {
+        JSON_TOK_IMPL_AVX2, JSON_TOK_IMPL_SSE2, JSON_TOK_IMPL_NEON
+    };
+    size_t i;
+
+#if defined(JSON_TOK_X86)
+    __builtin_cpu_init();
+#endif
+
+    for (i = 0; i < sizeof(order) / sizeof(order[0]); i++) {
+        if (json_tok_supported(order[i])) {
+            return order[i];
+        }
+    }
+
+    return JSON_TOK_IMPL_SCALAR;
+}
+
+/* First use: default to the best scanners */
+static void json_tok_probe(void)
+{
+    cpu_dispatch_offer(&json_tok_dispatch, json_tok_kernels_for(json_tok_detect()));
+}
+
+/* Scanners in use */
+static const json_tok_kernels_t *json_tok_kernels_get(void)
+{
+    return (const json_tok_kernels_t *) cpu_dispatch_get(&json_tok_dispatch, json_tok_probe);
+}
+
+/* Force a kernel */
+int json_tok_set_impl(json_tok_impl_t impl)
+{
+    if (impl == JSON_TOK_IMPL_AUTO) {
+        impl = json_tok_detect();
+    } else if (!json_tok_supported(impl)) {
+        return JSON_TOK_ERR_UNSUPPORTED;
+    }
+
+    cpu_dispatch_set(&json_tok_dispatch, json_tok_kernels_for(impl));
+
+    return JSON_TOK_OK;
+}
+
+/* Kernel currently in use */
+json_tok_impl_t json_tok_get_impl(void)
+{
+    return json_tok_kernels_get()->impl;
+}
+
+/* Printable kernel name */
+const char *json_tok_impl_name(json_tok_impl_t impl)
+{
+    switch (impl) {
+    case JSON_TOK_IMPL_AUTO:
+        return "auto";
+    case JSON_TOK_IMPL_SCALAR:
+        return "scalar";
+    case JSON_TOK_IMPL_SSE2:
+        return "sse2";
+    case JSON_TOK_IMPL_AVX2:
+        return "avx2";
+    case JSON_TOK_IMPL_NEON:
+        return "neon";
+    default:
+        return "unknown";
+    }
+}
+
+static int json_tok_is_space(char c)
+{
+    return c == ' ' || c == '\n' || c == '\r' || c == '\t';
+}
+
+static int json_tok_is_digit(char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+static int json_tok_is_number_char(char c)
+{
+    return json_tok_is_digit(c) || c == '-' || c == '+' || c == '.' || c == 'e' || c == 'E';
+}
+
+/* Full number grammar, once the token is complete */
+static int json_tok_number_valid(const char *p, size_t len)
+{
+    const char *end = p + len;
+
+    if (p < end && *p == '-') {
+        p++;
+    }
+    if (p == end) {
+        return 0;
+    }
+
+    if (*p == '0') {
+        p++;
+    } else if (json_tok_is_digit(*p)) {
+        while (p < end && json_tok_is_digit(*p)) {
+            p++;
+        }
+    } else {
+        return 0;
+    }
+
+    if (p < end && *p == '.') {
+        if (++p == end || !json_tok_is_digit(*p)) {
+            return 0;
+        }
+        while (p < end && json_tok_is_digit(*p)) {
+            p++;
+        }
+    }
+
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        if (++p < end && (*p == '+' || *p == '-')) {
+            p++;
+        }
+        if (p == end || !json_tok_is_digit(*p)) {
+            return 0;
+        }
+        while (p < end && json_tok_is_digit(*p)) {
+            p++;
+        }
+    }
+
+    return p == end;
+}
+
+/* Index of a watched member name, -1 if not watched */
+static int json_tok_match(const json_tok_t *tok, const char *key, size_t len)
+{
+    size_t i;
+
+    for (i = 0; i < tok->field_count; i++) {
+        if (tok->field_len[i] == len && memcmp(tok->fields[i], key, len) == 0) {
+            return (int) i;
+        }
+    }
+
+    return -1;
+}
+
+/* Hand a token to the callback unless it is filtered out */
+static int json_tok_emit(json_tok_t *tok, json_token_type_t type, const char *data,
+                         size_t len, int partial)
+{
+    json_token_t token;
+
+    if (!partial) {
+        tok->tokens++;
+    }
+
+    if (tok->cb == NULL || (tok->watched_only && tok->field < 0)) {
+        return JSON_TOK_OK;
+    }
+
+    token.type = type;
+    token.data = data;
+    token.len = len;
+    token.depth = tok->depth;
+    token.field = tok->field;
+    token.escaped = (type == JSON_TOKEN_KEY || type == JSON_TOKEN_STRING) ? tok->escaped : 0;
+    token.partial = partial;
+
+    return tok->cb(&token, tok->arg) != 0 ? JSON_TOK_ERR_ABORTED : JSON_TOK_OK;
+}
+
+/* A value ended: what may follow depends on the enclosing container */
+static void json_tok_value_done(json_tok_t *tok)
+{
+    tok->expect = tok->depth == 0 ? JSON_EXPECT_NOTHING : JSON_EXPECT_COMMA_OR_END;
+}
+
+/* Keep the part of a token cut by the chunk end; full pieces go out early */
+static int json_tok_stash(json_tok_t *tok, const char *data, size_t len)
+{
+    int ret;
+
+    while (len > 0) {
+        size_t n = JSON_TOK_SCRATCH - tok->scratch_len;
+
+        if (n == 0) {
+            /* A key this long cannot be a watched one */
+            if (tok->tok_type == JSON_TOKEN_KEY && tok->depth == 1) {
+                tok->field = -1;
+            }
+
+            ret = json_tok_emit(tok, (json_token_type_t) tok->tok_type,
+                                tok->scratch, tok->scratch_len, 1);
+            if (ret != JSON_TOK_OK) {
+                return ret;
+            }
+            tok->scratch_len = 0;
+            tok->partial_sent = 1;
+            continue;
+        }
+
+        if (n > len) {
+            n = len;
+        }
+        memcpy(tok->scratch + tok->scratch_len, data, n);
+        tok->scratch_len += n;
+        data += n;
+        len -= n;
+    }
+
+    return JSON_TOK_OK;
+}
+
+/* A key, string or number ended with data[len - 1] */
+static int json_tok_complete(json_tok_t *tok, const char *data, size_t len)
+{
+    int ret;
+
+    /* Started in an earlier chunk: finish it in the scratch buffer */
+    if (tok->scratch_len > 0 || tok->partial_sent) {
+        ret = json_tok_stash(tok, data, len);
+        if (ret != JSON_TOK_OK) {
+            return ret;
+        }
+        data = tok->scratch;
+        len = tok->scratch_len;
+    }
+
+    if (tok->tok_type == JSON_TOKEN_KEY) {
+        if (tok->depth == 1) {
+            tok->field = tok->partial_sent ? -1 : json_tok_match(tok, data, len);
+        }
+        tok->expect = JSON_EXPECT_COLON;
+    } else {
+        if (tok->tok_type == JSON_TOKEN_NUMBER && !tok->partial_sent &&
+            !json_tok_number_valid(data, len)) {
+            return JSON_TOK_ERR_SYNTAX;
+        }
+        json_tok_value_done(tok);
+    }
+
+    ret = json_tok_emit(tok, (json_token_type_t) tok->tok_type, data, len, 0);
+
+    tok->lex = JSON_LEX_TOKEN;
+    tok->scratch_len = 0;
+    tok->partial_sent = 0;
+
+    return ret;
+}
+
+/* String or key body, from the opening quote or where the last chunk ended */
+static int json_tok_lex_string(json_tok_t *tok, const char **pp, const char *end)
+{
+    json_tok_scan_fn scan = json_tok_kernels_get()->string_fn;
+    const char *start = *pp;
+    const char *p = start;
+
+    for (;;) {
+        if (tok->str_escape) {
+            if (p == end) {
+                break;
+            }
+            if (memchr("\"\\/bfnrtu", *p, 9) == NULL) {
+                return JSON_TOK_ERR_SYNTAX;
+            }
+            tok->str_escape = 0;
+            p++;
+            continue;
+        }
+
+        p = scan(p, end);
+        if (p == end) {
+            break;
+        }
+
+        if (*p == '\\') {
+            tok->str_escape = 1;
+            tok->escaped = 1;
+            p++;
+            continue;
+        }
+
+        /* Raw control character */
+        if (*p != '"') {
+            return JSON_TOK_ERR_SYNTAX;
+        }
+
+        *pp = p + 1;
+        return json_tok_complete(tok, start, (size_t)(p - start));
+    }
+
+    *pp = end;
+    return json_tok_stash(tok, start, (size_t)(end - start));
+}
+
+/* Number, ended by the first byte that cannot be part of one */
+static int json_tok_lex_number(json_tok_t *tok, const char **pp, const char *end)
+{
+    const char *start = *pp;
+    const char *p = start;
+
+    while (p < end && json_tok_is_number_char(*p)) {
+        p++;
+    }
+
+    *pp = p;
+    if (p == end) {
+        return json_tok_stash(tok, start, (size_t)(end - start));
+    }
+
+    return json_tok_complete(tok, start, (size_t)(p - start));
+}
+
+/* true, false or null */
+static int json_tok_lex_literal(json_tok_t *tok, const char **pp, const char *end)
+{
+    const char *p = *pp;
+    json_token_type_t type;
+
+    while (p < end && tok->literal[tok->literal_pos] != '\0') {
+        if (*p != tok->literal[tok->literal_pos]) {
+            return JSON_TOK_ERR_SYNTAX;
+        }
+        p++;
+        tok->literal_pos++;
+    }
+
+    *pp = p;
+    if (tok->literal[tok->literal_pos] != '\0') {
+        return JSON_TOK_OK;
+    }
+
+    type = tok->literal[0] == 't' ? JSON_TOKEN_TRUE :
+           tok->literal[0] == 'f' ? JSON_TOKEN_FALSE : JSON_TOKEN_NULL;
+
+    tok->lex = JSON_LEX_TOKEN;
+    json_tok_value_done(tok);
+
+    return json_tok_emit(tok, type, tok->literal, tok->literal_pos, 0);
+}
+
+/* Object or array of an unwatched member: count brackets outside strings */
+static int json_tok_lex_skip(json_tok_t *tok, const char **pp, const char *end)
+{
+    const json_tok_kernels_t *kernels = json_tok_kernels_get();
+    const char *p = *pp;
+
+    while (p < end) {
+        if (tok->skip_string) {
+            if (tok->str_escape) {
+                tok->str_escape = 0;
+                p++;
+                continue;
+            }
+
+            p = kernels->string_fn(p, end);
+            if (p == end) {
+                break;
+            }
+            if (*p == '\\') {
+                tok->str_escape = 1;
+            } else if (*p == '"') {
+                tok->skip_string = 0;
+            }
+            p++;
+            continue;
+        }
+
+        p = kernels->skip_fn(p, end);
+        if (p == end) {
+            break;
+        }
+
+        if (*p == '"') {
+            tok->skip_string = 1;
+        } else if (*p == '{' || *p == '[') {
+            if (tok->depth + ++tok->skip_level > JSON_TOK_MAX_DEPTH) {
+                return JSON_TOK_ERR_DEPTH;
+            }
+        } else if (--tok->skip_level == 0) {
+            *pp = p + 1;
+            tok->lex = JSON_LEX_TOKEN;
+            json_tok_value_done(tok);
+            return JSON_TOK_OK;
+        }
+        p++;
+    }
+
+    *pp = end;
+    return JSON_TOK_OK;
+}
+
+/* First byte of a value */
+static int json_tok_value(json_tok_t *tok, const char **pp, const char *end)
+{
+    const char *p = *pp;
+    int ret;
+
+    switch (*p) {
+    case '{':
+    case '[':
+        if (tok->depth >= JSON_TOK_MAX_DEPTH) {
+            return JSON_TOK_ERR_DEPTH;
+        }
+        *pp = p + 1;
+
+        if (tok->watched_only && tok->depth > 0 && tok->field < 0) {
+            tok->lex = JSON_LEX_SKIP;
+            tok->skip_level = 1;
+            tok->skip_string = 0;
+            tok->str_escape = 0;
+            return JSON_TOK_OK;
+        }
+
+        ret = json_tok_emit(tok, *p == '{' ? JSON_TOKEN_OBJECT_BEGIN : JSON_TOKEN_ARRAY_BEGIN,
+                            p, 1, 0);
+        tok->stack[tok->depth++] = (uint8_t) *p;
+        tok->expect = *p == '{' ? JSON_EXPECT_KEY_OR_END : JSON_EXPECT_VALUE_OR_END;
+        return ret;
+
+    case '"':
+        tok->lex = JSON_LEX_STRING;
+        tok->tok_type = JSON_TOKEN_STRING;
+        tok->escaped = 0;
+        tok->str_escape = 0;
+        *pp = p + 1;
+        return json_tok_lex_string(tok, pp, end);
+
+    case 't':
+    case 'f':
+    case 'n':
+        tok->lex = JSON_LEX_LITERAL;
+        tok->literal = *p == 't' ? "true" : *p == 'f' ? "false" : "null";
+        tok->literal_pos = 0;
+        return json_tok_lex_literal(tok, pp, end);
+
+    default:
+        if (*p != '-' && !json_tok_is_digit(*p)) {
+            return JSON_TOK_ERR_SYNTAX;
+        }
+        tok->lex = JSON_LEX_NUMBER;
+        tok->tok_type = JSON_TOKEN_NUMBER;
+        return json_tok_lex_number(tok, pp, end);
+    }
+}
+
+/* '}' or ']' closing the innermost container */
+static int json_tok_close(json_tok_t *tok, const char *p)
+{
+    char open = *p == '}' ? '{' : '[';
+
+    if (tok->depth == 0 || tok->stack[tok->depth - 1] != (uint8_t) open) {
+        return JSON_TOK_ERR_SYNTAX;
+    }
+
+    tok->depth--;
+    if (tok->depth == 0) {
+        tok->field = -1;
+    }
+    json_tok_value_done(tok);
+
+    return json_tok_emit(tok, *p == '}' ? JSON_TOKEN_OBJECT_END : JSON_TOKEN_ARRAY_END,
+                         p, 1, 0);
+}
+
+/* Between tokens: whitespace, punctuation and the start of the next token */
+static int json_tok_lex_token(json_tok_t *tok, const char **pp, const char *end)
+{
+    const char *p = *pp;
+
+    while (p < end && json_tok_is_space(*p)) {
+        p++;
+    }
+    *pp = p;
+    if (p == end) {
+        return JSON_TOK_OK;
+    }
+
+    switch (tok->expect) {
+    case JSON_EXPECT_VALUE_OR_END:
+        if (*p == ']') {
+            *pp = p + 1;
+            return json_tok_close(tok, p);
+        }
+        return json_tok_value(tok, pp, end);
+
+    case JSON_EXPECT_VALUE:
+        return json_tok_value(tok, pp, end);
+
+    case JSON_EXPECT_KEY_OR_END:
+        if (*p == '}') {
+            *pp = p + 1;
+            return json_tok_close(tok, p);
+        }
+        /* fall through */
+    case JSON_EXPECT_KEY:
+        if (*p != '"') {
+            return JSON_TOK_ERR_SYNTAX;
+        }
+        tok->lex = JSON_LEX_STRING;
+        tok->tok_type = JSON_TOKEN_KEY;
+        tok->escaped = 0;
+        tok->str_escape = 0;
+        *pp = p + 1;
+        return json_tok_lex_string(tok, pp, end);
+
+    case JSON_EXPECT_COLON:
+        if (*p != ':') {
+            return JSON_TOK_ERR_SYNTAX;
+        }
+        tok->expect = JSON_EXPECT_VALUE;
+        *pp = p + 1;
+        return JSON_TOK_OK;
+
+    case JSON_EXPECT_COMMA_OR_END:
+        if (*p == ',') {
+            tok->expect = tok->stack[tok->depth - 1] == '{' ?
+                          JSON_EXPECT_KEY : JSON_EXPECT_VALUE;
+            *pp = p + 1;
+            return JSON_TOK_OK;
+        }
+        if (*p == '}' || *p == ']') {
+            *pp = p + 1;
+            return json_tok_close(tok, p);
+        }
+        return JSON_TOK_ERR_SYNTAX;
+
+    default:
+        /* Anything but whitespace after the top-level value */
+        return JSON_TOK_ERR_SYNTAX;
+    }
+}
+
+/* Initialize */
+void json_tok_init(json_tok_t *tok, json_tok_cb cb, void *arg)
+{
+    if (tok == NULL) {
+        return;
+    }
+
+    memset(tok, 0, sizeof(*tok));
+    tok->cb = cb;
+    tok->arg = arg;
+    json_tok_reset(tok);
+}
+
+/* Top-level members to tag tokens with */
+int json_tok_watch(json_tok_t *tok, const char *const *fields, size_t count)
+{
+    size_t i;
+
+    if (tok == NULL || count > JSON_TOK_MAX_FIELDS || (fields == NULL && count > 0)) {
+        return JSON_TOK_ERR_INVALID_PARAM;
+    }
+
+    for (i = 0; i < count; i++) {
+        if (fields[i] == NULL) {
+            return JSON_TOK_ERR_INVALID_PARAM;
+        }
+        tok->fields[i] = fields[i];
+        tok->field_len[i] = strlen(fields[i]);
+    }
+    tok->field_count = count;
+
+    return JSON_TOK_OK;
+}
+
+/* Tokenize the next piece of the message */
+int json_tok_feed(json_tok_t *tok, const char *data, size_t len)
+{
+    const char *p, *end;
+    int ret = JSON_TOK_OK;
+
+    if (tok == NULL || (data == NULL && len > 0)) {
+        return JSON_TOK_ERR_INVALID_PARAM;
+    }
+
+    if (tok->error != JSON_TOK_OK || len == 0) {
+        return tok->error;
+    }
+
+    tok->bytes += len;
+    p = data;
+    end = data + len;
+
+    while (p < end && ret == JSON_TOK_OK) {
+        switch (tok->lex) {
+        case JSON_LEX_STRING:
+            ret = json_tok_lex_string(tok, &p, end);
+            break;
+        case JSON_LEX_NUMBER:
+            ret = json_tok_lex_number(tok, &p, end);
+            break;
+        case JSON_LEX_LITERAL:
+            ret = json_tok_lex_literal(tok, &p, end);
+            break;
+        case JSON_LEX_SKIP:
+            ret = json_tok_lex_skip(tok, &p, end);
+            break;
+        default:
+            ret = json_tok_lex_token(tok, &p, end);
+            break;
+        }
+    }
+
+    tok->error = ret;
+    return ret;
+}
+
+/* End of message */
+int json_tok_finish(json_tok_t *tok)
+{
+    int ret;
+
+    if (tok == NULL) {
+        return JSON_TOK_ERR_INVALID_PARAM;
+    }
+
+    if (tok->error != JSON_TOK_OK) {
+        return tok->error;
+    }
+
+    /* A top-level number only ends with the message */
+    ret = JSON_TOK_OK;
+    if (tok->lex == JSON_LEX_NUMBER) {
+        ret = json_tok_complete(tok, tok->scratch, 0);
+    }
+
+    if (ret == JSON_TOK_OK &&
+        (tok->lex != JSON_LEX_TOKEN || tok->expect != JSON_EXPECT_NOTHING)) {
+        ret = JSON_TOK_ERR_SYNTAX;
+    }
+
+    tok->error = ret;
+    return ret;
+}
+
+/* Ready for the next message */
+void json_tok_reset(json_tok_t *tok)
+{
+    if (tok == NULL) {
+        return;
+    }
+
+    tok->field = -1;
+    tok->depth = 0;
+    tok->lex = JSON_LEX_TOKEN;
+    tok->expect = JSON_EXPECT_VALUE;
+    tok->tok_type = JSON_TOKEN_STRING;
+    tok->str_escape = 0;
+    tok->escaped = 0;
+    tok->partial_sent = 0;
+    tok->literal = NULL;
+    tok->literal_pos = 0;
+    tok->skip_level = 0;
+    tok->skip_string = 0;
+    tok->error = JSON_TOK_OK;
+    tok->scratch_len = 0;
+}
+
+static void json_tok_put(char *out, size_t out_len, size_t *n, unsigned char c)
+{
+    if (*n < out_len) {
+        out[*n] = (char) c;
+    }
+    (*n)++;
+}
+
+/* Four hex digits of a \u escape */
+static int json_tok_hex4(const char *p, size_t len, unsigned long *value)
+{
+    size_t i;
+
+    if (len < 4) {
+        return -1;
+    }
+
+    *value = 0;
+    for (i = 0; i < 4; i++) {
+        char c = p[i];
+
+        *value <<= 4;
+        if (c >= '0' && c <= '9') {
+            *value |= (unsigned long)(c - '0');
+        } else if ((c | 0x20) >= 'a' && (c | 0x20) <= 'f') {
+            *value |= (unsigned long)((c | 0x20) - 'a' + 10);
+        } else {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/* Decode the escapes of a string token */
+int json_tok_unescape(const char *data, size_t len, char *out, size_t out_len)
+{
+    size_t i = 0, n = 0;
+    unsigned long cp, lo;
+
+    if (data == NULL || (out == NULL && out_len > 0)) {
+        return JSON_TOK_ERR_INVALID_PARAM;
+    }
+
+    while (i < len) {
+        unsigned char c = (unsigned char) data[i++];
+
+        if (c != '\\') {
+            json_tok_put(out, out_len, &n, c);
+            continue;
+        }
+
+        if (i == len) {
+            return JSON_TOK_ERR_SYNTAX;
+        }
+
+        c = (unsigned char) data[i++];
+        switch (c) {
+        case '"':
+        case '\\':
+        case '/':
+            json_tok_put(out, out_len, &n, c);
+            continue;
+        case 'b':
+            json_tok_put(out, out_len, &n, '\b');
+            continue;
+        case 'f':
+            json_tok_put(out, out_len, &n, '\f');
+            continue;
+        case 'n':
+            json_tok_put(out, out_len, &n, '\n');
+            continue;
+        case 'r':
+            json_tok_put(out, out_len, &n, '\r');
+            continue;
+        case 't':
+            json_tok_put(out, out_len, &n, '\t');
+            continue;
+        case 'u':
+            break;
+        default:
+            return JSON_TOK_ERR_SYNTAX;
+        }
+
+        if (json_tok_hex4(data + i, len - i, &cp) != 0) {
+            return JSON_TOK_ERR_SYNTAX;
+        }
+        i += 4;
+
+        /* Surrogate pair; a lone half becomes U+FFFD */
+        if (cp >= 0xd800 && cp <= 0xdbff) {
+            if (len - i >= 6 && data[i] == '\\' && data[i + 1] == 'u' &&
+                json_tok_hex4(data + i + 2, len - i - 2, &lo) == 0 &&
+                lo >= 0xdc00 && lo <= 0xdfff) {
+                cp = 0x10000 + ((cp - 0xd800) << 10) + (lo - 0xdc00);
+                i += 6;
+            } else {
+                cp = 0xfffd;
+            }
+        } else if (cp >= 0xdc00 && cp <= 0xdfff) {
+            cp = 0xfffd;
+        }
+
+        if (cp < 0x80) {
+            json_tok_put(out, out_len, &n, (unsigned char) cp);
+        } else if (cp < 0x800) {
+            json_tok_put(out, out_len, &n, (unsigned char)(0xc0 | (cp >> 6)));
+            json_tok_put(out, out_len, &n, (unsigned char)(0x80 | (cp & 0x3f)));
+        } else if (cp < 0x10000) {
+            json_tok_put(out, out_len, &n, (unsigned char)(0xe0 | (cp >> 12)));
+            json_tok_put(out, out_len, &n, (unsigned char)(0x80 | ((cp >> 6) & 0x3f)));
+            json_tok_put(out, out_len, &n, (unsigned char)(0x80 | (cp & 0x3f)));
+        } else {
+            json_tok_put(out, out_len, &n, (unsigned char)(0xf0 | (cp >> 18)));
+            json_tok_put(out, out_len, &n, (unsigned char)(0x80 | ((cp >> 12) & 0x3f)));
+            json_tok_put(out, out_len, &n, (unsigned char)(0x80 | ((cp >> 6) & 0x3f)));
+            json_tok_put(out, out_len, &n, (unsigned char)(0x80 | (cp & 0x3f)));
+        }
+    }
+
+    return (int) n;
+}
+
+/* Whether a complete string token equals a C string */
+int json_tok_equals(const json_token_t *token, const char *str)
+{
+    char buf[JSON_TOK_SCRATCH];
+    size_t len;
+    int n;
+
+    if (token == NULL || str == NULL || token->partial ||
+        (token->type != JSON_TOKEN_STRING && token->type != JSON_TOKEN_KEY)) {
+        return 0;
+    }
+
+    len = strlen(str);
+    if (!token->escaped) {
+        return token->len == len && memcmp(token->data, str, len) == 0;
+    }
+
+    n = json_tok_unescape(token->data, token->len, buf, sizeof(buf));
+
+    return n >= 0 && (size_t) n == len && len <= sizeof(buf) && memcmp(buf, str, len) == 0;
+}
@@ -0,0 +1,146 @@
+/*
+ * Streaming JSON tokenizer
+ * Incremental, zero-copy tokenizer for WebSocket text messages fed in the
+ * pieces on_frame_body delivers. Tokens point into the caller's chunk; only
+ * a string or number cut by a chunk boundary is assembled in a small
+ * scratch buffer (and handed out in pieces if it outgrows it).
+ *
+ * Key lookup without a DOM: the caller names the top-level members it
+ * routes on ("type", "devId", "dps"); every token carries the index of the
+ * member it belongs to, so dps entries arrive as depth 2 key/value tokens
+ * of that field. With watched_only set, tokens of other members are not
+ * reported and their object/array values are skipped by a bracket scan
+ * instead of being tokenized.
+ *
+ * String bodies and skipped values are scanned with SSE2, AVX2 or NEON
+ * kernels picked at runtime (16/32 bytes per step for quotes, backslashes,
+ * control characters and brackets), with a scalar fallback.
+ *
+ * Escapes are reported, not decoded (json_tok_unescape() does that on
+ * demand); skipped values are only checked for balanced brackets.
+ */
+
+#ifndef JSON_TOK_H
+#define JSON_TOK_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Error codes */
+#define JSON_TOK_OK                         0
+#define JSON_TOK_ERR_INVALID_PARAM         -1
+#define JSON_TOK_ERR_SYNTAX                -2
+#define JSON_TOK_ERR_DEPTH                 -3
+#define JSON_TOK_ERR_ABORTED               -4
+#define JSON_TOK_ERR_UNSUPPORTED           -5
+
+/* Nesting limit */
+#define JSON_TOK_MAX_DEPTH                 32
+
+/* Assembly buffer for tokens cut by a chunk boundary */
+#define JSON_TOK_SCRATCH                   256
+
+/* Watched top-level members */
+#define JSON_TOK_MAX_FIELDS                16
+
+/* Token types */
+typedef enum {
+    JSON_TOKEN_OBJECT_BEGIN = 0,
+    JSON_TOKEN_OBJECT_END,
+    JSON_TOKEN_ARRAY_BEGIN,
+    JSON_TOKEN_ARRAY_END,
+    JSON_TOKEN_KEY,                     /* Member name, without quotes */
+    JSON_TOKEN_STRING,                  /* Without quotes, escapes not decoded */
+    JSON_TOKEN_NUMBER,                  /* Raw text */
+    JSON_TOKEN_TRUE,
+    JSON_TOKEN_FALSE,
+    JSON_TOKEN_NULL
+} json_token_type_t;
+
+/* One token; data is only valid during the callback */
+typedef struct {
+    json_token_type_t type;
+    const char *data;
+    size_t len;
+    unsigned int depth;                 /* 0 = top-level value, 1 = its members */
+    int field;                          /* Watched member it belongs to, -1 = none */
+    int escaped;                        /* String or key contains backslash escapes */
+    int partial;                        /* A piece; the rest follows in further tokens */
+} json_token_t;
+
+/* Token callback; non-zero stops with JSON_TOK_ERR_ABORTED */
+typedef int (*json_tok_cb)(const json_token_t *token, void *arg);
+
+/* Kernel variants */
+typedef enum {
+    JSON_TOK_IMPL_AUTO = 0,             /* AVX2, SSE2 or NEON scanners if present */
+    JSON_TOK_IMPL_SCALAR,
+    JSON_TOK_IMPL_SSE2,
+    JSON_TOK_IMPL_AVX2,
+    JSON_TOK_IMPL_NEON
+} json_tok_impl_t;
+
+/* Tokenizer context, one per connection; set watched_only after init */
+typedef struct {
+    json_tok_cb cb;
+    void *arg;
+    const char *fields[JSON_TOK_MAX_FIELDS];
+    size_t field_len[JSON_TOK_MAX_FIELDS];
+    size_t field_count;
+    int watched_only;                   /* Report and tokenize watched members only */
+    int field;                          /* Member the current token belongs to */
+    uint8_t stack[JSON_TOK_MAX_DEPTH];  /* '{' or '[' per open container */
+    unsigned int depth;
+    int lex;                            /* Lexer state between chunks */
+    int expect;                         /* Grammar state */
+    int tok_type;                       /* Key, string or number being lexed */
+    int str_escape;                     /* Backslash was the last byte seen */
+    int escaped;                        /* Current string has escapes */
+    int partial_sent;                   /* Pieces of the current token went out */
+    const char *literal;                /* "true", "false" or "null" being matched */
+    unsigned int literal_pos;
+    unsigned int skip_level;            /* Open brackets of a skipped value */
+    int skip_string;                    /* Skipped value is inside a string */
+    int error;                          /* Sticky until json_tok_reset() */
+    char scratch[JSON_TOK_SCRATCH];
+    size_t scratch_len;
+    uint64_t tokens;                    /* Tokens lexed, reported or not */
+    uint64_t bytes;                     /* Bytes fed */
+} json_tok_t;
+
+/* Initialize; cb may be NULL to only validate */
+void json_tok_init(json_tok_t *tok, json_tok_cb cb, void *arg);
+
+/* Top-level members to tag tokens with (names must stay valid) */
+int json_tok_watch(json_tok_t *tok, const char *const *fields, size_t count);
+
+/* Tokenize the next piece of the message */
+int json_tok_feed(json_tok_t *tok, const char *data, size_t len);
+
+/* End of message: flush a trailing number and check the value is complete */
+int json_tok_finish(json_tok_t *tok);
+
+/* Ready for the next message; callback and watched members are kept */
+void json_tok_reset(json_tok_t *tok);
+
+/* Decode the escapes of a string token into out (UTF-8, not terminated).
+ * Returns the full decoded length like snprintf, so a result above out_len
+ * means it was truncated; JSON_TOK_ERR_SYNTAX on a bad escape. */
+int json_tok_unescape(const char *data, size_t len, char *out, size_t out_len);
+
+/* Whether a complete string token equals a C string (escapes decoded) */
+int json_tok_equals(const json_token_t *token, const char *str);
+
+/* Scan strings and skipped values with impl in every tokenizer, e.g. to
+ * check that all scanners agree; JSON_TOK_IMPL_AUTO returns to the CPU's
+ * default. A tokenizer fed concurrently picks the change up at its next
+ * string or skipped value. JSON_TOK_ERR_UNSUPPORTED if impl is missing. */
+int json_tok_set_impl(json_tok_impl_t impl);
+
+/* Kernel currently in use */
+json_tok_impl_t json_tok_get_impl(void);
+
+/* Printable kernel name */
+const char *json_tok_impl_name(json_tok_impl_t impl);
+
+#endif /* JSON_TOK_H */
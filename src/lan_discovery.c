@@ -0,0 +1,826 @@
+/*
+ * Tuya LAN discovery implementation
+ * Datagrams are classified by the port they arrived on, deduplicated
+ * against the sender's last announcement, decoded with a tuya_codec_t
+ * keyed once with the broadcast key, and parsed with a json_tok_t that
+ * only looks at the members the table keeps.
+ */
+
+#define _GNU_SOURCE
+#include "lan_discovery.h"
+#include "crc32.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+
+#define LAN_DISCOVERY_PREFIX_55AA           0x000055aau
+#define LAN_DISCOVERY_SUFFIX_55AA           0x0000aa55u
+
+/* prefix seq cmd len / CRC suffix */
+#define LAN_DISCOVERY_HEADER                16
+#define LAN_DISCOVERY_TRAILER               8
+
+/* Largest pcap record read; longer ones are skipped */
+#define LAN_DISCOVERY_PCAP_SNAPLEN          65536
+
+/* Replayed packets share a batch while within this of its first one */
+#define LAN_DISCOVERY_REPLAY_WINDOW_MS      1000
+
+/* pcap link types */
+#define LAN_DISCOVERY_LINK_ETHERNET         1
+#define LAN_DISCOVERY_LINK_RAW              101
+#define LAN_DISCOVERY_LINK_LINUX_SLL        113
+#define LAN_DISCOVERY_LINK_IPV4             228
+#define LAN_DISCOVERY_LINK_LINUX_SLL2       276
+
+/* md5("yGAdlopoPVldABfn") */
+const unsigned char lan_discovery_key[TUYA_CODEC_KEY_LEN] = {
+    0x6c, 0x1e, 0xc8, 0xe2, 0xbb, 0x9b, 0xb5, 0x9a,
+    0xb5, 0x0b, 0x0d, 0xaf, 0x64, 0x9b, 0x41, 0x0a
+};
+
+/* Members kept in the table */
+enum {
+    LAN_DISCOVERY_FIELD_GW_ID = 0,
+    LAN_DISCOVERY_FIELD_PRODUCT_KEY,
+    LAN_DISCOVERY_FIELD_VERSION
+};
+
+static const char *const lan_discovery_fields[] = { "gwId", "productKey", "version" };
+
+/* recvmmsg() buffers of one batch */
+struct lan_discovery_rx {
+    struct mmsghdr msgs[LAN_DISCOVERY_BATCH];
+    struct iovec iov[LAN_DISCOVERY_BATCH];
+    struct sockaddr_in from[LAN_DISCOVERY_BATCH];
+    lan_discovery_dgram_t dgrams[LAN_DISCOVERY_BATCH];
+    unsigned char bufs[LAN_DISCOVERY_BATCH][LAN_DISCOVERY_DGRAM_MAX];
+};
+
+static const uint16_t lan_discovery_default_ports[LAN_DISCOVERY_KINDS] = {
+    LAN_DISCOVERY_PORT_PLAIN, LAN_DISCOVERY_PORT_ECB, LAN_DISCOVERY_PORT_GCM
+};
+
+static uint32_t lan_discovery_get32(const unsigned char *p)
+{
+    return (uint32_t) p[0] << 24 | (uint32_t) p[1] << 16 | (uint32_t) p[2] << 8 | p[3];
+}
+
+static uint16_t lan_discovery_get16(const unsigned char *p)
+{
+    return (uint16_t)(p[0] << 8 | p[1]);
+}
+
+/* Monotonic clock for lan_discovery_recv() */
+uint64_t lan_discovery_now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+/* The broadcast codecs only decode, so the IV this would seed is never used */
+static int lan_discovery_no_rng(void *ctx, unsigned char *output, size_t len)
+{
+    (void)ctx;
+    memset(output, 0, len);
+
+    return 0;
+}
+
+/* Copy a complete string token, truncating */
+static void lan_discovery_copy(const json_token_t *token, char *out, size_t out_len)
+{
+    int n = json_tok_unescape(token->data, token->len, out, out_len - 1);
+
+    if (n < 0) {
+        n = 0;
+    } else if ((size_t) n > out_len - 1) {
+        n = (int)(out_len - 1);
+    }
+    out[n] = '\0';
+}
+
+/* Top-level string members of an announcement */
+static int lan_discovery_json_cb(const json_token_t *token, void *arg)
+{
+    lan_discovery_device_t *parsed = arg;
+
+    if (token->depth != 1 || token->type != JSON_TOKEN_STRING || token->partial) {
+        return 0;
+    }
+
+    switch (token->field) {
+    case LAN_DISCOVERY_FIELD_GW_ID:
+        lan_discovery_copy(token, parsed->gw_id, sizeof(parsed->gw_id));
+        break;
+    case LAN_DISCOVERY_FIELD_PRODUCT_KEY:
+        lan_discovery_copy(token, parsed->product_key, sizeof(parsed->product_key));
+        break;
+    case LAN_DISCOVERY_FIELD_VERSION:
+        lan_discovery_copy(token, parsed->version, sizeof(parsed->version));
+        break;
+    default:
+        break;
+    }
+
+    return 0;
+}
+
+/* Initialize an empty table */
+int lan_discovery_init(lan_discovery_t *disc, size_t max_devices,
+                       lan_discovery_cb cb, void *arg)
+{
+    size_t slots = 16;
+    int i;
+
+    if (disc == NULL || max_devices == 0 || max_devices > UINT32_MAX / 4) {
+        return LAN_DISCOVERY_ERR_INVALID_PARAM;
+    }
+
+    memset(disc, 0, sizeof(*disc));
+    disc->epfd = -1;
+    disc->rcvbuf = LAN_DISCOVERY_RCVBUF;
+    disc->max_devices = max_devices;
+    disc->cb = cb;
+    disc->cb_arg = arg;
+    for (i = 0; i < LAN_DISCOVERY_KINDS; i++) {
+        disc->fds[i] = -1;
+        disc->ports[i] = lan_discovery_default_ports[i];
+    }
+
+    /* Index load stays under one half */
+    while (slots < 2 * max_devices) {
+        slots *= 2;
+    }
+    disc->index_mask = slots - 1;
+
+    disc->devices = calloc(max_devices, sizeof(*disc->devices));
+    disc->id_index = calloc(slots, sizeof(*disc->id_index));
+    disc->dedupe = calloc(slots, sizeof(*disc->dedupe));
+    disc->rx = calloc(1, sizeof(*disc->rx));
+    if (disc->devices == NULL || disc->id_index == NULL || disc->dedupe == NULL ||
+        disc->rx == NULL) {
+        lan_discovery_free(disc);
+        return LAN_DISCOVERY_ERR_ALLOC_FAILED;
+    }
+
+    if (tuya_codec_init(&disc->ecb, TUYA_PROTO_33, lan_discovery_key, NULL, NULL) != TUYA_CODEC_OK) {
+        lan_discovery_free(disc);
+        return LAN_DISCOVERY_ERR_CRYPTO;
+    }
+    if (tuya_codec_init(&disc->gcm, TUYA_PROTO_35, lan_discovery_key,
+                        lan_discovery_no_rng, NULL) != TUYA_CODEC_OK) {
+        lan_discovery_free(disc);
+        return LAN_DISCOVERY_ERR_CRYPTO;
+    }
+
+    json_tok_init(&disc->json, lan_discovery_json_cb, &disc->parsed);
+    json_tok_watch(&disc->json, lan_discovery_fields, 3);
+    disc->json.watched_only = 1;
+
+    return LAN_DISCOVERY_OK;
+}
+
+/* Bind the broadcast sockets */
+int lan_discovery_listen(lan_discovery_t *disc, const uint16_t ports[LAN_DISCOVERY_KINDS])
+{
+    struct sockaddr_in addr;
+    struct epoll_event ev;
+    int i, fd, one = 1;
+
+    if (disc == NULL || disc->rx == NULL) {
+        return LAN_DISCOVERY_ERR_INVALID_PARAM;
+    }
+
+    lan_discovery_close(disc);
+    if (ports == NULL) {
+        ports = lan_discovery_default_ports;
+    }
+
+    disc->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (disc->epfd < 0) {
+        return LAN_DISCOVERY_ERR_SOCKET_FAILED;
+    }
+
+    for (i = 0; i < LAN_DISCOVERY_KINDS; i++) {
+        disc->ports[i] = ports[i];
+        if (ports[i] == 0) {
+            continue;
+        }
+
+        fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd < 0) {
+            lan_discovery_close(disc);
+            return LAN_DISCOVERY_ERR_SOCKET_FAILED;
+        }
+        disc->fds[i] = fd;
+
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        /* Best effort: capped by net.core.rmem_max */
+        if (disc->rcvbuf > 0) {
+            setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &disc->rcvbuf, sizeof(disc->rcvbuf));
+        }
+
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_ANY);
+        addr.sin_port = htons(ports[i]);
+
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.u32 = (uint32_t) i;
+
+        if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0 ||
+            epoll_ctl(disc->epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            lan_discovery_close(disc);
+            return LAN_DISCOVERY_ERR_SOCKET_FAILED;
+        }
+    }
+
+    return LAN_DISCOVERY_OK;
+}
+
+/* epoll descriptor of the sockets */
+int lan_discovery_fd(const lan_discovery_t *disc)
+{
+    return disc == NULL ? -1 : disc->epfd;
+}
+
+/* Frame body of a 55AA datagram (without header, CRC and suffix); the
+ * part that identifies an announcement whatever its sequence number */
+static int lan_discovery_body(const lan_discovery_dgram_t *d, const unsigned char **body,
+                              size_t *len)
+{
+    if (d->len < LAN_DISCOVERY_HEADER + LAN_DISCOVERY_TRAILER ||
+        lan_discovery_get32(d->data) != LAN_DISCOVERY_PREFIX_55AA) {
+        return -1;
+    }
+
+    *body = d->data + LAN_DISCOVERY_HEADER;
+    *len = d->len - LAN_DISCOVERY_HEADER - LAN_DISCOVERY_TRAILER;
+    return 0;
+}
+
+/* Unencrypted 55AA frame: check the CRC, skip the return code */
+static int lan_discovery_plain(const lan_discovery_dgram_t *d, const unsigned char **payload,
+                               size_t *len)
+{
+    const unsigned char *body;
+    size_t frame_len, body_len;
+
+    if (lan_discovery_body(d, &body, &body_len) != 0) {
+        return -1;
+    }
+
+    frame_len = LAN_DISCOVERY_HEADER + (size_t) lan_discovery_get32(d->data + 12);
+    if (frame_len != d->len ||
+        lan_discovery_get32(d->data + d->len - 4) != LAN_DISCOVERY_SUFFIX_55AA ||
+        crc32_compute(0, d->data, d->len - LAN_DISCOVERY_TRAILER) !=
+            lan_discovery_get32(d->data + d->len - LAN_DISCOVERY_TRAILER)) {
+        return -1;
+    }
+
+    if (body_len >= 4 && (lan_discovery_get32(body) & 0xffffff00u) == 0) {
+        body += 4;
+        body_len -= 4;
+    }
+
+    *payload = body;
+    *len = body_len;
+    return 0;
+}
+
+/* Dedupe slot of a CRC. Announcements differ in a few digits and a CRC is
+ * linear in its input, so its low bits alone cluster; multiplying spreads
+ * every bit into the ones used. */
+static size_t lan_discovery_dedupe_slot(const lan_discovery_t *disc, uint32_t crc)
+{
+    return (size_t)(((uint64_t) crc * 0x9e3779b97f4a7c15ULL) >> 32) & disc->index_mask;
+}
+
+/* Whether key is the last announcement of dev */
+static int lan_discovery_is_last(const lan_discovery_device_t *dev, uint32_t crc,
+                                 const unsigned char *key, size_t len)
+{
+    return dev->last_crc == crc && dev->last_len == len && memcmp(dev->last, key, len) == 0;
+}
+
+/* Device whose last announcement is key, if the dedupe slot still has it */
+static lan_discovery_device_t *lan_discovery_duplicate(lan_discovery_t *disc, uint32_t crc,
+                                                       const unsigned char *key, size_t len)
+{
+    uint32_t idx = disc->dedupe[lan_discovery_dedupe_slot(disc, crc)];
+
+    if (idx == 0 || !lan_discovery_is_last(&disc->devices[idx - 1], crc, key, len)) {
+        return NULL;
+    }
+
+    return &disc->devices[idx - 1];
+}
+
+static size_t lan_discovery_hash(const char *s)
+{
+    uint32_t h = 2166136261u;
+
+    while (*s != '\0') {
+        h = (h ^ (unsigned char) *s++) * 16777619u;
+    }
+
+    return h;
+}
+
+/* Index slot holding gwId, or the free slot where it goes. Devices are
+ * never removed, so probing needs no tombstones. */
+static size_t lan_discovery_slot(const lan_discovery_t *disc, const char *gw_id)
+{
+    size_t slot = lan_discovery_hash(gw_id) & disc->index_mask;
+    uint32_t idx;
+
+    while ((idx = disc->id_index[slot]) != 0 && strcmp(disc->devices[idx - 1].gw_id, gw_id) != 0) {
+        slot = (slot + 1) & disc->index_mask;
+    }
+
+    return slot;
+}
+
+/* Account an announcement of dev from d; reports at most one change */
+static void lan_discovery_seen(lan_discovery_t *disc, lan_discovery_device_t *dev,
+                               const lan_discovery_dgram_t *d, uint64_t now_ms,
+                               int created, int changed)
+{
+    lan_discovery_event_t event = LAN_DISCOVERY_UPDATED;
+    int notify = 1;
+
+    if (created) {
+        dev->first_seen_ms = now_ms;
+        dev->addr = d->addr;
+        event = LAN_DISCOVERY_NEW;
+    } else if (d->addr != dev->addr) {
+        dev->prev_addr = dev->addr;
+        dev->addr = d->addr;
+        dev->addr_changed_ms = now_ms;
+        dev->addr_changes++;
+        event = LAN_DISCOVERY_ADDR_CHANGED;
+    } else if (!changed) {
+        notify = 0;
+    }
+
+    dev->kind = d->kind;
+    dev->last_seen_ms = now_ms;
+    dev->announcements++;
+
+    if (notify && disc->cb != NULL) {
+        disc->cb(dev, event, disc->cb_arg);
+    }
+}
+
+/* Decode, deduplicate and record one datagram */
+static void lan_discovery_one(lan_discovery_t *disc, const lan_discovery_dgram_t *d,
+                              uint64_t now_ms)
+{
+    const unsigned char *key = NULL, *payload = NULL;
+    lan_discovery_device_t *dev;
+    size_t key_len = 0, len = 0, used, slot;
+    tuya_packet_t pkt;
+    uint32_t crc = 0;
+    int created = 0, changed;
+
+    /* ECB and clear frames repeat byte for byte: compare before decoding */
+    if (d->kind != LAN_DISCOVERY_GCM) {
+        if (lan_discovery_body(d, &key, &key_len) != 0) {
+            disc->stats.rejected++;
+            return;
+        }
+        crc = crc32_compute(0, key, key_len);
+        dev = lan_discovery_duplicate(disc, crc, key, key_len);
+        if (dev != NULL) {
+            disc->stats.duplicates++;
+            lan_discovery_seen(disc, dev, d, now_ms, 0, 0);
+            return;
+        }
+    }
+
+    if (d->kind == LAN_DISCOVERY_PLAIN) {
+        if (lan_discovery_plain(d, &payload, &len) != 0) {
+            disc->stats.rejected++;
+            return;
+        }
+    } else {
+        if (tuya_codec_decode(d->kind == LAN_DISCOVERY_GCM ? &disc->gcm : &disc->ecb,
+                              d->data, d->len, &pkt, disc->plain, sizeof(disc->plain),
+                              &used) != TUYA_CODEC_OK || used != d->len) {
+            disc->stats.rejected++;
+            return;
+        }
+        payload = pkt.payload;
+        len = pkt.len;
+    }
+
+    /* 3.5 IVs differ every time: compare the authenticated plaintext */
+    if (d->kind == LAN_DISCOVERY_GCM) {
+        key = payload;
+        key_len = len;
+        crc = crc32_compute(0, key, key_len);
+        dev = lan_discovery_duplicate(disc, crc, key, key_len);
+        if (dev != NULL) {
+            disc->stats.duplicates++;
+            lan_discovery_seen(disc, dev, d, now_ms, 0, 0);
+            return;
+        }
+    }
+
+    disc->parsed.gw_id[0] = '\0';
+    disc->parsed.product_key[0] = '\0';
+    disc->parsed.version[0] = '\0';
+    json_tok_reset(&disc->json);
+    if (json_tok_feed(&disc->json, (const char *) payload, len) != JSON_TOK_OK ||
+        json_tok_finish(&disc->json) != JSON_TOK_OK || disc->parsed.gw_id[0] == '\0') {
+        disc->stats.rejected++;
+        return;
+    }
+
+    slot = lan_discovery_slot(disc, disc->parsed.gw_id);
+    if (disc->id_index[slot] != 0) {
+        dev = &disc->devices[disc->id_index[slot] - 1];
+    } else if (disc->count < disc->max_devices) {
+        dev = &disc->devices[disc->count++];
+        memset(dev, 0, sizeof(*dev));
+        memcpy(dev->gw_id, disc->parsed.gw_id, sizeof(dev->gw_id));
+        disc->id_index[slot] = (uint32_t) disc->count;
+        created = 1;
+    } else {
+        disc->stats.dropped++;
+        return;
+    }
+
+    /* The dedupe slot may have been taken by another device since */
+    changed = created || !lan_discovery_is_last(dev, crc, key, key_len);
+    if (!changed) {
+        disc->stats.duplicates++;
+    }
+
+    memcpy(dev->product_key, disc->parsed.product_key, sizeof(dev->product_key));
+    memcpy(dev->version, disc->parsed.version, sizeof(dev->version));
+    dev->last_crc = crc;
+    dev->last_len = key_len;
+    memcpy(dev->last, key, key_len);
+    disc->dedupe[lan_discovery_dedupe_slot(disc, crc)] = (uint32_t)(dev - disc->devices) + 1;
+
+    lan_discovery_seen(disc, dev, d, now_ms, created, changed);
+}
+
+/* Process received datagrams */
+void lan_discovery_process(lan_discovery_t *disc, const lan_discovery_dgram_t *dgrams,
+                           size_t count, uint64_t now_ms)
+{
+    size_t i;
+
+    if (disc == NULL || disc->devices == NULL || dgrams == NULL) {
+        return;
+    }
+
+    for (i = 0; i < count; i++) {
+        if (dgrams[i].len > LAN_DISCOVERY_DGRAM_MAX) {
+            disc->stats.rejected++;
+            continue;
+        }
+        lan_discovery_one(disc, &dgrams[i], now_ms);
+    }
+
+    disc->stats.datagrams += count;
+}
+
+/* Drain one socket */
+static int lan_discovery_drain(lan_discovery_t *disc, lan_discovery_kind_t kind, uint64_t now_ms)
+{
+    struct lan_discovery_rx *rx = disc->rx;
+    int round, i, n, total = 0;
+
+    for (round = 0; round < LAN_DISCOVERY_MAX_ROUNDS; round++) {
+        for (i = 0; i < LAN_DISCOVERY_BATCH; i++) {
+            rx->iov[i].iov_base = rx->bufs[i];
+            rx->iov[i].iov_len = LAN_DISCOVERY_DGRAM_MAX;
+            memset(&rx->msgs[i].msg_hdr, 0, sizeof(rx->msgs[i].msg_hdr));
+            rx->msgs[i].msg_hdr.msg_iov = &rx->iov[i];
+            rx->msgs[i].msg_hdr.msg_iovlen = 1;
+            rx->msgs[i].msg_hdr.msg_name = &rx->from[i];
+            rx->msgs[i].msg_hdr.msg_namelen = sizeof(rx->from[i]);
+        }
+
+        n = recvmmsg(disc->fds[kind], rx->msgs, LAN_DISCOVERY_BATCH, MSG_DONTWAIT, NULL);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+            return LAN_DISCOVERY_ERR_RECV_FAILED;
+        }
+
+        for (i = 0; i < n; i++) {
+            rx->dgrams[i].data = rx->bufs[i];
+            rx->dgrams[i].addr = rx->from[i].sin_addr.s_addr;
+            rx->dgrams[i].kind = kind;
+            /* Oversized: rejected by lan_discovery_process() */
+            rx->dgrams[i].len = (rx->msgs[i].msg_hdr.msg_flags & MSG_TRUNC) ?
+                                LAN_DISCOVERY_DGRAM_MAX + 1 : rx->msgs[i].msg_len;
+        }
+
+        if (n > 0) {
+            disc->stats.batches++;
+            lan_discovery_process(disc, rx->dgrams, (size_t) n, now_ms);
+            total += n;
+        }
+
+        if (n < LAN_DISCOVERY_BATCH) {
+            break;
+        }
+    }
+
+    return total;
+}
+
+/* Drain the sockets */
+int lan_discovery_recv(lan_discovery_t *disc, uint64_t now_ms)
+{
+    int i, n, total = 0;
+
+    if (disc == NULL || disc->rx == NULL) {
+        return LAN_DISCOVERY_ERR_INVALID_PARAM;
+    }
+
+    for (i = 0; i < LAN_DISCOVERY_KINDS; i++) {
+        if (disc->fds[i] < 0) {
+            continue;
+        }
+        n = lan_discovery_drain(disc, (lan_discovery_kind_t) i, now_ms);
+        if (n < 0) {
+            return n;
+        }
+        total += n;
+    }
+
+    return total;
+}
+
+/* pcap header field in the file's byte order */
+static uint32_t lan_discovery_pcap32(const unsigned char *p, int big_endian)
+{
+    if (big_endian) {
+        return lan_discovery_get32(p);
+    }
+
+    return (uint32_t) p[3] << 24 | (uint32_t) p[2] << 16 | (uint32_t) p[1] << 8 | p[0];
+}
+
+/* Find the UDP payload of a captured frame. Returns 0 and fills d (data
+ * pointing into pkt) for a datagram to one of the ports, -1 otherwise. */
+static int lan_discovery_pcap_udp(const lan_discovery_t *disc, uint32_t link,
+                                  const unsigned char *pkt, size_t len,
+                                  lan_discovery_dgram_t *d)
+{
+    size_t off, ihl, total, udp_len;
+    uint16_t proto, dport;
+    int i;
+
+    switch (link) {
+    case LAN_DISCOVERY_LINK_ETHERNET:
+        if (len < 14) {
+            return -1;
+        }
+        proto = lan_discovery_get16(pkt + 12);
+        off = 14;
+        if (proto == 0x8100 && len >= 18) {   /* 802.1Q tag */
+            proto = lan_discovery_get16(pkt + 16);
+            off = 18;
+        }
+        break;
+    case LAN_DISCOVERY_LINK_LINUX_SLL:
+        if (len < 16) {
+            return -1;
+        }
+        proto = lan_discovery_get16(pkt + 14);
+        off = 16;
+        break;
+    case LAN_DISCOVERY_LINK_LINUX_SLL2:
+        if (len < 20) {
+            return -1;
+        }
+        proto = lan_discovery_get16(pkt);
+        off = 20;
+        break;
+    default:                            /* Raw IP */
+        proto = 0x0800;
+        off = 0;
+        break;
+    }
+
+    if (proto != 0x0800 || len - off < 20 || (pkt[off] >> 4) != 4) {
+        return -1;
+    }
+
+    pkt += off;
+    len -= off;
+    ihl = (size_t)(pkt[0] & 0x0f) * 4;
+    total = lan_discovery_get16(pkt + 2);
+    /* UDP, not a fragment */
+    if (ihl < 20 || total < ihl + 8 || total > len || pkt[9] != 17 ||
+        (lan_discovery_get16(pkt + 6) & 0x3fff) != 0) {
+        return -1;
+    }
+
+    memcpy(&d->addr, pkt + 12, sizeof(d->addr));
+    dport = lan_discovery_get16(pkt + ihl + 2);
+    udp_len = lan_discovery_get16(pkt + ihl + 4);
+    if (udp_len < 8 || udp_len > total - ihl) {
+        return -1;
+    }
+
+    for (i = 0; i < LAN_DISCOVERY_KINDS; i++) {
+        if (disc->ports[i] != 0 && disc->ports[i] == dport) {
+            d->kind = (lan_discovery_kind_t) i;
+            d->data = pkt + ihl + 8;
+            d->len = udp_len - 8;
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+/* Feed the broadcasts of a pcap capture */
+long lan_discovery_replay(lan_discovery_t *disc, const char *path)
+{
+    struct lan_discovery_rx *rx;
+    unsigned char hdr[24], *pkt;
+    lan_discovery_dgram_t d;
+    uint64_t now_ms = 0, t_ms, batch_ms = 0;
+    uint32_t link, caplen;
+    int big_endian, nsec;
+    size_t n = 0;
+    long total = 0;
+    FILE *f;
+
+    if (disc == NULL || disc->rx == NULL || path == NULL) {
+        return LAN_DISCOVERY_ERR_INVALID_PARAM;
+    }
+    rx = disc->rx;
+
+    f = fopen(path, "rb");
+    if (f == NULL) {
+        return LAN_DISCOVERY_ERR_IO_FAILED;
+    }
+
+    /* Magic in either byte order, microsecond or nanosecond timestamps */
+    if (fread(hdr, 1, 24, f) != 24) {
+        fclose(f);
+        return LAN_DISCOVERY_ERR_FORMAT;
+    }
+    big_endian = hdr[0] == 0xa1;
+    switch (lan_discovery_pcap32(hdr, big_endian)) {
+    case 0xa1b2c3d4u:
+        nsec = 0;
+        break;
+    case 0xa1b23c4du:
+        nsec = 1;
+        break;
+    default:
+        fclose(f);
+        return LAN_DISCOVERY_ERR_FORMAT;
+    }
+
+    link = lan_discovery_pcap32(hdr + 20, big_endian) & 0xffff;
+    if (link != LAN_DISCOVERY_LINK_ETHERNET && link != LAN_DISCOVERY_LINK_RAW &&
+        link != LAN_DISCOVERY_LINK_LINUX_SLL && link != LAN_DISCOVERY_LINK_IPV4 &&
+        link != LAN_DISCOVERY_LINK_LINUX_SLL2) {
+        fclose(f);
+        return LAN_DISCOVERY_ERR_FORMAT;
+    }
+
+    pkt = malloc(LAN_DISCOVERY_PCAP_SNAPLEN);
+    if (pkt == NULL) {
+        fclose(f);
+        return LAN_DISCOVERY_ERR_ALLOC_FAILED;
+    }
+
+    while (fread(hdr, 1, 16, f) == 16) {
+        caplen = lan_discovery_pcap32(hdr + 8, big_endian);
+        if (caplen > LAN_DISCOVERY_PCAP_SNAPLEN) {
+            if (fseek(f, (long) caplen, SEEK_CUR) != 0) {
+                break;
+            }
+            disc->stats.skipped++;
+            continue;
+        }
+        if (fread(pkt, 1, caplen, f) != caplen) {
+            break;                      /* Truncated capture */
+        }
+
+        if (lan_discovery_pcap_udp(disc, link, pkt, caplen, &d) != 0) {
+            disc->stats.skipped++;
+            continue;
+        }
+
+        /* A batch is processed at the time of its last packet */
+        t_ms = (uint64_t) lan_discovery_pcap32(hdr, big_endian) * 1000 +
+               lan_discovery_pcap32(hdr + 4, big_endian) / (nsec ? 1000000 : 1000);
+        if (n > 0 && t_ms - batch_ms > LAN_DISCOVERY_REPLAY_WINDOW_MS) {
+            lan_discovery_process(disc, rx->dgrams, n, now_ms);
+            total += (long) n;
+            n = 0;
+        }
+        if (n == 0) {
+            batch_ms = t_ms;
+        }
+        now_ms = t_ms;
+
+        rx->dgrams[n] = d;
+        if (d.len <= LAN_DISCOVERY_DGRAM_MAX) {
+            memcpy(rx->bufs[n], d.data, d.len);
+            rx->dgrams[n].data = rx->bufs[n];
+        }
+        if (++n == LAN_DISCOVERY_BATCH) {
+            lan_discovery_process(disc, rx->dgrams, n, now_ms);
+            total += (long) n;
+            n = 0;
+        }
+    }
+
+    if (n > 0) {
+        lan_discovery_process(disc, rx->dgrams, n, now_ms);
+        total += (long) n;
+    }
+
+    free(pkt);
+    fclose(f);
+
+    return total;
+}
+
+/* Device with this gwId */
+const lan_discovery_device_t *lan_discovery_find(const lan_discovery_t *disc, const char *gw_id)
+{
+    uint32_t idx;
+
+    if (disc == NULL || disc->devices == NULL || gw_id == NULL) {
+        return NULL;
+    }
+
+    idx = disc->id_index[lan_discovery_slot(disc, gw_id)];
+
+    return idx == 0 ? NULL : &disc->devices[idx - 1];
+}
+
+/* Close the sockets */
+void lan_discovery_close(lan_discovery_t *disc)
+{
+    int i;
+
+    if (disc == NULL) {
+        return;
+    }
+
+    for (i = 0; i < LAN_DISCOVERY_KINDS; i++) {
+        if (disc->fds[i] >= 0) {
+            close(disc->fds[i]);
+            disc->fds[i] = -1;
+        }
+    }
+
+    if (disc->epfd >= 0) {
+        close(disc->epfd);
+        disc->epfd = -1;
+    }
+}
+
+/* Close the sockets and free the table */
+void lan_discovery_free(lan_discovery_t *disc)
+{
+    if (disc == NULL) {
+        return;
+    }
+
+    lan_discovery_close(disc);
+    tuya_codec_free(&disc->ecb);
+    tuya_codec_free(&disc->gcm);
+
+    free(disc->devices);
+    free(disc->id_index);
+    free(disc->dedupe);
+    free(disc->rx);
+    disc->devices = NULL;
+    disc->id_index = NULL;
+    disc->dedupe = NULL;
+    disc->rx = NULL;
+    disc->count = 0;
+}
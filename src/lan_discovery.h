@@ -0,0 +1,188 @@
+/*
+ * Tuya LAN discovery
+ * Listens for the UDP broadcasts devices send every few seconds:
+ *
+ *   6666  protocol 3.1 and older: 55AA frame, JSON in clear
+ *   6667  3.3 / 3.4: 55AA frame, AES-128-ECB with the broadcast key
+ *   7000  3.5: 6699 frame, AES-128-GCM with the broadcast key
+ *
+ * The broadcast key is md5("yGAdlopoPVldABfn"), the same on every device.
+ *
+ * Each socket is drained with recvmmsg(), LAN_DISCOVERY_BATCH datagrams
+ * per system call, and a batch goes through one pass of decoding. Devices
+ * repeat the same announcement, so one identical to the one a device sent
+ * last (looked up by its CRC-32, then compared) only refreshes the
+ * device's last-seen time and address. ECB broadcasts are compared before
+ * decryption; 3.5 ones carry a fresh IV each time and are compared after
+ * it. JSON parsing happens for new or changed announcements only.
+ *
+ * The device table is keyed by gwId and records first/last-seen times and
+ * address changes. Times are in the clock the caller runs it on: monotonic
+ * milliseconds for live sockets, capture time for lan_discovery_replay(),
+ * which feeds the datagrams of a pcap capture through the same path.
+ *
+ * Single threaded: one discovery context per event loop.
+ */
+
+#ifndef LAN_DISCOVERY_H
+#define LAN_DISCOVERY_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "tuya_codec.h"
+#include "json_tok.h"
+
+/* Error codes */
+#define LAN_DISCOVERY_OK                    0
+#define LAN_DISCOVERY_ERR_INVALID_PARAM    -1
+#define LAN_DISCOVERY_ERR_ALLOC_FAILED     -2
+#define LAN_DISCOVERY_ERR_SOCKET_FAILED    -3
+#define LAN_DISCOVERY_ERR_RECV_FAILED      -4
+#define LAN_DISCOVERY_ERR_IO_FAILED        -5
+#define LAN_DISCOVERY_ERR_FORMAT           -6   /* Not a pcap capture, or unknown link type */
+#define LAN_DISCOVERY_ERR_CRYPTO           -7
+
+/* Broadcast ports */
+#define LAN_DISCOVERY_PORT_PLAIN           6666
+#define LAN_DISCOVERY_PORT_ECB             6667
+#define LAN_DISCOVERY_PORT_GCM             7000
+
+/* Datagrams per recvmmsg() */
+#define LAN_DISCOVERY_BATCH                64
+
+/* recvmmsg() rounds per socket per lan_discovery_recv(), so one busy port
+ * cannot starve the others or the rest of the loop */
+#define LAN_DISCOVERY_MAX_ROUNDS           16
+
+/* Larger datagrams are not announcements */
+#define LAN_DISCOVERY_DGRAM_MAX            512
+
+/* Default socket receive buffer, room for bursts between two polls */
+#define LAN_DISCOVERY_RCVBUF               (1024 * 1024)
+
+#define LAN_DISCOVERY_ID_LEN               32
+#define LAN_DISCOVERY_FIELD_LEN            24
+
+/* The broadcast key */
+extern const unsigned char lan_discovery_key[TUYA_CODEC_KEY_LEN];
+
+/* Broadcast kinds, one socket each */
+typedef enum {
+    LAN_DISCOVERY_PLAIN = 0,
+    LAN_DISCOVERY_ECB,
+    LAN_DISCOVERY_GCM,
+    LAN_DISCOVERY_KINDS
+} lan_discovery_kind_t;
+
+/* What changed in the table */
+typedef enum {
+    LAN_DISCOVERY_NEW = 0,              /* First announcement of a gwId */
+    LAN_DISCOVERY_ADDR_CHANGED,         /* Announced from another address */
+    LAN_DISCOVERY_UPDATED               /* Same address, different announcement */
+} lan_discovery_event_t;
+
+/* One device */
+typedef struct {
+    char gw_id[LAN_DISCOVERY_ID_LEN];
+    char product_key[LAN_DISCOVERY_FIELD_LEN];
+    char version[8];                    /* "3.3", empty if not announced */
+    lan_discovery_kind_t kind;          /* Broadcast it was last heard on */
+    uint32_t addr;                      /* IPv4 source, network byte order */
+    uint32_t prev_addr;                 /* Address before the last change, 0 = none */
+    uint64_t first_seen_ms;
+    uint64_t last_seen_ms;
+    uint64_t addr_changed_ms;           /* Time of the last address change */
+    unsigned long announcements;        /* Including duplicates */
+    unsigned long addr_changes;
+    uint32_t last_crc;                  /* Last announcement, for deduplication: */
+    size_t last_len;                    /* the frame body (3.3 and older) or the */
+    unsigned char last[LAN_DISCOVERY_DGRAM_MAX]; /* plaintext (3.5, random IVs) */
+} lan_discovery_device_t;
+
+/* Received datagram */
+typedef struct {
+    const unsigned char *data;
+    size_t len;
+    uint32_t addr;                      /* IPv4 source, network byte order */
+    lan_discovery_kind_t kind;          /* From the port it arrived on */
+} lan_discovery_dgram_t;
+
+/* Counters */
+typedef struct {
+    uint64_t datagrams;                 /* Received or replayed */
+    uint64_t batches;                   /* recvmmsg() calls that returned data */
+    uint64_t duplicates;                /* Same as the device's last announcement */
+    uint64_t rejected;                  /* Bad framing, integrity, encryption or JSON */
+    uint64_t dropped;                   /* New devices beyond max_devices */
+    uint64_t skipped;                   /* Replayed packets that are not broadcasts */
+} lan_discovery_stats_t;
+
+/* Table change; dev is valid during the call only */
+typedef void (*lan_discovery_cb)(const lan_discovery_device_t *dev, lan_discovery_event_t event,
+                                 void *arg);
+
+struct lan_discovery_rx;
+
+/* Discovery context */
+typedef struct {
+    int fds[LAN_DISCOVERY_KINDS];       /* -1 when not listening */
+    uint16_t ports[LAN_DISCOVERY_KINDS];
+    int epfd;                           /* Every socket, for lan_discovery_fd() */
+    int rcvbuf;                         /* SO_RCVBUF of new sockets, 0 = kernel default */
+    tuya_codec_t ecb;                   /* Keyed once with the broadcast key */
+    tuya_codec_t gcm;
+    json_tok_t json;
+    lan_discovery_device_t *devices;    /* In order of discovery */
+    size_t count;
+    size_t max_devices;
+    uint32_t *id_index;                 /* gwId hash -> device + 1, open addressing */
+    uint32_t *dedupe;                   /* Announcement CRC -> device + 1, direct mapped */
+    size_t index_mask;
+    struct lan_discovery_rx *rx;        /* recvmmsg() buffers */
+    unsigned char plain[LAN_DISCOVERY_DGRAM_MAX];
+    lan_discovery_device_t parsed;      /* Fields of the announcement being parsed */
+    lan_discovery_cb cb;
+    void *cb_arg;
+    lan_discovery_stats_t stats;
+} lan_discovery_t;
+
+/* Initialize an empty table for up to max_devices devices; cb may be NULL */
+int lan_discovery_init(lan_discovery_t *disc, size_t max_devices,
+                       lan_discovery_cb cb, void *arg);
+
+/* Bind the broadcast sockets (non-blocking, SO_REUSEADDR so other tools
+ * can listen too). ports is indexed by lan_discovery_kind_t; NULL listens
+ * on the standard ports and a zero entry skips that kind. Also sets the
+ * ports lan_discovery_replay() classifies packets by. */
+int lan_discovery_listen(lan_discovery_t *disc, const uint16_t ports[LAN_DISCOVERY_KINDS]);
+
+/* epoll descriptor, readable while any socket has datagrams */
+int lan_discovery_fd(const lan_discovery_t *disc);
+
+/* Drain the sockets with recvmmsg() and process what arrived.
+ * Returns the number of datagrams handled or a negative error code. */
+int lan_discovery_recv(lan_discovery_t *disc, uint64_t now_ms);
+
+/* Process received datagrams (what lan_discovery_recv() does per batch) */
+void lan_discovery_process(lan_discovery_t *disc, const lan_discovery_dgram_t *dgrams,
+                           size_t count, uint64_t now_ms);
+
+/* Feed the UDP packets of a pcap file (Ethernet, Linux cooked or raw IPv4)
+ * sent to the broadcast ports through lan_discovery_process(), in batches
+ * spanning at most a second of capture time and timed by their last
+ * packet. Returns the number of datagrams processed. */
+long lan_discovery_replay(lan_discovery_t *disc, const char *path);
+
+/* Device with this gwId, NULL if unknown */
+const lan_discovery_device_t *lan_discovery_find(const lan_discovery_t *disc, const char *gw_id);
+
+/* Monotonic clock for lan_discovery_recv(), in milliseconds */
+uint64_t lan_discovery_now_ms(void);
+
+/* Close the sockets */
+void lan_discovery_close(lan_discovery_t *disc);
+
+/* Close the sockets and free the table */
+void lan_discovery_free(lan_discovery_t *disc);
+
+#endif /* LAN_DISCOVERY_H */
@@ -0,0 +1,134 @@
+/*
+ * Latency histogram implementation
+ */
+
+#include "latency_hist.h"
+#include <string.h>
+
+/* Bucket index: values below 128 map to themselves, larger ones keep their
+ * top 7 significant bits (shift >= 1, sub-bucket 64..127) */
+static size_t latency_hist_index(uint64_t value)
+{
+    unsigned int shift;
+
+    if (value < 128) {
+        return (size_t) value;
+    }
+
+    shift = (unsigned int)(63 - __builtin_clzll(value)) - LATENCY_HIST_SUB_BITS;
+    if (shift > LATENCY_HIST_MAX_SHIFT) {
+        return LATENCY_HIST_BUCKETS - 1;
+    }
+
+    return 128 + (size_t)(shift - 1) * 64 + (size_t)((value >> shift) - 64);
+}
+
+/* Largest value that maps to a bucket */
+static uint64_t latency_hist_upper(size_t index)
+{
+    unsigned int shift;
+    uint64_t sub;
+
+    if (index < 128) {
+        return index;
+    }
+
+    shift = (unsigned int)((index - 128) / 64) + 1;
+    sub = (uint64_t)((index - 128) % 64) + 64;
+
+    return ((sub + 1) << shift) - 1;
+}
+
+/* Reset to empty */
+void latency_hist_init(latency_hist_t *hist)
+{
+    if (hist != NULL) {
+        memset(hist, 0, sizeof(*hist));
+    }
+}
+
+/* Record one value */
+void latency_hist_record(latency_hist_t *hist, uint64_t value)
+{
+    if (hist == NULL) {
+        return;
+    }
+
+    hist->counts[latency_hist_index(value)]++;
+
+    if (hist->count == 0 || value < hist->min) {
+        hist->min = value;
+    }
+    if (value > hist->max) {
+        hist->max = value;
+    }
+    hist->count++;
+    hist->sum += value;
+}
+
+/* Add src to dst */
+void latency_hist_merge(latency_hist_t *dst, const latency_hist_t *src)
+{
+    size_t i;
+
+    if (dst == NULL || src == NULL || src->count == 0) {
+        return;
+    }
+
+    for (i = 0; i < LATENCY_HIST_BUCKETS; i++) {
+        dst->counts[i] += src->counts[i];
+    }
+
+    if (dst->count == 0 || src->min < dst->min) {
+        dst->min = src->min;
+    }
+    if (src->max > dst->max) {
+        dst->max = src->max;
+    }
+    dst->count += src->count;
+    dst->sum += src->sum;
+}
+
+/* Value at percentile p */
+uint64_t latency_hist_percentile(const latency_hist_t *hist, double p)
+{
+    uint64_t rank, seen = 0;
+    size_t i;
+
+    if (hist == NULL || hist->count == 0) {
+        return 0;
+    }
+
+    if (p <= 0.0) {
+        return hist->min;
+    }
+    if (p >= 100.0) {
+        return hist->max;
+    }
+
+    /* Smallest value with at least p% of the samples at or below it */
+    rank = (uint64_t)(p / 100.0 * (double) hist->count + 0.5);
+    if (rank == 0) {
+        rank = 1;
+    }
+
+    for (i = 0; i < LATENCY_HIST_BUCKETS; i++) {
+        seen += hist->counts[i];
+        if (seen >= rank) {
+            uint64_t upper = latency_hist_upper(i);
+            return upper < hist->max ? upper : hist->max;
+        }
+    }
+
+    return hist->max;
+}
+
+/* Arithmetic mean */
+double latency_hist_mean(const latency_hist_t *hist)
+{
+    if (hist == NULL || hist->count == 0) {
+        return 0.0;
+    }
+
+    return (double) hist->sum / (double) hist->count;
+}
@@ -0,0 +1,44 @@
+/*
+ * Latency histogram
+ * HDR-style log-linear histogram of nanosecond values: exact below 128,
+ * then 64 sub-buckets per power of two (under 1.6% relative error) up to
+ * about 70 minutes. Recording is a few instructions and never allocates.
+ */
+
+#ifndef LATENCY_HIST_H
+#define LATENCY_HIST_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Bucket layout */
+#define LATENCY_HIST_SUB_BITS              6
+#define LATENCY_HIST_MAX_SHIFT             35
+#define LATENCY_HIST_BUCKETS               (128 + LATENCY_HIST_MAX_SHIFT * 64)
+
+/* Histogram; zero-initialized is empty */
+typedef struct {
+    uint64_t counts[LATENCY_HIST_BUCKETS];
+    uint64_t count;                 /* Values recorded */
+    uint64_t sum;                   /* For the mean */
+    uint64_t min;
+    uint64_t max;
+} latency_hist_t;
+
+/* Reset to empty */
+void latency_hist_init(latency_hist_t *hist);
+
+/* Record one value (nanoseconds); larger values land in the last bucket */
+void latency_hist_record(latency_hist_t *hist, uint64_t value);
+
+/* Add all values of src to dst */
+void latency_hist_merge(latency_hist_t *dst, const latency_hist_t *src);
+
+/* Value at percentile p (0-100), reported as the upper bound of its
+ * bucket; 0 when empty */
+uint64_t latency_hist_percentile(const latency_hist_t *hist, double p);
+
+/* Arithmetic mean; 0 when empty */
+double latency_hist_mean(const latency_hist_t *hist);
+
+#endif /* LATENCY_HIST_H */
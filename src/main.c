@@ -9,7 +9,11 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include "transport_tcp.h"
+#include "https_pool.h"
+#include "session_cache.h"
+#include "conn_metrics.h"
+#include "tls_profile.h"
+#include "resolver.h"
 #include "mbedtls/ssl.h"
 #include "mbedtls/error.h"
 #include "mbedtls/debug.h"
@@ -23,14 +27,25 @@
 
 #define SERVER_HOST "laundrygo.id"
 #define SERVER_PORT "443"
-#define GET_REQUEST "GET /api HTTP/1.1\r\n" \
-                    "Host: laundrygo.id\r\n" \
-                    "User-Agent: mbedtls-client/1.0\r\n" \
-                    "Connection: close\r\n" \
-                    "\r\n"
+#define SERVER_PATH "/api"
+
+/* Uncomment to pin SERVER_HOST to fixed addresses instead of resolving it */
+/* #define SERVER_ADDRS "203.0.113.10" */
+
+/* Requests issued per run; all but the first reuse the pooled connection */
+#define REQUEST_COUNT 3
 
 #define DEBUG_LEVEL 1
 
+/* Serialized TLS sessions are kept here between runs for resumption */
+#define SESSION_CACHE_FILE "tuya-client.sessions"
+
+/* TLS tuning profile ("default", "compat", "fast" or "lowmem"); overridden by argv[1] */
+#define TLS_PROFILE "compat"
+
+/* Prometheus text snapshot of the connection metrics, written on exit */
+#define METRICS_FILE "tuya-client.prom"
+
 static void my_debug(void *ctx, int level,
                      const char *file, int line,
                      const char *str)
@@ -40,12 +55,24 @@ static void my_debug(void *ctx, int level,
     fflush((FILE *) ctx);
 }
 
+/* Print response body as it arrives */
+static int print_body(void *ctx, const unsigned char *data, size_t len)
+{
+    ((void) ctx);
+    printf("%.*s", (int) len, (const char *) data);
+    return 0;
+}
+
 int main(int argc, char *argv[])
 {
-    int ret = 1, len;
-    transport_tcp_t transport;
-    unsigned char buf[4096];
+    int ret = 1, i;
     const char *pers = "tuya_client";
+    const tls_profile_t *profile;
+    session_cache_t sessions;
+    conn_metrics_registry_t metrics;
+    resolver_t resolver;
+    https_pool_t pool;
+    https_response_t resp;
 
 #ifdef CUSTOM_RNG
     custom_rng_context custom_rng;
@@ -53,7 +80,6 @@ int main(int argc, char *argv[])
     mbedtls_entropy_context entropy;
     mbedtls_ctr_drbg_context ctr_drbg;
 #endif
-    mbedtls_ssl_context ssl;
     mbedtls_ssl_config conf;
 
 #if defined(MBEDTLS_DEBUG_C)
@@ -61,9 +87,14 @@ int main(int argc, char *argv[])
 #endif
 
     /* Initialize contexts */
-    transport_tcp_init(&transport);
-    mbedtls_ssl_init(&ssl);
     mbedtls_ssl_config_init(&conf);
+    memset(&pool, 0, sizeof(pool));
+    session_cache_init(&sessions, SESSION_CACHE_FILE);
+    conn_metrics_registry_init(&metrics);
+    resolver_init(&resolver);
+#ifdef SERVER_ADDRS
+    resolver_pin(&resolver, SERVER_HOST, SERVER_ADDRS);
+#endif
     
 #ifdef CUSTOM_RNG
     custom_rng_init(&custom_rng);
@@ -98,18 +129,7 @@ int main(int argc, char *argv[])
 
     printf(" ok\n");
 
-    /* 2. Connect to server */
-    printf("  . Connecting to tcp/%s/%s...", SERVER_HOST, SERVER_PORT);
-    fflush(stdout);
-
-    if ((ret = transport_tcp_connect(&transport, SERVER_HOST, SERVER_PORT)) != 0) {
-        printf(" failed\n  ! transport_tcp_connect returned %d\n\n", ret);
-        goto exit;
-    }
-
-    printf(" ok\n");
-
-    /* 3. Setup SSL/TLS structure */
+    /* 2. Setup SSL/TLS configuration */
     printf("  . Setting up the SSL/TLS structure...");
     fflush(stdout);
 
@@ -121,7 +141,20 @@ int main(int argc, char *argv[])
         goto exit;
     }
 
-    printf(" ok\n");
+    profile = tls_profile_find(argc > 1 ? argv[1] : TLS_PROFILE);
+    if (profile == NULL) {
+        printf(" failed\n  ! unknown TLS profile %s\n\n", argc > 1 ? argv[1] : TLS_PROFILE);
+        ret = 1;
+        goto exit;
+    }
+
+    if ((ret = tls_profile_apply(&conf, profile)) != TLS_PROFILE_OK) {
+        printf(" failed\n  ! tls_profile_apply(%s) returned %d\n\n", profile->name, ret);
+        goto exit;
+    }
+
+    printf(" ok (profile %s%s)\n", profile->name,
+           tls_profile_early_data(profile) ? ", 0-RTT" : "");
 
     /* IMPORTANT: Skip certificate verification - NOT SECURE, for testing only */
     printf("  . Configuring SSL/TLS (skipping certificate verification)...");
@@ -135,90 +168,49 @@ int main(int argc, char *argv[])
     
     mbedtls_ssl_conf_dbg(&conf, my_debug, stdout);
 
-    if ((ret = mbedtls_ssl_setup(&ssl, &conf)) != 0) {
-        printf(" failed\n  ! mbedtls_ssl_setup returned %d\n\n", ret);
-        goto exit;
-    }
-
-    if ((ret = mbedtls_ssl_set_hostname(&ssl, SERVER_HOST)) != 0) {
-        printf(" failed\n  ! mbedtls_ssl_set_hostname returned %d\n\n", ret);
-        goto exit;
-    }
+#if defined(MBEDTLS_SSL_SESSION_TICKETS)
+    mbedtls_ssl_conf_session_tickets(&conf, MBEDTLS_SSL_SESSION_TICKETS_ENABLED);
+#if defined(MBEDTLS_SSL_PROTO_TLS1_3) && MBEDTLS_VERSION_NUMBER >= 0x03060100
+    /* Report TLS 1.3 NewSessionTicket from mbedtls_ssl_read() so it can be cached */
+    mbedtls_ssl_conf_tls13_enable_signal_new_session_tickets(
+        &conf, MBEDTLS_SSL_TLS1_3_SIGNAL_NEW_SESSION_TICKETS_ENABLED);
+#endif
+#endif
 
-    mbedtls_ssl_set_bio(&ssl, &transport, transport_tcp_send, transport_tcp_recv, NULL);
+    https_pool_init(&pool, &conf, &sessions);
+    pool.metrics = &metrics;
+    pool.resolver = &resolver;
+    /* ClientHello rides on the SYN of reconnects once the server sent a cookie */
+    pool.tcp_opts.fastopen = 1;
+    pool.early_data = tls_profile_early_data(profile);
 
     printf(" ok\n");
 
-    /* 4. Perform SSL/TLS handshake */
-    printf("  . Performing the SSL/TLS handshake...");
-    fflush(stdout);
+    /* 3. Send requests over the keep-alive connection pool */
+    for (i = 0; i < REQUEST_COUNT; i++) {
+        printf("\n  > GET %s%s (request %d/%d)\n\n", SERVER_HOST, SERVER_PATH,
+               i + 1, REQUEST_COUNT);
+        fflush(stdout);
 
-    while ((ret = mbedtls_ssl_handshake(&ssl)) != 0) {
-        if (ret != MBEDTLS_ERR_SSL_WANT_READ && ret != MBEDTLS_ERR_SSL_WANT_WRITE) {
-            char error_buf[100];
-            mbedtls_strerror(ret, error_buf, 100);
-            printf(" failed\n  ! mbedtls_ssl_handshake returned -0x%x: %s\n\n",
-                   (unsigned int) -ret, error_buf);
+        ret = https_pool_request(&pool, SERVER_HOST, SERVER_PORT, "GET", SERVER_PATH,
+                                 &resp, print_body, NULL);
+        if (ret != HTTPS_POOL_OK) {
+            printf("\n  ! https_pool_request returned %d\n\n", ret);
             goto exit;
         }
-    }
-
-    printf(" ok\n");
-    printf("    [ Protocol is %s ]\n", mbedtls_ssl_get_version(&ssl));
-    printf("    [ Ciphersuite is %s ]\n", mbedtls_ssl_get_ciphersuite(&ssl));
 
-    /* 5. Send HTTP GET request */
-    printf("\n  > Write to server:");
-    fflush(stdout);
-
-    len = sprintf((char *) buf, GET_REQUEST);
-
-    while ((ret = mbedtls_ssl_write(&ssl, buf, len)) <= 0) {
-        if (ret != MBEDTLS_ERR_SSL_WANT_READ && ret != MBEDTLS_ERR_SSL_WANT_WRITE) {
-            printf(" failed\n  ! mbedtls_ssl_write returned %d\n\n", ret);
-            goto exit;
-        }
+        printf("\n\n  < HTTP %d, %zu body bytes\n", resp.status, resp.body_len);
+        printf("    [ Protocol is %s ]\n", resp.tls_version);
+        printf("    [ Ciphersuite is %s ]\n", resp.ciphersuite);
+        printf("    [ %s connection, %s handshake%s, %s ]\n",
+               resp.reused ? "Reused" : "New",
+               resp.resumed ? "resumed" : "full",
+               resp.early_data ? " with 0-RTT request" : "",
+               resp.keep_alive ? "kept alive" : "closed");
     }
 
-    len = ret;
-    printf(" %d bytes written\n\n", len);
-    printf("Request sent:\n%s\n", (char *) buf);
-
-    /* 6. Read HTTP response */
-    printf("  < Read from server:\n\n");
-    fflush(stdout);
-
-    do {
-        len = sizeof(buf) - 1;
-        memset(buf, 0, sizeof(buf));
-        ret = mbedtls_ssl_read(&ssl, buf, len);
-
-        if (ret == MBEDTLS_ERR_SSL_WANT_READ || ret == MBEDTLS_ERR_SSL_WANT_WRITE) {
-            continue;
-        }
-
-        if (ret == MBEDTLS_ERR_SSL_PEER_CLOSE_NOTIFY) {
-            printf("\nConnection closed by server\n");
-            ret = 0;
-            break;
-        }
-
-        if (ret < 0) {
-            printf("failed\n  ! mbedtls_ssl_read returned %d\n\n", ret);
-            break;
-        }
-
-        if (ret == 0) {
-            printf("\nEOF\n\n");
-            break;
-        }
-
-        len = ret;
-        printf("%.*s", len, (char *) buf);
-    } while (1);
-
-    printf("\n");
-    mbedtls_ssl_close_notify(&ssl);
+    printf("\n  . Connection pool: %lu connects, %lu reuses, %lu stale\n",
+           pool.connects, pool.reuses, pool.stale);
 
 exit:
 #ifdef MBEDTLS_ERROR_C
@@ -229,10 +221,25 @@ exit:
     }
 #endif
 
+    printf("  . DNS cache: %lu/%lu hits, %lu queries sent, %lu timeouts\n",
+           resolver.hits, resolver.lookups, resolver.sent, resolver.timeouts);
+    printf("  . Session cache: %lu/%lu hits, %lu resumed / %lu full handshakes\n\n",
+           sessions.hits, sessions.lookups,
+           sessions.resumed_handshakes, sessions.full_handshakes);
+    session_cache_flush(&sessions);
+
+    /* Written before the pool closes so open connections are included */
+    if (conn_metrics_write_file(&metrics, CONN_METRICS_FORMAT_PROMETHEUS,
+                                METRICS_FILE) == CONN_METRICS_OK) {
+        printf("  . Connection metrics written to %s\n\n", METRICS_FILE);
+    }
+
     /* Cleanup */
-    transport_tcp_close(&transport);
-    mbedtls_ssl_free(&ssl);
+    https_pool_free(&pool);
+    conn_metrics_registry_free(&metrics);
+    resolver_free(&resolver);
     mbedtls_ssl_config_free(&conf);
+    session_cache_free(&sessions);
     
 #ifdef CUSTOM_RNG
     custom_rng_free(&custom_rng);
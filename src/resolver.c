@@ -0,0 +1,1293 @@
+/*
+ * DNS resolver implementation
+ *
+ * Wire format (RFC 1035): 12 byte header (id, flags, 4 section counts),
+ * question (name, type, class), then resource records (name, type, class,
+ * ttl, rdlength, rdata). Names in answers may be compressed with pointers.
+ */
+
+#include "resolver.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/random.h>
+#include <sys/stat.h>
+#include <sys/epoll.h>
+
+#define RESOLVER_DNS_PORT          53
+#define RESOLVER_MAX_PACKET        1232    /* EDNS-safe UDP payload */
+#define RESOLVER_MAX_HOSTS_FILE    (1024 * 1024)
+#define RESOLVER_MAX_POINTERS      16
+
+#define RESOLVER_TYPE_A            1
+#define RESOLVER_TYPE_SOA          6
+#define RESOLVER_TYPE_AAAA         28
+#define RESOLVER_CLASS_IN          1
+
+#define RESOLVER_RCODE_NXDOMAIN    3
+
+#define RESOLVER_FLAG_QR           0x8000
+#define RESOLVER_FLAG_TC           0x0200
+
+/* Query slot index per record type */
+#define RESOLVER_V4                0
+#define RESOLVER_V6                1
+
+static const uint16_t resolver_qtypes[2] = { RESOLVER_TYPE_A, RESOLVER_TYPE_AAAA };
+
+/* Monotonic clock in milliseconds */
+uint64_t resolver_now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+static uint16_t resolver_get16(const unsigned char *p)
+{
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+static uint32_t resolver_get32(const unsigned char *p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+           ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+static void resolver_put16(unsigned char *p, uint16_t v)
+{
+    p[0] = (unsigned char)(v >> 8);
+    p[1] = (unsigned char)v;
+}
+
+/* Lowercase host without a trailing dot into key; checks label lengths */
+static int resolver_normalize(const char *host, char *key)
+{
+    size_t i, len = strlen(host), label = 0;
+
+    if (len > 0 && host[len - 1] == '.') {
+        len--;
+    }
+
+    if (len == 0 || len >= RESOLVER_NAME_LEN) {
+        return RESOLVER_ERR_INVALID_PARAM;
+    }
+
+    for (i = 0; i < len; i++) {
+        if (host[i] == '.') {
+            if (label == 0) {
+                return RESOLVER_ERR_INVALID_PARAM;
+            }
+            label = 0;
+        } else if (++label > 63) {
+            return RESOLVER_ERR_INVALID_PARAM;
+        }
+        key[i] = (char)tolower((unsigned char)host[i]);
+    }
+    key[len] = '\0';
+
+    return RESOLVER_OK;
+}
+
+/* Parse one textual address */
+static int resolver_parse_addr(const char *text, resolver_addr_t *addr)
+{
+    memset(addr, 0, sizeof(*addr));
+
+    if (inet_pton(AF_INET, text, addr->addr) == 1) {
+        addr->family = AF_INET;
+        return RESOLVER_OK;
+    }
+
+    if (inet_pton(AF_INET6, text, addr->addr) == 1) {
+        addr->family = AF_INET6;
+        return RESOLVER_OK;
+    }
+
+    return RESOLVER_ERR_INVALID_PARAM;
+}
+
+/* Append an address if there is room */
+static void resolver_addrs_add(resolver_addrs_t *addrs, const resolver_addr_t *addr)
+{
+    if (addrs->count < RESOLVER_MAX_ADDRS) {
+        addrs->addrs[addrs->count++] = *addr;
+    }
+}
+
+/* IPv4 list followed by the IPv6 list */
+static void resolver_addrs_merge(resolver_addrs_t *out, const resolver_addrs_t *v4,
+                                 const resolver_addrs_t *v6)
+{
+    size_t i;
+
+    out->count = 0;
+    for (i = 0; i < v4->count; i++) {
+        resolver_addrs_add(out, &v4->addrs[i]);
+    }
+    for (i = 0; i < v6->count; i++) {
+        resolver_addrs_add(out, &v6->addrs[i]);
+    }
+}
+
+/* Alternate the families, starting with first_family (RFC 8305 section 4) */
+void resolver_interleave(resolver_addrs_t *addrs, int first_family)
+{
+    resolver_addrs_t first, other;
+    size_t i, a = 0, b = 0;
+
+    if (addrs == NULL) {
+        return;
+    }
+
+    if (first_family == AF_UNSPEC) {
+        first_family = AF_INET6;
+    }
+
+    first.count = 0;
+    other.count = 0;
+    for (i = 0; i < addrs->count; i++) {
+        resolver_addrs_add(addrs->addrs[i].family == first_family ? &first : &other,
+                           &addrs->addrs[i]);
+    }
+
+    for (i = 0; i < addrs->count; i++) {
+        if (a < first.count && (i % 2 == 0 || b == other.count)) {
+            addrs->addrs[i] = first.addrs[a++];
+        } else {
+            addrs->addrs[i] = other.addrs[b++];
+        }
+    }
+}
+
+/* Fill ss with addr:port */
+socklen_t resolver_sockaddr(const resolver_addr_t *addr, uint16_t port,
+                            struct sockaddr_storage *ss)
+{
+    memset(ss, 0, sizeof(*ss));
+
+    if (addr->family == AF_INET6) {
+        struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *)ss;
+
+        sin6->sin6_family = AF_INET6;
+        sin6->sin6_port = htons(port);
+        memcpy(&sin6->sin6_addr, addr->addr, 16);
+        return sizeof(*sin6);
+    }
+
+    {
+        struct sockaddr_in *sin = (struct sockaddr_in *)ss;
+
+        sin->sin_family = AF_INET;
+        sin->sin_port = htons(port);
+        memcpy(&sin->sin_addr, addr->addr, 4);
+        return sizeof(*sin);
+    }
+}
+
+/* ---- Cache --------------------------------------------------------- */
+
+static resolver_entry_t *resolver_find(resolver_t *res, const char *key)
+{
+    size_t i;
+
+    for (i = 0; i < RESOLVER_MAX_ENTRIES; i++) {
+        if (res->cache[i].name[0] != '\0' && strcmp(res->cache[i].name, key) == 0) {
+            return &res->cache[i];
+        }
+    }
+
+    return NULL;
+}
+
+/* Entry for key: the existing one, a free one, or the least recently used
+ * non-pinned one. NULL if every slot is pinned. */
+static resolver_entry_t *resolver_slot(resolver_t *res, const char *key)
+{
+    resolver_entry_t *entry = resolver_find(res, key), *lru = NULL;
+    size_t i;
+
+    if (entry != NULL) {
+        return entry;
+    }
+
+    for (i = 0; i < RESOLVER_MAX_ENTRIES; i++) {
+        entry = &res->cache[i];
+        if (entry->name[0] == '\0') {
+            return entry;
+        }
+        if (entry->source != RESOLVER_SOURCE_PIN &&
+            (lru == NULL || entry->last_used_ms < lru->last_used_ms)) {
+            lru = entry;
+        }
+    }
+
+    return lru;
+}
+
+/* Cache an answer; ttl_sec 0 means it never expires */
+static void resolver_store(resolver_t *res, const char *key, int status,
+                           const resolver_addrs_t *addrs, resolver_source_t source,
+                           uint32_t ttl_sec)
+{
+    resolver_entry_t *entry = resolver_slot(res, key);
+    uint64_t now = resolver_now_ms();
+    int family = AF_UNSPEC;
+
+    /* A pin is only replaced by another pin */
+    if (entry == NULL ||
+        (entry->source == RESOLVER_SOURCE_PIN && entry->name[0] != '\0' &&
+         source != RESOLVER_SOURCE_PIN)) {
+        return;
+    }
+
+    /* The connect preference outlives the answer it was learned with */
+    if (strcmp(entry->name, key) == 0) {
+        family = entry->family;
+    }
+
+    memset(entry, 0, sizeof(*entry));
+    snprintf(entry->name, sizeof(entry->name), "%s", key);
+    entry->status = status;
+    entry->source = source;
+    entry->family = family;
+    entry->last_used_ms = now;
+    entry->expires_ms = ttl_sec != 0 ? now + (uint64_t)ttl_sec * 1000 : 0;
+    if (addrs != NULL) {
+        entry->addrs = *addrs;
+    }
+}
+
+/* Pin host to a list of addresses */
+int resolver_pin(resolver_t *res, const char *host, const char *addrs)
+{
+    char key[RESOLVER_NAME_LEN], token[64];
+    resolver_addrs_t list;
+    resolver_addr_t addr;
+    size_t n;
+
+    if (res == NULL || host == NULL || addrs == NULL ||
+        resolver_normalize(host, key) != RESOLVER_OK) {
+        return RESOLVER_ERR_INVALID_PARAM;
+    }
+
+    list.count = 0;
+    while (*addrs != '\0') {
+        n = strcspn(addrs, ", \t");
+        if (n > 0 && n < sizeof(token)) {
+            memcpy(token, addrs, n);
+            token[n] = '\0';
+            if (resolver_parse_addr(token, &addr) != RESOLVER_OK) {
+                return RESOLVER_ERR_INVALID_PARAM;
+            }
+            resolver_addrs_add(&list, &addr);
+        } else if (n > 0) {
+            return RESOLVER_ERR_INVALID_PARAM;
+        }
+        addrs += n;
+        addrs += strspn(addrs, ", \t");
+    }
+
+    if (list.count == 0) {
+        return RESOLVER_ERR_INVALID_PARAM;
+    }
+
+    resolver_store(res, key, RESOLVER_OK, &list, RESOLVER_SOURCE_PIN, 0);
+
+    return RESOLVER_OK;
+}
+
+/* Remove a pin */
+void resolver_unpin(resolver_t *res, const char *host)
+{
+    char key[RESOLVER_NAME_LEN];
+    resolver_entry_t *entry;
+
+    if (res == NULL || host == NULL || resolver_normalize(host, key) != RESOLVER_OK) {
+        return;
+    }
+
+    entry = resolver_find(res, key);
+    if (entry != NULL && entry->source == RESOLVER_SOURCE_PIN) {
+        memset(entry, 0, sizeof(*entry));
+    }
+}
+
+/* Drop every cached answer except pins */
+void resolver_flush(resolver_t *res)
+{
+    size_t i;
+
+    if (res == NULL) {
+        return;
+    }
+
+    for (i = 0; i < RESOLVER_MAX_ENTRIES; i++) {
+        if (res->cache[i].source != RESOLVER_SOURCE_PIN) {
+            memset(&res->cache[i], 0, sizeof(res->cache[i]));
+        }
+    }
+}
+
+/* Remember the family that connected */
+void resolver_set_family(resolver_t *res, const char *host, int family)
+{
+    char key[RESOLVER_NAME_LEN];
+    resolver_entry_t *entry;
+
+    if (res == NULL || host == NULL || resolver_normalize(host, key) != RESOLVER_OK) {
+        return;
+    }
+
+    entry = resolver_find(res, key);
+    if (entry != NULL) {
+        entry->family = family;
+    }
+}
+
+/* Family remembered for host */
+int resolver_family(resolver_t *res, const char *host)
+{
+    char key[RESOLVER_NAME_LEN];
+    resolver_entry_t *entry;
+
+    if (res == NULL || host == NULL || resolver_normalize(host, key) != RESOLVER_OK) {
+        return AF_UNSPEC;
+    }
+
+    entry = resolver_find(res, key);
+
+    return entry != NULL ? entry->family : AF_UNSPEC;
+}
+
+/* ---- Configuration sources ------------------------------------------- */
+
+/* Read a whole file into a NUL terminated buffer sized by fstat(), keeping
+ * at most RESOLVER_MAX_HOSTS_FILE bytes */
+static char *resolver_read_file(const char *path)
+{
+    FILE *f = fopen(path, "r");
+    struct stat st;
+    char *buf;
+    size_t size, len = 0, n;
+
+    if (f == NULL) {
+        return NULL;
+    }
+
+    if (fstat(fileno(f), &st) != 0) {
+        fclose(f);
+        return NULL;
+    }
+    size = st.st_size < RESOLVER_MAX_HOSTS_FILE ? (size_t)st.st_size : RESOLVER_MAX_HOSTS_FILE;
+
+    buf = malloc(size + 1);
+    if (buf != NULL) {
+        while (len < size && (n = fread(buf + len, 1, size - len, f)) > 0) {
+            len += n;
+        }
+        buf[len] = '\0';
+    }
+
+    fclose(f);
+
+    return buf;
+}
+
+/* Addresses of key in the hosts file: "address name [aliases...]" lines */
+static int resolver_hosts_lookup(const char *hosts, const char *key, resolver_addrs_t *out)
+{
+    resolver_addrs_t v4, v6;
+    resolver_addr_t addr;
+    char line[512], *tok, *save;
+    const char *p = hosts, *eol;
+    size_t n;
+
+    v4.count = 0;
+    v6.count = 0;
+
+    while (*p != '\0') {
+        eol = strchr(p, '\n');
+        n = eol != NULL ? (size_t)(eol - p) : strlen(p);
+
+        if (n < sizeof(line)) {
+            memcpy(line, p, n);
+            line[n] = '\0';
+            line[strcspn(line, "#")] = '\0';
+
+            tok = strtok_r(line, " \t\r", &save);
+            if (tok != NULL && resolver_parse_addr(tok, &addr) == RESOLVER_OK) {
+                while ((tok = strtok_r(NULL, " \t\r", &save)) != NULL) {
+                    if (strcasecmp(tok, key) == 0) {
+                        resolver_addrs_add(addr.family == AF_INET ? &v4 : &v6, &addr);
+                        break;
+                    }
+                }
+            }
+        }
+
+        p += n;
+        if (*p == '\n') {
+            p++;
+        }
+    }
+
+    resolver_addrs_merge(out, &v4, &v6);
+
+    return out->count > 0 ? RESOLVER_OK : RESOLVER_ERR_NOT_FOUND;
+}
+
+/* Replace the hosts source */
+int resolver_load_hosts(resolver_t *res, const char *path)
+{
+    char *hosts = NULL;
+
+    if (res == NULL) {
+        return RESOLVER_ERR_INVALID_PARAM;
+    }
+
+    if (path != NULL && (hosts = resolver_read_file(path)) == NULL) {
+        return RESOLVER_ERR_IO_FAILED;
+    }
+
+    free(res->hosts);
+    res->hosts = hosts;
+
+    /* Answers from the previous sources may now be wrong */
+    resolver_flush(res);
+
+    return RESOLVER_OK;
+}
+
+/* Add another nameserver */
+int resolver_add_server(resolver_t *res, const char *ip, uint16_t port)
+{
+    resolver_addr_t addr;
+    size_t i;
+
+    if (res == NULL || ip == NULL || res->server_count >= RESOLVER_MAX_SERVERS ||
+        resolver_parse_addr(ip, &addr) != RESOLVER_OK) {
+        return RESOLVER_ERR_INVALID_PARAM;
+    }
+
+    i = res->server_count;
+    if (i > 0 && res->servers[0].ss_family != addr.family) {
+        return RESOLVER_ERR_INVALID_PARAM;
+    }
+
+    res->server_lens[i] = resolver_sockaddr(&addr, port, &res->servers[i]);
+    res->server_count++;
+
+    return RESOLVER_OK;
+}
+
+/* Replace the nameservers */
+int resolver_set_server(resolver_t *res, const char *ip, uint16_t port)
+{
+    if (res == NULL) {
+        return RESOLVER_ERR_INVALID_PARAM;
+    }
+
+    res->server_count = 0;
+
+    return resolver_add_server(res, ip, port);
+}
+
+/* "nameserver" and "options timeout:n attempts:n" lines of resolv.conf */
+static void resolver_load_resolv_conf(resolver_t *res, const char *path)
+{
+    char line[256], *tok, *save;
+    FILE *f = fopen(path, "r");
+    int v;
+
+    if (f == NULL) {
+        return;
+    }
+
+    while (fgets(line, sizeof(line), f) != NULL) {
+        line[strcspn(line, "#;")] = '\0';
+        tok = strtok_r(line, " \t\r\n", &save);
+        if (tok == NULL) {
+            continue;
+        }
+
+        if (strcmp(tok, "nameserver") == 0) {
+            tok = strtok_r(NULL, " \t\r\n", &save);
+            if (tok != NULL) {
+                tok[strcspn(tok, "%")] = '\0';  /* Drop an IPv6 zone index */
+                resolver_add_server(res, tok, RESOLVER_DNS_PORT);
+            }
+        } else if (strcmp(tok, "options") == 0) {
+            while ((tok = strtok_r(NULL, " \t\r\n", &save)) != NULL) {
+                if (sscanf(tok, "timeout:%d", &v) == 1 && v > 0) {
+                    res->timeout_ms = (uint32_t)v * 1000;
+                } else if (sscanf(tok, "attempts:%d", &v) == 1 && v > 0) {
+                    res->attempts = v;
+                }
+            }
+        }
+    }
+
+    fclose(f);
+}
+
+/* Initialize the resolver */
+int resolver_init(resolver_t *res)
+{
+    if (res == NULL) {
+        return RESOLVER_ERR_INVALID_PARAM;
+    }
+
+    memset(res, 0, sizeof(*res));
+    res->timeout_ms = RESOLVER_TIMEOUT_MS;
+    res->attempts = RESOLVER_ATTEMPTS;
+
+    res->fd = epoll_create1(EPOLL_CLOEXEC);
+    if (res->fd < 0) {
+        return RESOLVER_ERR_SOCKET_FAILED;
+    }
+
+    resolver_load_resolv_conf(res, RESOLVER_RESOLV_CONF);
+    if (res->server_count == 0 &&
+        resolver_add_server(res, "127.0.0.1", RESOLVER_DNS_PORT) != RESOLVER_OK) {
+        return RESOLVER_ERR_SOCKET_FAILED;
+    }
+
+    resolver_load_hosts(res, RESOLVER_HOSTS_FILE);
+
+    return RESOLVER_OK;
+}
+
+/* ---- Queries ----------------------------------------------------------- */
+
+static resolver_query_t *resolver_find_query(resolver_t *res, const char *key)
+{
+    size_t i;
+
+    for (i = 0; i < RESOLVER_MAX_QUERIES; i++) {
+        if (res->queries[i].name[0] != '\0' && strcmp(res->queries[i].name, key) == 0) {
+            return &res->queries[i];
+        }
+    }
+
+    return NULL;
+}
+
+/* Random transaction id not used by another query in flight. Without the
+ * kernel's random source the query fails: a guessable id would undo the
+ * RFC 5452 hardening. */
+static int resolver_new_id(resolver_t *res, uint16_t *out)
+{
+    uint16_t id;
+    ssize_t n;
+    size_t i;
+    int used;
+
+    do {
+        do {
+            n = getrandom(&id, sizeof(id), GRND_NONBLOCK);
+        } while (n < 0 && errno == EINTR);
+        if (n != sizeof(id)) {
+            return RESOLVER_ERR_RANDOM_FAILED;
+        }
+
+        used = 0;
+        for (i = 0; i < RESOLVER_MAX_QUERIES; i++) {
+            resolver_query_t *q = &res->queries[i];
+            if (q->name[0] != '\0' && (q->id[0] == id || q->id[1] == id)) {
+                used = 1;
+            }
+        }
+    } while (used);
+
+    *out = id;
+
+    return RESOLVER_OK;
+}
+
+/* Header + question for name/type */
+static size_t resolver_build(unsigned char *buf, uint16_t id, const char *name, uint16_t type)
+{
+    size_t pos = 12, n;
+    const char *p = name;
+
+    memset(buf, 0, 12);
+    resolver_put16(buf, id);
+    resolver_put16(buf + 2, 0x0100);        /* Standard query, recursion desired */
+    resolver_put16(buf + 4, 1);
+
+    while (*p != '\0') {
+        n = strcspn(p, ".");
+        buf[pos++] = (unsigned char)n;
+        memcpy(buf + pos, p, n);
+        pos += n;
+        p += n;
+        if (*p == '.') {
+            p++;
+        }
+    }
+    buf[pos++] = 0;
+
+    resolver_put16(buf + pos, type);
+    resolver_put16(buf + pos + 2, RESOLVER_CLASS_IN);
+
+    return pos + 4;
+}
+
+/* Open the socket of q on a fresh ephemeral port, so each query has its own
+ * random source port besides its random ids (RFC 5452 section 9.2), and add
+ * it to the epoll set */
+static int resolver_open(resolver_t *res, resolver_query_t *q)
+{
+    struct epoll_event ev;
+
+    q->fd = socket(res->servers[0].ss_family, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (q->fd < 0) {
+        return RESOLVER_ERR_SOCKET_FAILED;
+    }
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.ptr = q;
+
+    if (epoll_ctl(res->fd, EPOLL_CTL_ADD, q->fd, &ev) < 0) {
+        close(q->fd);
+        q->fd = -1;
+        return RESOLVER_ERR_SOCKET_FAILED;
+    }
+
+    return RESOLVER_OK;
+}
+
+/* Close the socket of q (closing also removes it from the epoll set) */
+static void resolver_close(resolver_query_t *q)
+{
+    if (q->fd >= 0) {
+        close(q->fd);
+    }
+    q->fd = -1;
+}
+
+/* Send the unanswered questions of q to the next server */
+static void resolver_send(resolver_t *res, resolver_query_t *q)
+{
+    unsigned char buf[12 + RESOLVER_NAME_LEN + 2 + 4];
+    size_t server = (size_t)q->attempt % res->server_count, len;
+    int t;
+
+    for (t = 0; t < 2; t++) {
+        if (q->done[t]) {
+            continue;
+        }
+        len = resolver_build(buf, q->id[t], q->name, resolver_qtypes[t]);
+        if (sendto(q->fd, buf, len, 0, (const struct sockaddr *)&res->servers[server],
+                   res->server_lens[server]) == (ssize_t)len) {
+            res->sent++;
+        }
+    }
+
+    q->attempt++;
+    q->deadline_ms = resolver_now_ms() + res->timeout_ms;
+}
+
+static uint32_t resolver_clamp(uint32_t ttl, uint32_t min, uint32_t max)
+{
+    return ttl < min ? min : ttl > max ? max : ttl;
+}
+
+/* Both answers are in (or the query gave up): cache and notify */
+static void resolver_complete(resolver_t *res, resolver_query_t *q)
+{
+    resolver_waiter_t *w, *next;
+    resolver_entry_t *entry;
+    resolver_addrs_t addrs;
+    char key[RESOLVER_NAME_LEN];
+    int status;
+
+    resolver_addrs_merge(&addrs, &q->v4, &q->v6);
+    memcpy(key, q->name, sizeof(key));
+
+    if (addrs.count > 0) {
+        status = RESOLVER_OK;
+        resolver_store(res, key, status, &addrs, RESOLVER_SOURCE_DNS,
+                       resolver_clamp(q->ttl, RESOLVER_MIN_TTL, RESOLVER_MAX_TTL));
+    } else if ((q->rcode[RESOLVER_V4] == RESOLVER_ERR_NOT_FOUND ||
+                q->rcode[RESOLVER_V4] == RESOLVER_OK) &&
+               (q->rcode[RESOLVER_V6] == RESOLVER_ERR_NOT_FOUND ||
+                q->rcode[RESOLVER_V6] == RESOLVER_OK)) {
+        /* Authoritative "no such address" for both types */
+        status = RESOLVER_ERR_NOT_FOUND;
+        resolver_store(res, key, status, NULL, RESOLVER_SOURCE_DNS,
+                       resolver_clamp(q->negative_ttl != UINT32_MAX ? q->negative_ttl
+                                                                    : RESOLVER_NEGATIVE_TTL,
+                                      RESOLVER_MIN_TTL, RESOLVER_MAX_NEGATIVE_TTL));
+    } else {
+        status = q->rcode[RESOLVER_V4] != RESOLVER_OK && q->rcode[RESOLVER_V4] != RESOLVER_ERR_NOT_FOUND
+                 ? q->rcode[RESOLVER_V4] : q->rcode[RESOLVER_V6];
+
+        /* Nameservers unreachable: better an old answer than none */
+        entry = resolver_find(res, key);
+        if (entry != NULL && entry->source == RESOLVER_SOURCE_DNS &&
+            entry->status == RESOLVER_OK &&
+            entry->expires_ms + (uint64_t)RESOLVER_STALE_TTL * 1000 > resolver_now_ms()) {
+            status = RESOLVER_OK;
+            addrs = entry->addrs;
+            res->stale++;
+        }
+    }
+
+    if (status == RESOLVER_OK) {
+        resolver_interleave(&addrs, resolver_family(res, key));
+    }
+
+    /* Free the slot first: callbacks may start new queries */
+    w = q->waiters;
+    resolver_close(q);
+    memset(q, 0, sizeof(*q));
+
+    for (; w != NULL; w = next) {
+        next = w->next;
+        w->next = NULL;
+        w->pending = 0;
+        w->cb(w, status, status == RESOLVER_OK ? &addrs : NULL);
+    }
+}
+
+/* Skip a possibly compressed name */
+static int resolver_skip_name(const unsigned char *msg, size_t len, size_t *pos)
+{
+    while (*pos < len) {
+        unsigned char c = msg[*pos];
+
+        if (c == 0) {
+            (*pos)++;
+            return 0;
+        }
+        if ((c & 0xC0) == 0xC0) {
+            *pos += 2;
+            return *pos <= len ? 0 : -1;
+        }
+        if (c & 0xC0) {
+            return -1;
+        }
+        *pos += 1 + (size_t)c;
+    }
+
+    return -1;
+}
+
+/* Whether the name at pos equals key (case-insensitive, follows pointers) */
+static int resolver_name_equals(const unsigned char *msg, size_t len, size_t pos,
+                                const char *key)
+{
+    size_t k = 0, hops = 0;
+
+    while (pos < len) {
+        unsigned char c = msg[pos];
+
+        if (c == 0) {
+            return key[k] == '\0';
+        }
+        if ((c & 0xC0) == 0xC0) {
+            if (pos + 1 >= len || ++hops > RESOLVER_MAX_POINTERS) {
+                return 0;
+            }
+            pos = ((size_t)(c & 0x3F) << 8) | msg[pos + 1];
+            continue;
+        }
+        if (c & 0xC0 || pos + 1 + c > len) {
+            return 0;
+        }
+        if (k > 0) {
+            if (key[k] != '.') {
+                return 0;
+            }
+            k++;
+        }
+        if (strncasecmp(key + k, (const char *)msg + pos + 1, c) != 0) {
+            return 0;
+        }
+        k += c;
+        pos += 1 + (size_t)c;
+    }
+
+    return 0;
+}
+
+/* Whether from is one of the configured nameservers */
+static int resolver_from_server(const resolver_t *res, const struct sockaddr_storage *from)
+{
+    size_t i;
+
+    for (i = 0; i < res->server_count; i++) {
+        const struct sockaddr_storage *s = &res->servers[i];
+
+        if (s->ss_family != from->ss_family) {
+            continue;
+        }
+        if (s->ss_family == AF_INET) {
+            const struct sockaddr_in *a = (const struct sockaddr_in *)s;
+            const struct sockaddr_in *b = (const struct sockaddr_in *)from;
+            if (a->sin_port == b->sin_port && a->sin_addr.s_addr == b->sin_addr.s_addr) {
+                return 1;
+            }
+        } else {
+            const struct sockaddr_in6 *a = (const struct sockaddr_in6 *)s;
+            const struct sockaddr_in6 *b = (const struct sockaddr_in6 *)from;
+            if (a->sin6_port == b->sin6_port &&
+                memcmp(&a->sin6_addr, &b->sin6_addr, sizeof(a->sin6_addr)) == 0) {
+                return 1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+/* Parse one response datagram, received on the socket of q */
+static void resolver_answer(resolver_t *res, resolver_query_t *q,
+                            const unsigned char *msg, size_t len)
+{
+    uint16_t id, flags, qd, an, ns, type, rdlen;
+    uint32_t ttl;
+    resolver_addr_t addr;
+    size_t pos, rr;
+    int t, rcode;
+
+    if (len < 12) {
+        return;
+    }
+
+    id = resolver_get16(msg);
+    for (t = 0; t < 2; t++) {
+        if (!q->done[t] && q->id[t] == id) {
+            break;
+        }
+    }
+
+    flags = resolver_get16(msg + 2);
+    qd = resolver_get16(msg + 4);
+    an = resolver_get16(msg + 6);
+    ns = resolver_get16(msg + 8);
+
+    /* Must be a response to exactly our question */
+    if (t == 2 || !(flags & RESOLVER_FLAG_QR) || qd != 1 ||
+        !resolver_name_equals(msg, len, 12, q->name)) {
+        return;
+    }
+    pos = 12;
+    if (resolver_skip_name(msg, len, &pos) != 0 || pos + 4 > len ||
+        resolver_get16(msg + pos) != resolver_qtypes[t]) {
+        return;
+    }
+    pos += 4;
+
+    rcode = flags & 0x000F;
+    q->done[t] = 1;
+    q->rcode[t] = rcode == 0 ? RESOLVER_OK
+                : rcode == RESOLVER_RCODE_NXDOMAIN ? RESOLVER_ERR_NOT_FOUND
+                : RESOLVER_ERR_SERVER_FAILED;
+
+    /* A truncated answer may miss records (and there is no TCP retry): it
+     * must not be cached as complete, nor a truncated NXDOMAIN as negative */
+    if (flags & RESOLVER_FLAG_TC) {
+        q->rcode[t] = RESOLVER_ERR_SERVER_FAILED;
+    }
+
+    /* Answer section (CNAME chains are followed by simply taking every
+     * address record of the requested type), then the SOA of a negative
+     * answer in the authority section */
+    for (rr = 0; rr < (size_t)an + ns && q->rcode[t] != RESOLVER_ERR_SERVER_FAILED; rr++) {
+        if (resolver_skip_name(msg, len, &pos) != 0 || pos + 10 > len) {
+            q->rcode[t] = RESOLVER_ERR_SERVER_FAILED;
+            break;
+        }
+        type = resolver_get16(msg + pos);
+        ttl = resolver_get32(msg + pos + 4);
+        rdlen = resolver_get16(msg + pos + 8);
+        pos += 10;
+        if (pos + rdlen > len) {
+            q->rcode[t] = RESOLVER_ERR_SERVER_FAILED;
+            break;
+        }
+
+        if (rr < an && type == resolver_qtypes[t] &&
+            rdlen == (t == RESOLVER_V4 ? 4 : 16)) {
+            memset(&addr, 0, sizeof(addr));
+            addr.family = t == RESOLVER_V4 ? AF_INET : AF_INET6;
+            memcpy(addr.addr, msg + pos, rdlen);
+            resolver_addrs_add(t == RESOLVER_V4 ? &q->v4 : &q->v6, &addr);
+            if (ttl < q->ttl) {
+                q->ttl = ttl;
+            }
+        } else if (rr >= an && type == RESOLVER_TYPE_SOA) {
+            /* Negative TTL = min(SOA TTL, SOA MINIMUM) after mname, rname
+             * and four 32-bit fields */
+            size_t p = pos;
+            if (resolver_skip_name(msg, len, &p) == 0 &&
+                resolver_skip_name(msg, len, &p) == 0 && p + 20 <= pos + rdlen) {
+                uint32_t minimum = resolver_get32(msg + p + 16);
+                if (minimum < ttl) {
+                    ttl = minimum;
+                }
+                if (ttl < q->negative_ttl) {
+                    q->negative_ttl = ttl;
+                }
+            }
+        }
+
+        pos += rdlen;
+    }
+
+    /* Server failure, truncation or a malformed answer: ask the next server
+     * while attempts remain (resolver_tick() keeps the error if they run out) */
+    if (q->rcode[t] == RESOLVER_ERR_SERVER_FAILED &&
+        q->attempt < res->attempts * (int)res->server_count) {
+        q->done[t] = 0;
+        (t == RESOLVER_V4 ? &q->v4 : &q->v6)->count = 0;
+        resolver_send(res, q);
+        return;
+    }
+
+    /* NOERROR without records of the type (NODATA) */
+    if (q->rcode[t] == RESOLVER_OK &&
+        (t == RESOLVER_V4 ? q->v4.count : q->v6.count) == 0) {
+        q->rcode[t] = RESOLVER_ERR_NOT_FOUND;
+    }
+
+    if (q->done[RESOLVER_V4] && q->done[RESOLVER_V6]) {
+        resolver_complete(res, q);
+    }
+}
+
+/* Read the pending answers of q until it completes or its socket is empty */
+static int resolver_drain(resolver_t *res, resolver_query_t *q)
+{
+    unsigned char buf[RESOLVER_MAX_PACKET];
+    struct sockaddr_storage from;
+    socklen_t from_len;
+    ssize_t n;
+    int fd = q->fd;
+
+    /* Completion closes the socket (a callback may reopen the slot) */
+    while (q->name[0] != '\0' && q->fd == fd) {
+        from_len = sizeof(from);
+        n = recvfrom(fd, buf, sizeof(buf), 0, (struct sockaddr *)&from, &from_len);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return errno == EAGAIN || errno == EWOULDBLOCK ? RESOLVER_OK
+                                                           : RESOLVER_ERR_IO_FAILED;
+        }
+
+        if (resolver_from_server(res, &from)) {
+            resolver_answer(res, q, buf, (size_t)n);
+        }
+    }
+
+    return RESOLVER_OK;
+}
+
+/* Read every pending answer */
+int resolver_process(resolver_t *res)
+{
+    struct epoll_event events[RESOLVER_MAX_QUERIES];
+    int n, i, ret = RESOLVER_OK;
+
+    if (res == NULL || res->fd < 0) {
+        return RESOLVER_ERR_INVALID_PARAM;
+    }
+
+    n = epoll_wait(res->fd, events, RESOLVER_MAX_QUERIES, 0);
+    if (n < 0) {
+        return errno == EINTR ? RESOLVER_OK : RESOLVER_ERR_IO_FAILED;
+    }
+
+    /* Every socket here belongs to a query in flight: resolver_complete()
+     * closes a socket before it runs the callbacks that could reuse a slot */
+    for (i = 0; i < n; i++) {
+        resolver_query_t *q = (resolver_query_t *)events[i].data.ptr;
+
+        if (q->name[0] != '\0' && resolver_drain(res, q) != RESOLVER_OK) {
+            ret = RESOLVER_ERR_IO_FAILED;
+        }
+    }
+
+    return ret;
+}
+
+/* Milliseconds until resolver_tick() has work */
+int resolver_next_timeout(const resolver_t *res, uint64_t now_ms)
+{
+    uint64_t next = 0;
+    size_t i;
+
+    if (res == NULL) {
+        return -1;
+    }
+
+    for (i = 0; i < RESOLVER_MAX_QUERIES; i++) {
+        const resolver_query_t *q = &res->queries[i];
+        if (q->name[0] != '\0' && (next == 0 || q->deadline_ms < next)) {
+            next = q->deadline_ms;
+        }
+    }
+
+    if (next == 0) {
+        return -1;
+    }
+
+    return next <= now_ms ? 0 : (int)(next - now_ms);
+}
+
+/* Retransmit or fail queries whose deadline passed */
+void resolver_tick(resolver_t *res, uint64_t now_ms)
+{
+    size_t i;
+    int t;
+
+    if (res == NULL) {
+        return;
+    }
+
+    for (i = 0; i < RESOLVER_MAX_QUERIES; i++) {
+        resolver_query_t *q = &res->queries[i];
+
+        if (q->name[0] == '\0' || q->deadline_ms > now_ms) {
+            continue;
+        }
+
+        if (q->attempt < res->attempts * (int)res->server_count) {
+            resolver_send(res, q);
+            continue;
+        }
+
+        /* A type whose last answer was a server failure keeps that error */
+        for (t = 0; t < 2; t++) {
+            if (!q->done[t]) {
+                q->done[t] = 1;
+                if (q->rcode[t] != RESOLVER_ERR_SERVER_FAILED) {
+                    q->rcode[t] = RESOLVER_ERR_TIMEOUT;
+                }
+            }
+        }
+        res->timeouts++;
+        resolver_complete(res, q);
+    }
+}
+
+/* Look host up */
+int resolver_query(resolver_t *res, const char *host, resolver_addrs_t *out,
+                   resolver_waiter_t *waiter)
+{
+    char key[RESOLVER_NAME_LEN];
+    resolver_entry_t *entry;
+    resolver_query_t *q;
+    resolver_addr_t addr;
+    resolver_addrs_t addrs;
+    uint64_t now;
+    size_t i;
+
+    if (res == NULL || host == NULL || out == NULL ||
+        (waiter != NULL && (waiter->cb == NULL || waiter->pending))) {
+        return RESOLVER_ERR_INVALID_PARAM;
+    }
+
+    res->lookups++;
+
+    if (resolver_parse_addr(host, &addr) == RESOLVER_OK) {
+        res->hits++;
+        out->count = 0;
+        resolver_addrs_add(out, &addr);
+        return RESOLVER_OK;
+    }
+
+    if (resolver_normalize(host, key) != RESOLVER_OK) {
+        return RESOLVER_ERR_INVALID_PARAM;
+    }
+
+    now = resolver_now_ms();
+    entry = resolver_find(res, key);
+    if (entry != NULL && (entry->expires_ms == 0 || entry->expires_ms > now)) {
+        res->hits++;
+        entry->last_used_ms = now;
+        if (entry->status == RESOLVER_OK) {
+            *out = entry->addrs;
+            resolver_interleave(out, entry->family);
+        }
+        return entry->status;
+    }
+
+    if (res->hosts != NULL && resolver_hosts_lookup(res->hosts, key, &addrs) == RESOLVER_OK) {
+        res->hits++;
+        resolver_store(res, key, RESOLVER_OK, &addrs, RESOLVER_SOURCE_HOSTS, 0);
+        *out = addrs;
+        resolver_interleave(out, resolver_family(res, key));
+        return RESOLVER_OK;
+    }
+
+    q = resolver_find_query(res, key);
+    if (q != NULL) {
+        res->coalesced++;
+    } else {
+        for (i = 0; i < RESOLVER_MAX_QUERIES && q == NULL; i++) {
+            if (res->queries[i].name[0] == '\0') {
+                q = &res->queries[i];
+            }
+        }
+        if (q == NULL) {
+            return RESOLVER_ERR_BUSY;
+        }
+
+        memset(q, 0, sizeof(*q));
+        if (resolver_open(res, q) != RESOLVER_OK) {
+            return RESOLVER_ERR_SOCKET_FAILED;
+        }
+        memcpy(q->name, key, sizeof(q->name));
+        if (resolver_new_id(res, &q->id[RESOLVER_V4]) != RESOLVER_OK ||
+            resolver_new_id(res, &q->id[RESOLVER_V6]) != RESOLVER_OK) {
+            resolver_close(q);
+            memset(q, 0, sizeof(*q));
+            return RESOLVER_ERR_RANDOM_FAILED;
+        }
+        q->ttl = UINT32_MAX;
+        q->negative_ttl = UINT32_MAX;       /* Until an SOA is seen */
+        resolver_send(res, q);
+    }
+
+    if (waiter != NULL) {
+        waiter->next = q->waiters;
+        waiter->pending = 1;
+        q->waiters = waiter;
+    }
+
+    return RESOLVER_IN_PROGRESS;
+}
+
+/* Detach a pending waiter */
+void resolver_cancel(resolver_t *res, resolver_waiter_t *waiter)
+{
+    resolver_waiter_t **link;
+    size_t i;
+
+    if (res == NULL || waiter == NULL || !waiter->pending) {
+        return;
+    }
+
+    for (i = 0; i < RESOLVER_MAX_QUERIES; i++) {
+        for (link = &res->queries[i].waiters; *link != NULL; link = &(*link)->next) {
+            if (*link == waiter) {
+                *link = waiter->next;
+                waiter->next = NULL;
+                waiter->pending = 0;
+                return;
+            }
+        }
+    }
+}
+
+/* Blocking lookup state */
+typedef struct {
+    int done;
+    int status;
+    resolver_addrs_t *out;
+} resolver_wait_t;
+
+static void resolver_wait_cb(resolver_waiter_t *waiter, int status,
+                             const resolver_addrs_t *addrs)
+{
+    resolver_wait_t *wait = (resolver_wait_t *)waiter->arg;
+
+    wait->done = 1;
+    wait->status = status;
+    if (status == RESOLVER_OK) {
+        *wait->out = *addrs;
+    }
+}
+
+/* Blocking lookup */
+int resolver_resolve(resolver_t *res, const char *host, resolver_addrs_t *out)
+{
+    resolver_waiter_t waiter;
+    resolver_wait_t wait;
+    struct pollfd pfd;
+    int ret;
+
+    memset(&waiter, 0, sizeof(waiter));
+    waiter.cb = resolver_wait_cb;
+    waiter.arg = &wait;
+    wait.done = 0;
+    wait.status = RESOLVER_ERR_TIMEOUT;
+    wait.out = out;
+
+    ret = resolver_query(res, host, out, &waiter);
+    if (ret != RESOLVER_IN_PROGRESS) {
+        return ret;
+    }
+
+    while (!wait.done) {
+        pfd.fd = res->fd;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+
+        ret = poll(&pfd, 1, resolver_next_timeout(res, resolver_now_ms()));
+        if (ret < 0 && errno != EINTR) {
+            resolver_cancel(res, &waiter);
+            return RESOLVER_ERR_IO_FAILED;
+        }
+        if (ret > 0) {
+            resolver_process(res);
+        }
+        resolver_tick(res, resolver_now_ms());
+    }
+
+    return wait.status;
+}
+
+/* epoll descriptor to watch for readability */
+int resolver_fd(const resolver_t *res)
+{
+    return res != NULL ? res->fd : -1;
+}
+
+/* Release the resolver */
+void resolver_free(resolver_t *res)
+{
+    resolver_waiter_t *w, *next;
+    size_t i;
+
+    if (res == NULL) {
+        return;
+    }
+
+    for (i = 0; i < RESOLVER_MAX_QUERIES; i++) {
+        for (w = res->queries[i].waiters; w != NULL; w = next) {
+            next = w->next;
+            w->next = NULL;
+            w->pending = 0;
+        }
+        if (res->queries[i].name[0] != '\0') {
+            resolver_close(&res->queries[i]);
+        }
+    }
+
+    if (res->fd >= 0) {
+        close(res->fd);
+    }
+
+    free(res->hosts);
+    memset(res, 0, sizeof(*res));
+    res->fd = -1;
+}
@@ -0,0 +1,221 @@
+/*
+ * DNS resolver
+ * Non-blocking A/AAAA stub resolver with an in-process cache. Answers come,
+ * in order of precedence, from pinned addresses, numeric host strings, a
+ * hosts file, the cache, and finally UDP queries to the nameservers from
+ * resolv.conf (or set explicitly, e.g. a local stub server in tests).
+ *
+ * Positive answers are cached for the smallest record TTL, negative ones
+ * (NXDOMAIN / no address) for min(SOA TTL, SOA minimum) (RFC 2308), or
+ * RESOLVER_NEGATIVE_TTL without an SOA, both clamped to the RESOLVER_*_TTL
+ * limits. Concurrent lookups of one name share a single query, and an
+ * expired answer is served for RESOLVER_STALE_TTL more seconds if the
+ * nameservers stop answering (RFC 8767). SERVFAIL, REFUSED and truncated
+ * answers (there is no TCP fallback) move on to the next nameserver.
+ *
+ * Each query sends from its own UDP socket, so every query has a fresh
+ * random source port on top of its random ids (RFC 5452). The sockets sit
+ * in an epoll set a resolver is polled through.
+ *
+ * A resolver is owned by one thread. It can be polled by an event loop
+ * (resolver_fd(), resolver_process(), resolver_next_timeout(),
+ * resolver_tick()), or resolver_resolve() waits for the answer itself.
+ */
+
+#ifndef RESOLVER_H
+#define RESOLVER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+
+/* Error codes */
+#define RESOLVER_OK                         0
+#define RESOLVER_ERR_INVALID_PARAM         -1
+#define RESOLVER_ERR_NOT_FOUND             -2   /* NXDOMAIN or no A/AAAA records */
+#define RESOLVER_ERR_SERVER_FAILED         -3   /* SERVFAIL, REFUSED, bad answer */
+#define RESOLVER_ERR_TIMEOUT               -4
+#define RESOLVER_ERR_SOCKET_FAILED         -5
+#define RESOLVER_ERR_BUSY                  -6   /* RESOLVER_MAX_QUERIES in flight */
+#define RESOLVER_ERR_IO_FAILED             -7
+#define RESOLVER_ERR_RANDOM_FAILED         -8   /* No secure random transaction id */
+
+/* Returned by resolver_query() when the answer will arrive via callback */
+#define RESOLVER_IN_PROGRESS                1
+
+/* Limits */
+#define RESOLVER_NAME_LEN                  128
+#define RESOLVER_MAX_ADDRS                 8
+#define RESOLVER_MAX_ENTRIES               64
+#define RESOLVER_MAX_QUERIES               16
+#define RESOLVER_MAX_SERVERS               3
+
+/* Query timing: each attempt waits timeout_ms, then moves to the next server */
+#define RESOLVER_TIMEOUT_MS                1000
+#define RESOLVER_ATTEMPTS                  3
+
+/* Cache lifetimes in seconds */
+#define RESOLVER_MIN_TTL                   5
+#define RESOLVER_MAX_TTL                   3600
+#define RESOLVER_NEGATIVE_TTL              30    /* When the answer carries no SOA */
+#define RESOLVER_MAX_NEGATIVE_TTL          300
+#define RESOLVER_STALE_TTL                 30
+
+#define RESOLVER_RESOLV_CONF               "/etc/resolv.conf"
+#define RESOLVER_HOSTS_FILE                "/etc/hosts"
+
+/* Where a cached answer came from */
+typedef enum {
+    RESOLVER_SOURCE_DNS = 0,
+    RESOLVER_SOURCE_HOSTS,
+    RESOLVER_SOURCE_PIN
+} resolver_source_t;
+
+/* One address, network byte order */
+typedef struct {
+    int family;                         /* AF_INET or AF_INET6 */
+    unsigned char addr[16];             /* 4 or 16 bytes used */
+} resolver_addr_t;
+
+/* Answer of a lookup in connect order: families alternate, starting with
+ * the one that last connected to the host (IPv6 if unknown) */
+typedef struct {
+    resolver_addr_t addrs[RESOLVER_MAX_ADDRS];
+    size_t count;
+} resolver_addrs_t;
+
+typedef struct resolver_waiter resolver_waiter_t;
+
+/* Lookup completion: status is RESOLVER_OK (addrs valid during the call only)
+ * or a negative error code */
+typedef void (*resolver_cb)(resolver_waiter_t *waiter, int status,
+                            const resolver_addrs_t *addrs);
+
+/* Intrusive waiter, embedded in the object that wants the answer */
+struct resolver_waiter {
+    resolver_waiter_t *next;
+    resolver_cb cb;
+    void *arg;
+    int pending;                        /* Linked to a query */
+};
+
+/* Cache entry */
+typedef struct {
+    char name[RESOLVER_NAME_LEN];       /* Lowercase, empty if unused */
+    resolver_addrs_t addrs;
+    int status;                         /* RESOLVER_OK or a cached negative answer */
+    resolver_source_t source;
+    int family;                         /* Family that last connected, AF_UNSPEC if unknown */
+    uint64_t expires_ms;                /* Monotonic; 0 = never (pins, hosts) */
+    uint64_t last_used_ms;              /* For LRU eviction */
+} resolver_entry_t;
+
+/* Query in flight (A and AAAA sent together) */
+typedef struct {
+    char name[RESOLVER_NAME_LEN];       /* Empty if the slot is free */
+    uint16_t id[2];                     /* Transaction ids of the A / AAAA queries */
+    int done[2];                        /* Answer received per type */
+    int rcode[2];                       /* RESOLVER_OK or error per type */
+    uint32_t ttl;                       /* Smallest TTL of the address records */
+    uint32_t negative_ttl;              /* From the SOA of a negative answer, UINT32_MAX = none */
+    resolver_addrs_t v4;
+    resolver_addrs_t v6;
+    int fd;                             /* Non-blocking UDP socket of this query */
+    int attempt;                        /* Transmissions so far */
+    uint64_t deadline_ms;               /* Retransmit or give up at */
+    resolver_waiter_t *waiters;
+} resolver_query_t;
+
+/* Resolver context */
+typedef struct {
+    int fd;                             /* epoll set of the query sockets */
+    struct sockaddr_storage servers[RESOLVER_MAX_SERVERS];
+    socklen_t server_lens[RESOLVER_MAX_SERVERS];
+    size_t server_count;
+    uint32_t timeout_ms;                /* Per attempt */
+    int attempts;
+    resolver_entry_t cache[RESOLVER_MAX_ENTRIES];
+    resolver_query_t queries[RESOLVER_MAX_QUERIES];
+    char *hosts;                        /* Hosts file contents, NUL terminated */
+    unsigned long lookups;              /* resolver_query() calls */
+    unsigned long hits;                 /* Answered without a query */
+    unsigned long coalesced;            /* Joined a query already in flight */
+    unsigned long sent;                 /* Datagrams sent */
+    unsigned long timeouts;             /* Queries that got no answer */
+    unsigned long stale;                /* Expired answers served after a failure */
+} resolver_t;
+
+/* Initialize with the nameservers and options of RESOLVER_RESOLV_CONF and
+ * the entries of RESOLVER_HOSTS_FILE (both optional; without nameservers
+ * 127.0.0.1:53 is used) */
+int resolver_init(resolver_t *res);
+
+/* Replace the nameservers with the one at ip:port (e.g. a local stub server).
+ * All servers must share one address family, that of the first one. */
+int resolver_set_server(resolver_t *res, const char *ip, uint16_t port);
+
+/* Add another nameserver */
+int resolver_add_server(resolver_t *res, const char *ip, uint16_t port);
+
+/* Replace the hosts source with the file at path (NULL removes it) */
+int resolver_load_hosts(resolver_t *res, const char *path);
+
+/* Pin host to a comma or space separated list of addresses; pins never
+ * expire and take precedence over every other source */
+int resolver_pin(resolver_t *res, const char *host, const char *addrs);
+
+/* Remove a pin */
+void resolver_unpin(resolver_t *res, const char *host);
+
+/* Drop every cached answer except pins */
+void resolver_flush(resolver_t *res);
+
+/* Remember that a connect to host succeeded over family (AF_INET or
+ * AF_INET6); kept with the cached answer, including across refreshes */
+void resolver_set_family(resolver_t *res, const char *host, int family);
+
+/* Family remembered for host, AF_UNSPEC if none */
+int resolver_family(resolver_t *res, const char *host);
+
+/* Look host up. Returns RESOLVER_OK with *out filled, a negative (possibly
+ * cached) error, or RESOLVER_IN_PROGRESS after which waiter->cb is called
+ * from resolver_process() or resolver_tick(). waiter may be NULL to only
+ * consult the cache (RESOLVER_IN_PROGRESS then means a query was started). */
+int resolver_query(resolver_t *res, const char *host, resolver_addrs_t *out,
+                   resolver_waiter_t *waiter);
+
+/* Detach a pending waiter; its callback will not be called */
+void resolver_cancel(resolver_t *res, resolver_waiter_t *waiter);
+
+/* Blocking lookup: resolver_query() plus waiting on resolver_fd() */
+int resolver_resolve(resolver_t *res, const char *host, resolver_addrs_t *out);
+
+/* epoll descriptor to watch for readability (stays the same for the life
+ * of the resolver) */
+int resolver_fd(const resolver_t *res);
+
+/* Read every pending answer and complete the queries it finishes */
+int resolver_process(resolver_t *res);
+
+/* Milliseconds until resolver_tick() has work, or -1 with no query in flight */
+int resolver_next_timeout(const resolver_t *res, uint64_t now_ms);
+
+/* Retransmit or fail queries whose deadline passed */
+void resolver_tick(resolver_t *res, uint64_t now_ms);
+
+/* Monotonic clock used for deadlines, in milliseconds */
+uint64_t resolver_now_ms(void);
+
+/* Reorder addrs to alternate families, starting with first_family
+ * (AF_UNSPEC = IPv6), keeping the order within each family */
+void resolver_interleave(resolver_addrs_t *addrs, int first_family);
+
+/* Fill ss with addr:port; returns the address length */
+socklen_t resolver_sockaddr(const resolver_addr_t *addr, uint16_t port,
+                            struct sockaddr_storage *ss);
+
+/* Drop pending queries (their callbacks are not called), close the sockets
+ * and free the hosts source */
+void resolver_free(resolver_t *res);
+
+#endif /* RESOLVER_H */
@@ -0,0 +1,477 @@
+/*
+ * TLS session cache implementation
+ *
+ * File format: "TSC2" magic, the 36 character boot id of the writer, then
+ * records of
+ *   u16 key length, key bytes, u64 stored_at, u32 data length, data bytes
+ * all little endian. The file is rewritten atomically via rename().
+ *
+ * TLS 1.3 tickets are dated with mbedtls_ms_time(), a clock that restarts at
+ * boot (timing_alt.c), so a file written during another boot (or whose boot
+ * is unknown) is ignored rather than offering tickets with bogus ages.
+ */
+
+#include "session_cache.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#define SESSION_CACHE_MAGIC       "TSC2"
+#define SESSION_CACHE_MAX_DATA    (64 * 1024)
+#define SESSION_CACHE_BOOT_ID_LEN 36
+#define SESSION_CACHE_BOOT_ID     "/proc/sys/kernel/random/boot_id"
+
+/* Build the "host:port" lookup key */
+static int session_cache_key(char *key, const char *host, const char *port)
+{
+    int n = snprintf(key, SESSION_CACHE_KEY_LEN, "%s:%s", host, port);
+
+    if (n < 0 || n >= SESSION_CACHE_KEY_LEN) {
+        return SESSION_CACHE_ERR_INVALID_PARAM;
+    }
+
+    return SESSION_CACHE_OK;
+}
+
+/* Find the entry for key, or NULL */
+static session_cache_entry_t *session_cache_find(session_cache_t *cache, const char *key)
+{
+    size_t i;
+
+    for (i = 0; i < SESSION_CACHE_MAX_ENTRIES; i++) {
+        if (cache->entries[i].data != NULL && strcmp(cache->entries[i].key, key) == 0) {
+            return &cache->entries[i];
+        }
+    }
+
+    return NULL;
+}
+
+/* Pick a free slot, evicting the oldest entry if the cache is full */
+static session_cache_entry_t *session_cache_slot(session_cache_t *cache)
+{
+    session_cache_entry_t *oldest = &cache->entries[0];
+    size_t i;
+
+    for (i = 0; i < SESSION_CACHE_MAX_ENTRIES; i++) {
+        if (cache->entries[i].data == NULL) {
+            return &cache->entries[i];
+        }
+        if (cache->entries[i].stored_at < oldest->stored_at) {
+            oldest = &cache->entries[i];
+        }
+    }
+
+    return oldest;
+}
+
+/* Release one entry */
+static void session_cache_clear(session_cache_entry_t *entry)
+{
+    if (entry->data != NULL) {
+        memset(entry->data, 0, entry->len);
+        free(entry->data);
+    }
+
+    entry->data = NULL;
+    entry->len = 0;
+    entry->key[0] = '\0';
+    entry->stored_at = 0;
+}
+
+/* Replace the contents of an entry (takes ownership of data) */
+static void session_cache_put(session_cache_entry_t *entry, const char *key,
+                              unsigned char *data, size_t len, time_t stored_at)
+{
+    session_cache_clear(entry);
+    strcpy(entry->key, key);
+    entry->data = data;
+    entry->len = len;
+    entry->stored_at = stored_at;
+}
+
+static void put_le(unsigned char *p, uint64_t v, size_t n)
+{
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        p[i] = (unsigned char)(v >> (8 * i));
+    }
+}
+
+static uint64_t get_le(const unsigned char *p, size_t n)
+{
+    uint64_t v = 0;
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        v |= (uint64_t)p[i] << (8 * i);
+    }
+
+    return v;
+}
+
+/* Read the id of the current boot, all zeros if unknown */
+static void session_cache_boot_id(char id[SESSION_CACHE_BOOT_ID_LEN])
+{
+    FILE *fp = fopen(SESSION_CACHE_BOOT_ID, "r");
+
+    if (fp == NULL || fread(id, 1, SESSION_CACHE_BOOT_ID_LEN, fp) != SESSION_CACHE_BOOT_ID_LEN) {
+        memset(id, 0, SESSION_CACHE_BOOT_ID_LEN);
+    }
+
+    if (fp != NULL) {
+        fclose(fp);
+    }
+}
+
+/* Read the persistence file into the cache (missing file is not an error) */
+static int session_cache_read_file(session_cache_t *cache)
+{
+    static const char unknown[SESSION_CACHE_BOOT_ID_LEN];
+    unsigned char hdr[8];
+    char key[SESSION_CACHE_KEY_LEN];
+    char boot[SESSION_CACHE_BOOT_ID_LEN], written[SESSION_CACHE_BOOT_ID_LEN];
+    time_t now = time(NULL);
+    FILE *fp;
+
+    fp = fopen(cache->path, "rb");
+    if (fp == NULL) {
+        return SESSION_CACHE_OK;
+    }
+
+    if (fread(hdr, 1, 4, fp) != 4 || memcmp(hdr, SESSION_CACHE_MAGIC, 4) != 0 ||
+        fread(written, 1, sizeof(written), fp) != sizeof(written)) {
+        fclose(fp);
+        return SESSION_CACHE_ERR_IO_FAILED;
+    }
+
+    /* Ticket ages do not carry over a reboot: start empty */
+    session_cache_boot_id(boot);
+    if (memcmp(boot, unknown, sizeof(boot)) == 0 || memcmp(boot, written, sizeof(boot)) != 0) {
+        fclose(fp);
+        return SESSION_CACHE_OK;
+    }
+
+    while (fread(hdr, 1, 2, fp) == 2) {
+        size_t key_len = (size_t)get_le(hdr, 2);
+        time_t stored_at;
+        size_t len;
+        unsigned char *data;
+
+        if (key_len >= SESSION_CACHE_KEY_LEN || fread(key, 1, key_len, fp) != key_len) {
+            break;
+        }
+        key[key_len] = '\0';
+
+        if (fread(hdr, 1, 8, fp) != 8) {
+            break;
+        }
+        stored_at = (time_t)get_le(hdr, 8);
+
+        if (fread(hdr, 1, 4, fp) != 4) {
+            break;
+        }
+        len = (size_t)get_le(hdr, 4);
+        if (len == 0 || len > SESSION_CACHE_MAX_DATA) {
+            break;
+        }
+
+        data = malloc(len);
+        if (data == NULL) {
+            break;
+        }
+        if (fread(data, 1, len, fp) != len) {
+            free(data);
+            break;
+        }
+
+        if (now - stored_at > SESSION_CACHE_MAX_AGE_SEC ||
+            session_cache_find(cache, key) != NULL) {
+            free(data);
+            continue;
+        }
+
+        session_cache_put(session_cache_slot(cache), key, data, len, stored_at);
+    }
+
+    fclose(fp);
+
+    return SESSION_CACHE_OK;
+}
+
+/* Initialize the cache */
+int session_cache_init(session_cache_t *cache, const char *path)
+{
+    if (cache == NULL) {
+        return SESSION_CACHE_ERR_INVALID_PARAM;
+    }
+
+    memset(cache, 0, sizeof(*cache));
+    pthread_mutex_init(&cache->lock, NULL);
+    cache->path = path;
+
+    if (path == NULL) {
+        return SESSION_CACHE_OK;
+    }
+
+    return session_cache_read_file(cache);
+}
+
+/* Offer the cached session for host:port */
+int session_cache_load(session_cache_t *cache, const char *host, const char *port,
+                       mbedtls_ssl_context *ssl)
+{
+    char key[SESSION_CACHE_KEY_LEN];
+    session_cache_entry_t *entry;
+    mbedtls_ssl_session session;
+    int ret;
+
+    if (cache == NULL || host == NULL || port == NULL || ssl == NULL) {
+        return SESSION_CACHE_ERR_INVALID_PARAM;
+    }
+
+    if ((ret = session_cache_key(key, host, port)) != SESSION_CACHE_OK) {
+        return ret;
+    }
+
+    pthread_mutex_lock(&cache->lock);
+    cache->lookups++;
+
+    entry = session_cache_find(cache, key);
+    if (entry == NULL) {
+        pthread_mutex_unlock(&cache->lock);
+        return SESSION_CACHE_MISS;
+    }
+
+    if (time(NULL) - entry->stored_at > SESSION_CACHE_MAX_AGE_SEC) {
+        session_cache_clear(entry);
+        pthread_mutex_unlock(&cache->lock);
+        return SESSION_CACHE_MISS;
+    }
+
+    mbedtls_ssl_session_init(&session);
+
+    if (mbedtls_ssl_session_load(&session, entry->data, entry->len) != 0 ||
+        mbedtls_ssl_set_session(ssl, &session) != 0) {
+        /* Stale format or rejected session: never offer it again */
+        mbedtls_ssl_session_free(&session);
+        session_cache_clear(entry);
+        pthread_mutex_unlock(&cache->lock);
+        return SESSION_CACHE_MISS;
+    }
+
+    mbedtls_ssl_session_free(&session);
+    cache->hits++;
+    pthread_mutex_unlock(&cache->lock);
+
+    return SESSION_CACHE_OK;
+}
+
+/* Save the current session of ssl */
+int session_cache_store(session_cache_t *cache, const char *host, const char *port,
+                        const mbedtls_ssl_context *ssl)
+{
+    char key[SESSION_CACHE_KEY_LEN];
+    mbedtls_ssl_session session;
+    session_cache_entry_t *entry;
+    unsigned char *data = NULL;
+    size_t len = 0;
+    int ret;
+
+    if (cache == NULL || host == NULL || port == NULL || ssl == NULL) {
+        return SESSION_CACHE_ERR_INVALID_PARAM;
+    }
+
+    if ((ret = session_cache_key(key, host, port)) != SESSION_CACHE_OK) {
+        return ret;
+    }
+
+    mbedtls_ssl_session_init(&session);
+
+    if (mbedtls_ssl_get_session(ssl, &session) != 0) {
+        /* e.g. TLS 1.3 before the server sent a ticket */
+        mbedtls_ssl_session_free(&session);
+        return SESSION_CACHE_ERR_SSL_FAILED;
+    }
+
+    /* First call sizes the buffer */
+    ret = mbedtls_ssl_session_save(&session, NULL, 0, &len);
+    if (ret == MBEDTLS_ERR_SSL_BUFFER_TOO_SMALL && len > 0) {
+        data = malloc(len);
+        ret = data == NULL ? SESSION_CACHE_ERR_ALLOC_FAILED
+                           : mbedtls_ssl_session_save(&session, data, len, &len);
+    }
+
+    mbedtls_ssl_session_free(&session);
+
+    if (ret != 0) {
+        free(data);
+        return ret == SESSION_CACHE_ERR_ALLOC_FAILED ? ret : SESSION_CACHE_ERR_SSL_FAILED;
+    }
+
+    pthread_mutex_lock(&cache->lock);
+
+    entry = session_cache_find(cache, key);
+    if (entry == NULL) {
+        entry = session_cache_slot(cache);
+    }
+
+    session_cache_put(entry, key, data, len, time(NULL));
+    pthread_mutex_unlock(&cache->lock);
+
+    return SESSION_CACHE_OK;
+}
+
+/* Drop the cached session for host:port */
+void session_cache_remove(session_cache_t *cache, const char *host, const char *port)
+{
+    char key[SESSION_CACHE_KEY_LEN];
+    session_cache_entry_t *entry;
+
+    if (cache == NULL || host == NULL || port == NULL ||
+        session_cache_key(key, host, port) != SESSION_CACHE_OK) {
+        return;
+    }
+
+    pthread_mutex_lock(&cache->lock);
+    entry = session_cache_find(cache, key);
+    if (entry != NULL) {
+        session_cache_clear(entry);
+    }
+    pthread_mutex_unlock(&cache->lock);
+}
+
+/* Drive the handshake, noting whether the server certificate was processed.
+ * Both the TLS 1.2 abbreviated handshake and TLS 1.3 PSK resumption skip the
+ * MBEDTLS_SSL_SERVER_CERTIFICATE state entirely. */
+int session_cache_handshake(mbedtls_ssl_context *ssl, int *full_handshake)
+{
+    int ret = 0;
+
+    if (ssl == NULL || full_handshake == NULL) {
+        return MBEDTLS_ERR_SSL_BAD_INPUT_DATA;
+    }
+
+    while (!mbedtls_ssl_is_handshake_over(ssl)) {
+        if (ssl->MBEDTLS_PRIVATE(state) == MBEDTLS_SSL_SERVER_CERTIFICATE) {
+            *full_handshake = 1;
+        }
+
+        ret = mbedtls_ssl_handshake_step(ssl);
+        if (ret != 0) {
+            break;
+        }
+    }
+
+    return ret;
+}
+
+/* Account a completed handshake */
+void session_cache_record(session_cache_t *cache, int full_handshake)
+{
+    if (cache == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&cache->lock);
+    if (full_handshake) {
+        cache->full_handshakes++;
+    } else {
+        cache->resumed_handshakes++;
+    }
+    pthread_mutex_unlock(&cache->lock);
+}
+
+/* Write the cache to its file */
+int session_cache_flush(session_cache_t *cache)
+{
+    char tmp_path[512];
+    char boot[SESSION_CACHE_BOOT_ID_LEN];
+    unsigned char hdr[8];
+    size_t i;
+    int ok = 1;
+    int fd;
+    FILE *fp;
+
+    if (cache == NULL) {
+        return SESSION_CACHE_ERR_INVALID_PARAM;
+    }
+
+    if (cache->path == NULL) {
+        return SESSION_CACHE_OK;
+    }
+
+    if (snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", cache->path) >= (int)sizeof(tmp_path)) {
+        return SESSION_CACHE_ERR_INVALID_PARAM;
+    }
+
+    /* Sessions carry master secrets: keep the file private */
+    fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0) {
+        return SESSION_CACHE_ERR_IO_FAILED;
+    }
+
+    fp = fdopen(fd, "wb");
+    if (fp == NULL) {
+        close(fd);
+        remove(tmp_path);
+        return SESSION_CACHE_ERR_IO_FAILED;
+    }
+
+    session_cache_boot_id(boot);
+
+    pthread_mutex_lock(&cache->lock);
+    ok = fwrite(SESSION_CACHE_MAGIC, 1, 4, fp) == 4 &&
+         fwrite(boot, 1, sizeof(boot), fp) == sizeof(boot);
+
+    for (i = 0; ok && i < SESSION_CACHE_MAX_ENTRIES; i++) {
+        const session_cache_entry_t *entry = &cache->entries[i];
+        size_t key_len = strlen(entry->key);
+
+        if (entry->data == NULL) {
+            continue;
+        }
+
+        put_le(hdr, key_len, 2);
+        ok = fwrite(hdr, 1, 2, fp) == 2 && fwrite(entry->key, 1, key_len, fp) == key_len;
+
+        put_le(hdr, (uint64_t)entry->stored_at, 8);
+        ok = ok && fwrite(hdr, 1, 8, fp) == 8;
+
+        put_le(hdr, entry->len, 4);
+        ok = ok && fwrite(hdr, 1, 4, fp) == 4 &&
+             fwrite(entry->data, 1, entry->len, fp) == entry->len;
+    }
+    pthread_mutex_unlock(&cache->lock);
+
+    if (fclose(fp) != 0) {
+        ok = 0;
+    }
+
+    if (!ok || rename(tmp_path, cache->path) != 0) {
+        remove(tmp_path);
+        return SESSION_CACHE_ERR_IO_FAILED;
+    }
+
+    return SESSION_CACHE_OK;
+}
+
+/* Free all cached sessions */
+void session_cache_free(session_cache_t *cache)
+{
+    size_t i;
+
+    if (cache == NULL) {
+        return;
+    }
+
+    for (i = 0; i < SESSION_CACHE_MAX_ENTRIES; i++) {
+        session_cache_clear(&cache->entries[i]);
+    }
+
+    pthread_mutex_destroy(&cache->lock);
+}
@@ -0,0 +1,82 @@
+/*
+ * TLS session cache
+ * Stores serialized mbedtls sessions per host:port so reconnects can resume
+ * (TLS 1.2 session IDs and tickets, TLS 1.3 PSK tickets) instead of paying
+ * for a full handshake. Optionally persisted to a file between runs of the
+ * same boot.
+ *
+ * All functions lock the cache, so one cache can serve the connections of
+ * several threads (worker_pool.h).
+ */
+
+#ifndef SESSION_CACHE_H
+#define SESSION_CACHE_H
+
+#include <stddef.h>
+#include <time.h>
+#include <pthread.h>
+#include "mbedtls/ssl.h"
+
+/* Error codes */
+#define SESSION_CACHE_OK                    0
+#define SESSION_CACHE_MISS                  1
+#define SESSION_CACHE_ERR_INVALID_PARAM    -1
+#define SESSION_CACHE_ERR_ALLOC_FAILED     -2
+#define SESSION_CACHE_ERR_IO_FAILED        -3
+#define SESSION_CACHE_ERR_SSL_FAILED       -4
+
+/* Cache limits */
+#define SESSION_CACHE_MAX_ENTRIES          64
+#define SESSION_CACHE_KEY_LEN              128
+#define SESSION_CACHE_MAX_AGE_SEC          (24 * 60 * 60)
+
+/* One cached session */
+typedef struct {
+    char key[SESSION_CACHE_KEY_LEN];    /* "host:port", empty if unused */
+    unsigned char *data;                /* mbedtls_ssl_session_save() output */
+    size_t len;                         /* Length of data */
+    time_t stored_at;                   /* Wall clock time of the save */
+} session_cache_entry_t;
+
+/* Session cache context */
+typedef struct {
+    session_cache_entry_t entries[SESSION_CACHE_MAX_ENTRIES];
+    pthread_mutex_t lock;               /* Held by every call */
+    const char *path;                   /* Persistence file, NULL for memory only */
+    unsigned long lookups;              /* session_cache_load() calls */
+    unsigned long hits;                 /* Lookups that offered a session */
+    unsigned long full_handshakes;      /* Handshakes that sent a certificate */
+    unsigned long resumed_handshakes;   /* Abbreviated / PSK handshakes */
+} session_cache_t;
+
+/* Initialize the cache and read path if it exists (path may be NULL) */
+int session_cache_init(session_cache_t *cache, const char *path);
+
+/* Offer the cached session for host:port on ssl (after mbedtls_ssl_setup()
+ * and mbedtls_ssl_set_hostname()). Returns SESSION_CACHE_MISS if none. */
+int session_cache_load(session_cache_t *cache, const char *host, const char *port,
+                       mbedtls_ssl_context *ssl);
+
+/* Save the current session of ssl for host:port. Call after the handshake
+ * and again once a TLS 1.3 NewSessionTicket has been received. */
+int session_cache_store(session_cache_t *cache, const char *host, const char *port,
+                        const mbedtls_ssl_context *ssl);
+
+/* Drop the cached session for host:port */
+void session_cache_remove(session_cache_t *cache, const char *host, const char *port);
+
+/* Drive the handshake like mbedtls_ssl_handshake(), setting *full_handshake
+ * when the server sent its certificate (i.e. the session was not resumed).
+ * *full_handshake must be 0 before the first call. */
+int session_cache_handshake(mbedtls_ssl_context *ssl, int *full_handshake);
+
+/* Account a completed handshake in the resumed/full counters */
+void session_cache_record(session_cache_t *cache, int full_handshake);
+
+/* Write the cache to its file (no-op for memory-only caches) */
+int session_cache_flush(session_cache_t *cache);
+
+/* Free all cached sessions */
+void session_cache_free(session_cache_t *cache);
+
+#endif /* SESSION_CACHE_H */
@@ -1,29 +1,152 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <unistd.h>
-#include <sys/socket.h>
-#include <netinet/in.h>
-#include <netdb.h>
 #include <errno.h>
-#include <sys/select.h>
+#include <poll.h>
 #include <websocket_parser.h>
+#include "ws_client.h"
+#include "ws_mask.h"
+#include "ws_heartbeat.h"
+#include "json_tok.h"
+#include "conn_metrics.h"
+#include "resolver.h"
+#include "custom_rng.h"
+#include "mbedtls/ssl.h"
 
-#define BUFFER_SIZE 4096
 #define HTTP_HOST "laundrygo.id"
 #define WS_HOST "do.laundrygo.id"
 #define WS_PORT "15774"
+#define WSS_PORT "443"
 
 #define PING_JSON "{\"type\":\"ping\"}"
 
-static int sockfd = -1;
-static websocket_parser parser;
+/* Prometheus snapshot on connect: socat - UNIX-CONNECT:test_websocket.metrics.sock */
+#define METRICS_SOCKET "test_websocket.metrics.sock"
+
+static ws_client_t client;
 static websocket_parser_settings settings;
+static ws_frame_pool_t frame_pool;
+static ws_deflate_pool_t deflate_pool;
+static conn_metrics_registry_t metrics;
+static conn_metrics_t conn_metrics;
+static conn_metrics_exporter_t metrics_exporter;
+static resolver_t resolver;
+static ws_heartbeat_t heartbeat;
+static ws_heartbeat_session_t liveness;
+static int peer_dead = 0;
+static json_tok_t json;
+static int rx_text = 0;
+static char rx_type[32];
+static char rx_dev_id[64];
 static const char *ws_path = "/";
 static const char *auth_token = NULL;
 
+/* Send every queued frame, batched into one write where possible */
+static int flush_frames(void)
+{
+    int ret;
+
+    if (client.queue_count == 0)
+    {
+        return 0;
+    }
+
+    ret = ws_client_flush(&client);
+
+    /* Blocking socket: only a signal can interrupt the send */
+    while (ret == WS_CLIENT_IN_PROGRESS)
+    {
+        ret = ws_client_flush(&client);
+    }
+
+    if (ret != WS_CLIENT_OK)
+    {
+        return -1;
+    }
+
+    ws_heartbeat_sent(&liveness, ws_heartbeat_now_ms());
+    return 0;
+}
+
+/* Queue one masked frame; it leaves with the next flush_frames() */
+static int queue_frame(int opcode, const char *data, size_t len)
+{
+    int ret = ws_client_queue(&client, opcode, data, len);
+
+    /* Queue full: make room first */
+    if (ret == WS_CLIENT_ERR_BUSY && flush_frames() == 0)
+    {
+        ret = ws_client_queue(&client, opcode, data, len);
+    }
+
+    return ret == WS_CLIENT_OK ? 0 : -1;
+}
+
+/* Top-level members messages are routed on */
+enum { JSON_FIELD_TYPE, JSON_FIELD_DEV_ID, JSON_FIELD_DPS };
+static const char *const json_fields[] = { "type", "devId", "dps" };
+
+/* Copy a string member, NUL-terminated and truncated to fit */
+static void copy_json_string(const json_token_t *token, char *out, size_t out_len)
+{
+    int n = json_tok_unescape(token->data, token->len, out, out_len - 1);
+
+    if (n < 0)
+    {
+        n = 0;
+    }
+    else if ((size_t)n > out_len - 1)
+    {
+        n = (int)(out_len - 1);
+    }
+    out[n] = '\0';
+}
+
+/* Tokens of the watched members of a text message */
+static int on_json_token(const json_token_t *token, void *arg)
+{
+    (void)arg;
+
+    if (token->depth == 1 && token->type == JSON_TOKEN_STRING && !token->partial)
+    {
+        if (token->field == JSON_FIELD_TYPE)
+        {
+            copy_json_string(token, rx_type, sizeof(rx_type));
+        }
+        else if (token->field == JSON_FIELD_DEV_ID)
+        {
+            copy_json_string(token, rx_dev_id, sizeof(rx_dev_id));
+        }
+    }
+    else if (token->field == JSON_FIELD_DPS && token->depth == 2)
+    {
+        // Data points: "dp id": value pairs
+        if (token->type == JSON_TOKEN_KEY)
+        {
+            printf("  dp %.*s = ", (int)token->len, token->data);
+        }
+        else if (token->type != JSON_TOKEN_OBJECT_END && token->type != JSON_TOKEN_ARRAY_END)
+        {
+            printf("%.*s%s", (int)token->len, token->data, token->partial ? "" : "\n");
+        }
+    }
+
+    return 0;
+}
+
 static int on_frame_header(websocket_parser *p)
 {
+    int opcode = websocket_parser_get_opcode(p);
+
+    // Control frames may arrive between the fragments of a message
+    if (opcode == WS_OP_TEXT || opcode == WS_OP_BINARY)
+    {
+        rx_text = opcode == WS_OP_TEXT;
+        rx_type[0] = '\0';
+        rx_dev_id[0] = '\0';
+        json_tok_reset(&json);
+    }
+
     printf("Frame header received: opcode=%d, final=%d, mask=%d\n",
            websocket_parser_get_opcode(p),
            websocket_parser_has_final(p),
@@ -31,14 +154,19 @@ static int on_frame_header(websocket_parser *p)
     return 0;
 }
 
-static int on_frame_body(websocket_parser *p, const char *data, size_t len)
+// Report one piece of a frame payload, already unmasked
+static void on_frame_data(int opcode, const char *data, size_t len)
 {
-    int opcode = websocket_parser_get_opcode(p);
-
     switch (opcode)
     {
     case WS_OP_TEXT:
+    case WS_OP_CONTINUE:
         printf("Text message: %.*s\n", (int)len, data);
+        if (rx_text)
+        {
+            // Errors are sticky and reported at the end of the message
+            json_tok_feed(&json, data, len);
+        }
         break;
     case WS_OP_BINARY:
         printf("Binary message (%zu bytes)\n", len);
@@ -55,374 +183,406 @@ static int on_frame_body(websocket_parser *p, const char *data, size_t len)
     default:
         printf("Unknown opcode: %d\n", opcode);
     }
-    return 0;
 }
 
-static int on_frame_end(websocket_parser *p)
+static int on_frame_body(websocket_parser *p, const char *data, size_t len)
 {
-    printf("Frame end\n");
-
+    static char unmasked[WS_CLIENT_BUF_SIZE];
     int opcode = websocket_parser_get_opcode(p);
-    if (opcode == WS_OP_PING)
+    size_t n;
+
+    if (!websocket_parser_has_mask(p))
     {
-        printf("Sending pong response\n");
-        char pong_frame[10];
-        size_t frame_len = websocket_build_frame(pong_frame, WS_OP_PONG | WS_FIN, NULL, NULL, 0);
-        send(sockfd, pong_frame, frame_len, 0);
+        on_frame_data(opcode, data, len);
+        return 0;
+    }
+
+    /* Servers must not mask, but unmask anyway, in buffer-sized pieces; the
+     * key offset carries over between pieces and between the fragments of
+     * one frame */
+    while (len > 0)
+    {
+        n = len < sizeof(unmasked) ? len : sizeof(unmasked);
+        p->mask_offset = (uint8_t)ws_mask_apply(unmasked, data, n,
+                                                (const unsigned char *)p->mask,
+                                                p->mask_offset);
+        on_frame_data(opcode, unmasked, n);
+        data += n;
+        len -= n;
     }
 
     return 0;
 }
 
-static int read_line(int fd, char *buffer, size_t max_len)
+static int on_frame_end(websocket_parser *p)
 {
-    size_t pos = 0;
-    char c;
-    ssize_t n;
+    printf("Frame end\n");
 
-    while (pos < max_len - 1)
+    int opcode = websocket_parser_get_opcode(p);
+    if (rx_text && (opcode == WS_OP_TEXT || opcode == WS_OP_CONTINUE) &&
+        websocket_parser_has_final(p))
     {
-        n = recv(fd, &c, 1, 0);
-
-        if (n < 0)
+        rx_text = 0;
+        if (json_tok_finish(&json) != JSON_TOK_OK)
         {
-            if (errno == EINTR)
-                continue;
-            return -1;
+            printf("Text message is not JSON\n");
         }
-
-        if (n == 0)
+        else
         {
-            if (pos == 0)
-                return 0;
-            break;
-        }
-
-        buffer[pos++] = c;
+            printf("JSON message: type=%s devId=%s\n", rx_type, rx_dev_id);
 
-        if (c == '\n')
-        {
-            if (pos >= 2 && buffer[pos - 2] == '\r')
-            {
-                buffer[pos - 2] = '\0';
-                return pos - 2;
-            }
-            else
+            // Application pong
+            if (strcmp(rx_type, "pong") == 0)
             {
-                buffer[pos - 1] = '\0';
-                return pos - 1;
+                ws_heartbeat_pong(&liveness, ws_heartbeat_now_ms());
             }
         }
     }
-
-    buffer[pos] = '\0';
-    return pos;
-}
-
-static int connect_to_server(const char *host, const char *port)
-{
-    struct addrinfo hints, *servinfo, *p;
-    int rv;
-
-    memset(&hints, 0, sizeof hints);
-    hints.ai_family = AF_UNSPEC;
-    hints.ai_socktype = SOCK_STREAM;
-
-    if ((rv = getaddrinfo(host, port, &hints, &servinfo)) != 0)
+    else if (opcode == WS_OP_PING)
     {
-        fprintf(stderr, "getaddrinfo: %s\n", gai_strerror(rv));
-        return -1;
+        printf("Queueing pong response\n");
+        queue_frame(WS_FRAME_OP_PONG, NULL, 0);
     }
-
-    for (p = servinfo; p != NULL; p = p->ai_next)
+    else if (opcode == WS_OP_PONG)
     {
-        if ((sockfd = socket(p->ai_family, p->ai_socktype, p->ai_protocol)) == -1)
-        {
-            perror("socket");
-            continue;
-        }
-
-        if (connect(sockfd, p->ai_addr, p->ai_addrlen) == -1)
-        {
-            close(sockfd);
-            perror("connect");
-            continue;
-        }
-
-        break;
+        // Usually empty, so the body callback may never see it
+        ws_heartbeat_pong(&liveness, ws_heartbeat_now_ms());
     }
 
-    freeaddrinfo(servinfo);
-
-    if (p == NULL)
-    {
-        fprintf(stderr, "Failed to connect\n");
-        return -1;
-    }
-
-    printf("Connected to %s:%s\n", host, port);
     return 0;
 }
 
-static int perform_handshake()
+static int send_text_message(const char *message)
 {
-    char request[4096];
-    char line[1024];
-    ssize_t bytes_sent;
-    int line_len;
-    int status_code = 0;
-    int headers_complete = 0;
-
-    const char *ws_key = "dGhlIHNhbXBsZSBub25jZQ==";
-
-    int offset = snprintf(
-        request, sizeof(request),
-        "GET %s HTTP/1.1\r\n"
-        "Host: %s\r\n"
-        "Upgrade: websocket\r\n"
-        "Connection: Upgrade\r\n"
-        "Sec-WebSocket-Key: %s\r\n"
-        "Sec-WebSocket-Version: 13\r\n",
-        ws_path, HTTP_HOST, ws_key);
-
-    if (auth_token)
-    {
-        offset += snprintf(
-            request + offset, sizeof(request) - offset,
-            "Authorization: Bearer %s\r\n", auth_token);
-    }
-
-    snprintf(request + offset, sizeof(request) - offset, "\r\n");
-
-    printf("Sending handshake:\n%s", request);
-
-    bytes_sent = send(sockfd, request, strlen(request), 0);
-    if (bytes_sent < 0)
-    {
-        perror("send");
-        return -1;
-    }
-
-    printf("Handshake response:\n");
-
-    line_len = read_line(sockfd, line, sizeof(line));
-    if (line_len <= 0)
+    if (queue_frame(WS_FRAME_OP_TEXT, message, strlen(message)) < 0)
     {
-        fprintf(stderr, "Failed to read status line\n");
+        fprintf(stderr, "Failed to queue text frame\n");
         return -1;
     }
 
-    printf("%s\n", line);
+    printf("Queued text message: %s\n", message);
+    return 0;
+}
 
-    if (sscanf(line, "HTTP/1.1 %d", &status_code) != 1)
+static int send_ping_frame()
+{
+    if (queue_frame(WS_FRAME_OP_PING, NULL, 0) < 0)
     {
-        fprintf(stderr, "Invalid HTTP response\n");
+        fprintf(stderr, "Failed to queue ping frame\n");
         return -1;
     }
 
-    while (!headers_complete)
-    {
-        line_len = read_line(sockfd, line, sizeof(line));
-        if (line_len < 0)
-        {
-            fprintf(stderr, "Failed to read header line\n");
-            return -1;
-        }
+    printf("Queued WebSocket ping frame\n");
+    return 0;
+}
 
-        if (line_len == 0)
-        {
-            headers_complete = 1;
-            printf("\n");
-            break;
-        }
+/* Heartbeat: the session went quiet, probe it at both protocol levels */
+static int on_heartbeat_ping(ws_heartbeat_session_t *session, void *user_data)
+{
+    (void)session;
+    (void)user_data;
 
-        printf("%s\n", line);
-    }
+    printf("Idle: sending pings\n");
 
-    if (status_code != 101)
+    // Both pings leave with the next flush, in one write
+    if (send_ping_frame() < 0 || send_text_message(PING_JSON) < 0)
     {
-        fprintf(stderr, "WebSocket handshake failed with status code: %d\n", status_code);
         return -1;
     }
 
-    printf("WebSocket handshake successful\n");
     return 0;
 }
 
-static int send_text_message(const char *message)
+/* Heartbeat: no pong and no other traffic for too long */
+static void on_heartbeat_dead(ws_heartbeat_session_t *session, void *user_data)
 {
-    size_t msg_len = strlen(message);
-    size_t frame_size = websocket_calc_frame_size(WS_OP_TEXT | WS_FIN | WS_HAS_MASK, msg_len);
-    char *frame = malloc(frame_size);
+    (void)user_data;
 
-    if (!frame)
-    {
-        fprintf(stderr, "Failed to allocate frame buffer\n");
-        return -1;
-    }
-
-    char mask[4] = {0x12, 0x34, 0x56, 0x78};
+    fprintf(stderr, "Peer missed %u pings, giving up\n", session->missed);
+    ws_heartbeat_remove(session);
+    peer_dead = 1;
+}
 
-    size_t frame_len = websocket_build_frame(frame, WS_OP_TEXT | WS_FIN | WS_HAS_MASK, mask, message, msg_len);
+static void send_close_frame()
+{
+    queue_frame(WS_FRAME_OP_CLOSE, NULL, 0);
+    flush_frames();
+    printf("Sent close frame\n");
+}
 
-    ssize_t sent = send(sockfd, frame, frame_len, 0);
-    free(frame);
+/* TLS configuration for wss:// (no certificate verification, testing only) */
+static int setup_tls(mbedtls_ssl_config *conf, custom_rng_context *rng)
+{
+    const char *pers = "test_websocket";
+    int ret;
 
-    if (sent < 0)
+    if ((ret = custom_rng_seed(rng, (const unsigned char *)pers, strlen(pers))) != 0)
     {
-        perror("send");
+        fprintf(stderr, "custom_rng_seed returned %d\n", ret);
         return -1;
     }
 
-    printf("Sent text message: %s\n", message);
-    return 0;
-}
-
-static int send_ping_frame()
-{
-    char ping_frame[10];
-    char mask[4] = {0x12, 0x34, 0x56, 0x78};
-    size_t frame_len = websocket_build_frame(ping_frame, WS_OP_PING | WS_FIN | WS_HAS_MASK, mask, NULL, 0);
-
-    ssize_t sent = send(sockfd, ping_frame, frame_len, 0);
-    if (sent < 0)
+    if ((ret = mbedtls_ssl_config_defaults(conf, MBEDTLS_SSL_IS_CLIENT,
+                                           MBEDTLS_SSL_TRANSPORT_STREAM,
+                                           MBEDTLS_SSL_PRESET_DEFAULT)) != 0)
     {
-        perror("send ping");
+        fprintf(stderr, "mbedtls_ssl_config_defaults returned -0x%x\n", (unsigned int)-ret);
         return -1;
     }
 
-    printf("Sent WebSocket ping frame\n");
-    return 0;
-}
+    mbedtls_ssl_conf_authmode(conf, MBEDTLS_SSL_VERIFY_NONE);
+    mbedtls_ssl_conf_rng(conf, custom_rng_random, rng);
 
-static void send_close_frame()
-{
-    char close_frame[10];
-    size_t frame_len = websocket_build_frame(close_frame, WS_OP_CLOSE | WS_FIN, NULL, NULL, 0);
-    send(sockfd, close_frame, frame_len, 0);
-    printf("Sent close frame\n");
+    return 0;
 }
 
 static void print_usage(const char *prog_name)
 {
-    fprintf(stderr, "Usage: %s <path> <bearer_token>\n", prog_name);
-    fprintf(stderr, "Example: %s /api/v1/stream abc123token456\n", prog_name);
+    fprintf(stderr, "Usage: %s [--tls] <path> <bearer_token>\n", prog_name);
+    fprintf(stderr, "Example: %s --tls /api/v1/stream abc123token456\n", prog_name);
     fprintf(stderr, "\n");
     fprintf(stderr, "Arguments:\n");
+    fprintf(stderr, "  --tls         Use wss:// (TLS) on port %s instead of ws:// on %s\n",
+            WSS_PORT, WS_PORT);
     fprintf(stderr, "  path          WebSocket path (e.g., /api/v1/stream)\n");
     fprintf(stderr, "  bearer_token  Bearer token for Authorization header\n");
 }
 
 int main(int argc, char *argv[])
 {
-    char buffer[BUFFER_SIZE];
-    ssize_t bytes_received;
+    custom_rng_context rng;
+    mbedtls_ssl_config conf;
+    transport_tcp_opts_t tcp_opts;
+    const char *port = WS_PORT;
+    int use_tls = 0, argi = 1, ret = 1, status;
 
-    if (argc != 3)
+    if (argc == 4 && strcmp(argv[1], "--tls") == 0)
+    {
+        use_tls = 1;
+        argi = 2;
+        port = WSS_PORT;
+    }
+    else if (argc != 3)
     {
         print_usage(argv[0]);
         return 1;
     }
 
-    ws_path = argv[1];
-    auth_token = argv[2];
+    ws_path = argv[argi];
+    auth_token = argv[argi + 1];
 
     printf("WebSocket client test\n");
-    printf("Host: %s:%s\n", WS_HOST, WS_PORT);
+    printf("Host: %s://%s:%s\n", use_tls ? "wss" : "ws", WS_HOST, port);
     printf("Path: %s\n", ws_path);
     printf("Auth: Bearer %s...\n", auth_token ? auth_token : "(none)");
 
-    if (connect_to_server(WS_HOST, WS_PORT) < 0)
-    {
-        return 1;
-    }
+    mbedtls_ssl_config_init(&conf);
+    custom_rng_init(&rng);
 
-    if (perform_handshake() < 0)
+    if (use_tls && setup_tls(&conf, &rng) < 0)
     {
-        close(sockfd);
-        return 1;
+        goto cleanup_tls;
     }
 
-    websocket_parser_init(&parser);
+    ws_frame_pool_init(&frame_pool);
+    ws_deflate_pool_init(&deflate_pool);
+    json_tok_init(&json, on_json_token, NULL);
+    json_tok_watch(&json, json_fields, sizeof(json_fields) / sizeof(json_fields[0]));
+    json.watched_only = 1;
     websocket_parser_settings_init(&settings);
     settings.on_frame_header = on_frame_header;
     settings.on_frame_body = on_frame_body;
     settings.on_frame_end = on_frame_end;
 
-    printf("Entering receive loop (press Ctrl+C to exit)...\n");
-
-    while (1)
+    if (ws_client_init(&client, use_tls ? &conf : NULL, &frame_pool, &settings, NULL) != WS_CLIENT_OK)
     {
-        fd_set readfds;
-        struct timeval tv;
-        int retval;
+        fprintf(stderr, "Failed to initialize WebSocket client\n");
+        goto cleanup_tls;
+    }
+    client.host_header = HTTP_HOST;
+
+    /* Device reports are verbose JSON; the default pool keeps context
+     * between messages, so repeated keys cost a few bits each */
+    client.deflate_pool = &deflate_pool;
+
+    conn_metrics_registry_init(&metrics);
+    conn_metrics_init(&conn_metrics, WS_HOST);
+    conn_metrics_register(&metrics, &conn_metrics);
+    client.metrics = &conn_metrics;
+
+    resolver_init(&resolver);
+    client.resolver = &resolver;
 
-        FD_ZERO(&readfds);
-        FD_SET(sockfd, &readfds);
+    /* Small frames go out at once; dead peers are found within a minute */
+    client.transport.opts.keepalive = 1;
+    client.transport.opts.keepidle_sec = 30;
+    client.transport.opts.keepintvl_sec = 10;
+    client.transport.opts.keepcnt = 3;
+    client.transport.opts.fastopen = 1;
+
+    if (conn_metrics_exporter_start(&metrics_exporter, &metrics, METRICS_SOCKET,
+                                    CONN_METRICS_FORMAT_PROMETHEUS) == CONN_METRICS_OK)
+    {
+        printf("Metrics: %s\n", METRICS_SOCKET);
+    }
 
-        tv.tv_sec = 5;
-        tv.tv_usec = 0;
+    status = ws_client_connect(&client, WS_HOST, port, ws_path, auth_token);
 
-        retval = select(sockfd + 1, &readfds, NULL, NULL, &tv);
+    if (client.handshake.header_len > 0)
+    {
+        printf("Handshake response:\n%.*s", (int)client.handshake.header_len, client.handshake.buf);
+    }
 
-        if (retval == -1)
+    if (status != WS_CLIENT_OK)
+    {
+        if (client.handshake.status_code != 0 && client.handshake.status_code != 101)
         {
-            if (errno == EINTR)
-                continue;
-            perror("select");
-            break;
+            fprintf(stderr, "WebSocket handshake failed with status code: %d\n",
+                    client.handshake.status_code);
         }
-        else if (retval == 0)
+        else
         {
-            printf("Timeout: sending pings\n");
+            fprintf(stderr, "Failed to connect (%d)\n", status);
+        }
+        goto cleanup;
+    }
 
-            // Send WebSocket protocol ping
-            if (send_ping_frame() < 0)
-            {
-                fprintf(stderr, "Failed to send WebSocket ping\n");
-                break;
-            }
+    printf("WebSocket handshake successful\n");
+
+    if (client.deflate.enabled)
+    {
+        printf("permessage-deflate: client window %d%s, server window %d%s\n",
+               client.deflate.client_bits,
+               client.deflate.client_takeover ? "" : " (no context takeover)",
+               client.deflate.server_bits,
+               client.deflate.server_takeover ? "" : " (no context takeover)");
+    }
+
+    if (transport_tcp_get_opts(&client.transport, &tcp_opts) != TRANSPORT_TCP_ERR_NOT_CONNECTED)
+    {
+        printf("Socket: nodelay=%d keepalive=%d idle=%ds sndbuf=%d rcvbuf=%d fastopen=%d%s\n",
+               tcp_opts.nodelay, tcp_opts.keepalive, tcp_opts.keepidle_sec,
+               tcp_opts.sndbuf, tcp_opts.rcvbuf, tcp_opts.fastopen,
+               client.transport.opts_failed > 0 ? " (some options rejected)" : "");
+    }
+    ws_heartbeat_init(&heartbeat, on_heartbeat_ping, on_heartbeat_dead, ws_heartbeat_now_ms());
+    liveness.metrics = &conn_metrics;
+    ws_heartbeat_add(&heartbeat, &liveness, &client, ws_heartbeat_now_ms());
+
+    printf("Entering receive loop (press Ctrl+C to exit)...\n");
+
+    while (!peer_dead)
+    {
+        /* Records mbedtls already decrypted do not make the socket readable */
+        if (ws_client_pending(&client) == 0)
+        {
+            struct pollfd pfd;
+            int retval;
+
+            pfd.fd = ws_client_fd(&client);
+            pfd.events = POLLIN;
+            pfd.revents = 0;
+
+            retval = poll(&pfd, 1, ws_heartbeat_next_timeout(&heartbeat, ws_heartbeat_now_ms()));
 
-            // Send JSON ping message
-            if (send_text_message(PING_JSON) < 0)
+            if (retval == -1)
             {
-                fprintf(stderr, "Failed to send JSON ping\n");
+                if (errno == EINTR)
+                    continue;
+                perror("poll");
                 break;
             }
+            else if (retval == 0)
+            {
+                // Deadlines due: pings for an idle session, or a missed pong
+                if (ws_heartbeat_advance(&heartbeat, ws_heartbeat_now_ms()) > 0 &&
+                    flush_frames() < 0)
+                {
+                    fprintf(stderr, "Failed to send pings\n");
+                    break;
+                }
 
-            continue;
+                continue;
+            }
         }
 
-        bytes_received = recv(sockfd, buffer, sizeof(buffer), 0);
+        // A busy socket still has deadlines: one direction may be quiet
+        if (ws_heartbeat_advance(&heartbeat, ws_heartbeat_now_ms()) > 0 &&
+            flush_frames() < 0)
+        {
+            fprintf(stderr, "Failed to send pings\n");
+            break;
+        }
 
-        if (bytes_received < 0)
+        if (peer_dead)
         {
-            if (errno == EINTR)
-                continue;
-            perror("recv");
             break;
         }
 
-        if (bytes_received == 0)
+        status = ws_client_read(&client);
+
+        if (status == WS_CLIENT_IN_PROGRESS)
+        {
+            continue;
+        }
+
+        if (status == WS_CLIENT_ERR_CLOSED)
         {
             printf("Connection closed by server\n");
             break;
         }
 
-        printf("Received %zd bytes\n", bytes_received);
+        if (status != WS_CLIENT_OK)
+        {
+            fprintf(stderr, "WebSocket read failed (%d)\n", status);
+            break;
+        }
 
-        size_t parsed = websocket_parser_execute(&parser, &settings, buffer, bytes_received);
+        ws_heartbeat_received(&liveness, ws_heartbeat_now_ms());
 
-        if (parsed != (size_t)bytes_received)
+        // Pongs queued by the frames just read
+        if (flush_frames() < 0)
         {
-            fprintf(stderr, "WebSocket parser error: parsed %zu of %zd bytes\n",
-                    parsed, bytes_received);
+            fprintf(stderr, "Failed to send queued frames\n");
             break;
         }
     }
 
+    ws_heartbeat_remove(&liveness);
     send_close_frame();
-    close(sockfd);
-
-    return 0;
-}
\ No newline at end of file
+    if (heartbeat.stats.pongs > 0)
+    {
+        printf("Heartbeat: %lu pings, %lu pongs, %lu missed, RTT p50 %.3f ms / max %.3f ms\n",
+               heartbeat.stats.pings, heartbeat.stats.pongs, heartbeat.stats.missed,
+               (double)latency_hist_percentile(&heartbeat.rtt, 50.0) / 1e6,
+               (double)heartbeat.rtt.max / 1e6);
+    }
+    printf("Write queue: %lu writes, %lu batched, high water %zu frames / %zu bytes\n",
+           client.queue_stats.writes, client.queue_stats.batched,
+           client.queue_stats.hwm_frames, client.queue_stats.hwm_bytes);
+    if (client.deflate.enabled)
+    {
+        printf("Compression: out %lu -> %lu bytes in %lu messages (%lu sent plain), "
+               "in %lu -> %lu bytes in %lu messages, deflate %.3f ms, inflate %.3f ms\n",
+               client.deflate.stats.raw_out, client.deflate.stats.wire_out,
+               client.deflate.stats.messages_out, client.deflate.stats.skipped,
+               client.deflate.stats.wire_in, client.deflate.stats.raw_in,
+               client.deflate.stats.messages_in,
+               (double)client.deflate.stats.deflate_ns / 1e6,
+               (double)client.deflate.stats.inflate_ns / 1e6);
+    }
+    ret = 0;
+
+cleanup:
+    conn_metrics_exporter_stop(&metrics_exporter);
+    ws_client_free(&client);
+    ws_deflate_pool_free(&deflate_pool);
+    conn_metrics_unregister(&conn_metrics);
+    conn_metrics_registry_free(&metrics);
+    resolver_free(&resolver);
+cleanup_tls:
+    mbedtls_ssl_config_free(&conf);
+    custom_rng_free(&rng);
+
+    return ret;
+}
@@ -0,0 +1,224 @@
+/*
+ * Hierarchical timer wheel implementation
+ * Timers due within 64 ticks live in level 0; later ones sit in coarser
+ * levels and cascade down one level each time the level below wraps.
+ */
+
+#include "timer_wheel.h"
+#include <string.h>
+
+#define TIMER_WHEEL_MASK       (TIMER_WHEEL_SLOTS - 1)
+#define TIMER_WHEEL_MAX_DELTA  ((1ULL << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS)) - 1)
+
+/* Push a timer onto a slot list */
+static void timer_wheel_link(timer_wheel_timer_t **head, timer_wheel_timer_t *timer)
+{
+    timer->next = *head;
+    if (*head != NULL) {
+        (*head)->pprev = &timer->next;
+    }
+    timer->pprev = head;
+    *head = timer;
+}
+
+/* Unlink a timer from whatever slot holds it */
+static void timer_wheel_unlink(timer_wheel_timer_t *timer)
+{
+    *timer->pprev = timer->next;
+    if (timer->next != NULL) {
+        timer->next->pprev = timer->pprev;
+    }
+
+    timer->next = NULL;
+    timer->pprev = NULL;
+}
+
+/* Place a timer in the level matching its distance from the next tick */
+static void timer_wheel_insert(timer_wheel_t *tw, timer_wheel_timer_t *timer)
+{
+    uint64_t base = tw->now + 1;
+    uint64_t expires = timer->expires;
+    uint64_t delta;
+    int level;
+
+    if (expires < base) {
+        expires = base;
+    }
+
+    delta = expires - base;
+    if (delta > TIMER_WHEEL_MAX_DELTA) {
+        /* Parked at the far end of the wheel, cascades back in later */
+        expires = base + TIMER_WHEEL_MAX_DELTA;
+        delta = TIMER_WHEEL_MAX_DELTA;
+    }
+
+    for (level = 0; level < TIMER_WHEEL_LEVELS - 1; level++) {
+        if (delta < (1ULL << (TIMER_WHEEL_BITS * (level + 1)))) {
+            break;
+        }
+    }
+
+    timer_wheel_link(&tw->slots[level][(expires >> (TIMER_WHEEL_BITS * level)) & TIMER_WHEEL_MASK],
+                     timer);
+}
+
+/* Move every timer of one slot down to finer levels */
+static void timer_wheel_cascade(timer_wheel_t *tw, int level, size_t index)
+{
+    timer_wheel_timer_t *timer = tw->slots[level][index];
+
+    tw->slots[level][index] = NULL;
+
+    while (timer != NULL) {
+        timer_wheel_timer_t *next = timer->next;
+        timer_wheel_insert(tw, timer);
+        timer = next;
+    }
+}
+
+/* Initialize the wheel */
+int timer_wheel_init(timer_wheel_t *tw, uint32_t tick_ms, uint64_t now_ms)
+{
+    if (tw == NULL || tick_ms == 0) {
+        return TIMER_WHEEL_ERR_INVALID_PARAM;
+    }
+
+    memset(tw, 0, sizeof(*tw));
+    tw->tick_ms = tick_ms;
+    tw->start_ms = now_ms;
+
+    return TIMER_WHEEL_OK;
+}
+
+/* Prepare a timer before its first use */
+void timer_wheel_timer_init(timer_wheel_timer_t *timer, timer_wheel_cb cb, void *arg)
+{
+    if (timer == NULL) {
+        return;
+    }
+
+    memset(timer, 0, sizeof(*timer));
+    timer->cb = cb;
+    timer->arg = arg;
+}
+
+/* (Re)schedule a timer */
+int timer_wheel_schedule(timer_wheel_t *tw, timer_wheel_timer_t *timer,
+                         uint64_t now_ms, uint64_t delay_ms)
+{
+    uint64_t deadline;
+
+    if (tw == NULL || timer == NULL || timer->cb == NULL) {
+        return TIMER_WHEEL_ERR_INVALID_PARAM;
+    }
+
+    timer_wheel_cancel(tw, timer);
+
+    /* Round up so a timer never fires early */
+    deadline = (now_ms < tw->start_ms ? 0 : now_ms - tw->start_ms) + delay_ms;
+    timer->expires = (deadline + tw->tick_ms - 1) / tw->tick_ms;
+
+    timer_wheel_insert(tw, timer);
+    timer->pending = 1;
+    tw->count++;
+
+    return TIMER_WHEEL_OK;
+}
+
+/* Cancel a pending timer */
+void timer_wheel_cancel(timer_wheel_t *tw, timer_wheel_timer_t *timer)
+{
+    if (tw == NULL || timer == NULL || !timer->pending) {
+        return;
+    }
+
+    timer_wheel_unlink(timer);
+    timer->pending = 0;
+    tw->count--;
+}
+
+/* Fire every timer due at now_ms */
+size_t timer_wheel_advance(timer_wheel_t *tw, uint64_t now_ms)
+{
+    uint64_t target;
+    size_t fired = 0;
+
+    if (tw == NULL || now_ms < tw->start_ms) {
+        return 0;
+    }
+
+    target = (now_ms - tw->start_ms) / tw->tick_ms;
+
+    while (tw->now < target) {
+        uint64_t tick = tw->now + 1;
+        size_t index = (size_t)(tick & TIMER_WHEEL_MASK);
+        timer_wheel_timer_t **slot;
+        int level;
+
+        if (tw->count == 0) {
+            /* Nothing pending: jump straight to the target */
+            tw->now = target;
+            break;
+        }
+
+        /* Cascade coarser levels whenever the level below wraps */
+        for (level = 1; level < TIMER_WHEEL_LEVELS; level++) {
+            if (((tick >> (TIMER_WHEEL_BITS * (level - 1))) & TIMER_WHEEL_MASK) != 0) {
+                break;
+            }
+            timer_wheel_cascade(tw, level,
+                                (size_t)((tick >> (TIMER_WHEEL_BITS * level)) & TIMER_WHEEL_MASK));
+        }
+
+        tw->now = tick;
+        slot = &tw->slots[0][index];
+
+        /* Callbacks may add or cancel timers; re-adds land on later ticks */
+        while (*slot != NULL) {
+            timer_wheel_timer_t *timer = *slot;
+
+            timer_wheel_unlink(timer);
+            timer->pending = 0;
+            tw->count--;
+
+            timer->cb(timer, timer->arg);
+            fired++;
+        }
+    }
+
+    return fired;
+}
+
+/* Milliseconds until advance() may have work */
+int timer_wheel_next_timeout(const timer_wheel_t *tw, uint64_t now_ms)
+{
+    uint64_t tick, due_ms;
+    size_t i;
+
+    if (tw == NULL || tw->count == 0) {
+        return -1;
+    }
+
+    /* First non-empty level 0 slot, else the next wrap (cascade) */
+    for (i = 1; i <= TIMER_WHEEL_SLOTS; i++) {
+        tick = tw->now + i;
+        if (tw->slots[0][tick & TIMER_WHEEL_MASK] != NULL) {
+            break;
+        }
+        if ((tick & TIMER_WHEEL_MASK) == 0) {
+            break;
+        }
+    }
+
+    due_ms = tw->start_ms + tick * tw->tick_ms;
+
+    if (due_ms <= now_ms) {
+        return 0;
+    }
+
+    if (due_ms - now_ms > 0x7fffffff) {
+        return 0x7fffffff;
+    }
+
+    return (int)(due_ms - now_ms);
+}
@@ -0,0 +1,69 @@
+/*
+ * Hierarchical timer wheel
+ * O(1) add/cancel deadlines (handshake, read, heartbeat) for many
+ * connections. Four levels of 64 slots: with a 10 ms tick, level 0 spans
+ * 640 ms, level 1 ~41 s, level 2 ~44 min and level 3 ~47 h.
+ */
+
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Error codes */
+#define TIMER_WHEEL_OK                      0
+#define TIMER_WHEEL_ERR_INVALID_PARAM      -1
+
+#define TIMER_WHEEL_BITS                   6
+#define TIMER_WHEEL_SLOTS                  (1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_LEVELS                 4
+
+/* Default resolution */
+#define TIMER_WHEEL_TICK_MS                10
+
+typedef struct timer_wheel_timer timer_wheel_timer_t;
+
+/* Expiry callback; the timer is no longer pending and may be re-added */
+typedef void (*timer_wheel_cb)(timer_wheel_timer_t *timer, void *arg);
+
+/* Intrusive timer, embedded in the object that owns the deadline */
+struct timer_wheel_timer {
+    timer_wheel_timer_t *next;
+    timer_wheel_timer_t **pprev;    /* Link that points at this timer */
+    uint64_t expires;               /* Absolute tick */
+    timer_wheel_cb cb;
+    void *arg;
+    int pending;                    /* Linked into the wheel */
+};
+
+/* Timer wheel context */
+typedef struct {
+    timer_wheel_timer_t *slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+    uint64_t now;                   /* Last processed tick */
+    uint64_t start_ms;              /* Clock value of tick 0 */
+    uint32_t tick_ms;               /* Milliseconds per tick */
+    size_t count;                   /* Pending timers */
+} timer_wheel_t;
+
+/* Initialize the wheel; now_ms is the current monotonic time */
+int timer_wheel_init(timer_wheel_t *tw, uint32_t tick_ms, uint64_t now_ms);
+
+/* Prepare a timer before its first use */
+void timer_wheel_timer_init(timer_wheel_timer_t *timer, timer_wheel_cb cb, void *arg);
+
+/* (Re)schedule timer to fire delay_ms after now_ms */
+int timer_wheel_schedule(timer_wheel_t *tw, timer_wheel_timer_t *timer,
+                         uint64_t now_ms, uint64_t delay_ms);
+
+/* Cancel a pending timer (no-op if not pending) */
+void timer_wheel_cancel(timer_wheel_t *tw, timer_wheel_timer_t *timer);
+
+/* Fire every timer due at now_ms; returns the number fired */
+size_t timer_wheel_advance(timer_wheel_t *tw, uint64_t now_ms);
+
+/* Milliseconds until advance() may have work, or -1 with no pending timers.
+ * Suitable as an epoll_wait() timeout; may be earlier than the real expiry. */
+int timer_wheel_next_timeout(const timer_wheel_t *tw, uint64_t now_ms);
+
+#endif /* TIMER_WHEEL_H */
@@ -0,0 +1,171 @@
+/*
+ * Per-connection TLS allocation arenas implementation
+ */
+
+#include "tls_arena.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mbedtls/platform.h"
+
+/* Header in front of every block; the union keeps the payload aligned */
+typedef union {
+    struct {
+        tls_arena_t *owner;             /* NULL = not charged */
+        struct tls_arena_block *prev;
+        struct tls_arena_block *next;
+        size_t size;
+    } h;
+    long double align;
+} tls_arena_header_t;
+
+struct tls_arena_block {
+    tls_arena_header_t hdr;
+};
+
+static __thread tls_arena_t *tls_arena_current = NULL;
+static int tls_arena_hooks = 0;
+
+/* mbedtls_calloc() hook */
+static void *tls_arena_calloc(size_t n, size_t size)
+{
+    tls_arena_t *arena = tls_arena_current;
+    struct tls_arena_block *block;
+    size_t len;
+
+    if (size != 0 && n > (SIZE_MAX - sizeof(*block)) / size) {
+        return NULL;
+    }
+    len = n * size;
+
+    if (arena != NULL && arena->limit != 0 && arena->current + len > arena->limit) {
+        arena->refused++;
+        return NULL;
+    }
+
+    block = calloc(1, sizeof(*block) + len);
+    if (block == NULL) {
+        return NULL;
+    }
+
+    block->hdr.h.size = len;
+
+    if (arena != NULL) {
+        block->hdr.h.owner = arena;
+        block->hdr.h.next = arena->blocks;
+        if (arena->blocks != NULL) {
+            arena->blocks->hdr.h.prev = block;
+        }
+        arena->blocks = block;
+
+        arena->current += len;
+        arena->allocs++;
+        if (arena->current > arena->peak) {
+            arena->peak = arena->current;
+        }
+    }
+
+    return block + 1;
+}
+
+/* mbedtls_free() hook */
+static void tls_arena_release(void *ptr)
+{
+    struct tls_arena_block *block;
+    tls_arena_t *arena;
+
+    if (ptr == NULL) {
+        return;
+    }
+
+    block = (struct tls_arena_block *)ptr - 1;
+    arena = block->hdr.h.owner;
+
+    if (arena != NULL) {
+        if (block->hdr.h.prev != NULL) {
+            block->hdr.h.prev->hdr.h.next = block->hdr.h.next;
+        } else {
+            arena->blocks = block->hdr.h.next;
+        }
+        if (block->hdr.h.next != NULL) {
+            block->hdr.h.next->hdr.h.prev = block->hdr.h.prev;
+        }
+        arena->current -= block->hdr.h.size;
+    }
+
+    free(block);
+}
+
+/* Install the mbedtls allocation hooks */
+int tls_arena_install(void)
+{
+#if defined(MBEDTLS_PLATFORM_MEMORY) && !defined(MBEDTLS_PLATFORM_CALLOC_MACRO)
+    if (!tls_arena_hooks) {
+        mbedtls_platform_set_calloc_free(tls_arena_calloc, tls_arena_release);
+        tls_arena_hooks = 1;
+    }
+
+    return TLS_ARENA_OK;
+#else
+    (void)tls_arena_calloc;
+    (void)tls_arena_release;
+    return TLS_ARENA_ERR_UNSUPPORTED;
+#endif
+}
+
+/* Whether the hooks are installed */
+int tls_arena_installed(void)
+{
+    return tls_arena_hooks;
+}
+
+/* Initialize an empty arena */
+void tls_arena_init(tls_arena_t *arena, size_t limit)
+{
+    if (arena == NULL) {
+        return;
+    }
+
+    memset(arena, 0, sizeof(*arena));
+    arena->limit = limit;
+}
+
+/* Make arena current on this thread */
+tls_arena_t *tls_arena_enter(tls_arena_t *arena)
+{
+    tls_arena_t *prev = tls_arena_current;
+
+    tls_arena_current = arena;
+
+    return prev;
+}
+
+/* Restore the previous arena */
+void tls_arena_leave(tls_arena_t *prev)
+{
+    tls_arena_current = prev;
+}
+
+/* Release the arena */
+void tls_arena_free(tls_arena_t *arena)
+{
+    struct tls_arena_block *block, *next;
+
+    if (arena == NULL) {
+        return;
+    }
+
+    /* E.g. a session ticket copied out of the connection */
+    for (block = arena->blocks; block != NULL; block = next) {
+        next = block->hdr.h.next;
+        block->hdr.h.owner = NULL;
+        block->hdr.h.prev = NULL;
+        block->hdr.h.next = NULL;
+    }
+
+    if (tls_arena_current == arena) {
+        tls_arena_current = NULL;
+    }
+
+    memset(arena, 0, sizeof(*arena));
+}
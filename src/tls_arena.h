@@ -0,0 +1,61 @@
+/*
+ * Per-connection TLS allocation arenas
+ * Routes mbedtls_calloc()/mbedtls_free() through a small header that
+ * records which arena an allocation was made for. Every allocation made
+ * while an arena is current on the calling thread (tls_arena_enter()) is
+ * charged to it, so each connection knows its own peak and steady-state
+ * heap use and can be held to a byte budget; anything else (configuration,
+ * certificates, other threads) is passed through uncharged.
+ *
+ * Budget rather than a fixed buffer: the handshake needs several times
+ * the memory of an idle session, and a carved-out buffer would pin that
+ * peak for the lifetime of every connection.
+ *
+ * tls_arena_install() must run before any other mbedtls call, since blocks
+ * allocated before it cannot be freed through the hooks. An arena and the
+ * blocks charged to it belong to one thread at a time.
+ */
+
+#ifndef TLS_ARENA_H
+#define TLS_ARENA_H
+
+#include <stddef.h>
+
+/* Error codes */
+#define TLS_ARENA_OK                        0
+#define TLS_ARENA_ERR_INVALID_PARAM        -1
+#define TLS_ARENA_ERR_UNSUPPORTED          -2   /* mbedtls built without MBEDTLS_PLATFORM_MEMORY */
+
+struct tls_arena_block;
+
+/* Arena context */
+typedef struct {
+    size_t limit;                       /* Budget in bytes, 0 = unlimited */
+    size_t current;                     /* Bytes charged now (payload, without headers) */
+    size_t peak;                        /* High-water mark of current */
+    unsigned long allocs;               /* Allocations charged */
+    unsigned long refused;              /* Allocations refused by the budget */
+    struct tls_arena_block *blocks;     /* Outstanding allocations */
+} tls_arena_t;
+
+/* Install the mbedtls allocation hooks (once, before any other mbedtls call) */
+int tls_arena_install(void);
+
+/* Whether the hooks are installed, i.e. arenas actually see allocations */
+int tls_arena_installed(void);
+
+/* Initialize an empty arena with a budget (0 = unlimited) */
+void tls_arena_init(tls_arena_t *arena, size_t limit);
+
+/* Charge this thread's mbedtls allocations to arena (NULL = none) until
+ * tls_arena_leave(); returns the previously current arena */
+tls_arena_t *tls_arena_enter(tls_arena_t *arena);
+
+/* Restore the arena returned by tls_arena_enter() */
+void tls_arena_leave(tls_arena_t *prev);
+
+/* Release the arena; blocks still outstanding are handed back to the plain
+ * heap, so they may outlive it */
+void tls_arena_free(tls_arena_t *arena);
+
+#endif /* TLS_ARENA_H */
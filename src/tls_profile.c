@@ -0,0 +1,140 @@
+/*
+ * TLS tuning profiles implementation
+ */
+
+#include "tls_profile.h"
+#include <string.h>
+
+/* X25519 for the key share; P-256 only as a HelloRetryRequest fallback */
+static const uint16_t tls_profile_fast_groups[] = {
+    MBEDTLS_SSL_IANA_TLS_GROUP_X25519,
+    MBEDTLS_SSL_IANA_TLS_GROUP_SECP256R1,
+    MBEDTLS_SSL_IANA_TLS_GROUP_NONE
+};
+
+/* Cheapest verifications first, nothing above SHA-384 */
+static const uint16_t tls_profile_fast_sig_algs[] = {
+    MBEDTLS_TLS1_3_SIG_ECDSA_SECP256R1_SHA256,
+    MBEDTLS_TLS1_3_SIG_RSA_PSS_RSAE_SHA256,
+    MBEDTLS_TLS1_3_SIG_RSA_PKCS1_SHA256,
+    MBEDTLS_TLS1_3_SIG_ECDSA_SECP384R1_SHA384,
+    MBEDTLS_TLS1_3_SIG_NONE
+};
+
+static const tls_profile_t tls_profiles[TLS_PROFILE_COUNT] = {
+    { "default", (mbedtls_ssl_protocol_version) 0, (mbedtls_ssl_protocol_version) 0,
+      NULL, NULL, 0, MBEDTLS_SSL_MAX_FRAG_LEN_NONE },
+    { "compat", MBEDTLS_SSL_VERSION_TLS1_2, MBEDTLS_SSL_VERSION_TLS1_3,
+      tls_profile_fast_groups, tls_profile_fast_sig_algs, 1, MBEDTLS_SSL_MAX_FRAG_LEN_NONE },
+    { "fast", MBEDTLS_SSL_VERSION_TLS1_3, MBEDTLS_SSL_VERSION_TLS1_3,
+      tls_profile_fast_groups, tls_profile_fast_sig_algs, 1, MBEDTLS_SSL_MAX_FRAG_LEN_NONE },
+    { "lowmem", MBEDTLS_SSL_VERSION_TLS1_2, MBEDTLS_SSL_VERSION_TLS1_3,
+      tls_profile_fast_groups, tls_profile_fast_sig_algs, 1, MBEDTLS_SSL_MAX_FRAG_LEN_4096 },
+};
+
+/* Built-in profile by id */
+const tls_profile_t *tls_profile_get(tls_profile_id_t id)
+{
+    if ((int) id < 0 || id >= TLS_PROFILE_COUNT) {
+        return NULL;
+    }
+
+    return &tls_profiles[id];
+}
+
+/* Built-in profile by name */
+const tls_profile_t *tls_profile_find(const char *name)
+{
+    size_t i;
+
+    if (name == NULL) {
+        return NULL;
+    }
+
+    for (i = 0; i < TLS_PROFILE_COUNT; i++) {
+        if (strcmp(tls_profiles[i].name, name) == 0) {
+            return &tls_profiles[i];
+        }
+    }
+
+    return NULL;
+}
+
+/* Whether a protocol version is compiled in */
+static int tls_profile_version_supported(mbedtls_ssl_protocol_version version)
+{
+    switch (version) {
+#if defined(MBEDTLS_SSL_PROTO_TLS1_2)
+    case MBEDTLS_SSL_VERSION_TLS1_2:
+        return 1;
+#endif
+#if defined(MBEDTLS_SSL_PROTO_TLS1_3)
+    case MBEDTLS_SSL_VERSION_TLS1_3:
+        return 1;
+#endif
+    default:
+        return 0;
+    }
+}
+
+/* Apply a profile to a client configuration */
+int tls_profile_apply(mbedtls_ssl_config *conf, const tls_profile_t *profile)
+{
+    if (conf == NULL || profile == NULL) {
+        return TLS_PROFILE_ERR_INVALID_PARAM;
+    }
+
+    if ((profile->min_version != 0 && !tls_profile_version_supported(profile->min_version)) ||
+        (profile->max_version != 0 && !tls_profile_version_supported(profile->max_version))) {
+        return TLS_PROFILE_ERR_UNSUPPORTED;
+    }
+
+#if !defined(MBEDTLS_SSL_MAX_FRAGMENT_LENGTH)
+    if (profile->max_frag_len != MBEDTLS_SSL_MAX_FRAG_LEN_NONE) {
+        return TLS_PROFILE_ERR_UNSUPPORTED;
+    }
+#endif
+
+    if (profile->min_version != 0) {
+        mbedtls_ssl_conf_min_tls_version(conf, profile->min_version);
+    }
+    if (profile->max_version != 0) {
+        mbedtls_ssl_conf_max_tls_version(conf, profile->max_version);
+    }
+
+    if (profile->groups != NULL) {
+        mbedtls_ssl_conf_groups(conf, profile->groups);
+    }
+
+#if defined(MBEDTLS_SSL_HANDSHAKE_WITH_CERT_ENABLED)
+    if (profile->sig_algs != NULL) {
+        mbedtls_ssl_conf_sig_algs(conf, profile->sig_algs);
+    }
+#endif
+
+#if defined(MBEDTLS_SSL_MAX_FRAGMENT_LENGTH)
+    if (profile->max_frag_len != MBEDTLS_SSL_MAX_FRAG_LEN_NONE &&
+        mbedtls_ssl_conf_max_frag_len(conf, profile->max_frag_len) != 0) {
+        return TLS_PROFILE_ERR_INVALID_PARAM;
+    }
+#endif
+
+#if defined(MBEDTLS_SSL_EARLY_DATA)
+    mbedtls_ssl_conf_early_data(conf, profile->early_data ? MBEDTLS_SSL_EARLY_DATA_ENABLED
+                                                          : MBEDTLS_SSL_EARLY_DATA_DISABLED);
+#endif
+
+    return TLS_PROFILE_OK;
+}
+
+/* Whether early data can actually be sent */
+int tls_profile_early_data(const tls_profile_t *profile)
+{
+#if defined(MBEDTLS_SSL_EARLY_DATA) && defined(MBEDTLS_SSL_PROTO_TLS1_3)
+    return profile != NULL && profile->early_data &&
+           profile->max_version != MBEDTLS_SSL_VERSION_TLS1_2;
+#else
+    (void) profile;
+    return 0;
+#endif
+}
@@ -0,0 +1,68 @@
+/*
+ * TLS tuning profiles
+ * Named client configurations layered on MBEDTLS_SSL_PRESET_DEFAULT:
+ * protocol version range, key exchange groups in preference order,
+ * accepted signature algorithms, TLS 1.3 0-RTT early data and the
+ * maximum fragment length.
+ *
+ * Putting X25519 first makes the client's single key share match what
+ * almost every server picks, so the handshake never needs a
+ * HelloRetryRequest round trip, and X25519 is the cheapest ECDHE group in
+ * mbedtls. Early data lets https_pool send an idempotent request together
+ * with the ClientHello of a resumed TLS 1.3 session, saving one more round
+ * trip per reconnect.
+ *
+ * The low-memory profile asks for 4 KiB records (RFC 6066
+ * max_fragment_length; TLS 1.3 record_size_limit when mbedtls is built
+ * with TUYA_TLS_RECORD_SIZE_LIMIT). With MBEDTLS_SSL_VARIABLE_BUFFER_LENGTH
+ * the record buffers of the session shrink to that size once the
+ * handshake is over, if the server agreed.
+ */
+
+#ifndef TLS_PROFILE_H
+#define TLS_PROFILE_H
+
+#include <stdint.h>
+#include "mbedtls/ssl.h"
+
+/* Error codes */
+#define TLS_PROFILE_OK                      0
+#define TLS_PROFILE_ERR_INVALID_PARAM      -1
+#define TLS_PROFILE_ERR_UNSUPPORTED        -2
+
+/* Built-in profiles */
+typedef enum {
+    TLS_PROFILE_DEFAULT = 0,            /* mbedtls defaults, untouched */
+    TLS_PROFILE_COMPAT,                 /* TLS 1.2-1.3, fast groups first, 0-RTT when 1.3 */
+    TLS_PROFILE_FAST,                   /* TLS 1.3 only, X25519, 0-RTT */
+    TLS_PROFILE_LOWMEM,                 /* As compat, with 4 KiB records for small buffers */
+    TLS_PROFILE_COUNT
+} tls_profile_id_t;
+
+/* Profile description; lists are terminated by 0 and point to static data */
+typedef struct {
+    const char *name;
+    mbedtls_ssl_protocol_version min_version;   /* 0 = keep the default */
+    mbedtls_ssl_protocol_version max_version;   /* 0 = keep the default */
+    const uint16_t *groups;             /* MBEDTLS_SSL_IANA_TLS_GROUP_*, NULL = default */
+    const uint16_t *sig_algs;           /* MBEDTLS_TLS1_3_SIG_*, NULL = default */
+    int early_data;                     /* Offer 0-RTT on resumed TLS 1.3 sessions */
+    unsigned char max_frag_len;         /* MBEDTLS_SSL_MAX_FRAG_LEN_*, NONE = default */
+} tls_profile_t;
+
+/* Built-in profile by id, NULL if out of range */
+const tls_profile_t *tls_profile_get(tls_profile_id_t id);
+
+/* Built-in profile by name ("default", "compat", "fast", "lowmem"), NULL if unknown */
+const tls_profile_t *tls_profile_find(const char *name);
+
+/* Apply a profile to a client configuration after mbedtls_ssl_config_defaults().
+ * Returns TLS_PROFILE_ERR_UNSUPPORTED if it pins a version or a fragment
+ * length that is not compiled in; early data is silently dropped without
+ * MBEDTLS_SSL_EARLY_DATA. */
+int tls_profile_apply(mbedtls_ssl_config *conf, const tls_profile_t *profile);
+
+/* Whether early data can actually be sent with this build and profile */
+int tls_profile_early_data(const tls_profile_t *profile);
+
+#endif /* TLS_PROFILE_H */
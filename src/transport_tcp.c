@@ -6,14 +6,17 @@
 #include "transport_tcp.h"
 #include "mbedtls/ssl.h"  /* For MBEDTLS_ERR_SSL_WANT_READ/WRITE */
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <errno.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <netdb.h>
 #include <fcntl.h>
+#include <poll.h>
 
 /* Initialize transport context */
 void transport_tcp_init(transport_tcp_t *ctx)
@@ -24,23 +27,165 @@ void transport_tcp_init(transport_tcp_t *ctx)
     
     ctx->fd = -1;
     ctx->connected = 0;
+    ctx->metrics = NULL;
+    ctx->resolver = NULL;
+    ctx->attempt_delay_ms = TRANSPORT_TCP_ATTEMPT_DELAY_MS;
+    transport_tcp_opts_init(&ctx->opts);
+    ctx->opts_failed = 0;
+    ctx->pending.count = 0;
+    ctx->pending_next = 0;
+    ctx->pending_port = 0;
+    ctx->host[0] = '\0';
+    ctx->attempt_count = 0;
 }
 
-/* Connect to a host:port */
-int transport_tcp_connect(transport_tcp_t *ctx, const char *host, const char *port)
+/* Default socket options */
+void transport_tcp_opts_init(transport_tcp_opts_t *opts)
 {
-    struct addrinfo hints, *addr_list, *cur;
-    int ret;
+    if (opts == NULL) {
+        return;
+    }
     
-    if (ctx == NULL || host == NULL || port == NULL) {
+    memset(opts, 0, sizeof(*opts));
+    opts->nodelay = 1;
+}
+
+/* setsockopt() of one int option; counts the failures */
+static void transport_tcp_setopt(int fd, int level, int name, int value, int *failed)
+{
+    if (setsockopt(fd, level, name, &value, sizeof(value)) < 0) {
+        (*failed)++;
+    }
+}
+
+/* Apply the non-zero options of opts to a fresh socket; fastopen says
+ * whether opts->fastopen may be used for this attempt */
+static int transport_tcp_apply_opts(const transport_tcp_opts_t *opts, int fd, int fastopen)
+{
+    int failed = 0;
+    
+    if (opts->nodelay) {
+        transport_tcp_setopt(fd, IPPROTO_TCP, TCP_NODELAY, 1, &failed);
+    }
+    if (opts->quickack) {
+        transport_tcp_setopt(fd, IPPROTO_TCP, TCP_QUICKACK, 1, &failed);
+    }
+    if (opts->keepalive) {
+        transport_tcp_setopt(fd, SOL_SOCKET, SO_KEEPALIVE, 1, &failed);
+    }
+    if (opts->keepidle_sec > 0) {
+        transport_tcp_setopt(fd, IPPROTO_TCP, TCP_KEEPIDLE, opts->keepidle_sec, &failed);
+    }
+    if (opts->keepintvl_sec > 0) {
+        transport_tcp_setopt(fd, IPPROTO_TCP, TCP_KEEPINTVL, opts->keepintvl_sec, &failed);
+    }
+    if (opts->keepcnt > 0) {
+        transport_tcp_setopt(fd, IPPROTO_TCP, TCP_KEEPCNT, opts->keepcnt, &failed);
+    }
+    /* Buffer sizes must be set before connect() to affect window scaling */
+    if (opts->sndbuf > 0) {
+        transport_tcp_setopt(fd, SOL_SOCKET, SO_SNDBUF, opts->sndbuf, &failed);
+    }
+    if (opts->rcvbuf > 0) {
+        transport_tcp_setopt(fd, SOL_SOCKET, SO_RCVBUF, opts->rcvbuf, &failed);
+    }
+    if (opts->user_timeout_ms > 0) {
+        transport_tcp_setopt(fd, IPPROTO_TCP, TCP_USER_TIMEOUT, opts->user_timeout_ms, &failed);
+    }
+    if (opts->busy_poll_us > 0) {
+#ifdef SO_BUSY_POLL
+        transport_tcp_setopt(fd, SOL_SOCKET, SO_BUSY_POLL, opts->busy_poll_us, &failed);
+#else
+        failed++;
+#endif
+    }
+    if (opts->fastopen && fastopen) {
+#ifdef TCP_FASTOPEN_CONNECT
+        transport_tcp_setopt(fd, IPPROTO_TCP, TCP_FASTOPEN_CONNECT, 1, &failed);
+#else
+        failed++;
+#endif
+    }
+    
+    return failed;
+}
+
+/* getsockopt() of one int option, -1 if unavailable */
+static int transport_tcp_getopt(int fd, int level, int name)
+{
+    int value = 0;
+    socklen_t len = sizeof(value);
+    
+    if (getsockopt(fd, level, name, &value, &len) < 0) {
+        return -1;
+    }
+    
+    return value;
+}
+
+/* Read back the option values in effect */
+int transport_tcp_get_opts(const transport_tcp_t *ctx, transport_tcp_opts_t *out)
+{
+    int fd;
+    
+    if (ctx == NULL || out == NULL) {
         return TRANSPORT_TCP_ERR_INVALID_PARAM;
     }
     
-    /* Close existing connection if any */
-    if (ctx->fd >= 0) {
-        close(ctx->fd);
-        ctx->fd = -1;
-        ctx->connected = 0;
+    if (ctx->fd < 0) {
+        return TRANSPORT_TCP_ERR_NOT_CONNECTED;
+    }
+    
+    fd = ctx->fd;
+    out->nodelay = transport_tcp_getopt(fd, IPPROTO_TCP, TCP_NODELAY);
+    out->quickack = transport_tcp_getopt(fd, IPPROTO_TCP, TCP_QUICKACK);
+    out->keepalive = transport_tcp_getopt(fd, SOL_SOCKET, SO_KEEPALIVE);
+    out->keepidle_sec = transport_tcp_getopt(fd, IPPROTO_TCP, TCP_KEEPIDLE);
+    out->keepintvl_sec = transport_tcp_getopt(fd, IPPROTO_TCP, TCP_KEEPINTVL);
+    out->keepcnt = transport_tcp_getopt(fd, IPPROTO_TCP, TCP_KEEPCNT);
+    out->sndbuf = transport_tcp_getopt(fd, SOL_SOCKET, SO_SNDBUF);
+    out->rcvbuf = transport_tcp_getopt(fd, SOL_SOCKET, SO_RCVBUF);
+    out->user_timeout_ms = transport_tcp_getopt(fd, IPPROTO_TCP, TCP_USER_TIMEOUT);
+#ifdef SO_BUSY_POLL
+    out->busy_poll_us = transport_tcp_getopt(fd, SOL_SOCKET, SO_BUSY_POLL);
+#else
+    out->busy_poll_us = -1;
+#endif
+#ifdef TCP_FASTOPEN_CONNECT
+    out->fastopen = transport_tcp_getopt(fd, IPPROTO_TCP, TCP_FASTOPEN_CONNECT);
+#else
+    out->fastopen = -1;
+#endif
+    
+    return ctx->opts_failed > 0 ? TRANSPORT_TCP_ERR_SOCKOPT_FAILED : TRANSPORT_TCP_OK;
+}
+
+/* Resolve host:port into out, via ctx->resolver or getaddrinfo() */
+static int transport_tcp_resolve(transport_tcp_t *ctx, const char *host, const char *port,
+                                 resolver_addrs_t *out, uint16_t *port_num)
+{
+    struct addrinfo hints, *addr_list, *cur;
+    resolver_addr_t addr;
+    char *end;
+    unsigned long value;
+    int ret;
+    
+    if (ctx->resolver != NULL) {
+        value = strtoul(port, &end, 10);
+        if (*port == '\0' || *end != '\0' || value > 65535) {
+            return TRANSPORT_TCP_ERR_INVALID_PARAM;
+        }
+        *port_num = (uint16_t)value;
+        
+        conn_metrics_phase_begin(ctx->metrics, CONN_METRICS_PHASE_DNS);
+        ret = resolver_resolve(ctx->resolver, host, out);
+        if (ret != RESOLVER_OK) {
+            conn_metrics_phase_fail(ctx->metrics, CONN_METRICS_PHASE_DNS);
+            return TRANSPORT_TCP_ERR_UNKNOWN_HOST;
+        }
+        conn_metrics_phase_end(ctx->metrics, CONN_METRICS_PHASE_DNS);
+        
+        return TRANSPORT_TCP_OK;
     }
     
     /* Setup hints for getaddrinfo */
@@ -50,39 +195,446 @@ int transport_tcp_connect(transport_tcp_t *ctx, const char *host, const char *po
     hints.ai_protocol = IPPROTO_TCP;
     
     /* Resolve hostname */
+    conn_metrics_phase_begin(ctx->metrics, CONN_METRICS_PHASE_DNS);
     ret = getaddrinfo(host, port, &hints, &addr_list);
     if (ret != 0) {
+        conn_metrics_phase_fail(ctx->metrics, CONN_METRICS_PHASE_DNS);
         fprintf(stderr, "getaddrinfo failed: %s\n", gai_strerror(ret));
         return TRANSPORT_TCP_ERR_UNKNOWN_HOST;
     }
+    conn_metrics_phase_end(ctx->metrics, CONN_METRICS_PHASE_DNS);
+    
+    out->count = 0;
+    for (cur = addr_list; cur != NULL && out->count < RESOLVER_MAX_ADDRS; cur = cur->ai_next) {
+        memset(&addr, 0, sizeof(addr));
+        addr.family = cur->ai_family;
+        if (cur->ai_family == AF_INET) {
+            const struct sockaddr_in *sin = (const struct sockaddr_in *)cur->ai_addr;
+            memcpy(addr.addr, &sin->sin_addr, 4);
+            *port_num = ntohs(sin->sin_port);
+        } else if (cur->ai_family == AF_INET6) {
+            const struct sockaddr_in6 *sin6 = (const struct sockaddr_in6 *)cur->ai_addr;
+            memcpy(addr.addr, &sin6->sin6_addr, 16);
+            *port_num = ntohs(sin6->sin6_port);
+        } else {
+            continue;
+        }
+        out->addrs[out->count++] = addr;
+    }
+    
+    freeaddrinfo(addr_list);
+    
+    /* Keep the RFC 6724 preference of getaddrinfo() for the first family */
+    if (out->count > 0) {
+        resolver_interleave(out, out->addrs[0].family);
+    }
+    
+    return out->count > 0 ? TRANSPORT_TCP_OK : TRANSPORT_TCP_ERR_UNKNOWN_HOST;
+}
+
+/* With a cookie cached, a TCP_FASTOPEN_CONNECT connect() returns 0 before
+ * any SYN leaves, so that attempt would win every race whether or not the
+ * address answers. Fast open is only used where nothing is raced: a single
+ * address, or the family that connected to host last time. */
+static int transport_tcp_fastopen(transport_tcp_t *ctx, const resolver_addrs_t *addrs,
+                                  const resolver_addr_t *addr, const char *host)
+{
+    if (!ctx->opts.fastopen) {
+        return 0;
+    }
+    
+    return addrs->count == 1 || addr->family == resolver_family(ctx->resolver, host);
+}
+
+/* Close the non-blocking connect attempts in flight, except keep_fd */
+static void transport_tcp_cancel_attempts(transport_tcp_t *ctx, int keep_fd)
+{
+    size_t i;
+    
+    for (i = 0; i < ctx->attempt_count; i++) {
+        if (ctx->attempts[i].fd != keep_fd) {
+            close(ctx->attempts[i].fd);
+        }
+    }
     
-    /* Try each address until we successfully connect */
-    for (cur = addr_list; cur != NULL; cur = cur->ai_next) {
-        ctx->fd = socket(cur->ai_family, cur->ai_socktype, cur->ai_protocol);
-        if (ctx->fd < 0) {
+    ctx->attempt_count = 0;
+}
+
+/* Happy Eyeballs (RFC 8305): start a non-blocking connect to the next
+ * address every attempt_delay_ms, or at once when an attempt fails, and keep
+ * the first socket that connects. Returns its fd or -1. */
+static int transport_tcp_race(transport_tcp_t *ctx, const char *host,
+                              const resolver_addrs_t *addrs, uint16_t port, int *family)
+{
+    struct pollfd fds[RESOLVER_MAX_ADDRS];
+    int families[RESOLVER_MAX_ADDRS];
+    int opts_failed[RESOLVER_MAX_ADDRS];
+    const resolver_addr_t *addr;
+    struct sockaddr_storage ss;
+    socklen_t ss_len, err_len;
+    size_t next = 0, active = 0, i;
+    uint64_t now, next_ms = 0;
+    int fd, err, failed, winner = -1;
+    
+    while (winner < 0 && (next < addrs->count || active > 0)) {
+        now = resolver_now_ms();
+        
+        /* Next attempt is due, or nothing is left in flight */
+        if (next < addrs->count && (active == 0 || now >= next_ms)) {
+            addr = &addrs->addrs[next++];
+            ss_len = resolver_sockaddr(addr, port, &ss);
+            
+            fd = socket(ss.ss_family, SOCK_STREAM | SOCK_NONBLOCK, IPPROTO_TCP);
+            if (fd < 0) {
+                continue;
+            }
+            
+            failed = transport_tcp_apply_opts(&ctx->opts, fd,
+                                              transport_tcp_fastopen(ctx, addrs, addr, host));
+            CONN_METRICS_ADD(ctx->metrics, connect_attempts, 1);
+            
+            if (connect(fd, (struct sockaddr *)&ss, ss_len) == 0) {
+                winner = fd;
+                *family = ss.ss_family;
+                ctx->opts_failed = failed;
+                break;
+            }
+            
+            if (errno != EINPROGRESS) {
+                close(fd);
+                continue;
+            }
+            
+            fds[active].fd = fd;
+            fds[active].events = POLLOUT;
+            families[active] = ss.ss_family;
+            opts_failed[active] = failed;
+            active++;
+            next_ms = now + ctx->attempt_delay_ms;
             continue;
         }
         
-        if (connect(ctx->fd, cur->ai_addr, cur->ai_addrlen) == 0) {
-            /* Connected successfully */
-            ctx->connected = 1;
+        for (i = 0; i < active; i++) {
+            fds[i].revents = 0;
+        }
+        
+        if (poll(fds, active, next < addrs->count ? (int)(next_ms - now) : -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
             break;
         }
         
-        /* Connection failed, close socket and try next */
+        for (i = 0; i < active; ) {
+            if (fds[i].revents == 0) {
+                i++;
+                continue;
+            }
+            
+            err = 0;
+            err_len = sizeof(err);
+            if (getsockopt(fds[i].fd, SOL_SOCKET, SO_ERROR, &err, &err_len) < 0) {
+                err = errno;
+            }
+            
+            if (err == EINPROGRESS || err == EALREADY) {
+                i++;
+                continue;
+            }
+            
+            if (err == 0 && winner < 0) {
+                winner = fds[i].fd;
+                *family = families[i];
+                ctx->opts_failed = opts_failed[i];
+            } else {
+                close(fds[i].fd);
+                /* A failure starts the next attempt without waiting */
+                next_ms = now;
+            }
+            
+            active--;
+            fds[i] = fds[active];
+            families[i] = families[active];
+            opts_failed[i] = opts_failed[active];
+        }
+    }
+    
+    /* Cancel the attempts that lost */
+    for (i = 0; i < active; i++) {
+        close(fds[i].fd);
+    }
+    
+    return winner;
+}
+
+/* Connect to a host:port */
+int transport_tcp_connect(transport_tcp_t *ctx, const char *host, const char *port)
+{
+    resolver_addrs_t addrs;
+    uint16_t port_num = 0;
+    int ret, family = AF_UNSPEC;
+    
+    if (ctx == NULL || host == NULL || port == NULL) {
+        return TRANSPORT_TCP_ERR_INVALID_PARAM;
+    }
+    
+    /* Close existing connection if any */
+    transport_tcp_cancel_attempts(ctx, ctx->fd);
+    if (ctx->fd >= 0) {
         close(ctx->fd);
         ctx->fd = -1;
+        ctx->connected = 0;
     }
     
-    freeaddrinfo(addr_list);
+    ret = transport_tcp_resolve(ctx, host, port, &addrs, &port_num);
+    if (ret != TRANSPORT_TCP_OK) {
+        return ret;
+    }
     
-    if (!ctx->connected) {
+    /* Race the addresses until one connects */
+    conn_metrics_phase_begin(ctx->metrics, CONN_METRICS_PHASE_CONNECT);
+    ctx->fd = transport_tcp_race(ctx, host, &addrs, port_num, &family);
+    if (ctx->fd < 0) {
+        conn_metrics_phase_fail(ctx->metrics, CONN_METRICS_PHASE_CONNECT);
         return TRANSPORT_TCP_ERR_CONNECT_FAILED;
     }
     
+    /* Callers of the blocking connect expect a blocking socket */
+    if (transport_tcp_set_nonblocking(ctx, 0) != TRANSPORT_TCP_OK) {
+        conn_metrics_phase_fail(ctx->metrics, CONN_METRICS_PHASE_CONNECT);
+        close(ctx->fd);
+        ctx->fd = -1;
+        return TRANSPORT_TCP_ERR_SOCKET_FAILED;
+    }
+    
+    ctx->connected = 1;
+    resolver_set_family(ctx->resolver, host, family);
+    conn_metrics_phase_end(ctx->metrics, CONN_METRICS_PHASE_CONNECT);
+    
+    return TRANSPORT_TCP_OK;
+}
+
+/* Enable or disable O_NONBLOCK on the socket */
+int transport_tcp_set_nonblocking(transport_tcp_t *ctx, int enable)
+{
+    int flags;
+    
+    if (ctx == NULL || ctx->fd < 0) {
+        return TRANSPORT_TCP_ERR_INVALID_PARAM;
+    }
+    
+    flags = fcntl(ctx->fd, F_GETFL, 0);
+    if (flags < 0) {
+        return TRANSPORT_TCP_ERR_SOCKET_FAILED;
+    }
+    
+    flags = enable ? (flags | O_NONBLOCK) : (flags & ~O_NONBLOCK);
+    
+    if (fcntl(ctx->fd, F_SETFL, flags) < 0) {
+        return TRANSPORT_TCP_ERR_SOCKET_FAILED;
+    }
+    
     return TRANSPORT_TCP_OK;
 }
 
+/* Start a non-blocking connect to host:port */
+int transport_tcp_connect_async(transport_tcp_t *ctx, const char *host, const char *port)
+{
+    resolver_addrs_t addrs;
+    uint16_t port_num = 0;
+    int ret;
+    
+    if (ctx == NULL || host == NULL || port == NULL) {
+        return TRANSPORT_TCP_ERR_INVALID_PARAM;
+    }
+    
+    ret = transport_tcp_resolve(ctx, host, port, &addrs, &port_num);
+    if (ret != TRANSPORT_TCP_OK) {
+        return ret;
+    }
+    
+    return transport_tcp_connect_addrs_async(ctx, host, &addrs, port_num);
+}
+
+/* Attempt i connected: keep its socket, cancel the others and remember
+ * the family for the next connect to the host */
+static int transport_tcp_connected(transport_tcp_t *ctx, size_t i)
+{
+    transport_tcp_attempt_t won = ctx->attempts[i];
+    
+    transport_tcp_cancel_attempts(ctx, won.fd);
+    
+    ctx->fd = won.fd;
+    ctx->connected = 1;
+    ctx->opts_failed = won.opts_failed;
+    resolver_set_family(ctx->resolver, ctx->host, won.family);
+    conn_metrics_phase_end(ctx->metrics, CONN_METRICS_PHASE_CONNECT);
+    
+    return TRANSPORT_TCP_OK;
+}
+
+/* Start a connect to the next address of ctx->pending whose connect is
+ * accepted or in progress, alongside the attempts already in flight */
+static int transport_tcp_connect_pending(transport_tcp_t *ctx)
+{
+    transport_tcp_attempt_t *attempt;
+    const resolver_addr_t *addr;
+    struct sockaddr_storage ss;
+    socklen_t ss_len;
+    int fd;
+    
+    while (ctx->pending_next < ctx->pending.count) {
+        addr = &ctx->pending.addrs[ctx->pending_next++];
+        ss_len = resolver_sockaddr(addr, ctx->pending_port, &ss);
+        
+        fd = socket(ss.ss_family, SOCK_STREAM | SOCK_NONBLOCK, IPPROTO_TCP);
+        if (fd < 0) {
+            continue;
+        }
+        
+        attempt = &ctx->attempts[ctx->attempt_count++];
+        attempt->fd = fd;
+        attempt->family = ss.ss_family;
+        attempt->opts_failed = transport_tcp_apply_opts(&ctx->opts, fd,
+                                                        transport_tcp_fastopen(ctx, &ctx->pending,
+                                                                               addr, ctx->host));
+        CONN_METRICS_ADD(ctx->metrics, connect_attempts, 1);
+        
+        if (connect(fd, (struct sockaddr *)&ss, ss_len) == 0) {
+            return transport_tcp_connected(ctx, ctx->attempt_count - 1);
+        }
+        
+        if (errno == EINPROGRESS) {
+            break;
+        }
+        
+        close(fd);
+        ctx->attempt_count--;
+    }
+    
+    /* ctx->fd is the newest attempt, for callers that watch only one */
+    if (ctx->attempt_count == 0) {
+        ctx->fd = -1;
+        conn_metrics_phase_fail(ctx->metrics, CONN_METRICS_PHASE_CONNECT);
+        return TRANSPORT_TCP_ERR_CONNECT_FAILED;
+    }
+    
+    ctx->fd = ctx->attempts[ctx->attempt_count - 1].fd;
+    
+    return TRANSPORT_TCP_IN_PROGRESS;
+}
+
+/* Start a non-blocking connect to already resolved addresses */
+int transport_tcp_connect_addrs_async(transport_tcp_t *ctx, const char *host,
+                                      const resolver_addrs_t *addrs, uint16_t port)
+{
+    if (ctx == NULL || addrs == NULL) {
+        return TRANSPORT_TCP_ERR_INVALID_PARAM;
+    }
+    
+    /* Close existing connection if any */
+    transport_tcp_cancel_attempts(ctx, ctx->fd);
+    if (ctx->fd >= 0) {
+        close(ctx->fd);
+        ctx->fd = -1;
+        ctx->connected = 0;
+    }
+    
+    /* The other addresses wait for transport_tcp_connect_next() */
+    ctx->pending = *addrs;
+    ctx->pending_next = 0;
+    ctx->pending_port = port;
+    if (host == NULL) {
+        ctx->host[0] = '\0';
+    } else if (host != ctx->host) {
+        snprintf(ctx->host, sizeof(ctx->host), "%s", host);
+    }
+    
+    conn_metrics_phase_begin(ctx->metrics, CONN_METRICS_PHASE_CONNECT);
+    
+    return transport_tcp_connect_pending(ctx);
+}
+
+/* Start the next address alongside the attempts in flight */
+int transport_tcp_connect_next(transport_tcp_t *ctx)
+{
+    if (ctx == NULL) {
+        return TRANSPORT_TCP_ERR_INVALID_PARAM;
+    }
+    
+    if (ctx->connected) {
+        return TRANSPORT_TCP_OK;
+    }
+    
+    return transport_tcp_connect_pending(ctx);
+}
+
+/* Complete a pending non-blocking connect */
+int transport_tcp_connect_finish(transport_tcp_t *ctx)
+{
+    struct pollfd fds[RESOLVER_MAX_ADDRS];
+    socklen_t err_len;
+    size_t i, count, failed = 0;
+    int err;
+    
+    if (ctx == NULL || ctx->fd < 0) {
+        return TRANSPORT_TCP_ERR_NOT_CONNECTED;
+    }
+    
+    if (ctx->connected) {
+        return TRANSPORT_TCP_OK;
+    }
+    
+    /* SO_ERROR is 0 while a connect is still pending: ask which are done */
+    count = ctx->attempt_count;
+    for (i = 0; i < count; i++) {
+        fds[i].fd = ctx->attempts[i].fd;
+        fds[i].events = POLLOUT;
+        fds[i].revents = 0;
+    }
+    
+    if (poll(fds, count, 0) < 0) {
+        if (errno == EINTR) {
+            return TRANSPORT_TCP_IN_PROGRESS;
+        }
+        conn_metrics_phase_fail(ctx->metrics, CONN_METRICS_PHASE_CONNECT);
+        return TRANSPORT_TCP_ERR_CONNECT_FAILED;
+    }
+    
+    /* Backwards, so removing attempt i only moves one already looked at */
+    for (i = count; i-- > 0; ) {
+        if (fds[i].revents == 0) {
+            continue;
+        }
+        
+        err = 0;
+        err_len = sizeof(err);
+        if (getsockopt(fds[i].fd, SOL_SOCKET, SO_ERROR, &err, &err_len) < 0) {
+            err = errno;
+        }
+        
+        if (err == 0) {
+            return transport_tcp_connected(ctx, i);
+        }
+        
+        if (err == EINPROGRESS || err == EALREADY) {
+            continue;
+        }
+        
+        /* Refused or unreachable */
+        close(fds[i].fd);
+        ctx->attempts[i] = ctx->attempts[--ctx->attempt_count];
+        failed++;
+    }
+    
+    /* A failure starts the next attempt without waiting */
+    if (failed > 0) {
+        return transport_tcp_connect_pending(ctx);
+    }
+    
+    return TRANSPORT_TCP_IN_PROGRESS;
+}
+
 /* Send data (compatible with mbedtls bio callback) */
 int transport_tcp_send(void *ctx, const unsigned char *buf, size_t len)
 {
@@ -93,10 +645,12 @@ int transport_tcp_send(void *ctx, const unsigned char *buf, size_t len)
         return TRANSPORT_TCP_ERR_NOT_CONNECTED;
     }
     
-    ret = send(tcp_ctx->fd, buf, len, 0);
+    ret = send(tcp_ctx->fd, buf, len, MSG_NOSIGNAL);
+    CONN_METRICS_ADD(tcp_ctx->metrics, send_calls, 1);
     
     if (ret < 0) {
-        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+            CONN_METRICS_ADD(tcp_ctx->metrics, want_write, 1);
             return MBEDTLS_ERR_SSL_WANT_WRITE;
         }
         
@@ -107,6 +661,48 @@ int transport_tcp_send(void *ctx, const unsigned char *buf, size_t len)
         return TRANSPORT_TCP_ERR_SEND_FAILED;
     }
     
+    if (tcp_ctx->metrics != NULL) {
+        CONN_METRICS_ADD(tcp_ctx->metrics, bytes_out, ret);
+        CONN_METRICS_FLIGHT(tcp_ctx->metrics, 1);
+        conn_metrics_tls_stream(tcp_ctx->metrics, 1, buf, (size_t)ret);
+    }
+    
+    return (int)ret;
+}
+
+/* Gather send in one sendmsg() */
+int transport_tcp_sendv(transport_tcp_t *ctx, const struct iovec *iov, int iovcnt)
+{
+    struct msghdr msg;
+    ssize_t ret;
+    
+    if (ctx == NULL || ctx->fd < 0) {
+        return TRANSPORT_TCP_ERR_NOT_CONNECTED;
+    }
+    
+    if (iov == NULL || iovcnt <= 0) {
+        return TRANSPORT_TCP_ERR_INVALID_PARAM;
+    }
+    
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = (struct iovec *)iov;
+    msg.msg_iovlen = (size_t)iovcnt;
+    
+    ret = sendmsg(ctx->fd, &msg, MSG_NOSIGNAL);
+    CONN_METRICS_ADD(ctx->metrics, send_calls, 1);
+    
+    if (ret < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+            CONN_METRICS_ADD(ctx->metrics, want_write, 1);
+            return MBEDTLS_ERR_SSL_WANT_WRITE;
+        }
+        
+        return TRANSPORT_TCP_ERR_SEND_FAILED;
+    }
+    
+    CONN_METRICS_ADD(ctx->metrics, bytes_out, ret);
+    CONN_METRICS_FLIGHT(ctx->metrics, 1);
+    
     return (int)ret;
 }
 
@@ -121,9 +717,11 @@ int transport_tcp_recv(void *ctx, unsigned char *buf, size_t len)
     }
     
     ret = recv(tcp_ctx->fd, buf, len, 0);
+    CONN_METRICS_ADD(tcp_ctx->metrics, recv_calls, 1);
     
     if (ret < 0) {
-        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+            CONN_METRICS_ADD(tcp_ctx->metrics, want_read, 1);
             return MBEDTLS_ERR_SSL_WANT_READ;
         }
         
@@ -139,6 +737,18 @@ int transport_tcp_recv(void *ctx, unsigned char *buf, size_t len)
         return 0;
     }
     
+    /* The kernel drops back to delayed ACKs after a while; re-arm */
+    if (tcp_ctx->opts.quickack) {
+        int one = 1;
+        setsockopt(tcp_ctx->fd, IPPROTO_TCP, TCP_QUICKACK, &one, sizeof(one));
+    }
+    
+    if (tcp_ctx->metrics != NULL) {
+        CONN_METRICS_ADD(tcp_ctx->metrics, bytes_in, ret);
+        CONN_METRICS_FLIGHT(tcp_ctx->metrics, 0);
+        conn_metrics_tls_stream(tcp_ctx->metrics, 0, buf, (size_t)ret);
+    }
+    
     return (int)ret;
 }
 
@@ -149,6 +759,7 @@ void transport_tcp_close(transport_tcp_t *ctx)
         return;
     }
     
+    transport_tcp_cancel_attempts(ctx, ctx->fd);
     if (ctx->fd >= 0) {
         shutdown(ctx->fd, SHUT_RDWR);
         close(ctx->fd);
@@ -156,4 +767,5 @@ void transport_tcp_close(transport_tcp_t *ctx)
     }
     
     ctx->connected = 0;
+    ctx->pending_next = ctx->pending.count;
 }
\ No newline at end of file
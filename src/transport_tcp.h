@@ -7,6 +7,10 @@
 #define TRANSPORT_TCP_H
 
 #include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+#include "conn_metrics.h"
+#include "resolver.h"
 
 /* Error codes */
 #define TRANSPORT_TCP_OK                    0
@@ -17,22 +21,121 @@
 #define TRANSPORT_TCP_ERR_UNKNOWN_HOST     -5
 #define TRANSPORT_TCP_ERR_INVALID_PARAM    -6
 #define TRANSPORT_TCP_ERR_NOT_CONNECTED    -7
+#define TRANSPORT_TCP_ERR_SOCKOPT_FAILED   -8
+
+/* Happy Eyeballs (RFC 8305) stagger between connection attempts */
+#define TRANSPORT_TCP_ATTEMPT_DELAY_MS      250
+
+/* Returned by the non-blocking connect functions while the connect is pending */
+#define TRANSPORT_TCP_IN_PROGRESS           1
+
+/* Socket options applied to every socket before it connects. Zero leaves
+ * the kernel default (nodelay is on after transport_tcp_init()). */
+typedef struct {
+    int nodelay;            /* TCP_NODELAY: no Nagle delay for small records */
+    int quickack;           /* TCP_QUICKACK, re-armed after every receive */
+    int keepalive;          /* SO_KEEPALIVE */
+    int keepidle_sec;       /* TCP_KEEPIDLE: idle time before the first probe */
+    int keepintvl_sec;      /* TCP_KEEPINTVL: time between probes */
+    int keepcnt;            /* TCP_KEEPCNT: unanswered probes before reset */
+    int sndbuf;             /* SO_SNDBUF bytes (the kernel doubles it) */
+    int rcvbuf;             /* SO_RCVBUF bytes (the kernel doubles it) */
+    int user_timeout_ms;    /* TCP_USER_TIMEOUT: fail on unacknowledged data */
+    int busy_poll_us;       /* SO_BUSY_POLL (raising it needs CAP_NET_ADMIN) */
+    int fastopen;           /* TCP_FASTOPEN_CONNECT: data rides on the SYN, see
+                             * transport_tcp_connect() for when it is used */
+} transport_tcp_opts_t;
+
+/* Socket of a non-blocking connect still in flight */
+typedef struct {
+    int fd;
+    int family;
+    int opts_failed;        /* Options the kernel rejected on it */
+} transport_tcp_attempt_t;
 
 /* Transport TCP context structure */
 typedef struct {
     int fd;                 /* Socket file descriptor */
     int connected;          /* Connection status flag */
+    conn_metrics_t *metrics; /* Optional counters and phase timings, NULL = off */
+    resolver_t *resolver;   /* Cached DNS, NULL = getaddrinfo() */
+    uint32_t attempt_delay_ms; /* Head start of each address over the next */
+    transport_tcp_opts_t opts; /* Applied on connect, set after transport_tcp_init() */
+    int opts_failed;        /* Options the kernel rejected on the connected socket */
+    resolver_addrs_t pending; /* Addresses of a non-blocking connect */
+    size_t pending_next;    /* Next of them to try */
+    uint16_t pending_port;
+    char host[RESOLVER_NAME_LEN]; /* Name they belong to, empty if unknown */
+    transport_tcp_attempt_t attempts[RESOLVER_MAX_ADDRS]; /* In flight, fd is the newest */
+    size_t attempt_count;
 } transport_tcp_t;
 
 /* Initialize transport context */
 void transport_tcp_init(transport_tcp_t *ctx);
 
-/* Connect to a host:port */
+/* Default socket options: TCP_NODELAY on, everything else kernel default */
+void transport_tcp_opts_init(transport_tcp_opts_t *opts);
+
+/* Connect to a host:port (port must be numeric when ctx->resolver is set).
+ * Addresses are raced Happy Eyeballs style: a new attempt starts every
+ * attempt_delay_ms (alternating IPv6/IPv4) until one connects, and the
+ * winning family is remembered in ctx->resolver for the next connect.
+ * ctx->opts are applied to each socket before it connects; with fastopen
+ * and a cookie from an earlier connect, the connect completes at once and
+ * the SYN leaves with the first send. Such an attempt cannot lose a race,
+ * so fastopen is only set when there is a single address, or on addresses
+ * of the family remembered for the host. */
 int transport_tcp_connect(transport_tcp_t *ctx, const char *host, const char *port);
 
+/* Start a non-blocking connect to host:port.
+ * Returns TRANSPORT_TCP_OK if the socket connected immediately, or
+ * TRANSPORT_TCP_IN_PROGRESS if the caller must wait for the fd to become
+ * writable and then call transport_tcp_connect_finish(). The name lookup
+ * itself still blocks; an event loop uses resolver_query() and
+ * transport_tcp_connect_addrs_async() instead. */
+int transport_tcp_connect_async(transport_tcp_t *ctx, const char *host, const char *port);
+
+/* Start a non-blocking connect to addrs (tried in order) on port, for
+ * callers that resolved host themselves, e.g. via resolver_query(). host
+ * may be NULL; otherwise the family that connects is remembered in
+ * ctx->resolver. The addresses are copied: one attempt starts now, the
+ * others wait for transport_tcp_connect_next() or for attempts to fail.
+ * Same return values as transport_tcp_connect_async(). */
+int transport_tcp_connect_addrs_async(transport_tcp_t *ctx, const char *host,
+                                      const resolver_addrs_t *addrs, uint16_t port);
+
+/* Happy Eyeballs for non-blocking connects: start an attempt to the next
+ * address alongside those in flight, once ctx->attempt_delay_ms passed
+ * without an answer. Every socket in ctx->attempts must then be watched
+ * for writability. Returns TRANSPORT_TCP_OK if the new socket connected
+ * at once, TRANSPORT_TCP_IN_PROGRESS while attempts are in flight, or
+ * TRANSPORT_TCP_ERR_CONNECT_FAILED when none is left. */
+int transport_tcp_connect_next(transport_tcp_t *ctx);
+
+/* Complete a pending non-blocking connect (call once ctx->fd, or any
+ * socket in ctx->attempts, is writable). The first attempt that connected
+ * becomes ctx->fd and the others are closed. Failed attempts are closed
+ * and immediately replaced by one to the next remaining address, so
+ * TRANSPORT_TCP_IN_PROGRESS may come with new sockets, and
+ * TRANSPORT_TCP_ERR_CONNECT_FAILED means every address failed. */
+int transport_tcp_connect_finish(transport_tcp_t *ctx);
+
+/* Read back the option values in effect on the connected socket, as
+ * reported by getsockopt() (-1 for options the kernel does not have).
+ * Returns TRANSPORT_TCP_ERR_SOCKOPT_FAILED if some of ctx->opts could
+ * not be applied. */
+int transport_tcp_get_opts(const transport_tcp_t *ctx, transport_tcp_opts_t *out);
+
+/* Enable or disable O_NONBLOCK on the socket */
+int transport_tcp_set_nonblocking(transport_tcp_t *ctx, int enable);
+
 /* Send data (compatible with mbedtls bio callback) */
 int transport_tcp_send(void *ctx, const unsigned char *buf, size_t len);
 
+/* Gather send of up to iovcnt buffers in one sendmsg(); same return
+ * values as transport_tcp_send() */
+int transport_tcp_sendv(transport_tcp_t *ctx, const struct iovec *iov, int iovcnt);
+
 /* Receive data (compatible with mbedtls bio callback) */
 int transport_tcp_recv(void *ctx, unsigned char *buf, size_t len);
 
@@ -0,0 +1,645 @@
+/*
+ * Tuya local protocol codec implementation
+ * Encoding writes the plaintext straight into its place in the output
+ * frame and encrypts in place; decoding verifies the whole frame before
+ * decrypting into the caller's buffer.
+ */
+
+#include "tuya_codec.h"
+#include "crc32.h"
+#include <string.h>
+
+#define TUYA_PREFIX_55AA                    0x000055aau
+#define TUYA_SUFFIX_55AA                    0x0000aa55u
+#define TUYA_PREFIX_6699                    0x00006699u
+#define TUYA_SUFFIX_6699                    0x00009966u
+
+/* prefix seq cmd len, and 3.5's two reserved bytes before seq */
+#define TUYA_HEADER_55AA                    16
+#define TUYA_HEADER_6699                    18
+
+#define TUYA_VERSION_HEADER_LEN             15
+#define TUYA_HMAC_LEN                       32
+#define TUYA_GCM_IV_LEN                     12
+#define TUYA_GCM_TAG_LEN                    16
+#define TUYA_BLOCK                          16
+
+static void tuya_put32(unsigned char *p, uint32_t v)
+{
+    p[0] = (unsigned char)(v >> 24);
+    p[1] = (unsigned char)(v >> 16);
+    p[2] = (unsigned char)(v >> 8);
+    p[3] = (unsigned char) v;
+}
+
+static uint32_t tuya_get32(const unsigned char *p)
+{
+    return (uint32_t) p[0] << 24 | (uint32_t) p[1] << 16 | (uint32_t) p[2] << 8 | p[3];
+}
+
+/* Commands sent without the "3.x" version header */
+static int tuya_codec_bare_cmd(uint32_t cmd)
+{
+    switch (cmd) {
+    case TUYA_CMD_DP_QUERY:
+    case TUYA_CMD_DP_QUERY_NEW:
+    case TUYA_CMD_UPDATEDPS:
+    case TUYA_CMD_HEART_BEAT:
+    case TUYA_CMD_SESS_KEY_NEG_START:
+    case TUYA_CMD_SESS_KEY_NEG_RESP:
+    case TUYA_CMD_SESS_KEY_NEG_FINISH:
+    case TUYA_CMD_LAN_EXT_STREAM:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+/* "3.x" followed by 12 zero bytes */
+static void tuya_codec_version_header(const tuya_codec_t *codec, unsigned char *p)
+{
+    p[0] = '3';
+    p[1] = '.';
+    p[2] = (unsigned char)('0' + codec->version % 10);
+    memset(p + 3, 0, TUYA_VERSION_HEADER_LEN - 3);
+}
+
+static int tuya_codec_has_version_header(const tuya_codec_t *codec,
+                                         const unsigned char *p, size_t len)
+{
+    return len >= TUYA_VERSION_HEADER_LEN && p[0] == '3' && p[1] == '.' &&
+           p[2] == (unsigned char)('0' + codec->version % 10);
+}
+
+/* Device replies put a small status code in front of the payload */
+static int tuya_codec_is_retcode(const unsigned char *p, size_t len)
+{
+    return len >= 4 && (tuya_get32(p) & 0xffffff00u) == 0;
+}
+
+/* Key everything the version needs, once per key */
+int tuya_codec_set_key(tuya_codec_t *codec, const unsigned char key[TUYA_CODEC_KEY_LEN])
+{
+    unsigned char iv[TUYA_GCM_IV_LEN];
+    size_t i;
+
+    if (codec == NULL || key == NULL) {
+        return TUYA_CODEC_ERR_INVALID_PARAM;
+    }
+
+    memcpy(codec->key, key, TUYA_CODEC_KEY_LEN);
+
+    if (codec->version == TUYA_PROTO_35) {
+        if (mbedtls_gcm_setkey(&codec->gcm, MBEDTLS_CIPHER_ID_AES, key, 128) != 0) {
+            return TUYA_CODEC_ERR_CRYPTO;
+        }
+
+        /* Random starting IV per key; the counter part then never repeats */
+        if (codec->f_rng(codec->p_rng, iv, sizeof(iv)) != 0) {
+            return TUYA_CODEC_ERR_CRYPTO;
+        }
+        memcpy(codec->iv_salt, iv, sizeof(codec->iv_salt));
+        codec->iv_counter = 0;
+        for (i = sizeof(codec->iv_salt); i < sizeof(iv); i++) {
+            codec->iv_counter = codec->iv_counter << 8 | iv[i];
+        }
+        return TUYA_CODEC_OK;
+    }
+
+    if (mbedtls_aes_setkey_enc(&codec->enc, key, 128) != 0 ||
+        mbedtls_aes_setkey_dec(&codec->dec, key, 128) != 0) {
+        return TUYA_CODEC_ERR_CRYPTO;
+    }
+
+    if (codec->version == TUYA_PROTO_34 &&
+        mbedtls_md_hmac_starts(&codec->hmac, key, TUYA_CODEC_KEY_LEN) != 0) {
+        return TUYA_CODEC_ERR_CRYPTO;
+    }
+
+    return TUYA_CODEC_OK;
+}
+
+/* Initialize for a protocol version */
+int tuya_codec_init(tuya_codec_t *codec, int version, const unsigned char key[TUYA_CODEC_KEY_LEN],
+                    tuya_codec_rng_cb f_rng, void *p_rng)
+{
+    int ret;
+
+    if (codec == NULL || key == NULL ||
+        (version != TUYA_PROTO_33 && version != TUYA_PROTO_34 && version != TUYA_PROTO_35) ||
+        (version == TUYA_PROTO_35 && f_rng == NULL)) {
+        return TUYA_CODEC_ERR_INVALID_PARAM;
+    }
+
+    memset(codec, 0, sizeof(*codec));
+    codec->version = version;
+    codec->f_rng = f_rng;
+    codec->p_rng = p_rng;
+
+    mbedtls_aes_init(&codec->enc);
+    mbedtls_aes_init(&codec->dec);
+    mbedtls_md_init(&codec->hmac);
+    mbedtls_gcm_init(&codec->gcm);
+
+    if (version == TUYA_PROTO_34 &&
+        mbedtls_md_setup(&codec->hmac, mbedtls_md_info_from_type(MBEDTLS_MD_SHA256), 1) != 0) {
+        tuya_codec_free(codec);
+        return TUYA_CODEC_ERR_CRYPTO;
+    }
+
+    ret = tuya_codec_set_key(codec, key);
+    if (ret != TUYA_CODEC_OK) {
+        tuya_codec_free(codec);
+    }
+
+    return ret;
+}
+
+/* Release the crypto contexts */
+void tuya_codec_free(tuya_codec_t *codec)
+{
+    if (codec == NULL) {
+        return;
+    }
+
+    mbedtls_aes_free(&codec->enc);
+    mbedtls_aes_free(&codec->dec);
+    mbedtls_md_free(&codec->hmac);
+    mbedtls_gcm_free(&codec->gcm);
+    memset(codec->key, 0, sizeof(codec->key));
+}
+
+/* Size of the frame a message encodes to */
+size_t tuya_codec_frame_len(const tuya_codec_t *codec, const tuya_msg_t *msg)
+{
+    size_t rc = msg->has_retcode ? 4 : 0;
+    size_t vh = tuya_codec_bare_cmd(msg->cmd) ? 0 : TUYA_VERSION_HEADER_LEN;
+
+    switch (codec->version) {
+    case TUYA_PROTO_33:
+        return TUYA_HEADER_55AA + rc + vh + (msg->len / TUYA_BLOCK + 1) * TUYA_BLOCK + 4 + 4;
+    case TUYA_PROTO_34:
+        return TUYA_HEADER_55AA + rc + ((vh + msg->len) / TUYA_BLOCK + 1) * TUYA_BLOCK +
+               TUYA_HMAC_LEN + 4;
+    default:
+        return TUYA_HEADER_6699 + TUYA_GCM_IV_LEN + rc + vh + msg->len + TUYA_GCM_TAG_LEN + 4;
+    }
+}
+
+/* PKCS#7 pad p[0..len) and encrypt it in place; padded length in out_len */
+static int tuya_codec_ecb_encrypt(tuya_codec_t *codec, unsigned char *p, size_t len, size_t *out_len)
+{
+    size_t padded = (len / TUYA_BLOCK + 1) * TUYA_BLOCK;
+    size_t i;
+
+    memset(p + len, (int)(padded - len), padded - len);
+
+    for (i = 0; i < padded; i += TUYA_BLOCK) {
+        if (mbedtls_aes_crypt_ecb(&codec->enc, MBEDTLS_AES_ENCRYPT, p + i, p + i) != 0) {
+            return TUYA_CODEC_ERR_CRYPTO;
+        }
+    }
+
+    *out_len = padded;
+    return TUYA_CODEC_OK;
+}
+
+/* Encode one message; out_size already checked */
+static int tuya_codec_encode_one(tuya_codec_t *codec, tuya_msg_t *msg, unsigned char *out,
+                                 size_t frame_len)
+{
+    int vh = !tuya_codec_bare_cmd(msg->cmd);
+    unsigned char *p;
+    size_t ct_len;
+    uint64_t counter;
+    int ret, i;
+
+    if (msg->seq == 0) {
+        msg->seq = ++codec->seq;
+        if (msg->seq == 0) {
+            msg->seq = ++codec->seq;
+        }
+    }
+
+    if (codec->version == TUYA_PROTO_35) {
+        tuya_put32(out, TUYA_PREFIX_6699);
+        out[4] = 0;
+        out[5] = 0;
+        tuya_put32(out + 6, msg->seq);
+        tuya_put32(out + 10, msg->cmd);
+        tuya_put32(out + 14, (uint32_t)(frame_len - TUYA_HEADER_6699 - 4));
+
+        p = out + TUYA_HEADER_6699;
+        memcpy(p, codec->iv_salt, sizeof(codec->iv_salt));
+        counter = codec->iv_counter++;
+        for (i = 0; i < 8; i++) {
+            p[4 + i] = (unsigned char)(counter >> (56 - 8 * i));
+        }
+
+        /* Plaintext in place, then encrypted where it lies */
+        p += TUYA_GCM_IV_LEN;
+        ct_len = frame_len - TUYA_HEADER_6699 - TUYA_GCM_IV_LEN - TUYA_GCM_TAG_LEN - 4;
+        if (msg->has_retcode) {
+            tuya_put32(p, msg->retcode);
+        }
+        if (vh) {
+            tuya_codec_version_header(codec, p + (msg->has_retcode ? 4 : 0));
+        }
+        if (msg->len > 0) {
+            memcpy(p + ct_len - msg->len, msg->payload, msg->len);
+        }
+
+        if (mbedtls_gcm_crypt_and_tag(&codec->gcm, MBEDTLS_GCM_ENCRYPT, ct_len,
+                                      out + TUYA_HEADER_6699, TUYA_GCM_IV_LEN,
+                                      out + 4, TUYA_HEADER_6699 - 4, p, p,
+                                      TUYA_GCM_TAG_LEN, p + ct_len) != 0) {
+            return TUYA_CODEC_ERR_CRYPTO;
+        }
+
+        tuya_put32(out + frame_len - 4, TUYA_SUFFIX_6699);
+        return TUYA_CODEC_OK;
+    }
+
+    tuya_put32(out, TUYA_PREFIX_55AA);
+    tuya_put32(out + 4, msg->seq);
+    tuya_put32(out + 8, msg->cmd);
+    tuya_put32(out + 12, (uint32_t)(frame_len - TUYA_HEADER_55AA));
+
+    p = out + TUYA_HEADER_55AA;
+    if (msg->has_retcode) {
+        tuya_put32(p, msg->retcode);
+        p += 4;
+    }
+
+    if (codec->version == TUYA_PROTO_33) {
+        /* 3.3 puts the version header in clear in front of the ciphertext */
+        if (vh) {
+            tuya_codec_version_header(codec, p);
+            p += TUYA_VERSION_HEADER_LEN;
+        }
+        if (msg->len > 0) {
+            memcpy(p, msg->payload, msg->len);
+        }
+        ret = tuya_codec_ecb_encrypt(codec, p, msg->len, &ct_len);
+        if (ret != TUYA_CODEC_OK) {
+            return ret;
+        }
+        p += ct_len;
+        tuya_put32(p, crc32_compute(0, out, (size_t)(p - out)));
+        p += 4;
+    } else {
+        if (vh) {
+            tuya_codec_version_header(codec, p);
+        }
+        if (msg->len > 0) {
+            memcpy(p + (vh ? TUYA_VERSION_HEADER_LEN : 0), msg->payload, msg->len);
+        }
+        ret = tuya_codec_ecb_encrypt(codec, p, (vh ? TUYA_VERSION_HEADER_LEN : 0) + msg->len,
+                                     &ct_len);
+        if (ret != TUYA_CODEC_OK) {
+            return ret;
+        }
+        p += ct_len;
+
+        if (mbedtls_md_hmac_reset(&codec->hmac) != 0 ||
+            mbedtls_md_hmac_update(&codec->hmac, out, (size_t)(p - out)) != 0 ||
+            mbedtls_md_hmac_finish(&codec->hmac, p) != 0) {
+            return TUYA_CODEC_ERR_CRYPTO;
+        }
+        p += TUYA_HMAC_LEN;
+    }
+
+    tuya_put32(p, TUYA_SUFFIX_55AA);
+    return TUYA_CODEC_OK;
+}
+
+/* Encode messages back to back */
+int tuya_codec_encode_batch(tuya_codec_t *codec, tuya_msg_t *msgs, size_t count,
+                            unsigned char *out, size_t out_size, size_t *out_len)
+{
+    size_t used = 0, frame_len, i;
+    int ret = TUYA_CODEC_ERR_NO_SPACE;
+
+    if (codec == NULL || (msgs == NULL && count > 0) || out == NULL || out_len == NULL) {
+        return TUYA_CODEC_ERR_INVALID_PARAM;
+    }
+
+    for (i = 0; i < count; i++) {
+        if (msgs[i].payload == NULL && msgs[i].len > 0) {
+            ret = TUYA_CODEC_ERR_INVALID_PARAM;
+            break;
+        }
+
+        frame_len = tuya_codec_frame_len(codec, &msgs[i]);
+        if (frame_len > TUYA_CODEC_MAX_FRAME) {
+            ret = TUYA_CODEC_ERR_INVALID_PARAM;
+            break;
+        }
+        if (frame_len > out_size - used) {
+            break;
+        }
+
+        ret = tuya_codec_encode_one(codec, &msgs[i], out + used, frame_len);
+        if (ret != TUYA_CODEC_OK) {
+            break;
+        }
+        used += frame_len;
+    }
+
+    *out_len = used;
+    codec->stats.packets_out += i;
+    codec->stats.bytes_out += used;
+    if (i > 0) {
+        codec->stats.batches++;
+    }
+
+    /* A failure on a later message shows as a short count */
+    if (i == 0 && count > 0) {
+        return ret;
+    }
+
+    return (int) i;
+}
+
+/* Encode one message */
+int tuya_codec_encode(tuya_codec_t *codec, tuya_msg_t *msg,
+                      unsigned char *out, size_t out_size, size_t *out_len)
+{
+    int ret = tuya_codec_encode_batch(codec, msg, 1, out, out_size, out_len);
+
+    return ret < 0 ? ret : TUYA_CODEC_OK;
+}
+
+/* Decrypt whole blocks into out and strip the PKCS#7 padding */
+static int tuya_codec_ecb_decrypt(tuya_codec_t *codec, const unsigned char *in, size_t len,
+                                  unsigned char *out, size_t *out_len)
+{
+    size_t i, pad;
+
+    *out_len = 0;
+    if (len == 0) {
+        return TUYA_CODEC_OK;
+    }
+    if (len % TUYA_BLOCK != 0) {
+        return TUYA_CODEC_ERR_DECRYPT;
+    }
+
+    for (i = 0; i < len; i += TUYA_BLOCK) {
+        if (mbedtls_aes_crypt_ecb(&codec->dec, MBEDTLS_AES_DECRYPT, in + i, out + i) != 0) {
+            return TUYA_CODEC_ERR_CRYPTO;
+        }
+    }
+
+    pad = out[len - 1];
+    if (pad == 0 || pad > TUYA_BLOCK) {
+        return TUYA_CODEC_ERR_DECRYPT;
+    }
+    for (i = len - pad; i < len; i++) {
+        if (out[i] != pad) {
+            return TUYA_CODEC_ERR_DECRYPT;
+        }
+    }
+
+    *out_len = len - pad;
+    return TUYA_CODEC_OK;
+}
+
+/* Length of the complete frame at in, 0 if more bytes are needed,
+ * TUYA_CODEC_ERR_FRAMING if in does not start with a frame */
+static long tuya_codec_frame_at(const tuya_codec_t *codec, const unsigned char *in, size_t in_len)
+{
+    size_t len, frame_len;
+
+    if (in_len < 4) {
+        return 0;
+    }
+
+    if (codec->version == TUYA_PROTO_35) {
+        if (tuya_get32(in) != TUYA_PREFIX_6699) {
+            return TUYA_CODEC_ERR_FRAMING;
+        }
+        if (in_len < TUYA_HEADER_6699) {
+            return 0;
+        }
+        len = tuya_get32(in + 14);
+        if (len < TUYA_GCM_IV_LEN + TUYA_GCM_TAG_LEN ||
+            len > TUYA_CODEC_MAX_FRAME - TUYA_HEADER_6699 - 4) {
+            return TUYA_CODEC_ERR_FRAMING;
+        }
+        frame_len = TUYA_HEADER_6699 + len + 4;
+        if (in_len < frame_len) {
+            return 0;
+        }
+        if (tuya_get32(in + frame_len - 4) != TUYA_SUFFIX_6699) {
+            return TUYA_CODEC_ERR_FRAMING;
+        }
+        return (long) frame_len;
+    }
+
+    if (tuya_get32(in) != TUYA_PREFIX_55AA) {
+        return TUYA_CODEC_ERR_FRAMING;
+    }
+    if (in_len < TUYA_HEADER_55AA) {
+        return 0;
+    }
+    len = tuya_get32(in + 12);
+    if (len < (codec->version == TUYA_PROTO_34 ? TUYA_HMAC_LEN : 4) + 4 ||
+        len > TUYA_CODEC_MAX_FRAME - TUYA_HEADER_55AA) {
+        return TUYA_CODEC_ERR_FRAMING;
+    }
+    frame_len = TUYA_HEADER_55AA + len;
+    if (in_len < frame_len) {
+        return 0;
+    }
+    if (tuya_get32(in + frame_len - 4) != TUYA_SUFFIX_55AA) {
+        return TUYA_CODEC_ERR_FRAMING;
+    }
+
+    return (long) frame_len;
+}
+
+/* Verify and decrypt one complete frame into buf (room for frame_len) */
+static int tuya_codec_decode_one(tuya_codec_t *codec, const unsigned char *in, size_t frame_len,
+                                 tuya_packet_t *pkt, unsigned char *buf)
+{
+    unsigned char mac[TUYA_HMAC_LEN];
+    const unsigned char *body;
+    size_t body_len, pt_len;
+    unsigned char diff = 0;
+    int ret;
+    size_t i;
+
+    pkt->retcode = 0;
+    pkt->has_retcode = 0;
+    pkt->payload = buf;
+    pkt->len = 0;
+
+    if (codec->version == TUYA_PROTO_35) {
+        pkt->seq = tuya_get32(in + 6);
+        pkt->cmd = tuya_get32(in + 10);
+
+        body = in + TUYA_HEADER_6699 + TUYA_GCM_IV_LEN;
+        body_len = frame_len - TUYA_HEADER_6699 - TUYA_GCM_IV_LEN - TUYA_GCM_TAG_LEN - 4;
+
+        ret = mbedtls_gcm_auth_decrypt(&codec->gcm, body_len, in + TUYA_HEADER_6699,
+                                       TUYA_GCM_IV_LEN, in + 4, TUYA_HEADER_6699 - 4,
+                                       body + body_len, TUYA_GCM_TAG_LEN, body, buf);
+        if (ret == MBEDTLS_ERR_GCM_AUTH_FAILED) {
+            return TUYA_CODEC_ERR_INTEGRITY;
+        }
+        if (ret != 0) {
+            return TUYA_CODEC_ERR_CRYPTO;
+        }
+
+        /* Retcode and version header are inside the ciphertext */
+        pt_len = body_len;
+        if (tuya_codec_is_retcode(buf, pt_len)) {
+            pkt->retcode = tuya_get32(buf);
+            pkt->has_retcode = 1;
+            buf += 4;
+            pt_len -= 4;
+        }
+        if (tuya_codec_has_version_header(codec, buf, pt_len)) {
+            buf += TUYA_VERSION_HEADER_LEN;
+            pt_len -= TUYA_VERSION_HEADER_LEN;
+        }
+        pkt->payload = buf;
+        pkt->len = pt_len;
+        return TUYA_CODEC_OK;
+    }
+
+    pkt->seq = tuya_get32(in + 4);
+    pkt->cmd = tuya_get32(in + 8);
+
+    if (codec->version == TUYA_PROTO_34) {
+        body_len = frame_len - TUYA_HEADER_55AA - TUYA_HMAC_LEN - 4;
+        if (mbedtls_md_hmac_reset(&codec->hmac) != 0 ||
+            mbedtls_md_hmac_update(&codec->hmac, in, TUYA_HEADER_55AA + body_len) != 0 ||
+            mbedtls_md_hmac_finish(&codec->hmac, mac) != 0) {
+            return TUYA_CODEC_ERR_CRYPTO;
+        }
+        /* Constant time: the MAC is the key's only protection */
+        for (i = 0; i < TUYA_HMAC_LEN; i++) {
+            diff |= (unsigned char)(mac[i] ^ in[TUYA_HEADER_55AA + body_len + i]);
+        }
+        if (diff != 0) {
+            return TUYA_CODEC_ERR_INTEGRITY;
+        }
+    } else {
+        body_len = frame_len - TUYA_HEADER_55AA - 8;
+        if (crc32_compute(0, in, TUYA_HEADER_55AA + body_len) !=
+            tuya_get32(in + TUYA_HEADER_55AA + body_len)) {
+            return TUYA_CODEC_ERR_INTEGRITY;
+        }
+    }
+
+    body = in + TUYA_HEADER_55AA;
+    if (tuya_codec_is_retcode(body, body_len)) {
+        pkt->retcode = tuya_get32(body);
+        pkt->has_retcode = 1;
+        body += 4;
+        body_len -= 4;
+    }
+
+    /* 3.3: version header in clear; 3.4: inside the ciphertext */
+    if (codec->version == TUYA_PROTO_33 && tuya_codec_has_version_header(codec, body, body_len)) {
+        body += TUYA_VERSION_HEADER_LEN;
+        body_len -= TUYA_VERSION_HEADER_LEN;
+    }
+
+    ret = tuya_codec_ecb_decrypt(codec, body, body_len, buf, &pt_len);
+    if (ret != TUYA_CODEC_OK) {
+        return ret;
+    }
+
+    if (codec->version == TUYA_PROTO_34 && tuya_codec_has_version_header(codec, buf, pt_len)) {
+        buf += TUYA_VERSION_HEADER_LEN;
+        pt_len -= TUYA_VERSION_HEADER_LEN;
+    }
+
+    pkt->payload = buf;
+    pkt->len = pt_len;
+    return TUYA_CODEC_OK;
+}
+
+/* Decode every complete frame at the start of in */
+int tuya_codec_decode_batch(tuya_codec_t *codec, const unsigned char *in, size_t in_len,
+                            tuya_packet_t *pkts, size_t max_pkts,
+                            unsigned char *buf, size_t buf_size, size_t *consumed)
+{
+    size_t pos = 0, used = 0, n = 0;
+    long frame_len;
+
+    if (codec == NULL || (in == NULL && in_len > 0) || pkts == NULL ||
+        (buf == NULL && buf_size > 0) || consumed == NULL) {
+        return TUYA_CODEC_ERR_INVALID_PARAM;
+    }
+
+    while (n < max_pkts) {
+        frame_len = tuya_codec_frame_at(codec, in + pos, in_len - pos);
+        if (frame_len < 0) {
+            if (n == 0) {
+                *consumed = 0;
+                return TUYA_CODEC_ERR_FRAMING;
+            }
+            /* Reported by the next call, after these packets */
+            break;
+        }
+
+        /* Plaintext is never longer than its frame */
+        if (frame_len == 0 || (size_t) frame_len > buf_size - used) {
+            break;
+        }
+
+        pkts[n].status = tuya_codec_decode_one(codec, in + pos, (size_t) frame_len,
+                                               &pkts[n], buf + used);
+        if (pkts[n].status == TUYA_CODEC_OK) {
+            used += (size_t)(pkts[n].payload - (buf + used)) + pkts[n].len;
+        } else {
+            pkts[n].payload = NULL;
+            pkts[n].len = 0;
+            codec->stats.rejected++;
+        }
+
+        pos += (size_t) frame_len;
+        n++;
+    }
+
+    *consumed = pos;
+    codec->stats.packets_in += n;
+    codec->stats.bytes_in += pos;
+    if (n > 0) {
+        codec->stats.batches++;
+    }
+
+    return (int) n;
+}
+
+/* Decode the frame at the start of in */
+int tuya_codec_decode(tuya_codec_t *codec, const unsigned char *in, size_t in_len,
+                      tuya_packet_t *pkt, unsigned char *buf, size_t buf_size,
+                      size_t *consumed)
+{
+    long frame_len;
+    int ret;
+
+    if (codec == NULL || (in == NULL && in_len > 0) || pkt == NULL || consumed == NULL) {
+        return TUYA_CODEC_ERR_INVALID_PARAM;
+    }
+
+    *consumed = 0;
+    frame_len = tuya_codec_frame_at(codec, in, in_len);
+    if (frame_len < 0) {
+        return TUYA_CODEC_ERR_FRAMING;
+    }
+    if (frame_len == 0) {
+        return TUYA_CODEC_ERR_NEED_MORE;
+    }
+    if ((size_t) frame_len > buf_size) {
+        return TUYA_CODEC_ERR_NO_SPACE;
+    }
+
+    ret = tuya_codec_decode_batch(codec, in, in_len, pkt, 1, buf, buf_size, consumed);
+
+    return ret < 0 ? ret : pkt->status;
+}
@@ -0,0 +1,159 @@
+/*
+ * Tuya local protocol codec
+ * Framing, encryption and integrity for the device protocol over TCP 6668:
+ *
+ *   3.3  000055AA seq cmd len [retcode] ["3.3" + 12 zero] AES-128-ECB(payload)
+ *        CRC32 0000AA55
+ *   3.4  000055AA seq cmd len [retcode] AES-128-ECB(["3.4" + 12 zero] payload)
+ *        HMAC-SHA256 0000AA55
+ *   3.5  00006699 0000 seq cmd len IV AES-128-GCM([retcode] ["3.5" + 12 zero]
+ *        payload) tag 00009966, header bytes 4-17 as additional data
+ *
+ * The key is the device localKey, or for 3.4/3.5 the session key once the
+ * caller has negotiated it (tuya_codec_set_key()). Retcodes only appear in
+ * device replies and are recognized the way devices use them: a 32 bit
+ * value below 256 in front of the payload.
+ *
+ * Batching: gateways relay many packets per device, so a codec keeps its
+ * expanded AES key, GCM tables and HMAC pads for the life of the key, and
+ * the batch calls frame a run of messages into one buffer (one write) or
+ * decode every frame of one read. What a batch saves is the per-packet key
+ * setup and calls; ECB frames are still processed by mbedtls_aes_crypt_ecb()
+ * one 16 byte block at a time (mbedtls has no multi-block ECB call), using
+ * AES-NI or the ARMv8 crypto extensions when mbedtls was built with them.
+ */
+
+#ifndef TUYA_CODEC_H
+#define TUYA_CODEC_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "mbedtls/aes.h"
+#include "mbedtls/gcm.h"
+#include "mbedtls/md.h"
+
+/* Error codes */
+#define TUYA_CODEC_OK                       0
+#define TUYA_CODEC_ERR_INVALID_PARAM       -1
+#define TUYA_CODEC_ERR_NEED_MORE           -2
+#define TUYA_CODEC_ERR_FRAMING             -3
+#define TUYA_CODEC_ERR_INTEGRITY           -4
+#define TUYA_CODEC_ERR_DECRYPT             -5
+#define TUYA_CODEC_ERR_NO_SPACE            -6
+#define TUYA_CODEC_ERR_CRYPTO              -7
+
+/* Protocol versions */
+#define TUYA_PROTO_33                      33
+#define TUYA_PROTO_34                      34
+#define TUYA_PROTO_35                      35
+
+/* Commands */
+#define TUYA_CMD_SESS_KEY_NEG_START        0x03
+#define TUYA_CMD_SESS_KEY_NEG_RESP         0x04
+#define TUYA_CMD_SESS_KEY_NEG_FINISH       0x05
+#define TUYA_CMD_CONTROL                   0x07
+#define TUYA_CMD_STATUS                    0x08
+#define TUYA_CMD_HEART_BEAT                0x09
+#define TUYA_CMD_DP_QUERY                  0x0a
+#define TUYA_CMD_CONTROL_NEW               0x0d
+#define TUYA_CMD_DP_QUERY_NEW              0x10
+#define TUYA_CMD_UPDATEDPS                 0x12
+#define TUYA_CMD_UDP_NEW                   0x13
+#define TUYA_CMD_BROADCAST_LPV34           0x23
+#define TUYA_CMD_LAN_EXT_STREAM            0x40
+
+#define TUYA_CODEC_KEY_LEN                 16
+
+/* Most bytes an encoded frame adds to its payload (3.4 with retcode) */
+#define TUYA_CODEC_OVERHEAD                87
+
+/* Larger length fields are treated as a desynchronized stream */
+#define TUYA_CODEC_MAX_FRAME               65536
+
+/* Random source for 3.5 IVs (mbedtls f_rng signature) */
+typedef int (*tuya_codec_rng_cb)(void *ctx, unsigned char *output, size_t len);
+
+/* Outgoing message */
+typedef struct {
+    uint32_t cmd;
+    uint32_t seq;                       /* 0 = next from the codec; set to the one used */
+    uint32_t retcode;                   /* Device replies only */
+    int has_retcode;
+    const void *payload;
+    size_t len;
+} tuya_msg_t;
+
+/* Incoming packet; payload lives in the caller's buffer */
+typedef struct {
+    int status;                         /* TUYA_CODEC_OK, _ERR_INTEGRITY or _ERR_DECRYPT */
+    uint32_t seq;
+    uint32_t cmd;
+    uint32_t retcode;
+    int has_retcode;
+    const unsigned char *payload;       /* Plaintext without the version header */
+    size_t len;
+} tuya_packet_t;
+
+/* Counters */
+typedef struct {
+    uint64_t packets_out;
+    uint64_t packets_in;
+    uint64_t bytes_out;                 /* Frame bytes */
+    uint64_t bytes_in;
+    uint64_t rejected;                  /* Integrity or decryption failures */
+    uint64_t batches;                   /* Batch calls that did any work */
+} tuya_codec_stats_t;
+
+/* One device connection's codec */
+typedef struct {
+    int version;
+    unsigned char key[TUYA_CODEC_KEY_LEN];
+    mbedtls_aes_context enc;            /* 3.3, 3.4 */
+    mbedtls_aes_context dec;
+    mbedtls_md_context_t hmac;          /* 3.4, keyed once per key */
+    mbedtls_gcm_context gcm;            /* 3.5 */
+    tuya_codec_rng_cb f_rng;
+    void *p_rng;
+    uint32_t seq;                       /* Last sequence number assigned */
+    unsigned char iv_salt[4];           /* 3.5 IV: salt, then a 64 bit counter */
+    uint64_t iv_counter;
+    tuya_codec_stats_t stats;
+} tuya_codec_t;
+
+/* Initialize for a protocol version; f_rng is required for 3.5 only */
+int tuya_codec_init(tuya_codec_t *codec, int version, const unsigned char key[TUYA_CODEC_KEY_LEN],
+                    tuya_codec_rng_cb f_rng, void *p_rng);
+
+/* Switch to a new key (3.4/3.5 session key) */
+int tuya_codec_set_key(tuya_codec_t *codec, const unsigned char key[TUYA_CODEC_KEY_LEN]);
+
+/* Release the crypto contexts */
+void tuya_codec_free(tuya_codec_t *codec);
+
+/* Size of the frame a message encodes to */
+size_t tuya_codec_frame_len(const tuya_codec_t *codec, const tuya_msg_t *msg);
+
+/* Encode one message */
+int tuya_codec_encode(tuya_codec_t *codec, tuya_msg_t *msg,
+                      unsigned char *out, size_t out_size, size_t *out_len);
+
+/* Encode messages back to back into out, stopping when the next one does
+ * not fit. Returns the number encoded or a negative error. */
+int tuya_codec_encode_batch(tuya_codec_t *codec, tuya_msg_t *msgs, size_t count,
+                            unsigned char *out, size_t out_size, size_t *out_len);
+
+/* Decode the frame at the start of in. TUYA_CODEC_ERR_NEED_MORE until it
+ * is complete; an integrity or decryption failure still consumes it. */
+int tuya_codec_decode(tuya_codec_t *codec, const unsigned char *in, size_t in_len,
+                      tuya_packet_t *pkt, unsigned char *buf, size_t buf_size,
+                      size_t *consumed);
+
+/* Decode every complete frame at the start of in, up to max_pkts or until
+ * buf is full; packets that fail verification are returned with their
+ * status set. Returns the number of packets, or TUYA_CODEC_ERR_FRAMING if
+ * the first frame is not a valid one (the stream must be dropped). */
+int tuya_codec_decode_batch(tuya_codec_t *codec, const unsigned char *in, size_t in_len,
+                            tuya_packet_t *pkts, size_t max_pkts,
+                            unsigned char *buf, size_t buf_size, size_t *consumed);
+
+#endif /* TUYA_CODEC_H */
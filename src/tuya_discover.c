@@ -0,0 +1,129 @@
+/*
+ * Tuya LAN discovery tool
+ * Lists the devices announcing themselves on the local network, live or
+ * from a pcap capture:
+ *
+ *   tuya-discover [seconds]           listen on 6666/6667/7000 (default 15 s)
+ *   tuya-discover --replay file.pcap  replay a capture instead
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <poll.h>
+#include <arpa/inet.h>
+#include "lan_discovery.h"
+
+/* Devices the table holds */
+#define MAX_DEVICES 4096
+
+/* Listening time without an argument */
+#define LISTEN_SEC 15
+
+static const char *const kind_names[] = { "clear", "ecb", "gcm" };
+
+static const char *format_addr(uint32_t addr, char *buf, size_t len)
+{
+    struct in_addr in;
+
+    in.s_addr = addr;
+    return inet_ntop(AF_INET, &in, buf, (socklen_t) len);
+}
+
+/* Print table changes as they happen */
+static void print_event(const lan_discovery_device_t *dev, lan_discovery_event_t event, void *arg)
+{
+    char addr[INET_ADDRSTRLEN], prev[INET_ADDRSTRLEN];
+
+    (void)arg;
+
+    switch (event) {
+    case LAN_DISCOVERY_NEW:
+        printf("  + %s %s (%s, %s)\n", dev->gw_id, format_addr(dev->addr, addr, sizeof(addr)),
+               dev->version[0] != '\0' ? dev->version : "?", kind_names[dev->kind]);
+        break;
+    case LAN_DISCOVERY_ADDR_CHANGED:
+        printf("  ~ %s moved %s -> %s\n", dev->gw_id,
+               format_addr(dev->prev_addr, prev, sizeof(prev)),
+               format_addr(dev->addr, addr, sizeof(addr)));
+        break;
+    default:
+        break;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    const lan_discovery_device_t *dev;
+    char addr[INET_ADDRSTRLEN];
+    lan_discovery_t disc;
+    struct pollfd pfd;
+    uint64_t start, now, duration_ms = LISTEN_SEC * 1000ULL;
+    const char *replay = NULL;
+    long replayed;
+    int ret = EXIT_FAILURE;
+    size_t i;
+
+    if (argc > 2 && strcmp(argv[1], "--replay") == 0) {
+        replay = argv[2];
+    } else if (argc > 1) {
+        duration_ms = strtoull(argv[1], NULL, 10) * 1000ULL;
+    }
+
+    if (lan_discovery_init(&disc, MAX_DEVICES, print_event, NULL) != LAN_DISCOVERY_OK) {
+        printf("  ! discovery setup failed\n");
+        return EXIT_FAILURE;
+    }
+
+    printf("\n==== Tuya LAN discovery ====\n\n");
+
+    if (replay != NULL) {
+        printf("  . Replaying %s\n", replay);
+        replayed = lan_discovery_replay(&disc, replay);
+        if (replayed < 0) {
+            printf("  ! replay failed (%ld)\n", replayed);
+            goto exit;
+        }
+    } else {
+        printf("  . Listening on UDP %d, %d and %d for %llu s\n", LAN_DISCOVERY_PORT_PLAIN,
+               LAN_DISCOVERY_PORT_ECB, LAN_DISCOVERY_PORT_GCM,
+               (unsigned long long)(duration_ms / 1000));
+        if (lan_discovery_listen(&disc, NULL) != LAN_DISCOVERY_OK) {
+            printf("  ! cannot bind the discovery ports\n");
+            goto exit;
+        }
+
+        pfd.fd = lan_discovery_fd(&disc);
+        pfd.events = POLLIN;
+        start = lan_discovery_now_ms();
+        for (now = start; now - start < duration_ms; now = lan_discovery_now_ms()) {
+            if (poll(&pfd, 1, (int)(duration_ms - (now - start))) > 0 &&
+                lan_discovery_recv(&disc, lan_discovery_now_ms()) < 0) {
+                printf("  ! receive failed\n");
+                goto exit;
+            }
+        }
+    }
+
+    printf("\n  %-24s %-15s %-7s %-5s %-18s %s\n", "gwId", "address", "version", "kind",
+           "productKey", "seen");
+    for (i = 0; i < disc.count; i++) {
+        dev = &disc.devices[i];
+        printf("  %-24s %-15s %-7s %-5s %-18s %lu\n", dev->gw_id,
+               format_addr(dev->addr, addr, sizeof(addr)), dev->version, kind_names[dev->kind],
+               dev->product_key, dev->announcements);
+    }
+
+    printf("\n  . %llu datagrams in %llu batches: %zu devices, %llu repeats, "
+           "%llu rejected, %llu dropped\n\n",
+           (unsigned long long) disc.stats.datagrams, (unsigned long long) disc.stats.batches,
+           disc.count, (unsigned long long) disc.stats.duplicates,
+           (unsigned long long) disc.stats.rejected, (unsigned long long) disc.stats.dropped);
+
+    ret = EXIT_SUCCESS;
+
+exit:
+    lan_discovery_free(&disc);
+
+    return ret;
+}
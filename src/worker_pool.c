@@ -0,0 +1,510 @@
+/*
+ * Worker pool implementation
+ * Submissions travel through a mutex-protected queue per worker and an
+ * eventfd wakeup of its loop; everything after that happens on the worker
+ * thread without locks, except the shared session cache and metrics
+ * registry, which lock once per connection event.
+ */
+
+#define _GNU_SOURCE
+#include "worker_pool.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <unistd.h>
+
+/* One connection; conn comes first so callbacks can cast back */
+struct worker_pool_conn {
+    event_conn_t conn;
+    conn_metrics_t metrics;
+    worker_pool_worker_t *worker;
+    const worker_pool_handler_t *handler;
+    void *user_data;                    /* Handed to conn.user_data on start */
+    int established;                    /* Handshake completed */
+    char host[WORKER_POOL_HOST_LEN];
+    char port[WORKER_POOL_PORT_LEN];
+    struct worker_pool_conn *next;      /* queue, live or closed list */
+    struct worker_pool_conn **pprev;    /* live list only */
+};
+
+/* Add n to a counter of worker w. Single writer: the worker thread. */
+#define WORKER_POOL_ADD(w, field, n)                                        \
+    __atomic_store_n(&(w)->stats.field, (w)->stats.field + (uint64_t)(n),  \
+                     __ATOMIC_RELAXED)
+
+/* Connection finished: account it and queue it for freeing */
+static void worker_pool_closed(event_conn_t *conn, int reason)
+{
+    worker_pool_conn_t *wc = (worker_pool_conn_t *)conn;
+    worker_pool_worker_t *w = wc->worker;
+
+    if (wc->established) {
+        WORKER_POOL_ADD(w, closed, 1);
+    } else {
+        WORKER_POOL_ADD(w, failed, 1);
+    }
+
+    if (wc->handler->on_close != NULL) {
+        wc->handler->on_close(conn, reason);
+    }
+
+    if (wc->pprev != NULL) {
+        *wc->pprev = wc->next;
+        if (wc->next != NULL) {
+            wc->next->pprev = wc->pprev;
+        }
+        wc->pprev = NULL;
+    }
+
+    wc->next = w->closed;
+    w->closed = wc;
+}
+
+/* Handshake done: keep the session for the other workers */
+static void worker_pool_connected(event_conn_t *conn)
+{
+    worker_pool_conn_t *wc = (worker_pool_conn_t *)conn;
+    worker_pool_t *pool = wc->worker->pool;
+
+    wc->established = 1;
+    WORKER_POOL_ADD(wc->worker, established, 1);
+
+    /* TLS 1.3 fails here until a ticket arrives, see worker_pool_read() */
+    if (pool->sessions != NULL) {
+        session_cache_store(pool->sessions, wc->host, wc->port, &conn->ssl);
+    }
+    if (pool->idle_timeout_ms != 0) {
+        event_conn_set_idle_timeout(conn, pool->idle_timeout_ms);
+    }
+
+    if (wc->handler->on_connected != NULL) {
+        wc->handler->on_connected(conn);
+    }
+}
+
+/* Free the connections closed during the last round */
+static void worker_pool_reap(worker_pool_worker_t *w)
+{
+    worker_pool_conn_t *wc;
+
+    while ((wc = w->closed) != NULL) {
+        w->closed = wc->next;
+
+        /* Already reported */
+        wc->conn.on_close = NULL;
+        event_conn_free(&wc->conn);
+        if (wc->conn.metrics != NULL) {
+            conn_metrics_unregister(wc->conn.metrics);
+        }
+        free(wc);
+
+        __atomic_fetch_sub(&w->load, 1, __ATOMIC_RELAXED);
+    }
+}
+
+/* Start a submitted connection on the worker thread */
+static void worker_pool_begin(worker_pool_worker_t *w, worker_pool_conn_t *wc)
+{
+    worker_pool_t *pool = w->pool;
+    event_conn_t *conn = &wc->conn;
+    char label[CONN_METRICS_LABEL_LEN];
+    int ret;
+
+    WORKER_POOL_ADD(w, started, 1);
+
+    /* Listed first so worker_pool_closed() can always unlink it */
+    wc->next = w->live;
+    if (w->live != NULL) {
+        w->live->pprev = &wc->next;
+    }
+    w->live = wc;
+    wc->pprev = &w->live;
+
+    ret = event_conn_init(conn, pool->conf);
+    conn->on_connected = worker_pool_connected;
+    conn->on_readable = wc->handler->on_readable;
+    conn->on_writable = wc->handler->on_writable;
+    conn->on_close = worker_pool_closed;
+    conn->user_data = wc->user_data;
+    if (ret != EVENT_LOOP_OK) {
+        worker_pool_closed(conn, ret);
+        return;
+    }
+
+    conn->transport.opts = pool->tcp_opts;
+
+    if (pool->metrics != NULL) {
+        snprintf(label, sizeof(label), "%s:%s", wc->host, wc->port);
+        conn_metrics_init(&wc->metrics, label);
+        if (conn_metrics_register(pool->metrics, &wc->metrics) == CONN_METRICS_OK) {
+            conn->metrics = &wc->metrics;
+        }
+    }
+
+    /* The hostname must be set before a cached session is offered */
+    if (pool->sessions != NULL &&
+        mbedtls_ssl_set_hostname(&conn->ssl, wc->host) == 0) {
+        session_cache_load(pool->sessions, wc->host, wc->port, &conn->ssl);
+    }
+
+    ret = event_conn_start(&w->loop, conn, wc->host, wc->port);
+
+    /* Failures before the connection was attached report nothing */
+    if (ret != EVENT_LOOP_OK && conn->state != EVENT_CONN_CLOSED) {
+        conn->state = EVENT_CONN_CLOSED;
+        transport_tcp_close(&conn->transport);
+        worker_pool_closed(conn, ret);
+    }
+}
+
+/* Wakeup: take over the submission queue */
+static void worker_pool_wake(event_loop_t *loop, void *arg)
+{
+    worker_pool_worker_t *w = (worker_pool_worker_t *)arg;
+    worker_pool_conn_t *wc, *next;
+
+    (void)loop;
+
+    pthread_mutex_lock(&w->lock);
+    wc = w->queue;
+    w->queue = NULL;
+    w->queue_tail = &w->queue;
+    pthread_mutex_unlock(&w->lock);
+
+    if (wc != NULL) {
+        WORKER_POOL_ADD(w, wakeups, 1);
+    }
+
+    for (; wc != NULL; wc = next) {
+        next = wc->next;
+        worker_pool_begin(w, wc);
+    }
+}
+
+/* Worker thread */
+static void *worker_pool_main(void *arg)
+{
+    worker_pool_worker_t *w = (worker_pool_worker_t *)arg;
+    cpu_set_t set;
+
+    if (w->cpu >= 0) {
+        CPU_ZERO(&set);
+        CPU_SET(w->cpu, &set);
+        pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    }
+
+    while (!__atomic_load_n(&w->stopping, __ATOMIC_ACQUIRE)) {
+        event_loop_run_once(&w->loop, -1);
+        WORKER_POOL_ADD(w, rounds, 1);
+        worker_pool_reap(w);
+    }
+
+    while (w->live != NULL) {
+        event_conn_close(&w->live->conn);
+    }
+    worker_pool_reap(w);
+
+    return NULL;
+}
+
+/* CPUs this process may run on, in order; returns how many were found */
+static unsigned int worker_pool_cpus(int *cpus, unsigned int max)
+{
+    cpu_set_t set;
+    unsigned int n = 0;
+    int cpu;
+
+    if (sched_getaffinity(0, sizeof(set), &set) != 0) {
+        return 0;
+    }
+
+    for (cpu = 0; cpu < CPU_SETSIZE && n < max; cpu++) {
+        if (CPU_ISSET(cpu, &set)) {
+            cpus[n++] = cpu;
+        }
+    }
+
+    return n;
+}
+
+/* Initialize the pool */
+int worker_pool_init(worker_pool_t *pool, const mbedtls_ssl_config *conf,
+                     session_cache_t *sessions, unsigned int workers)
+{
+    int cpus[WORKER_POOL_MAX_WORKERS];
+    unsigned int ncpus, i;
+
+    if (pool == NULL || conf == NULL || workers > WORKER_POOL_MAX_WORKERS) {
+        return WORKER_POOL_ERR_INVALID_PARAM;
+    }
+
+    memset(pool, 0, sizeof(*pool));
+    pool->conf = conf;
+    pool->sessions = sessions;
+    transport_tcp_opts_init(&pool->tcp_opts);
+
+    ncpus = worker_pool_cpus(cpus, WORKER_POOL_MAX_WORKERS);
+    if (workers == 0) {
+        workers = ncpus > 0 ? ncpus : 1;
+    }
+
+    pool->workers = calloc(workers, sizeof(*pool->workers));
+    if (pool->workers == NULL) {
+        return WORKER_POOL_ERR_ALLOC_FAILED;
+    }
+
+    for (i = 0; i < workers; i++) {
+        worker_pool_worker_t *w = &pool->workers[i];
+
+        w->pool = pool;
+        w->index = i;
+        w->cpu = ncpus > 0 ? cpus[i % ncpus] : -1;
+        w->queue_tail = &w->queue;
+        pthread_mutex_init(&w->lock, NULL);
+
+        /* Per worker: the resolver is not shared between threads */
+        if (resolver_init(&w->resolver) != RESOLVER_OK) {
+            resolver_free(&w->resolver);
+            pthread_mutex_destroy(&w->lock);
+            worker_pool_free(pool);
+            return WORKER_POOL_ERR_RESOLVER_FAILED;
+        }
+
+        if (event_loop_init(&w->loop) != EVENT_LOOP_OK ||
+            event_loop_set_wakeup(&w->loop, worker_pool_wake, w) != EVENT_LOOP_OK) {
+            event_loop_free(&w->loop);
+            resolver_free(&w->resolver);
+            pthread_mutex_destroy(&w->lock);
+            worker_pool_free(pool);
+            return WORKER_POOL_ERR_LOOP_FAILED;
+        }
+
+        /* Without it, lookups block the worker in getaddrinfo() */
+        event_loop_set_resolver(&w->loop, &w->resolver);
+        pool->count++;
+    }
+
+    return WORKER_POOL_OK;
+}
+
+/* Start the worker threads */
+int worker_pool_start(worker_pool_t *pool)
+{
+    unsigned int i;
+
+    if (pool == NULL || pool->workers == NULL || pool->running) {
+        return WORKER_POOL_ERR_INVALID_PARAM;
+    }
+
+    for (i = 0; i < pool->count; i++) {
+        worker_pool_worker_t *w = &pool->workers[i];
+
+        if (!pool->pin) {
+            w->cpu = -1;
+        }
+
+        if (pthread_create(&w->thread, NULL, worker_pool_main, w) != 0) {
+            worker_pool_stop(pool);
+            return WORKER_POOL_ERR_THREAD_FAILED;
+        }
+        w->running = 1;
+    }
+
+    pool->running = 1;
+
+    return WORKER_POOL_OK;
+}
+
+/* Least loaded worker, scanning from a rotating start so ties spread out */
+static worker_pool_worker_t *worker_pool_pick(worker_pool_t *pool)
+{
+    worker_pool_worker_t *best = NULL;
+    uint64_t load, best_load = 0;
+    unsigned int start, i;
+
+    start = __atomic_fetch_add(&pool->next, 1, __ATOMIC_RELAXED) % pool->count;
+
+    for (i = 0; i < pool->count; i++) {
+        worker_pool_worker_t *w = &pool->workers[(start + i) % pool->count];
+
+        load = __atomic_load_n(&w->load, __ATOMIC_RELAXED);
+        if (best == NULL || load < best_load) {
+            best = w;
+            best_load = load;
+        }
+    }
+
+    return best;
+}
+
+/* Queue a connection on the least loaded worker */
+int worker_pool_connect(worker_pool_t *pool, const char *host, const char *port,
+                        const worker_pool_handler_t *handler, void *user_data)
+{
+    worker_pool_worker_t *w;
+    worker_pool_conn_t *wc;
+
+    if (pool == NULL || host == NULL || port == NULL || handler == NULL ||
+        strlen(host) >= WORKER_POOL_HOST_LEN || strlen(port) >= WORKER_POOL_PORT_LEN) {
+        return WORKER_POOL_ERR_INVALID_PARAM;
+    }
+
+    if (!pool->running) {
+        return WORKER_POOL_ERR_STOPPED;
+    }
+
+    wc = calloc(1, sizeof(*wc));
+    if (wc == NULL) {
+        return WORKER_POOL_ERR_ALLOC_FAILED;
+    }
+
+    strcpy(wc->host, host);
+    strcpy(wc->port, port);
+    wc->handler = handler;
+    wc->user_data = user_data;
+
+    w = worker_pool_pick(pool);
+    wc->worker = w;
+    __atomic_fetch_add(&w->load, 1, __ATOMIC_RELAXED);
+
+    pthread_mutex_lock(&w->lock);
+    *w->queue_tail = wc;
+    w->queue_tail = &wc->next;
+    pthread_mutex_unlock(&w->lock);
+
+    event_loop_wake(&w->loop);
+
+    return WORKER_POOL_OK;
+}
+
+/* mbedtls_ssl_read() that caches TLS 1.3 tickets */
+int worker_pool_read(event_conn_t *conn, unsigned char *buf, size_t len)
+{
+    worker_pool_conn_t *wc = (worker_pool_conn_t *)conn;
+    int ret;
+
+    for (;;) {
+        ret = mbedtls_ssl_read(&conn->ssl, buf, len);
+#if defined(MBEDTLS_ERR_SSL_RECEIVED_NEW_SESSION_TICKET)
+        if (ret == MBEDTLS_ERR_SSL_RECEIVED_NEW_SESSION_TICKET) {
+            if (wc->worker->pool->sessions != NULL) {
+                session_cache_store(wc->worker->pool->sessions, wc->host, wc->port,
+                                    &conn->ssl);
+            }
+            continue;
+        }
+#endif
+        return ret;
+    }
+}
+
+/* Owning worker of a pool connection */
+unsigned int worker_pool_worker_of(const event_conn_t *conn)
+{
+    return ((const worker_pool_conn_t *)conn)->worker->index;
+}
+
+/* Counters of one worker */
+int worker_pool_stats(const worker_pool_t *pool, unsigned int index, worker_pool_stats_t *out)
+{
+    const worker_pool_worker_t *w;
+
+    if (pool == NULL || out == NULL || index >= pool->count) {
+        return WORKER_POOL_ERR_INVALID_PARAM;
+    }
+
+    w = &pool->workers[index];
+    out->started = __atomic_load_n(&w->stats.started, __ATOMIC_RELAXED);
+    out->established = __atomic_load_n(&w->stats.established, __ATOMIC_RELAXED);
+    out->failed = __atomic_load_n(&w->stats.failed, __ATOMIC_RELAXED);
+    out->closed = __atomic_load_n(&w->stats.closed, __ATOMIC_RELAXED);
+    out->wakeups = __atomic_load_n(&w->stats.wakeups, __ATOMIC_RELAXED);
+    out->rounds = __atomic_load_n(&w->stats.rounds, __ATOMIC_RELAXED);
+    out->active = __atomic_load_n(&w->load, __ATOMIC_RELAXED);
+
+    return WORKER_POOL_OK;
+}
+
+/* Sum over all workers */
+void worker_pool_totals(const worker_pool_t *pool, worker_pool_stats_t *out)
+{
+    worker_pool_stats_t s;
+    uint64_t *sum = (uint64_t *)out;
+    const uint64_t *add = (const uint64_t *)&s;
+    unsigned int i;
+    size_t j;
+
+    if (out == NULL) {
+        return;
+    }
+
+    memset(out, 0, sizeof(*out));
+
+    for (i = 0; pool != NULL && i < pool->count; i++) {
+        worker_pool_stats(pool, i, &s);
+        for (j = 0; j < sizeof(s) / sizeof(uint64_t); j++) {
+            sum[j] += add[j];
+        }
+    }
+}
+
+/* Close everything and join the threads */
+void worker_pool_stop(worker_pool_t *pool)
+{
+    unsigned int i;
+
+    if (pool == NULL || pool->workers == NULL) {
+        return;
+    }
+
+    pool->running = 0;
+
+    for (i = 0; i < pool->count; i++) {
+        worker_pool_worker_t *w = &pool->workers[i];
+
+        if (w->running) {
+            __atomic_store_n(&w->stopping, 1, __ATOMIC_RELEASE);
+            event_loop_wake(&w->loop);
+        }
+    }
+
+    for (i = 0; i < pool->count; i++) {
+        worker_pool_worker_t *w = &pool->workers[i];
+
+        if (w->running) {
+            pthread_join(w->thread, NULL);
+            w->running = 0;
+        }
+    }
+}
+
+/* Release the pool */
+void worker_pool_free(worker_pool_t *pool)
+{
+    worker_pool_conn_t *wc;
+    unsigned int i;
+
+    if (pool == NULL || pool->workers == NULL) {
+        return;
+    }
+
+    worker_pool_stop(pool);
+
+    for (i = 0; i < pool->count; i++) {
+        worker_pool_worker_t *w = &pool->workers[i];
+
+        while ((wc = w->queue) != NULL) {
+            w->queue = wc->next;
+            free(wc);
+        }
+
+        resolver_free(&w->resolver);
+        event_loop_free(&w->loop);
+        pthread_mutex_destroy(&w->lock);
+    }
+
+    free(pool->workers);
+    pool->workers = NULL;
+    pool->count = 0;
+}
@@ -0,0 +1,139 @@
+/*
+ * Worker pool
+ * Thread-per-core runtime: each worker thread owns an event loop, a
+ * resolver and its connections, while all workers share one read-only
+ * mbedtls_ssl_config (with its CA chain) and one session_cache_t for
+ * resumption. worker_pool_connect() may be called from any thread; it
+ * hands the connection to the least loaded worker, and that worker's
+ * thread runs every callback of the connection.
+ *
+ * The shared configuration must be complete before worker_pool_start()
+ * and everything it calls back into must be thread safe:
+ * custom_rng_random() keeps one DRBG per thread and qualifies,
+ * mbedtls_ctr_drbg_random() on a single context does not, and a debug
+ * callback must not keep unlocked state. mbedtls itself needs
+ * MBEDTLS_THREADING_C for its PSA key store (TUYA_TLS_THREADING in
+ * vendor/mbedtls.cmake).
+ */
+
+#ifndef WORKER_POOL_H
+#define WORKER_POOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "event_loop.h"
+#include "resolver.h"
+#include "session_cache.h"
+#include "conn_metrics.h"
+#include "transport_tcp.h"
+#include "mbedtls/ssl.h"
+
+/* Error codes */
+#define WORKER_POOL_OK                      0
+#define WORKER_POOL_ERR_INVALID_PARAM      -1
+#define WORKER_POOL_ERR_ALLOC_FAILED       -2
+#define WORKER_POOL_ERR_LOOP_FAILED        -3
+#define WORKER_POOL_ERR_THREAD_FAILED      -4
+#define WORKER_POOL_ERR_STOPPED            -5
+#define WORKER_POOL_ERR_RESOLVER_FAILED    -6
+
+/* Upper bound for the worker count */
+#define WORKER_POOL_MAX_WORKERS            64
+
+#define WORKER_POOL_HOST_LEN               256
+#define WORKER_POOL_PORT_LEN               8
+
+/* Callbacks of a pool connection; they run on the owning worker's thread
+ * and receive the event_conn_t of the connection, whose user_data is the
+ * pointer given to worker_pool_connect(). The pool frees the connection
+ * after on_close returns. */
+typedef struct {
+    event_conn_connected_cb on_connected;
+    event_conn_io_cb on_readable;
+    event_conn_io_cb on_writable;
+    event_conn_close_cb on_close;
+} worker_pool_handler_t;
+
+/* Counters of one worker; only uint64_t members so they can be summed */
+typedef struct {
+    uint64_t started;                   /* Connections taken from the queue */
+    uint64_t established;               /* TLS handshakes completed */
+    uint64_t failed;                    /* Closed before the handshake completed */
+    uint64_t closed;                    /* Closed after being established */
+    uint64_t wakeups;                   /* Queue hand-offs from other threads */
+    uint64_t rounds;                    /* Event loop rounds */
+    uint64_t active;                    /* Connections queued or open (a gauge) */
+} worker_pool_stats_t;
+
+typedef struct worker_pool worker_pool_t;
+typedef struct worker_pool_conn worker_pool_conn_t;
+
+/* One worker thread and everything it owns */
+typedef struct {
+    worker_pool_t *pool;
+    unsigned int index;
+    int cpu;                            /* CPU the thread is pinned to, -1 = none */
+    pthread_t thread;
+    int running;                        /* Thread created */
+    volatile int stopping;              /* Set by worker_pool_stop() */
+    event_loop_t loop;
+    resolver_t resolver;
+    pthread_mutex_t lock;               /* Guards queue */
+    worker_pool_conn_t *queue;          /* Submitted, not started yet */
+    worker_pool_conn_t **queue_tail;
+    worker_pool_conn_t *live;           /* Started, not closed */
+    worker_pool_conn_t *closed;         /* Freed after the current round */
+    uint64_t load;                      /* Queued + open, updated atomically */
+    worker_pool_stats_t stats;          /* Written by the worker thread only */
+} worker_pool_worker_t;
+
+/* Pool context; set the optional fields between init and start */
+struct worker_pool {
+    const mbedtls_ssl_config *conf;     /* Shared, read-only */
+    session_cache_t *sessions;          /* Shared ticket store, NULL = no resumption */
+    conn_metrics_registry_t *metrics;   /* Optional, shared */
+    transport_tcp_opts_t tcp_opts;      /* Socket options for new connections */
+    uint32_t idle_timeout_ms;           /* Applied once established, 0 = none */
+    int pin;                            /* Pin worker i to the i-th allowed CPU */
+    worker_pool_worker_t *workers;
+    unsigned int count;
+    unsigned int next;                  /* Where the least-loaded scan starts */
+    volatile int running;               /* Between start and stop */
+};
+
+/* Initialize a pool of worker threads (0 = one per CPU the process may
+ * run on) sharing conf and sessions (may be NULL); no thread runs yet */
+int worker_pool_init(worker_pool_t *pool, const mbedtls_ssl_config *conf,
+                     session_cache_t *sessions, unsigned int workers);
+
+/* Start the worker threads */
+int worker_pool_start(worker_pool_t *pool);
+
+/* Open a TLS connection to host:port (numeric port) on the least loaded
+ * worker; callable from any thread. handler must stay valid until the
+ * connection is closed. */
+int worker_pool_connect(worker_pool_t *pool, const char *host, const char *port,
+                        const worker_pool_handler_t *handler, void *user_data);
+
+/* mbedtls_ssl_read() for pool connections: TLS 1.3 session tickets are put
+ * into the shared cache instead of being returned */
+int worker_pool_read(event_conn_t *conn, unsigned char *buf, size_t len);
+
+/* Index of the worker that owns a pool connection */
+unsigned int worker_pool_worker_of(const event_conn_t *conn);
+
+/* Snapshot of the counters of one worker */
+int worker_pool_stats(const worker_pool_t *pool, unsigned int index, worker_pool_stats_t *out);
+
+/* Sum of the counters of all workers */
+void worker_pool_totals(const worker_pool_t *pool, worker_pool_stats_t *out);
+
+/* Close every connection (on_close reason 0) and join the threads;
+ * connections still queued are dropped without callbacks */
+void worker_pool_stop(worker_pool_t *pool);
+
+/* Stop if needed and release the pool */
+void worker_pool_free(worker_pool_t *pool);
+
+#endif /* WORKER_POOL_H */
@@ -0,0 +1,713 @@
+/*
+ * WebSocket client implementation
+ */
+
+#include "ws_client.h"
+#include <string.h>
+
+/* Raw read from the session: TLS plaintext or socket bytes */
+static int ws_client_recv_raw(void *ctx, unsigned char *buf, size_t len)
+{
+    ws_client_t *client = (ws_client_t *) ctx;
+    int ret;
+
+    if (!client->tls) {
+        return transport_tcp_recv(&client->transport, buf, len);
+    }
+
+    for (;;) {
+        ret = mbedtls_ssl_read(&client->ssl, buf, len);
+#if defined(MBEDTLS_ERR_SSL_RECEIVED_NEW_SESSION_TICKET)
+        /* TLS 1.3 ticket signalled in between application data */
+        if (ret == MBEDTLS_ERR_SSL_RECEIVED_NEW_SESSION_TICKET) {
+            continue;
+        }
+#endif
+        break;
+    }
+
+    if (ret == MBEDTLS_ERR_SSL_PEER_CLOSE_NOTIFY) {
+        return 0;
+    }
+
+    return ret;
+}
+
+/* Raw write of a whole buffer (blocking sockets) */
+static int ws_client_write_all(ws_client_t *client, const unsigned char *buf, size_t len)
+{
+    int ret;
+
+    while (len > 0) {
+        if (client->tls) {
+            ret = mbedtls_ssl_write(&client->ssl, buf, len);
+        } else {
+            ret = transport_tcp_send(&client->transport, buf, len);
+        }
+
+        if (ret == MBEDTLS_ERR_SSL_WANT_READ || ret == MBEDTLS_ERR_SSL_WANT_WRITE) {
+            continue;
+        }
+        if (ret <= 0) {
+            return WS_CLIENT_ERR_SEND_FAILED;
+        }
+
+        buf += ret;
+        len -= (size_t) ret;
+    }
+
+    return WS_CLIENT_OK;
+}
+
+/* A data frame of a compressed message (control frames may interleave) */
+static int ws_client_inflating(const ws_client_t *client, websocket_parser *parser)
+{
+    int opcode = websocket_parser_get_opcode(parser);
+
+    return client->rx_compressed &&
+           (opcode == WS_OP_CONTINUE || opcode == WS_OP_TEXT || opcode == WS_OP_BINARY);
+}
+
+/* Count incoming frames, then hand over to the application callback */
+static int ws_client_on_frame_header(websocket_parser *parser)
+{
+    ws_client_t *client = (ws_client_t *) parser->data;
+    int opcode = websocket_parser_get_opcode(parser);
+
+    CONN_METRICS_FRAME(client->metrics, frames_in, opcode);
+
+    if (client->deflate.enabled) {
+        /* RSV1 is only valid on the first frame of a data message */
+        if (opcode == WS_OP_TEXT || opcode == WS_OP_BINARY) {
+            client->rx_compressed = client->rx_rsv1;
+        } else if (client->rx_rsv1) {
+            return 1;
+        }
+
+        /* Servers never mask; inflating masked bytes would be garbage */
+        if (ws_client_inflating(client, parser) && websocket_parser_has_mask(parser)) {
+            return 1;
+        }
+    }
+
+    if (client->settings.on_frame_header != NULL) {
+        return client->settings.on_frame_header(parser);
+    }
+
+    return 0;
+}
+
+/* Decompressed data goes to the application as if it had been received */
+static int ws_client_inflated(void *arg, const unsigned char *data, size_t len)
+{
+    websocket_parser *parser = (websocket_parser *) arg;
+    ws_client_t *client = (ws_client_t *) parser->data;
+
+    if (client->settings.on_frame_body != NULL) {
+        return client->settings.on_frame_body(parser, (const char *) data, len);
+    }
+
+    return 0;
+}
+
+/* Payload of a frame: decompress it if it belongs to a compressed message */
+static int ws_client_on_frame_body(websocket_parser *parser, const char *data, size_t len)
+{
+    ws_client_t *client = (ws_client_t *) parser->data;
+
+    if (ws_client_inflating(client, parser)) {
+        return ws_deflate_inflate(&client->deflate, data, len, 0,
+                                  ws_client_inflated, parser) != WS_DEFLATE_OK;
+    }
+
+    if (client->settings.on_frame_body != NULL) {
+        return client->settings.on_frame_body(parser, data, len);
+    }
+
+    return 0;
+}
+
+/* End of a frame: the last one of a compressed message flushes the inflater */
+static int ws_client_on_frame_end(websocket_parser *parser)
+{
+    ws_client_t *client = (ws_client_t *) parser->data;
+
+    if (ws_client_inflating(client, parser) && websocket_parser_has_final(parser)) {
+        if (ws_deflate_inflate(&client->deflate, NULL, 0, 1,
+                               ws_client_inflated, parser) != WS_DEFLATE_OK) {
+            return 1;
+        }
+        client->rx_compressed = 0;
+    }
+
+    if (client->settings.on_frame_end != NULL) {
+        return client->settings.on_frame_end(parser);
+    }
+
+    return 0;
+}
+
+/* Run received bytes through the parser. With compression, each frame's
+ * RSV1 bit is noted before the parser reaches that frame, since
+ * websocket_parser does not keep it: the input is split at frame starts. */
+static int ws_client_execute(ws_client_t *client, const char *data, size_t len)
+{
+    ws_client_rx_frame_t *st = &client->rx_frame;
+    const unsigned char *p = (const unsigned char *) data;
+    size_t pos = 0, start = 0, n;
+    unsigned int i, ext;
+
+    if (!client->deflate.enabled) {
+        return websocket_parser_execute(&client->parser, &client->hooks, data, len) == len ?
+               WS_CLIENT_OK : WS_CLIENT_ERR_PROTOCOL;
+    }
+
+    while (pos < len) {
+        if (st->remaining > 0) {
+            n = len - pos < st->remaining ? len - pos : (size_t) st->remaining;
+            st->remaining -= n;
+            pos += n;
+            continue;
+        }
+
+        if (st->header_len == 0) {
+            /* First byte of a frame: finish the previous one first */
+            if (pos > start &&
+                websocket_parser_execute(&client->parser, &client->hooks,
+                                         data + start, pos - start) != pos - start) {
+                return WS_CLIENT_ERR_PROTOCOL;
+            }
+            start = pos;
+            client->rx_rsv1 = (p[pos] & WS_FRAME_RSV1) != 0;
+            st->need = 2;
+        }
+
+        st->header[st->header_len++] = p[pos++];
+
+        if (st->header_len == 2) {
+            ext = st->header[1] & 0x7F;
+            st->need = (uint8_t)(2 + (ext == 126 ? 2 : ext == 127 ? 8 : 0) +
+                                 ((st->header[1] & 0x80) ? 4 : 0));
+        }
+
+        if (st->header_len == st->need) {
+            ext = st->header[1] & 0x7F;
+            if (ext < 126) {
+                st->remaining = ext;
+            } else {
+                st->remaining = 0;
+                for (i = 0; i < (ext == 126 ? 2u : 8u); i++) {
+                    st->remaining = (st->remaining << 8) | st->header[2 + i];
+                }
+            }
+            st->header_len = 0;
+        }
+    }
+
+    if (len > start &&
+        websocket_parser_execute(&client->parser, &client->hooks,
+                                 data + start, len - start) != len - start) {
+        return WS_CLIENT_ERR_PROTOCOL;
+    }
+
+    return WS_CLIENT_OK;
+}
+
+/* Initialize a client */
+int ws_client_init(ws_client_t *client, const mbedtls_ssl_config *conf,
+                   ws_frame_pool_t *pool, const websocket_parser_settings *settings,
+                   void *user_data)
+{
+    if (client == NULL || pool == NULL || settings == NULL) {
+        return WS_CLIENT_ERR_INVALID_PARAM;
+    }
+
+    memset(client, 0, sizeof(*client));
+    transport_tcp_init(&client->transport);
+    mbedtls_ssl_init(&client->ssl);
+
+    if (conf != NULL) {
+        if (mbedtls_ssl_setup(&client->ssl, conf) != 0) {
+            mbedtls_ssl_free(&client->ssl);
+            return WS_CLIENT_ERR_SSL_SETUP_FAILED;
+        }
+        mbedtls_ssl_set_bio(&client->ssl, &client->transport,
+                            transport_tcp_send, transport_tcp_recv, NULL);
+        client->tls = 1;
+    }
+
+    client->pool = pool;
+    client->queue_limit = WS_CLIENT_QUEUE_BYTES;
+    client->settings = *settings;
+    client->hooks = *settings;
+    client->user_data = user_data;
+    websocket_parser_init(&client->parser);
+    client->parser.data = client;
+
+    return WS_CLIENT_OK;
+}
+
+/* HTTP upgrade on the connected (and secured) transport */
+static int ws_client_upgrade(ws_client_t *client, const char *host, const char *path,
+                             const char *auth_token)
+{
+    char offer[WS_DEFLATE_OFFER_LEN];
+    int ret;
+
+    if (ws_handshake_init(&client->handshake) != WS_HANDSHAKE_OK) {
+        return WS_CLIENT_ERR_HANDSHAKE_FAILED;
+    }
+
+    if (client->deflate_pool != NULL) {
+        ws_deflate_init(&client->deflate, client->deflate_pool, client->metrics,
+                        client->queue_limit);
+        if (ws_deflate_offer(client->deflate_pool, offer, sizeof(offer)) < 0) {
+            return WS_CLIENT_ERR_INVALID_PARAM;
+        }
+        client->handshake.offer = offer;
+    }
+
+    ret = ws_handshake_build_request(&client->handshake, (char *) client->tx,
+                                     sizeof(client->tx),
+                                     client->host_header ? client->host_header : host,
+                                     path, auth_token);
+    client->handshake.offer = NULL;
+    if (ret < 0) {
+        return WS_CLIENT_ERR_INVALID_PARAM;
+    }
+
+    if (ws_client_write_all(client, client->tx, (size_t) ret) != WS_CLIENT_OK) {
+        return WS_CLIENT_ERR_SEND_FAILED;
+    }
+
+    do {
+        ret = ws_handshake_read(&client->handshake, ws_client_recv_raw, client);
+    } while (ret == WS_HANDSHAKE_IN_PROGRESS);
+
+    if (ret != WS_HANDSHAKE_OK) {
+        return WS_CLIENT_ERR_HANDSHAKE_FAILED;
+    }
+
+    /* An extension we did not offer, or a bad answer, fails the connection */
+    if (client->handshake.extensions_len > 0) {
+        if (client->deflate_pool == NULL ||
+            ws_deflate_accept(&client->deflate, client->handshake.extensions,
+                              client->handshake.extensions_len) != WS_DEFLATE_OK) {
+            return WS_CLIENT_ERR_HANDSHAKE_FAILED;
+        }
+        client->hooks.on_frame_header = ws_client_on_frame_header;
+        client->hooks.on_frame_body = ws_client_on_frame_body;
+        client->hooks.on_frame_end = ws_client_on_frame_end;
+    }
+
+    return WS_CLIENT_OK;
+}
+
+/* Connect, handshake and upgrade */
+int ws_client_connect(ws_client_t *client, const char *host, const char *port,
+                      const char *path, const char *auth_token)
+{
+    const char *early;
+    size_t early_len;
+    int ret;
+
+    if (client == NULL || host == NULL || port == NULL || path == NULL) {
+        return WS_CLIENT_ERR_INVALID_PARAM;
+    }
+
+    /* Frames are only counted when someone is looking */
+    client->transport.metrics = client->metrics;
+    client->transport.resolver = client->resolver;
+    if (client->metrics != NULL) {
+        client->metrics->tls = client->tls;
+        client->hooks.on_frame_header = ws_client_on_frame_header;
+    }
+
+    if (transport_tcp_connect(&client->transport, host, port) != TRANSPORT_TCP_OK) {
+        return WS_CLIENT_ERR_CONNECT_FAILED;
+    }
+
+    if (client->tls) {
+        if (mbedtls_ssl_set_hostname(&client->ssl, host) != 0) {
+            return WS_CLIENT_ERR_SSL_SETUP_FAILED;
+        }
+
+        conn_metrics_phase_begin(client->metrics, CONN_METRICS_PHASE_TLS_HANDSHAKE);
+        do {
+            ret = mbedtls_ssl_handshake(&client->ssl);
+        } while (ret == MBEDTLS_ERR_SSL_WANT_READ || ret == MBEDTLS_ERR_SSL_WANT_WRITE);
+
+        if (ret != 0) {
+            conn_metrics_phase_fail(client->metrics, CONN_METRICS_PHASE_TLS_HANDSHAKE);
+            return WS_CLIENT_ERR_HANDSHAKE_FAILED;
+        }
+        conn_metrics_phase_end(client->metrics, CONN_METRICS_PHASE_TLS_HANDSHAKE);
+    }
+
+    conn_metrics_phase_begin(client->metrics, CONN_METRICS_PHASE_WS_UPGRADE);
+    ret = ws_client_upgrade(client, host, path, auth_token);
+    if (ret != WS_CLIENT_OK) {
+        conn_metrics_phase_fail(client->metrics, CONN_METRICS_PHASE_WS_UPGRADE);
+        return ret;
+    }
+    conn_metrics_phase_end(client->metrics, CONN_METRICS_PHASE_WS_UPGRADE);
+    client->open = 1;
+
+    /* Frames the server sent right behind the 101 response */
+    early = ws_handshake_leftover(&client->handshake, &early_len);
+    if (early_len > 0 && ws_client_execute(client, early, early_len) != WS_CLIENT_OK) {
+        return WS_CLIENT_ERR_PROTOCOL;
+    }
+
+    return WS_CLIENT_OK;
+}
+
+/* Queued frame i, counted from the oldest */
+static ws_frame_t *ws_client_queued(ws_client_t *client, size_t i)
+{
+    return &client->queue[(client->queue_head + i) % WS_CLIENT_QUEUE_FRAMES];
+}
+
+/* Drop the oldest queued frame (sent, or copied into tx) */
+static void ws_client_retire(ws_client_t *client)
+{
+    ws_frame_t *frame = ws_client_queued(client, 0);
+
+    client->queue_bytes -= frame->header_len + frame->payload_len;
+    ws_frame_free(frame);
+    client->queue_head = (client->queue_head + 1) % WS_CLIENT_QUEUE_FRAMES;
+    client->queue_count--;
+
+    /* No queued frame points into the compression buffer any more */
+    if (client->queue_count == 0) {
+        ws_deflate_release_buf(&client->deflate);
+    }
+}
+
+/* Abandon everything pending after a failed write */
+static int ws_client_send_failed(ws_client_t *client)
+{
+    while (client->queue_count > 0) {
+        ws_client_retire(client);
+    }
+
+    client->tx_len = 0;
+    client->tx_sent = 0;
+    client->sending = 0;
+
+    return WS_CLIENT_ERR_SEND_FAILED;
+}
+
+/* Plain socket: the queued frames, header and masked chunks, in one sendmsg() */
+static int ws_client_flush_plain(ws_client_t *client)
+{
+    struct iovec iov[WS_CLIENT_QUEUE_FRAMES * 2];
+    size_t span[WS_CLIENT_QUEUE_FRAMES];
+    size_t frames, i, n, sent;
+    ws_frame_t *frame;
+    int iovcnt, ret, k;
+
+    while (client->queue_count > 0) {
+        iovcnt = 0;
+
+        for (frames = 0; frames < client->queue_count; frames++) {
+            frame = ws_client_queued(client, frames);
+
+            ret = ws_frame_iov(frame, iov + iovcnt);
+            if (ret < 0) {
+                /* Pool empty: send what is gathered, or give up */
+                if (frames == 0) {
+                    return ws_client_send_failed(client);
+                }
+                break;
+            }
+
+            span[frames] = 0;
+            for (k = 0; k < ret; k++) {
+                span[frames] += iov[iovcnt + k].iov_len;
+            }
+            iovcnt += ret;
+
+            /* Only one chunk of a long payload is masked at a time, and
+             * the next frame must not overtake the rest of it */
+            if (span[frames] < ws_frame_pending(frame)) {
+                frames++;
+                break;
+            }
+        }
+
+        ret = transport_tcp_sendv(&client->transport, iov, iovcnt);
+
+        if (ret == MBEDTLS_ERR_SSL_WANT_WRITE) {
+            return WS_CLIENT_IN_PROGRESS;
+        }
+
+        if (ret < 0) {
+            return ws_client_send_failed(client);
+        }
+
+        client->queue_stats.writes++;
+        if (frames > 1) {
+            client->queue_stats.batched++;
+        }
+
+        sent = (size_t) ret;
+        for (i = 0; i < frames && sent > 0; i++) {
+            frame = ws_client_queued(client, 0);
+            n = sent < span[i] ? sent : span[i];
+            ws_frame_consume(frame, n);
+            sent -= n;
+            if (!ws_frame_done(frame)) {
+                break;
+            }
+            ws_client_retire(client);
+        }
+    }
+
+    client->sending = 0;
+
+    return WS_CLIENT_OK;
+}
+
+/* TLS: pack queued frames into whole records so small frames share one */
+static int ws_client_flush_tls(ws_client_t *client)
+{
+    ws_frame_t *frame;
+    size_t record, frames;
+    int ret;
+
+    ret = mbedtls_ssl_get_max_out_record_payload(&client->ssl);
+    record = (ret <= 0 || (size_t) ret > sizeof(client->tx)) ? sizeof(client->tx)
+                                                            : (size_t) ret;
+
+    for (;;) {
+        if (client->tx_sent == client->tx_len) {
+            client->tx_len = 0;
+            client->tx_sent = 0;
+
+            /* A frame is retired once masked into tx; its payload is free */
+            for (frames = 0; client->queue_count > 0 && client->tx_len < record; frames++) {
+                frame = ws_client_queued(client, 0);
+                client->tx_len += ws_frame_fill(frame, client->tx + client->tx_len,
+                                                record - client->tx_len);
+                if (!ws_frame_done(frame)) {
+                    frames++;
+                    break;
+                }
+                ws_client_retire(client);
+            }
+
+            if (client->tx_len == 0) {
+                client->sending = 0;
+                return WS_CLIENT_OK;
+            }
+            if (frames > 1) {
+                client->queue_stats.batched++;
+            }
+        }
+
+        /* On WANT_WRITE mbedtls expects the same buffer again, which tx keeps */
+        ret = mbedtls_ssl_write(&client->ssl, client->tx + client->tx_sent,
+                                client->tx_len - client->tx_sent);
+
+        if (ret == MBEDTLS_ERR_SSL_WANT_READ || ret == MBEDTLS_ERR_SSL_WANT_WRITE) {
+            return WS_CLIENT_IN_PROGRESS;
+        }
+
+        if (ret < 0) {
+            return ws_client_send_failed(client);
+        }
+
+        client->queue_stats.writes++;
+        client->tx_sent += (size_t) ret;
+    }
+}
+
+/* Queue a frame */
+int ws_client_queue(ws_client_t *client, int opcode, const void *payload, size_t len)
+{
+    return ws_client_queue_fragment(client, opcode, 1, payload, len);
+}
+
+/* Queue one fragment */
+int ws_client_queue_fragment(ws_client_t *client, int opcode, int fin,
+                             const void *payload, size_t len)
+{
+    const unsigned char *deflated;
+    ws_frame_t *frame;
+    size_t wire, deflated_len;
+    int ret;
+
+    if (client == NULL || !client->open) {
+        return WS_CLIENT_ERR_INVALID_PARAM;
+    }
+
+    /* Backpressure: the caller has to flush before queueing more */
+    if (client->queue_count == WS_CLIENT_QUEUE_FRAMES ||
+        (client->queue_count > 0 && client->queue_bytes + len > client->queue_limit)) {
+        client->queue_stats.refused++;
+        return WS_CLIENT_ERR_BUSY;
+    }
+
+    /* Whole data messages above the threshold go out compressed */
+    if (client->deflate.enabled && (opcode == WS_FRAME_OP_TEXT || opcode == WS_FRAME_OP_BINARY)) {
+        ret = WS_DEFLATE_ERR_INVALID_PARAM;
+        if (fin && len > 0 && len >= client->deflate_pool->conf.threshold &&
+            client->deflate.client_bits != 0) {
+            ret = ws_deflate_compress(&client->deflate, payload, len, &deflated, &deflated_len);
+        }
+
+        if (ret == WS_DEFLATE_OK) {
+            payload = deflated;
+            len = deflated_len;
+            opcode |= WS_FRAME_RSV1;
+        } else if (ret == WS_DEFLATE_ERR_NO_SPACE && client->queue_count > 0) {
+            /* Compression buffer is freed by the flush */
+            client->queue_stats.refused++;
+            return WS_CLIENT_ERR_BUSY;
+        } else if (ret == WS_DEFLATE_ERR_DATA) {
+            /* The compressor may have consumed part of it; the peer's copy
+             * of the context is out of step now */
+            return WS_CLIENT_ERR_SEND_FAILED;
+        } else {
+            client->deflate.stats.skipped++;
+        }
+    }
+
+    frame = ws_client_queued(client, client->queue_count);
+    if (ws_frame_init(frame, client->pool, opcode, fin, payload, len) != WS_FRAME_OK) {
+        return WS_CLIENT_ERR_SEND_FAILED;
+    }
+
+    CONN_METRICS_FRAME(client->metrics, frames_out, opcode);
+
+    wire = frame->header_len + frame->payload_len;
+    client->queue_count++;
+    client->queue_bytes += wire;
+    client->sending = 1;
+
+    if (client->queue_count > client->queue_stats.hwm_frames) {
+        client->queue_stats.hwm_frames = client->queue_count;
+    }
+    if (client->queue_bytes > client->queue_stats.hwm_bytes) {
+        client->queue_stats.hwm_bytes = client->queue_bytes;
+    }
+
+    return WS_CLIENT_OK;
+}
+
+/* Queue a frame and flush */
+int ws_client_send(ws_client_t *client, int opcode, const void *payload, size_t len)
+{
+    return ws_client_send_fragment(client, opcode, 1, payload, len);
+}
+
+/* Queue one fragment and flush */
+int ws_client_send_fragment(ws_client_t *client, int opcode, int fin,
+                            const void *payload, size_t len)
+{
+    int ret = ws_client_queue_fragment(client, opcode, fin, payload, len);
+
+    if (ret != WS_CLIENT_OK) {
+        return ret;
+    }
+
+    return ws_client_flush(client);
+}
+
+/* Send the queued frames */
+int ws_client_flush(ws_client_t *client)
+{
+    if (client == NULL) {
+        return WS_CLIENT_ERR_INVALID_PARAM;
+    }
+
+    if (!client->sending) {
+        return WS_CLIENT_OK;
+    }
+
+    return client->tls ? ws_client_flush_tls(client) : ws_client_flush_plain(client);
+}
+
+/* Read and parse available data */
+int ws_client_read(ws_client_t *client)
+{
+    int ret;
+
+    if (client == NULL || !client->open) {
+        return WS_CLIENT_ERR_INVALID_PARAM;
+    }
+
+    do {
+        ret = ws_client_recv_raw(client, client->rx, sizeof(client->rx));
+
+        if (ret == MBEDTLS_ERR_SSL_WANT_READ || ret == MBEDTLS_ERR_SSL_WANT_WRITE) {
+            return WS_CLIENT_IN_PROGRESS;
+        }
+
+        if (ret == 0) {
+            return WS_CLIENT_ERR_CLOSED;
+        }
+
+        if (ret < 0) {
+            return WS_CLIENT_ERR_RECV_FAILED;
+        }
+
+        if (ws_client_execute(client, (const char *) client->rx, (size_t) ret) != WS_CLIENT_OK) {
+            return WS_CLIENT_ERR_PROTOCOL;
+        }
+
+        /* Drain records mbedtls already decrypted; poll() cannot see them */
+    } while (ws_client_pending(client) > 0);
+
+    return WS_CLIENT_OK;
+}
+
+/* Socket descriptor */
+int ws_client_fd(const ws_client_t *client)
+{
+    return client != NULL ? client->transport.fd : -1;
+}
+
+/* Decrypted bytes waiting in mbedtls */
+size_t ws_client_pending(const ws_client_t *client)
+{
+    if (client == NULL || !client->tls) {
+        return 0;
+    }
+
+    return mbedtls_ssl_get_bytes_avail(&client->ssl);
+}
+
+/* Close the connection */
+void ws_client_close(ws_client_t *client)
+{
+    if (client == NULL) {
+        return;
+    }
+
+    if (client->tls && client->open) {
+        mbedtls_ssl_close_notify(&client->ssl);
+    }
+
+    client->open = 0;
+    transport_tcp_close(&client->transport);
+}
+
+/* Release all resources */
+void ws_client_free(ws_client_t *client)
+{
+    if (client == NULL) {
+        return;
+    }
+
+    ws_client_close(client);
+
+    while (client->queue_count > 0) {
+        ws_client_retire(client);
+    }
+    client->sending = 0;
+
+    ws_deflate_free(&client->deflate);
+    mbedtls_ssl_free(&client->ssl);
+}
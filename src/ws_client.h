@@ -0,0 +1,156 @@
+/*
+ * WebSocket client
+ * ws:// or wss:// session on transport_tcp_t, optionally wrapped in
+ * mbedtls. Decrypted records go straight from mbedtls_ssl_read() into
+ * websocket_parser_execute(); outgoing frames are masked straight into a
+ * record-sized buffer so each mbedtls_ssl_write() emits full TLS records.
+ *
+ * Outgoing frames wait in a bounded queue until ws_client_flush(), which
+ * sends everything queued so far in one sendmsg() (ws://) or packs it into
+ * as few TLS records as possible (wss://). Queueing several frames before
+ * one flush corks them: a ping and a message queued in the same loop
+ * iteration leave in one segment instead of two.
+ *
+ * With a deflate pool set, permessage-deflate is offered in the Upgrade.
+ * Once the server accepts, whole data messages above the pool's threshold
+ * are compressed as they are queued, and compressed messages are
+ * decompressed before they reach the application's on_frame_body.
+ * websocket_parser drops the RSV bits, so the client tracks frame headers
+ * in the received stream itself to see RSV1.
+ */
+
+#ifndef WS_CLIENT_H
+#define WS_CLIENT_H
+
+#include <stddef.h>
+#include <websocket_parser.h>
+#include "transport_tcp.h"
+#include "ws_handshake.h"
+#include "ws_frame.h"
+#include "ws_deflate.h"
+#include "conn_metrics.h"
+#include "mbedtls/ssl.h"
+
+/* Error codes */
+#define WS_CLIENT_OK                        0
+#define WS_CLIENT_IN_PROGRESS               1
+#define WS_CLIENT_ERR_INVALID_PARAM        -1
+#define WS_CLIENT_ERR_CONNECT_FAILED       -2
+#define WS_CLIENT_ERR_SSL_SETUP_FAILED     -3
+#define WS_CLIENT_ERR_HANDSHAKE_FAILED     -4
+#define WS_CLIENT_ERR_SEND_FAILED          -5
+#define WS_CLIENT_ERR_RECV_FAILED          -6
+#define WS_CLIENT_ERR_PROTOCOL             -7
+#define WS_CLIENT_ERR_CLOSED               -8
+#define WS_CLIENT_ERR_BUSY                 -9
+
+/* One maximum size TLS record of plaintext */
+#define WS_CLIENT_BUF_SIZE                 16384
+
+/* Write queue bounds; a single frame is always accepted by an empty queue */
+#define WS_CLIENT_QUEUE_FRAMES             16
+#define WS_CLIENT_QUEUE_BYTES              (256 * 1024)
+
+/* Write queue statistics */
+typedef struct {
+    size_t hwm_frames;                      /* Most frames queued at once */
+    size_t hwm_bytes;                       /* Most wire bytes queued at once */
+    unsigned long writes;                   /* sendmsg() calls / TLS writes of flushes */
+    unsigned long batched;                  /* Writes that carried more than one frame */
+    unsigned long refused;                  /* Frames pushed back with WS_CLIENT_ERR_BUSY */
+} ws_client_queue_stats_t;
+
+/* Frame header tracker for the received stream */
+typedef struct {
+    uint64_t remaining;                     /* Payload bytes left in the current frame */
+    unsigned char header[WS_FRAME_HEADER_MAX];
+    uint8_t header_len;                     /* Header bytes seen so far */
+    uint8_t need;                           /* Header length once known */
+} ws_client_rx_frame_t;
+
+/* Client context */
+typedef struct {
+    transport_tcp_t transport;              /* TCP socket */
+    mbedtls_ssl_context ssl;                /* TLS session (wss only) */
+    int tls;                                /* Non-zero for wss:// */
+    int open;                               /* Upgrade completed */
+    const char *host_header;                /* Host header override, NULL = host */
+    ws_handshake_t handshake;               /* Upgrade request/response */
+    websocket_parser parser;                /* parser.data points to the client */
+    websocket_parser_settings settings;     /* Application frame callbacks */
+    websocket_parser_settings hooks;        /* settings with frame counting */
+    conn_metrics_t *metrics;                /* Optional, set before connecting */
+    resolver_t *resolver;                   /* Optional cached DNS, set before connecting */
+    ws_frame_pool_t *pool;                  /* Shared send buffers and mask keys */
+    ws_deflate_pool_t *deflate_pool;        /* Optional: offer permessage-deflate, set before connecting */
+    ws_deflate_t deflate;                   /* Negotiated compression state */
+    ws_client_rx_frame_t rx_frame;          /* Only tracked with compression */
+    int rx_rsv1;                            /* RSV1 of the frame being parsed */
+    int rx_compressed;                      /* Current incoming message is compressed */
+    ws_frame_t queue[WS_CLIENT_QUEUE_FRAMES];   /* Ring of frames not sent yet */
+    size_t queue_head;                      /* Oldest queued frame */
+    size_t queue_count;
+    size_t queue_bytes;                     /* Wire bytes of the queued frames */
+    size_t queue_limit;                     /* Byte bound, WS_CLIENT_QUEUE_BYTES by default */
+    ws_client_queue_stats_t queue_stats;
+    int sending;                            /* Queued frames or tx bytes still pending */
+    unsigned char tx[WS_CLIENT_BUF_SIZE];   /* Outgoing TLS record */
+    size_t tx_len;
+    size_t tx_sent;
+    unsigned char rx[WS_CLIENT_BUF_SIZE];   /* Incoming data, parsed in place */
+    void *user_data;                        /* Opaque pointer for callbacks */
+} ws_client_t;
+
+/* Initialize a client. conf selects wss:// (NULL for plain ws://); pool is
+ * shared by all clients of a thread; parser callbacks reach the client
+ * through parser->data. */
+int ws_client_init(ws_client_t *client, const mbedtls_ssl_config *conf,
+                   ws_frame_pool_t *pool, const websocket_parser_settings *settings,
+                   void *user_data);
+
+/* Connect, run the TLS handshake (wss) and the HTTP Upgrade. Blocking;
+ * frames that arrived with the 101 response are dispatched before return.
+ * host is used for TCP, SNI and, unless host_header is set, the Host header. */
+int ws_client_connect(ws_client_t *client, const char *host, const char *port,
+                      const char *path, const char *auth_token);
+
+/* Queue a frame without sending it. The payload must stay valid until the
+ * frame is sent. Returns WS_CLIENT_ERR_BUSY when the queue is full (flush,
+ * then retry). */
+int ws_client_queue(ws_client_t *client, int opcode, const void *payload, size_t len);
+
+/* Like ws_client_queue() for one fragment of a message: the first carries
+ * the data opcode, the rest WS_FRAME_OP_CONTINUE, the last has fin set */
+int ws_client_queue_fragment(ws_client_t *client, int opcode, int fin,
+                             const void *payload, size_t len);
+
+/* Queue a frame and flush. Returns WS_CLIENT_OK once everything queued is
+ * sent, WS_CLIENT_IN_PROGRESS if a non-blocking socket is full (finish
+ * with ws_client_flush()), or WS_CLIENT_ERR_BUSY when the queue is full. */
+int ws_client_send(ws_client_t *client, int opcode, const void *payload, size_t len);
+
+/* ws_client_queue_fragment() + ws_client_flush() */
+int ws_client_send_fragment(ws_client_t *client, int opcode, int fin,
+                            const void *payload, size_t len);
+
+/* Send the queued frames, batched; returns like ws_client_send() */
+int ws_client_flush(ws_client_t *client);
+
+/* Read what is available and run it through the parser. Returns
+ * WS_CLIENT_OK after dispatching data, WS_CLIENT_IN_PROGRESS when a
+ * non-blocking socket has nothing, WS_CLIENT_ERR_CLOSED on EOF. */
+int ws_client_read(ws_client_t *client);
+
+/* Socket descriptor for select()/poll()/epoll */
+int ws_client_fd(const ws_client_t *client);
+
+/* Bytes already decrypted and waiting (wss); poll() will not report them */
+size_t ws_client_pending(const ws_client_t *client);
+
+/* Send close_notify (wss) and close the socket */
+void ws_client_close(ws_client_t *client);
+
+/* Release all resources */
+void ws_client_free(ws_client_t *client);
+
+#endif /* WS_CLIENT_H */
@@ -0,0 +1,564 @@
+/*
+ * permessage-deflate implementation
+ * Raw deflate streams (negative windowBits). A message is compressed with
+ * Z_SYNC_FLUSH and loses the trailing 00 00 ff ff, which the receiver
+ * appends again before the last inflate() (RFC 7692 section 7.2).
+ */
+
+#include "ws_deflate.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <zlib.h>
+
+#define WS_DEFLATE_NAME        "permessage-deflate"
+
+/* zlib refuses an 8 bit window for raw deflate */
+#define WS_DEFLATE_MIN_BITS    9
+#define WS_DEFLATE_MAX_BITS    15
+
+/* Sync flush marker: empty stored block, plus its header byte */
+#define WS_DEFLATE_FLUSH_SLACK 6
+
+/* Pooled zlib stream */
+struct ws_deflate_stream {
+    z_stream zs;
+    int bits;                           /* windowBits it was set up with */
+    struct ws_deflate_stream *next;     /* Idle list */
+};
+
+static const unsigned char ws_deflate_tail[4] = { 0x00, 0x00, 0xff, 0xff };
+
+static uint64_t ws_deflate_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/* Set up a stream for inflate or deflate with the given window */
+static int ws_deflate_stream_setup(const ws_deflate_pool_t *pool, ws_deflate_stream_t *s,
+                                   int inflating, int bits)
+{
+    memset(&s->zs, 0, sizeof(s->zs));
+    s->bits = bits;
+
+    if (inflating) {
+        return inflateInit2(&s->zs, -bits) == Z_OK ? 0 : -1;
+    }
+
+    return deflateInit2(&s->zs, pool->conf.level, Z_DEFLATED, -bits,
+                        pool->conf.mem_level, Z_DEFAULT_STRATEGY) == Z_OK ? 0 : -1;
+}
+
+static void ws_deflate_stream_end(ws_deflate_stream_t *s, int inflating)
+{
+    if (inflating) {
+        inflateEnd(&s->zs);
+    } else {
+        deflateEnd(&s->zs);
+    }
+}
+
+/* Take a reset stream with the given window, preferring an idle one */
+static ws_deflate_stream_t *ws_deflate_acquire(ws_deflate_pool_t *pool, int inflating, int bits)
+{
+    ws_deflate_stream_t **head = inflating ? &pool->idle_inflate : &pool->idle_deflate;
+    ws_deflate_stream_t **link, *s;
+
+    for (link = head; *link != NULL; link = &(*link)->next) {
+        if ((*link)->bits == bits) {
+            s = *link;
+            *link = s->next;
+            pool->idle--;
+            pool->reuses++;
+            return s;
+        }
+    }
+
+    /* Different window: set an idle stream up again rather than allocate */
+    s = *head;
+    if (s != NULL) {
+        *head = s->next;
+        pool->idle--;
+        ws_deflate_stream_end(s, inflating);
+    } else {
+        s = calloc(1, sizeof(*s));
+        if (s == NULL) {
+            return NULL;
+        }
+        pool->streams++;
+    }
+
+    if (ws_deflate_stream_setup(pool, s, inflating, bits) != 0) {
+        free(s);
+        pool->streams--;
+        return NULL;
+    }
+
+    return s;
+}
+
+/* Reset a stream and put it back on the idle list */
+static void ws_deflate_release(ws_deflate_pool_t *pool, ws_deflate_stream_t *s, int inflating)
+{
+    ws_deflate_stream_t **head = inflating ? &pool->idle_inflate : &pool->idle_deflate;
+
+    if (s == NULL) {
+        return;
+    }
+
+    if ((inflating ? inflateReset(&s->zs) : deflateReset(&s->zs)) != Z_OK) {
+        ws_deflate_stream_end(s, inflating);
+        free(s);
+        pool->streams--;
+        return;
+    }
+
+    s->next = *head;
+    *head = s;
+    pool->idle++;
+}
+
+/* Initialize a pool */
+void ws_deflate_pool_init(ws_deflate_pool_t *pool)
+{
+    if (pool == NULL) {
+        return;
+    }
+
+    memset(pool, 0, sizeof(*pool));
+    pool->conf.client_max_window_bits = WS_DEFLATE_MAX_BITS;
+    pool->conf.server_max_window_bits = WS_DEFLATE_MAX_BITS;
+    pool->conf.threshold = WS_DEFLATE_THRESHOLD;
+    pool->conf.level = WS_DEFLATE_LEVEL;
+    pool->conf.mem_level = WS_DEFLATE_MEM_LEVEL;
+}
+
+/* Release the idle streams */
+void ws_deflate_pool_free(ws_deflate_pool_t *pool)
+{
+    ws_deflate_stream_t *s;
+    int inflating;
+
+    if (pool == NULL) {
+        return;
+    }
+
+    for (inflating = 0; inflating < 2; inflating++) {
+        ws_deflate_stream_t **head = inflating ? &pool->idle_inflate : &pool->idle_deflate;
+
+        while ((s = *head) != NULL) {
+            *head = s->next;
+            ws_deflate_stream_end(s, inflating);
+            free(s);
+            pool->streams--;
+            pool->idle--;
+        }
+    }
+}
+
+/* Clamp a configured window to what zlib and the RFC allow */
+static int ws_deflate_bits(int bits)
+{
+    if (bits < WS_DEFLATE_MIN_BITS) {
+        return WS_DEFLATE_MIN_BITS;
+    }
+    if (bits > WS_DEFLATE_MAX_BITS) {
+        return WS_DEFLATE_MAX_BITS;
+    }
+
+    return bits;
+}
+
+/* Build the offer */
+int ws_deflate_offer(const ws_deflate_pool_t *pool, char *out, size_t out_len)
+{
+    const ws_deflate_config_t *conf;
+    int client_bits, server_bits, n;
+
+    if (pool == NULL || out == NULL) {
+        return WS_DEFLATE_ERR_INVALID_PARAM;
+    }
+
+    conf = &pool->conf;
+    client_bits = ws_deflate_bits(conf->client_max_window_bits);
+    server_bits = ws_deflate_bits(conf->server_max_window_bits);
+
+    /* A bare client_max_window_bits lets the server pick our window */
+    n = snprintf(out, out_len, "%s; client_max_window_bits", WS_DEFLATE_NAME);
+    if (n >= 0 && client_bits < WS_DEFLATE_MAX_BITS) {
+        n += snprintf(out + n, out_len > (size_t) n ? out_len - (size_t) n : 0,
+                      "=%d", client_bits);
+    }
+    if (n >= 0 && server_bits < WS_DEFLATE_MAX_BITS) {
+        n += snprintf(out + n, out_len > (size_t) n ? out_len - (size_t) n : 0,
+                      "; server_max_window_bits=%d", server_bits);
+    }
+    if (n >= 0 && conf->client_no_context_takeover) {
+        n += snprintf(out + n, out_len > (size_t) n ? out_len - (size_t) n : 0,
+                      "; client_no_context_takeover");
+    }
+    if (n >= 0 && conf->server_no_context_takeover) {
+        n += snprintf(out + n, out_len > (size_t) n ? out_len - (size_t) n : 0,
+                      "; server_no_context_takeover");
+    }
+
+    if (n < 0 || (size_t) n >= out_len) {
+        return WS_DEFLATE_ERR_INVALID_PARAM;
+    }
+
+    return n;
+}
+
+/* Prepare a connection */
+void ws_deflate_init(ws_deflate_t *d, ws_deflate_pool_t *pool, conn_metrics_t *metrics,
+                     size_t buf_limit)
+{
+    if (d == NULL) {
+        return;
+    }
+
+    memset(d, 0, sizeof(*d));
+    d->pool = pool;
+    d->metrics = metrics;
+    d->buf_limit = buf_limit;
+}
+
+/* Window bits parameter value: 8-15, optionally quoted */
+static int ws_deflate_parse_bits(const char *value, size_t len)
+{
+    if (len >= 2 && value[0] == '"' && value[len - 1] == '"') {
+        value++;
+        len -= 2;
+    }
+
+    if (len == 1 && value[0] >= '8' && value[0] <= '9') {
+        return value[0] - '0';
+    }
+    if (len == 2 && value[0] == '1' && value[1] >= '0' && value[1] <= '5') {
+        return 10 + value[1] - '0';
+    }
+
+    return -1;
+}
+
+/* Apply the server's response */
+int ws_deflate_accept(ws_deflate_t *d, const char *value, size_t len)
+{
+    const ws_deflate_config_t *conf;
+    const char *p, *end, *semi, *eq;
+    size_t name_len, arg_len;
+    unsigned int seen = 0;
+    int client_bits, server_bits, bits, first = 1;
+
+    if (d == NULL || d->pool == NULL || value == NULL) {
+        return WS_DEFLATE_ERR_INVALID_PARAM;
+    }
+
+    /* We offered exactly one extension, so exactly one may come back */
+    if (memchr(value, ',', len) != NULL) {
+        return WS_DEFLATE_ERR_NEGOTIATION;
+    }
+
+    conf = &d->pool->conf;
+    client_bits = ws_deflate_bits(conf->client_max_window_bits);
+    server_bits = WS_DEFLATE_MAX_BITS;
+    d->client_takeover = !conf->client_no_context_takeover;
+    d->server_takeover = 1;
+
+    for (p = value, end = value + len; p < end; p = semi + 1) {
+        const char *arg = NULL;
+        unsigned int bit;
+
+        semi = memchr(p, ';', (size_t)(end - p));
+        if (semi == NULL) {
+            semi = end;
+        }
+
+        while (p < semi && (*p == ' ' || *p == '\t')) {
+            p++;
+        }
+        name_len = (size_t)(semi - p);
+        while (name_len > 0 && (p[name_len - 1] == ' ' || p[name_len - 1] == '\t')) {
+            name_len--;
+        }
+
+        eq = memchr(p, '=', name_len);
+        arg_len = 0;
+        if (eq != NULL) {
+            arg = eq + 1;
+            arg_len = name_len - (size_t)(arg - p);
+            name_len = (size_t)(eq - p);
+            while (name_len > 0 && (p[name_len - 1] == ' ' || p[name_len - 1] == '\t')) {
+                name_len--;
+            }
+            while (arg_len > 0 && (*arg == ' ' || *arg == '\t')) {
+                arg++;
+                arg_len--;
+            }
+        }
+
+        if (first) {
+            if (arg != NULL || name_len != strlen(WS_DEFLATE_NAME) ||
+                strncasecmp(p, WS_DEFLATE_NAME, name_len) != 0) {
+                return WS_DEFLATE_ERR_NEGOTIATION;
+            }
+            first = 0;
+            continue;
+        }
+
+        if (name_len == 26 && strncasecmp(p, "server_no_context_takeover", 26) == 0 && arg == NULL) {
+            bit = 1;
+            d->server_takeover = 0;
+        } else if (name_len == 26 && strncasecmp(p, "client_no_context_takeover", 26) == 0 &&
+                   arg == NULL) {
+            bit = 2;
+            d->client_takeover = 0;
+        } else if (name_len == 22 && strncasecmp(p, "server_max_window_bits", 22) == 0 &&
+                   (bits = ws_deflate_parse_bits(arg, arg_len)) > 0) {
+            /* Never more than we asked for */
+            if (bits > ws_deflate_bits(conf->server_max_window_bits)) {
+                return WS_DEFLATE_ERR_NEGOTIATION;
+            }
+            bit = 4;
+            server_bits = bits;
+        } else if (name_len == 22 && strncasecmp(p, "client_max_window_bits", 22) == 0 &&
+                   (bits = ws_deflate_parse_bits(arg, arg_len)) > 0) {
+            bit = 8;
+            if (bits < client_bits) {
+                client_bits = bits;
+            }
+        } else {
+            return WS_DEFLATE_ERR_NEGOTIATION;
+        }
+
+        if (seen & bit) {
+            return WS_DEFLATE_ERR_NEGOTIATION;
+        }
+        seen |= bit;
+    }
+
+    if (first) {
+        return WS_DEFLATE_ERR_NEGOTIATION;
+    }
+
+    /* Our compressor cannot go below 9 bits; receiving still works */
+    d->client_bits = client_bits >= WS_DEFLATE_MIN_BITS ? client_bits : 0;
+    d->server_bits = ws_deflate_bits(server_bits);
+
+    d->buf = malloc(WS_DEFLATE_BUF_SIZE);
+    if (d->buf == NULL) {
+        return WS_DEFLATE_ERR_ALLOC_FAILED;
+    }
+    d->buf_size = WS_DEFLATE_BUF_SIZE;
+    d->buf_used = 0;
+    d->enabled = 1;
+
+    return WS_DEFLATE_OK;
+}
+
+/* Compress one message */
+int ws_deflate_compress(ws_deflate_t *d, const void *in, size_t len,
+                        const unsigned char **out, size_t *out_len)
+{
+    ws_deflate_stream_t *s;
+    unsigned char *buf;
+    uint64_t start;
+    size_t need, space, n;
+    int ret;
+
+    if (d == NULL || !d->enabled || d->client_bits == 0 || in == NULL || len == 0 ||
+        out == NULL || out_len == NULL) {
+        return WS_DEFLATE_ERR_INVALID_PARAM;
+    }
+
+    s = d->tx;
+    if (s == NULL) {
+        s = ws_deflate_acquire(d->pool, 0, d->client_bits);
+        if (s == NULL) {
+            return WS_DEFLATE_ERR_ALLOC_FAILED;
+        }
+    }
+
+    /* Checked up front: a half compressed message would desync the peer */
+    need = deflateBound(&s->zs, (uLong) len) + WS_DEFLATE_FLUSH_SLACK;
+    space = d->buf_size - d->buf_used;
+    if (need > space) {
+        /* Nothing queued points into the buffer: grow it to the message */
+        ret = WS_DEFLATE_ERR_NO_SPACE;
+        if (d->buf_used == 0 && len <= d->buf_limit) {
+            buf = malloc(need);
+            ret = buf != NULL ? WS_DEFLATE_OK : WS_DEFLATE_ERR_ALLOC_FAILED;
+            if (buf != NULL) {
+                free(d->buf);
+                d->buf = buf;
+                d->buf_size = need;
+                space = need;
+            }
+        }
+        if (ret != WS_DEFLATE_OK) {
+            if (s != d->tx) {
+                ws_deflate_release(d->pool, s, 0);
+            }
+            return ret;
+        }
+    }
+
+    start = ws_deflate_now_ns();
+
+    s->zs.next_in = (Bytef *) in;
+    s->zs.avail_in = (uInt) len;
+    s->zs.next_out = d->buf + d->buf_used;
+    s->zs.avail_out = (uInt) space;
+    ret = deflate(&s->zs, Z_SYNC_FLUSH);
+    n = space - s->zs.avail_out;
+
+    if (ret != Z_OK || s->zs.avail_in != 0 || n < sizeof(ws_deflate_tail) ||
+        memcmp(d->buf + d->buf_used + n - sizeof(ws_deflate_tail), ws_deflate_tail,
+               sizeof(ws_deflate_tail)) != 0) {
+        if (s != d->tx) {
+            ws_deflate_release(d->pool, s, 0);
+        }
+        return WS_DEFLATE_ERR_DATA;
+    }
+    n -= sizeof(ws_deflate_tail);
+
+    if (d->client_takeover) {
+        d->tx = s;
+    } else {
+        ws_deflate_release(d->pool, s, 0);
+    }
+
+    *out = d->buf + d->buf_used;
+    *out_len = n;
+    d->buf_used += n;
+
+    start = ws_deflate_now_ns() - start;
+    d->stats.messages_out++;
+    d->stats.raw_out += len;
+    d->stats.wire_out += n;
+    d->stats.deflate_ns += start;
+    CONN_METRICS_ADD(d->metrics, deflate_raw_out, len);
+    CONN_METRICS_ADD(d->metrics, deflate_wire_out, n);
+    CONN_METRICS_ADD(d->metrics, deflate_ns, start);
+
+    return WS_DEFLATE_OK;
+}
+
+/* Buffer space is free again */
+void ws_deflate_release_buf(ws_deflate_t *d)
+{
+    if (d != NULL) {
+        d->buf_used = 0;
+    }
+}
+
+/* Run input through the decompressor, emitting whatever comes out */
+static int ws_deflate_feed(ws_deflate_t *d, ws_deflate_stream_t *s, const void *in,
+                           size_t len, ws_deflate_sink_cb sink, void *arg)
+{
+    unsigned char out[WS_DEFLATE_CHUNK];
+    uint64_t start;
+    size_t n;
+    int ret;
+
+    s->zs.next_in = (Bytef *) in;
+    s->zs.avail_in = (uInt) len;
+
+    do {
+        s->zs.next_out = out;
+        s->zs.avail_out = sizeof(out);
+
+        /* The sink is application code, not decompression cost */
+        start = ws_deflate_now_ns();
+        ret = inflate(&s->zs, Z_SYNC_FLUSH);
+        start = ws_deflate_now_ns() - start;
+        d->stats.inflate_ns += start;
+        CONN_METRICS_ADD(d->metrics, inflate_ns, start);
+
+        if (ret != Z_OK && ret != Z_BUF_ERROR && ret != Z_STREAM_END) {
+            return WS_DEFLATE_ERR_DATA;
+        }
+
+        n = sizeof(out) - s->zs.avail_out;
+        if (n > 0) {
+            d->stats.raw_in += n;
+            CONN_METRICS_ADD(d->metrics, deflate_raw_in, n);
+            if (sink != NULL && sink(arg, out, n) != 0) {
+                return WS_DEFLATE_ERR_DATA;
+            }
+        }
+
+        /* The peer set BFINAL; whatever follows starts a new stream */
+        if (ret == Z_STREAM_END) {
+            inflateReset(&s->zs);
+            if (s->zs.avail_in == 0) {
+                break;
+            }
+        }
+    } while (s->zs.avail_in > 0 || s->zs.avail_out == 0);
+
+    return WS_DEFLATE_OK;
+}
+
+/* Decompress a frame of a compressed message */
+int ws_deflate_inflate(ws_deflate_t *d, const void *in, size_t len, int fin,
+                       ws_deflate_sink_cb sink, void *arg)
+{
+    int ret = WS_DEFLATE_OK;
+
+    if (d == NULL || !d->enabled || (in == NULL && len > 0)) {
+        return WS_DEFLATE_ERR_INVALID_PARAM;
+    }
+
+    if (d->rx == NULL) {
+        d->rx = ws_deflate_acquire(d->pool, 1, d->server_bits);
+        if (d->rx == NULL) {
+            return WS_DEFLATE_ERR_ALLOC_FAILED;
+        }
+    }
+
+    if (len > 0) {
+        ret = ws_deflate_feed(d, d->rx, in, len, sink, arg);
+        d->stats.wire_in += len;
+        CONN_METRICS_ADD(d->metrics, deflate_wire_in, len);
+    }
+
+    if (ret == WS_DEFLATE_OK && fin) {
+        ret = ws_deflate_feed(d, d->rx, ws_deflate_tail, sizeof(ws_deflate_tail), sink, arg);
+        d->stats.messages_in++;
+
+        if (!d->server_takeover) {
+            ws_deflate_release(d->pool, d->rx, 1);
+            d->rx = NULL;
+        }
+    }
+
+    return ret;
+}
+
+/* Return the streams and release the buffer */
+void ws_deflate_free(ws_deflate_t *d)
+{
+    if (d == NULL) {
+        return;
+    }
+
+    if (d->pool != NULL) {
+        ws_deflate_release(d->pool, d->tx, 0);
+        ws_deflate_release(d->pool, d->rx, 1);
+    }
+    d->tx = NULL;
+    d->rx = NULL;
+
+    free(d->buf);
+    d->buf = NULL;
+    d->buf_size = 0;
+    d->buf_used = 0;
+    d->enabled = 0;
+}
@@ -0,0 +1,145 @@
+/*
+ * permessage-deflate (RFC 7692)
+ * Extension offer and response parsing for the Upgrade handshake, and
+ * per-message compression for ws_client_t.
+ *
+ * zlib streams come from a per-thread pool. With context takeover a
+ * connection keeps its compressor and decompressor between messages, so
+ * repeated JSON keys compress to back references; without it a stream is
+ * borrowed for one message and reset, so idle connections hold no zlib
+ * state. Streams are allocated once and recycled, never per message.
+ *
+ * Messages below the pool's threshold, fragmented messages and control
+ * frames are sent uncompressed.
+ */
+
+#ifndef WS_DEFLATE_H
+#define WS_DEFLATE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "conn_metrics.h"
+
+/* Error codes */
+#define WS_DEFLATE_OK                       0
+#define WS_DEFLATE_ERR_INVALID_PARAM       -1
+#define WS_DEFLATE_ERR_ALLOC_FAILED        -2
+#define WS_DEFLATE_ERR_NEGOTIATION         -3
+#define WS_DEFLATE_ERR_NO_SPACE            -4
+#define WS_DEFLATE_ERR_DATA                -5
+
+/* Room for the Sec-WebSocket-Extensions offer */
+#define WS_DEFLATE_OFFER_LEN               160
+
+/* Initial room for the compressed payloads of one connection waiting in
+ * its write queue. The buffer grows, while the queue is empty, to the
+ * worst-case compressed size of a buf_limit byte message (see
+ * ws_deflate_init()) and keeps that size until ws_deflate_free(). */
+#define WS_DEFLATE_BUF_SIZE                16384
+
+/* Decompressed bytes handed to the sink per call */
+#define WS_DEFLATE_CHUNK                   4096
+
+/* Defaults */
+#define WS_DEFLATE_THRESHOLD               128
+#define WS_DEFLATE_LEVEL                   6
+#define WS_DEFLATE_MEM_LEVEL               8
+
+typedef struct ws_deflate_stream ws_deflate_stream_t;
+
+/* What to offer; every connection of the pool negotiates from this */
+typedef struct {
+    int client_max_window_bits;         /* 9-15, our compressor's window */
+    int server_max_window_bits;         /* 9-15, asked of the server; 15 = no limit */
+    int client_no_context_takeover;     /* Reset our compressor per message */
+    int server_no_context_takeover;     /* Ask the server to reset per message */
+    size_t threshold;                   /* Shorter messages go out uncompressed */
+    int level;                          /* zlib level, 1-9 */
+    int mem_level;                      /* zlib memLevel, 1-9 */
+} ws_deflate_config_t;
+
+/* Per-thread zlib stream pool; set conf between init and first use */
+typedef struct {
+    ws_deflate_config_t conf;
+    ws_deflate_stream_t *idle_deflate;  /* Reset compressors */
+    ws_deflate_stream_t *idle_inflate;  /* Reset decompressors */
+    size_t streams;                     /* Allocated */
+    size_t idle;                        /* On the idle lists */
+    unsigned long reuses;               /* Streams handed out without allocating */
+} ws_deflate_pool_t;
+
+/* Compression counters of one connection */
+typedef struct {
+    uint64_t messages_out;              /* Messages sent compressed */
+    uint64_t skipped;                   /* Data messages sent uncompressed */
+    uint64_t raw_out;                   /* Their bytes before compression */
+    uint64_t wire_out;                  /* Their payload bytes on the wire */
+    uint64_t messages_in;               /* Compressed messages received */
+    uint64_t wire_in;                   /* Their payload bytes on the wire */
+    uint64_t raw_in;                    /* Their bytes after decompression */
+    uint64_t deflate_ns;                /* Time spent in deflate() */
+    uint64_t inflate_ns;                /* Time spent in inflate() */
+} ws_deflate_stats_t;
+
+/* Per-connection state */
+typedef struct {
+    ws_deflate_pool_t *pool;
+    conn_metrics_t *metrics;            /* Optional */
+    int enabled;                        /* Negotiated */
+    int client_bits;                    /* Our window, 0 = never compress */
+    int server_bits;                    /* Server's window */
+    int client_takeover;                /* Keep tx between messages */
+    int server_takeover;                /* Keep rx between messages */
+    ws_deflate_stream_t *tx;            /* Held with takeover, else borrowed */
+    ws_deflate_stream_t *rx;
+    unsigned char *buf;                 /* Allocated once enabled */
+    size_t buf_size;
+    size_t buf_used;
+    size_t buf_limit;                   /* Largest message compressed, input bytes */
+    ws_deflate_stats_t stats;
+} ws_deflate_t;
+
+/* Receives decompressed data; non-zero aborts */
+typedef int (*ws_deflate_sink_cb)(void *arg, const unsigned char *data, size_t len);
+
+/* Initialize a pool with the default configuration */
+void ws_deflate_pool_init(ws_deflate_pool_t *pool);
+
+/* Release the idle streams (connections must have been freed) */
+void ws_deflate_pool_free(ws_deflate_pool_t *pool);
+
+/* Sec-WebSocket-Extensions value offering the pool's configuration.
+ * Returns its length or WS_DEFLATE_ERR_INVALID_PARAM. */
+int ws_deflate_offer(const ws_deflate_pool_t *pool, char *out, size_t out_len);
+
+/* Prepare a connection (not enabled until ws_deflate_accept()).
+ * buf_limit is the largest message, uncompressed, that will be compressed:
+ * normally the write queue limit. Bigger ones get WS_DEFLATE_ERR_NO_SPACE
+ * and are meant to go out uncompressed. */
+void ws_deflate_init(ws_deflate_t *d, ws_deflate_pool_t *pool, conn_metrics_t *metrics,
+                     size_t buf_limit);
+
+/* Apply the server's Sec-WebSocket-Extensions response and enable
+ * compression. WS_DEFLATE_ERR_NEGOTIATION if it is not a valid answer to
+ * our offer; the connection must then be failed. */
+int ws_deflate_accept(ws_deflate_t *d, const char *value, size_t len);
+
+/* Compress one whole message into the connection buffer. out stays valid
+ * until ws_deflate_release_buf(). WS_DEFLATE_ERR_NO_SPACE (nothing
+ * consumed) when it might not fit in what is left of the buffer: retry
+ * once the write queue has drained, unless len is above buf_limit. */
+int ws_deflate_compress(ws_deflate_t *d, const void *in, size_t len,
+                        const unsigned char **out, size_t *out_len);
+
+/* Buffer space is free again (write queue empty) */
+void ws_deflate_release_buf(ws_deflate_t *d);
+
+/* Decompress one frame's payload of a compressed message, in pieces as
+ * they arrive; fin marks the end of the message */
+int ws_deflate_inflate(ws_deflate_t *d, const void *in, size_t len, int fin,
+                       ws_deflate_sink_cb sink, void *arg);
+
+/* Return the streams to the pool and release the buffer */
+void ws_deflate_free(ws_deflate_t *d);
+
+#endif /* WS_DEFLATE_H */
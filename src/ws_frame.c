@@ -0,0 +1,297 @@
+/*
+ * WebSocket frame sender implementation
+ */
+
+#include "ws_frame.h"
+#include "ws_mask.h"
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/random.h>
+
+/* Take the next mask key from the cache, refilling it from the kernel */
+static int ws_frame_next_mask(ws_frame_pool_t *pool, unsigned char mask[4])
+{
+    if (pool->mask_pos + 4 > sizeof(pool->masks)) {
+        if (getrandom(pool->masks, sizeof(pool->masks), 0) != (ssize_t) sizeof(pool->masks)) {
+            return WS_FRAME_ERR_RNG_FAILED;
+        }
+        pool->mask_pos = 0;
+    }
+
+    memcpy(mask, pool->masks + pool->mask_pos, 4);
+    pool->mask_pos += 4;
+
+    return WS_FRAME_OK;
+}
+
+/* Build the header and pick a mask key */
+static int ws_frame_prepare(ws_frame_t *frame, ws_frame_pool_t *pool, int opcode, int fin,
+                            const void *payload, size_t len)
+{
+    unsigned char *h;
+    size_t n;
+    int i;
+
+    if (frame == NULL || pool == NULL || (payload == NULL && len > 0) ||
+        opcode < 0 || (opcode & ~WS_FRAME_RSV1) > 0xF) {
+        return WS_FRAME_ERR_INVALID_PARAM;
+    }
+
+    memset(frame, 0, sizeof(*frame));
+    frame->pool = pool;
+    frame->payload = (const unsigned char *) payload;
+    frame->payload_len = len;
+
+    if (ws_frame_next_mask(pool, frame->mask) != WS_FRAME_OK) {
+        return WS_FRAME_ERR_RNG_FAILED;
+    }
+
+    h = frame->header;
+    h[0] = (unsigned char)((fin ? 0x80 : 0x00) | opcode);
+
+    if (len < 126) {
+        h[1] = (unsigned char)(0x80 | len);
+        n = 2;
+    } else if (len <= 0xFFFF) {
+        h[1] = 0x80 | 126;
+        h[2] = (unsigned char)(len >> 8);
+        h[3] = (unsigned char) len;
+        n = 4;
+    } else {
+        h[1] = 0x80 | 127;
+        for (i = 0; i < 8; i++) {
+            h[2 + i] = (unsigned char)((uint64_t) len >> (56 - 8 * i));
+        }
+        n = 10;
+    }
+
+    memcpy(h + n, frame->mask, 4);
+    frame->header_len = n + 4;
+
+    return WS_FRAME_OK;
+}
+
+/* Initialize the pool */
+void ws_frame_pool_init(ws_frame_pool_t *pool)
+{
+    size_t i;
+
+    if (pool == NULL) {
+        return;
+    }
+
+    for (i = 0; i < WS_FRAME_POOL_BUFS; i++) {
+        pool->free_list[i] = pool->bufs[i];
+    }
+    pool->free_count = WS_FRAME_POOL_BUFS;
+    pool->mask_pos = sizeof(pool->masks);
+}
+
+/* Prepare a frame masked into a pooled buffer */
+int ws_frame_init(ws_frame_t *frame, ws_frame_pool_t *pool, int opcode, int fin,
+                  const void *payload, size_t len)
+{
+    return ws_frame_prepare(frame, pool, opcode, fin, payload, len);
+}
+
+/* Prepare a frame masked in place */
+int ws_frame_init_in_place(ws_frame_t *frame, ws_frame_pool_t *pool, int opcode, int fin,
+                           void *payload, size_t len)
+{
+    int ret = ws_frame_prepare(frame, pool, opcode, fin, payload, len);
+
+    if (ret != WS_FRAME_OK) {
+        return ret;
+    }
+
+    ws_mask_apply(payload, payload, len, frame->mask, 0);
+    frame->payload_masked = len;
+    frame->in_place = 1;
+
+    return WS_FRAME_OK;
+}
+
+/* Fill iov with the pending header and payload bytes */
+int ws_frame_iov(ws_frame_t *frame, struct iovec iov[2])
+{
+    int count = 0;
+
+    if (frame == NULL) {
+        return 0;
+    }
+
+    if (frame->header_sent < frame->header_len) {
+        iov[count].iov_base = frame->header + frame->header_sent;
+        iov[count].iov_len = frame->header_len - frame->header_sent;
+        count++;
+    }
+
+    if (frame->in_place) {
+        if (frame->payload_sent < frame->payload_len) {
+            iov[count].iov_base = (void *)(frame->payload + frame->payload_sent);
+            iov[count].iov_len = frame->payload_len - frame->payload_sent;
+            count++;
+        }
+        return count;
+    }
+
+    /* Mask the next chunk once the previous one is out */
+    if (frame->chunk_sent == frame->chunk_len && frame->payload_masked < frame->payload_len) {
+        size_t n = frame->payload_len - frame->payload_masked;
+
+        if (frame->chunk == NULL) {
+            if (frame->pool->free_count == 0) {
+                return WS_FRAME_ERR_POOL_EMPTY;
+            }
+            frame->chunk = frame->pool->free_list[--frame->pool->free_count];
+        }
+
+        if (n > WS_FRAME_CHUNK_SIZE) {
+            n = WS_FRAME_CHUNK_SIZE;
+        }
+
+        ws_mask_apply(frame->chunk, frame->payload + frame->payload_masked, n,
+                      frame->mask, frame->payload_masked);
+        frame->payload_masked += n;
+        frame->chunk_len = n;
+        frame->chunk_sent = 0;
+    }
+
+    if (frame->chunk_sent < frame->chunk_len) {
+        iov[count].iov_base = frame->chunk + frame->chunk_sent;
+        iov[count].iov_len = frame->chunk_len - frame->chunk_sent;
+        count++;
+    }
+
+    return count;
+}
+
+/* Copy the header and mask payload straight into out */
+size_t ws_frame_fill(ws_frame_t *frame, unsigned char *out, size_t out_len)
+{
+    size_t n, filled = 0;
+
+    if (frame == NULL || out == NULL || frame->in_place || frame->chunk != NULL) {
+        return 0;
+    }
+
+    n = frame->header_len - frame->header_sent;
+    if (n > out_len) {
+        n = out_len;
+    }
+    memcpy(out, frame->header + frame->header_sent, n);
+    frame->header_sent += n;
+    filled = n;
+
+    n = frame->payload_len - frame->payload_masked;
+    if (n > out_len - filled) {
+        n = out_len - filled;
+    }
+    ws_mask_apply(out + filled, frame->payload + frame->payload_masked, n,
+                  frame->mask, frame->payload_masked);
+    frame->payload_masked += n;
+    frame->payload_sent += n;
+    filled += n;
+
+    return filled;
+}
+
+/* Mark n bytes as sent */
+void ws_frame_consume(ws_frame_t *frame, size_t n)
+{
+    size_t step;
+
+    if (frame == NULL) {
+        return;
+    }
+
+    step = frame->header_len - frame->header_sent;
+    if (step > n) {
+        step = n;
+    }
+    frame->header_sent += step;
+    n -= step;
+
+    if (frame->in_place) {
+        frame->payload_sent += n;
+        return;
+    }
+
+    frame->chunk_sent += n;
+    frame->payload_sent += n;
+
+    /* Hand the buffer back as soon as the last chunk is out */
+    if (ws_frame_done(frame)) {
+        ws_frame_free(frame);
+    }
+}
+
+/* Whole frame sent */
+int ws_frame_done(const ws_frame_t *frame)
+{
+    return frame != NULL && frame->header_sent == frame->header_len &&
+           frame->payload_sent == frame->payload_len;
+}
+
+/* Bytes still to send */
+size_t ws_frame_pending(const ws_frame_t *frame)
+{
+    if (frame == NULL) {
+        return 0;
+    }
+
+    return (frame->header_len - frame->header_sent) +
+           (frame->payload_len - frame->payload_sent);
+}
+
+/* Send on a socket */
+int ws_frame_send_fd(ws_frame_t *frame, int fd)
+{
+    struct iovec iov[2];
+    struct msghdr msg;
+    ssize_t n;
+
+    if (frame == NULL || fd < 0) {
+        return WS_FRAME_ERR_INVALID_PARAM;
+    }
+
+    while (!ws_frame_done(frame)) {
+        int count = ws_frame_iov(frame, iov);
+
+        if (count < 0) {
+            return count;
+        }
+
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = (size_t) count;
+
+        n = sendmsg(fd, &msg, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return WS_FRAME_IN_PROGRESS;
+            }
+            return WS_FRAME_ERR_SEND_FAILED;
+        }
+
+        ws_frame_consume(frame, (size_t) n);
+    }
+
+    return WS_FRAME_OK;
+}
+
+/* Return the pooled buffer */
+void ws_frame_free(ws_frame_t *frame)
+{
+    if (frame == NULL || frame->chunk == NULL || frame->pool == NULL) {
+        return;
+    }
+
+    frame->pool->free_list[frame->pool->free_count++] = frame->chunk;
+    frame->chunk = NULL;
+}
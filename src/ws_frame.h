@@ -0,0 +1,111 @@
+/*
+ * WebSocket frame sender
+ * Client frames without a per-message allocation: the header is built in
+ * a fixed buffer, the payload is masked in place or chunk by chunk into
+ * pooled buffers, and header + payload leave in one writev-style call.
+ * Short writes are resumed where they stopped.
+ */
+
+#ifndef WS_FRAME_H
+#define WS_FRAME_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+/* Error codes */
+#define WS_FRAME_OK                         0
+#define WS_FRAME_IN_PROGRESS                1
+#define WS_FRAME_ERR_INVALID_PARAM         -1
+#define WS_FRAME_ERR_POOL_EMPTY            -2
+#define WS_FRAME_ERR_RNG_FAILED            -3
+#define WS_FRAME_ERR_SEND_FAILED           -4
+
+/* Opcodes (RFC 6455 section 5.2) */
+#define WS_FRAME_OP_CONTINUE               0x0
+#define WS_FRAME_OP_TEXT                   0x1
+#define WS_FRAME_OP_BINARY                 0x2
+#define WS_FRAME_OP_CLOSE                  0x8
+#define WS_FRAME_OP_PING                   0x9
+#define WS_FRAME_OP_PONG                   0xA
+
+/* OR into a data opcode: first frame of a compressed message (RFC 7692) */
+#define WS_FRAME_RSV1                      0x40
+
+/* 2 byte base + 8 byte extended length + 4 byte mask key */
+#define WS_FRAME_HEADER_MAX                14
+
+/* Pool geometry: a payload is masked at most one chunk at a time */
+#define WS_FRAME_POOL_BUFS                 8
+#define WS_FRAME_CHUNK_SIZE                4096
+
+/* Mask keys drawn from the kernel in one batch */
+#define WS_FRAME_MASK_CACHE                256
+
+/* Shared chunk buffers and mask key cache */
+typedef struct {
+    unsigned char bufs[WS_FRAME_POOL_BUFS][WS_FRAME_CHUNK_SIZE];
+    unsigned char *free_list[WS_FRAME_POOL_BUFS];
+    size_t free_count;
+    unsigned char masks[WS_FRAME_MASK_CACHE];
+    size_t mask_pos;                /* Next unused byte of masks */
+} ws_frame_pool_t;
+
+/* One outgoing frame; the payload must stay valid until the frame is sent */
+typedef struct {
+    unsigned char header[WS_FRAME_HEADER_MAX];
+    size_t header_len;
+    size_t header_sent;
+    unsigned char mask[4];
+    const unsigned char *payload;
+    size_t payload_len;
+    size_t payload_masked;          /* Payload bytes masked so far */
+    size_t payload_sent;
+    int in_place;                   /* Payload was masked in the caller's buffer */
+    unsigned char *chunk;           /* Pooled buffer, NULL when in place or empty */
+    size_t chunk_len;
+    size_t chunk_sent;
+    ws_frame_pool_t *pool;
+} ws_frame_t;
+
+/* Initialize the pool (all buffers free, mask cache empty) */
+void ws_frame_pool_init(ws_frame_pool_t *pool);
+
+/* Prepare a masked frame, leaving the caller's data untouched. The payload
+ * is masked chunk by chunk into a pooled buffer (ws_frame_iov) or straight
+ * into a caller buffer (ws_frame_fill). */
+int ws_frame_init(ws_frame_t *frame, ws_frame_pool_t *pool, int opcode, int fin,
+                  const void *payload, size_t len);
+
+/* Prepare a masked frame, masking payload in place (no copy at all).
+ * The buffer holds masked bytes afterwards. */
+int ws_frame_init_in_place(ws_frame_t *frame, ws_frame_pool_t *pool, int opcode, int fin,
+                           void *payload, size_t len);
+
+/* Fill iov with the bytes still to send; returns the iovec count, 0 when
+ * done, or WS_FRAME_ERR_POOL_EMPTY if no chunk buffer is free */
+int ws_frame_iov(ws_frame_t *frame, struct iovec iov[2]);
+
+/* Copy pending header bytes and mask up to out_len payload bytes into out,
+ * marking them sent; returns the bytes written. For transports that take one
+ * contiguous buffer (TLS records). Not to be mixed with ws_frame_iov(). */
+size_t ws_frame_fill(ws_frame_t *frame, unsigned char *out, size_t out_len);
+
+/* Mark n bytes of the last ws_frame_iov() result as sent */
+void ws_frame_consume(ws_frame_t *frame, size_t n);
+
+/* Whole frame sent */
+int ws_frame_done(const ws_frame_t *frame);
+
+/* Header and payload bytes not sent yet */
+size_t ws_frame_pending(const ws_frame_t *frame);
+
+/* Send on a socket with sendmsg(). Returns WS_FRAME_OK once complete,
+ * WS_FRAME_IN_PROGRESS when a non-blocking socket is full (call again on
+ * writability) or WS_FRAME_ERR_SEND_FAILED. */
+int ws_frame_send_fd(ws_frame_t *frame, int fd);
+
+/* Return the pooled buffer; safe on sent, aborted or zeroed frames */
+void ws_frame_free(ws_frame_t *frame);
+
+#endif /* WS_FRAME_H */
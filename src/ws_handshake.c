@@ -0,0 +1,287 @@
+/*
+ * WebSocket client handshake implementation
+ */
+
+#include "ws_handshake.h"
+#include "mbedtls/ssl.h"     /* For MBEDTLS_ERR_SSL_WANT_READ */
+#include "mbedtls/sha1.h"
+#include "mbedtls/base64.h"
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/random.h>
+
+/* RFC 6455 section 1.3 */
+#define WS_HANDSHAKE_GUID "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+
+/* Initialize and generate a fresh random Sec-WebSocket-Key */
+int ws_handshake_init(ws_handshake_t *hs)
+{
+    unsigned char nonce[16];
+    size_t olen;
+
+    if (hs == NULL) {
+        return WS_HANDSHAKE_ERR_INVALID_PARAM;
+    }
+
+    hs->len = 0;
+    hs->header_len = 0;
+    hs->status_code = 0;
+    hs->offer = NULL;
+    hs->extensions = NULL;
+    hs->extensions_len = 0;
+
+    if (getrandom(nonce, sizeof(nonce), 0) != (ssize_t) sizeof(nonce)) {
+        return WS_HANDSHAKE_ERR_RNG_FAILED;
+    }
+
+    if (mbedtls_base64_encode((unsigned char *) hs->key, sizeof(hs->key), &olen,
+                              nonce, sizeof(nonce)) != 0) {
+        return WS_HANDSHAKE_ERR_RNG_FAILED;
+    }
+
+    return WS_HANDSHAKE_OK;
+}
+
+/* Write the Upgrade request */
+int ws_handshake_build_request(const ws_handshake_t *hs, char *out, size_t out_len,
+                               const char *host, const char *path,
+                               const char *auth_token)
+{
+    int n;
+
+    if (hs == NULL || out == NULL || host == NULL || path == NULL) {
+        return WS_HANDSHAKE_ERR_INVALID_PARAM;
+    }
+
+    n = snprintf(out, out_len,
+                 "GET %s HTTP/1.1\r\n"
+                 "Host: %s\r\n"
+                 "Upgrade: websocket\r\n"
+                 "Connection: Upgrade\r\n"
+                 "Sec-WebSocket-Key: %s\r\n"
+                 "Sec-WebSocket-Version: 13\r\n"
+                 "%s%s%s"
+                 "%s%s%s"
+                 "\r\n",
+                 path, host, hs->key,
+                 hs->offer ? "Sec-WebSocket-Extensions: " : "",
+                 hs->offer ? hs->offer : "",
+                 hs->offer ? "\r\n" : "",
+                 auth_token ? "Authorization: Bearer " : "",
+                 auth_token ? auth_token : "",
+                 auth_token ? "\r\n" : "");
+
+    if (n < 0 || (size_t) n >= out_len) {
+        return WS_HANDSHAKE_ERR_INVALID_PARAM;
+    }
+
+    return n;
+}
+
+/* Find the end of the header block; returns its length or 0 */
+static size_t ws_handshake_header_end(const char *buf, size_t from, size_t len)
+{
+    size_t i = from > 3 ? from - 3 : 0;
+
+    for (; i + 3 < len; i++) {
+        if (buf[i] == '\r' && buf[i + 1] == '\n' && buf[i + 2] == '\r' && buf[i + 3] == '\n') {
+            return i + 4;
+        }
+    }
+
+    return 0;
+}
+
+/* Case-insensitive token search within a header value */
+static int ws_value_has(const char *value, size_t len, const char *token)
+{
+    size_t tlen = strlen(token), i;
+
+    for (i = 0; i + tlen <= len; i++) {
+        if (strncasecmp(value + i, token, tlen) == 0) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/* Compute the Sec-WebSocket-Accept value for a Sec-WebSocket-Key */
+int ws_handshake_accept_key(const char *key, char *out, size_t out_len)
+{
+    char concat[WS_HANDSHAKE_KEY_LEN + sizeof(WS_HANDSHAKE_GUID)];
+    unsigned char digest[20];
+    size_t olen;
+
+    if (key == NULL || out == NULL || strlen(key) != WS_HANDSHAKE_KEY_LEN) {
+        return WS_HANDSHAKE_ERR_INVALID_PARAM;
+    }
+
+    memcpy(concat, key, WS_HANDSHAKE_KEY_LEN);
+    memcpy(concat + WS_HANDSHAKE_KEY_LEN, WS_HANDSHAKE_GUID, sizeof(WS_HANDSHAKE_GUID) - 1);
+
+    if (mbedtls_sha1((const unsigned char *) concat,
+                     WS_HANDSHAKE_KEY_LEN + sizeof(WS_HANDSHAKE_GUID) - 1, digest) != 0) {
+        return WS_HANDSHAKE_ERR_INVALID_PARAM;
+    }
+
+    if (mbedtls_base64_encode((unsigned char *) out, out_len, &olen,
+                              digest, sizeof(digest)) != 0) {
+        return WS_HANDSHAKE_ERR_INVALID_PARAM;
+    }
+
+    return (int) olen;
+}
+
+/* Parse the complete header block in place */
+static int ws_handshake_parse(ws_handshake_t *hs)
+{
+    char expected[32];
+    const char *line = hs->buf, *end = hs->buf + hs->header_len - 2;
+    const char *eol;
+    int upgrade = 0, connection = 0, accept = 0, expected_len;
+
+    /* Status line */
+    eol = memchr(line, '\r', (size_t)(end - line));
+    if (eol == NULL || eol - line < 12 || strncmp(line, "HTTP/1.1 ", 9) != 0 ||
+        sscanf(line + 9, "%3d", &hs->status_code) != 1) {
+        return WS_HANDSHAKE_ERR_BAD_RESPONSE;
+    }
+
+    if (hs->status_code != 101) {
+        return WS_HANDSHAKE_ERR_BAD_STATUS;
+    }
+
+    expected_len = ws_handshake_accept_key(hs->key, expected, sizeof(expected));
+    if (expected_len < 0) {
+        return WS_HANDSHAKE_ERR_BAD_ACCEPT;
+    }
+
+    /* Header lines */
+    for (line = eol + 2; line < end; line = eol + 2) {
+        const char *colon, *value;
+        size_t name_len, value_len;
+
+        eol = memchr(line, '\r', (size_t)(end - line));
+        if (eol == NULL) {
+            eol = end;
+        }
+
+        colon = memchr(line, ':', (size_t)(eol - line));
+        if (colon == NULL) {
+            return WS_HANDSHAKE_ERR_BAD_RESPONSE;
+        }
+
+        name_len = (size_t)(colon - line);
+        value = colon + 1;
+        while (value < eol && (*value == ' ' || *value == '\t')) {
+            value++;
+        }
+        value_len = (size_t)(eol - value);
+        while (value_len > 0 && (value[value_len - 1] == ' ' || value[value_len - 1] == '\t')) {
+            value_len--;
+        }
+
+        if (name_len == 7 && strncasecmp(line, "Upgrade", 7) == 0) {
+            upgrade = ws_value_has(value, value_len, "websocket");
+        } else if (name_len == 10 && strncasecmp(line, "Connection", 10) == 0) {
+            connection = ws_value_has(value, value_len, "upgrade");
+        } else if (name_len == 20 && strncasecmp(line, "Sec-WebSocket-Accept", 20) == 0) {
+            accept = value_len == (size_t) expected_len &&
+                     memcmp(value, expected, value_len) == 0;
+        } else if (name_len == 24 && strncasecmp(line, "Sec-WebSocket-Extensions", 24) == 0 &&
+                   value_len > 0) {
+            /* We offer at most one extension; a second header is not an answer */
+            if (hs->extensions_len > 0) {
+                return WS_HANDSHAKE_ERR_BAD_RESPONSE;
+            }
+            hs->extensions = value;
+            hs->extensions_len = value_len;
+        }
+    }
+
+    if (!upgrade || !connection) {
+        return WS_HANDSHAKE_ERR_BAD_RESPONSE;
+    }
+
+    if (!accept) {
+        return WS_HANDSHAKE_ERR_BAD_ACCEPT;
+    }
+
+    return WS_HANDSHAKE_OK;
+}
+
+/* Read and validate the response */
+int ws_handshake_read(ws_handshake_t *hs, ws_handshake_recv_cb recv_cb, void *ctx)
+{
+    int ret;
+
+    if (hs == NULL || recv_cb == NULL) {
+        return WS_HANDSHAKE_ERR_INVALID_PARAM;
+    }
+
+    while (hs->header_len == 0) {
+        size_t before = hs->len;
+
+        if (hs->len == sizeof(hs->buf)) {
+            return WS_HANDSHAKE_ERR_TOO_LARGE;
+        }
+
+        ret = recv_cb(ctx, (unsigned char *) hs->buf + hs->len, sizeof(hs->buf) - hs->len);
+
+        if (ret == MBEDTLS_ERR_SSL_WANT_READ || ret == MBEDTLS_ERR_SSL_WANT_WRITE) {
+            return WS_HANDSHAKE_IN_PROGRESS;
+        }
+
+        if (ret == 0) {
+            return WS_HANDSHAKE_ERR_CLOSED;
+        }
+
+        if (ret < 0) {
+            return WS_HANDSHAKE_ERR_RECV_FAILED;
+        }
+
+        hs->len += (size_t) ret;
+        hs->header_len = ws_handshake_header_end(hs->buf, before, hs->len);
+    }
+
+    return ws_handshake_parse(hs);
+}
+
+/* Bytes received after the header block */
+const char *ws_handshake_leftover(const ws_handshake_t *hs, size_t *len)
+{
+    if (hs == NULL || hs->header_len == 0) {
+        if (len != NULL) {
+            *len = 0;
+        }
+        return NULL;
+    }
+
+    if (len != NULL) {
+        *len = hs->len - hs->header_len;
+    }
+
+    return hs->buf + hs->header_len;
+}
+
+/* recv() adapter for plain sockets */
+int ws_handshake_recv_fd(void *ctx, unsigned char *buf, size_t len)
+{
+    int fd = *(const int *) ctx;
+    ssize_t n;
+
+    do {
+        n = recv(fd, buf, len, 0);
+    } while (n < 0 && errno == EINTR);
+
+    if (n < 0) {
+        return (errno == EAGAIN || errno == EWOULDBLOCK) ? MBEDTLS_ERR_SSL_WANT_READ : -1;
+    }
+
+    return (int) n;
+}
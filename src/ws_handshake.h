@@ -0,0 +1,76 @@
+/*
+ * WebSocket client handshake
+ * Builds the HTTP Upgrade request and reads the 101 response in large
+ * chunks, parsing it in place and validating Sec-WebSocket-Accept.
+ * An extension offer (permessage-deflate) goes out as
+ * Sec-WebSocket-Extensions; the server's answer is kept for the caller to
+ * validate.
+ */
+
+#ifndef WS_HANDSHAKE_H
+#define WS_HANDSHAKE_H
+
+#include <stddef.h>
+
+/* Error codes */
+#define WS_HANDSHAKE_OK                     0
+#define WS_HANDSHAKE_IN_PROGRESS            1
+#define WS_HANDSHAKE_ERR_INVALID_PARAM     -1
+#define WS_HANDSHAKE_ERR_RNG_FAILED        -2
+#define WS_HANDSHAKE_ERR_RECV_FAILED       -3
+#define WS_HANDSHAKE_ERR_CLOSED            -4
+#define WS_HANDSHAKE_ERR_TOO_LARGE         -5
+#define WS_HANDSHAKE_ERR_BAD_RESPONSE      -6
+#define WS_HANDSHAKE_ERR_BAD_STATUS        -7
+#define WS_HANDSHAKE_ERR_BAD_ACCEPT        -8
+
+/* Buffer for the whole response header block */
+#define WS_HANDSHAKE_BUF_SIZE              4096
+
+/* base64 of the 16 byte nonce */
+#define WS_HANDSHAKE_KEY_LEN               24
+
+/* base64 of the SHA-1 digest */
+#define WS_HANDSHAKE_ACCEPT_LEN            28
+
+/* Reads up to len bytes: >0 bytes read, 0 on close, <0 on error */
+typedef int (*ws_handshake_recv_cb)(void *ctx, unsigned char *buf, size_t len);
+
+/* Handshake context */
+typedef struct {
+    char key[WS_HANDSHAKE_KEY_LEN + 1];     /* Sec-WebSocket-Key we sent */
+    char buf[WS_HANDSHAKE_BUF_SIZE];        /* Raw response bytes */
+    size_t len;                             /* Bytes in buf */
+    size_t header_len;                      /* Header block incl. final CRLFCRLF */
+    int status_code;                        /* Parsed status */
+    const char *offer;                      /* Sec-WebSocket-Extensions to send, NULL = none */
+    const char *extensions;                 /* Sec-WebSocket-Extensions received, in buf */
+    size_t extensions_len;                  /* 0 = none accepted */
+} ws_handshake_t;
+
+/* Initialize and generate a fresh random Sec-WebSocket-Key; set offer
+ * afterwards to request extensions */
+int ws_handshake_init(ws_handshake_t *hs);
+
+/* Write the Upgrade request into out. auth_token may be NULL.
+ * Returns the request length or a negative error code. */
+int ws_handshake_build_request(const ws_handshake_t *hs, char *out, size_t out_len,
+                               const char *host, const char *path,
+                               const char *auth_token);
+
+/* Read and validate the response. Returns WS_HANDSHAKE_OK once the 101
+ * response is complete and valid, WS_HANDSHAKE_IN_PROGRESS if recv_cb
+ * reported MBEDTLS_ERR_SSL_WANT_READ (non-blocking sockets), or an error. */
+int ws_handshake_read(ws_handshake_t *hs, ws_handshake_recv_cb recv_cb, void *ctx);
+
+/* Bytes received after the header block (early frames) */
+const char *ws_handshake_leftover(const ws_handshake_t *hs, size_t *len);
+
+/* Sec-WebSocket-Accept for a Sec-WebSocket-Key (server side, tests).
+ * Returns the value length or a negative error code. */
+int ws_handshake_accept_key(const char *key, char *out, size_t out_len);
+
+/* recv() adapter for plain sockets; ctx points to the int file descriptor */
+int ws_handshake_recv_fd(void *ctx, unsigned char *buf, size_t len);
+
+#endif /* WS_HANDSHAKE_H */
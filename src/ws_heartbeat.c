@@ -0,0 +1,244 @@
+/*
+ * WebSocket heartbeat scheduler implementation
+ * A session has exactly one timer. While no ping is outstanding it is due
+ * idle_ms after the older of the last send and the last receive; while a
+ * ping is outstanding it is due timeout_ms after the ping.
+ */
+
+#include "ws_heartbeat.h"
+#include <string.h>
+#include <time.h>
+
+static uint64_t ws_heartbeat_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/* Monotonic clock in milliseconds */
+uint64_t ws_heartbeat_now_ms(void)
+{
+    return ws_heartbeat_now_ns() / 1000000ULL;
+}
+
+/* Take the session off the wheel and report it */
+static void ws_heartbeat_kill(ws_heartbeat_t *hb, ws_heartbeat_session_t *session)
+{
+    session->dead = 1;
+    session->awaiting = 0;
+    hb->stats.dead++;
+
+    if (hb->on_dead != NULL) {
+        hb->on_dead(session, session->user_data);
+    }
+}
+
+/* Send a ping and wait timeout_ms for the answer */
+static void ws_heartbeat_ping(ws_heartbeat_t *hb, ws_heartbeat_session_t *session)
+{
+    uint64_t now = hb->now_ms;
+
+    session->awaiting = 1;
+    session->ping_ms = now;
+    session->ping_ns = ws_heartbeat_now_ns();
+
+    if (hb->on_ping != NULL && hb->on_ping(session, session->user_data) != 0) {
+        ws_heartbeat_kill(hb, session);
+        return;
+    }
+
+    session->last_send_ms = now;
+    hb->stats.pings++;
+    timer_wheel_schedule(&hb->wheel, &session->timer, now, hb->timeout_ms);
+}
+
+/* Deadline of a session */
+static void ws_heartbeat_expire(timer_wheel_timer_t *timer, void *arg)
+{
+    ws_heartbeat_session_t *session = arg;
+    ws_heartbeat_t *hb = session->hb;
+    uint64_t now = hb->now_ms;
+    uint64_t due;
+
+    (void)timer;
+
+    if (session->awaiting) {
+        due = session->ping_ms + hb->timeout_ms;
+        if (now < due) {
+            timer_wheel_schedule(&hb->wheel, &session->timer, now, due - now);
+            return;
+        }
+
+        session->awaiting = 0;
+
+        /* Any traffic after the ping proves the peer alive */
+        if (session->last_recv_ms <= session->ping_ms) {
+            session->missed++;
+            hb->stats.missed++;
+            CONN_METRICS_ADD(session->metrics, heartbeat_misses, 1);
+
+            if (session->missed >= hb->max_missed) {
+                ws_heartbeat_kill(hb, session);
+                return;
+            }
+
+            /* Probe again right away */
+            ws_heartbeat_ping(hb, session);
+            return;
+        }
+        session->missed = 0;
+    }
+
+    due = session->last_recv_ms < session->last_send_ms ?
+          session->last_recv_ms : session->last_send_ms;
+    due += hb->idle_ms;
+
+    if (now < due) {
+        hb->stats.deferred++;
+        timer_wheel_schedule(&hb->wheel, &session->timer, now, due - now);
+        return;
+    }
+
+    ws_heartbeat_ping(hb, session);
+}
+
+/* Initialize a scheduler */
+int ws_heartbeat_init(ws_heartbeat_t *hb, ws_heartbeat_ping_cb on_ping,
+                      ws_heartbeat_dead_cb on_dead, uint64_t now_ms)
+{
+    if (hb == NULL) {
+        return WS_HEARTBEAT_ERR_INVALID_PARAM;
+    }
+
+    memset(hb, 0, sizeof(*hb));
+    timer_wheel_init(&hb->wheel, TIMER_WHEEL_TICK_MS, now_ms);
+    hb->now_ms = now_ms;
+    hb->idle_ms = WS_HEARTBEAT_IDLE_MS;
+    hb->timeout_ms = WS_HEARTBEAT_TIMEOUT_MS;
+    hb->max_missed = WS_HEARTBEAT_MAX_MISSED;
+    hb->on_ping = on_ping;
+    hb->on_dead = on_dead;
+    latency_hist_init(&hb->rtt);
+
+    return WS_HEARTBEAT_OK;
+}
+
+/* Start watching a session */
+int ws_heartbeat_add(ws_heartbeat_t *hb, ws_heartbeat_session_t *session,
+                     void *user_data, uint64_t now_ms)
+{
+    conn_metrics_t *metrics;
+
+    if (hb == NULL || session == NULL || session->hb != NULL) {
+        return WS_HEARTBEAT_ERR_INVALID_PARAM;
+    }
+
+    /* May be set before adding */
+    metrics = session->metrics;
+
+    memset(session, 0, sizeof(*session));
+    timer_wheel_timer_init(&session->timer, ws_heartbeat_expire, session);
+    session->hb = hb;
+    session->user_data = user_data;
+    session->metrics = metrics;
+    session->last_send_ms = now_ms;
+    session->last_recv_ms = now_ms;
+
+    hb->sessions++;
+    timer_wheel_schedule(&hb->wheel, &session->timer, now_ms, hb->idle_ms);
+
+    return WS_HEARTBEAT_OK;
+}
+
+/* Stop watching a session */
+void ws_heartbeat_remove(ws_heartbeat_session_t *session)
+{
+    if (session == NULL || session->hb == NULL) {
+        return;
+    }
+
+    timer_wheel_cancel(&session->hb->wheel, &session->timer);
+    session->hb->sessions--;
+    session->hb = NULL;
+    session->awaiting = 0;
+}
+
+/* Note data sent to the peer */
+void ws_heartbeat_sent(ws_heartbeat_session_t *session, uint64_t now_ms)
+{
+    if (session != NULL) {
+        session->last_send_ms = now_ms;
+    }
+}
+
+/* Note data received from the peer */
+void ws_heartbeat_received(ws_heartbeat_session_t *session, uint64_t now_ms)
+{
+    if (session != NULL) {
+        session->last_recv_ms = now_ms;
+    }
+}
+
+/* Note a pong */
+void ws_heartbeat_pong(ws_heartbeat_session_t *session, uint64_t now_ms)
+{
+    ws_heartbeat_t *hb;
+    uint64_t rtt, due;
+
+    if (session == NULL) {
+        return;
+    }
+
+    session->last_recv_ms = now_ms;
+
+    hb = session->hb;
+    if (!session->awaiting || hb == NULL) {
+        return;
+    }
+
+    /* Never 0, so a measured RTT is distinguishable from none */
+    rtt = ws_heartbeat_now_ns() - session->ping_ns;
+    if (rtt == 0) {
+        rtt = 1;
+    }
+
+    session->awaiting = 0;
+    session->missed = 0;
+    session->rtt_ns = rtt;
+    hb->stats.pongs++;
+    latency_hist_record(&hb->rtt, rtt);
+    conn_metrics_pong(session->metrics, rtt);
+
+    /* Back from the ping timeout to the idle deadline */
+    due = (session->last_send_ms < now_ms ? session->last_send_ms : now_ms) + hb->idle_ms;
+    timer_wheel_schedule(&hb->wheel, &session->timer, now_ms, due > now_ms ? due - now_ms : 0);
+}
+
+/* Milliseconds until advance() may have work */
+int ws_heartbeat_next_timeout(const ws_heartbeat_t *hb, uint64_t now_ms)
+{
+    if (hb == NULL) {
+        return -1;
+    }
+
+    return timer_wheel_next_timeout(&hb->wheel, now_ms);
+}
+
+/* Run due deadlines */
+size_t ws_heartbeat_advance(ws_heartbeat_t *hb, uint64_t now_ms)
+{
+    uint64_t pings;
+
+    if (hb == NULL) {
+        return 0;
+    }
+
+    pings = hb->stats.pings;
+    hb->now_ms = now_ms;
+    timer_wheel_advance(&hb->wheel, now_ms);
+
+    return (size_t)(hb->stats.pings - pings);
+}
@@ -0,0 +1,115 @@
+/*
+ * WebSocket heartbeat scheduler
+ * Per-session liveness deadlines on a timer wheel. Each session records
+ * when it last sent and last received; a ping goes out only once one of
+ * the two directions has been quiet for idle_ms, so sessions that are
+ * busy both ways never see a redundant ping. A ping that gets no pong
+ * (and no other traffic) within timeout_ms is a miss, and max_missed
+ * misses in a row declare the peer dead.
+ *
+ * Recording activity is two stores, no timer operation: the deadline is
+ * checked lazily when the session's timer fires and pushed back by the
+ * activity seen since. Pong round trips go into a histogram and, when the
+ * session has one, into its conn_metrics_t.
+ *
+ * Single threaded: one scheduler per event loop or worker thread.
+ */
+
+#ifndef WS_HEARTBEAT_H
+#define WS_HEARTBEAT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "timer_wheel.h"
+#include "latency_hist.h"
+#include "conn_metrics.h"
+
+/* Error codes */
+#define WS_HEARTBEAT_OK                     0
+#define WS_HEARTBEAT_ERR_INVALID_PARAM     -1
+
+/* Defaults */
+#define WS_HEARTBEAT_IDLE_MS               5000
+#define WS_HEARTBEAT_TIMEOUT_MS            10000
+#define WS_HEARTBEAT_MAX_MISSED            2
+
+typedef struct ws_heartbeat ws_heartbeat_t;
+typedef struct ws_heartbeat_session ws_heartbeat_session_t;
+
+/* Send a ping (WebSocket ping frame, application JSON ping or both);
+ * non-zero declares the session dead */
+typedef int (*ws_heartbeat_ping_cb)(ws_heartbeat_session_t *session, void *user_data);
+
+/* The peer missed its pongs; the session is no longer scheduled. Call
+ * ws_heartbeat_remove() (here or later) before freeing it. */
+typedef void (*ws_heartbeat_dead_cb)(ws_heartbeat_session_t *session, void *user_data);
+
+/* Liveness state of one connection, embedded in the object that owns it */
+struct ws_heartbeat_session {
+    timer_wheel_timer_t timer;
+    ws_heartbeat_t *hb;                 /* NULL when not added */
+    void *user_data;
+    conn_metrics_t *metrics;            /* Optional, gets pong RTTs and misses */
+    uint64_t last_send_ms;
+    uint64_t last_recv_ms;
+    uint64_t ping_ms;                   /* When the outstanding ping was sent */
+    uint64_t ping_ns;                   /* Same, monotonic ns for the RTT */
+    uint64_t rtt_ns;                    /* Last pong round trip, 0 = none yet */
+    uint32_t missed;                    /* Pings in a row without an answer */
+    int awaiting;                       /* A ping is outstanding */
+    int dead;
+};
+
+/* Scheduler counters */
+typedef struct {
+    uint64_t pings;                     /* Pings sent */
+    uint64_t pongs;                     /* Pongs matched to a ping */
+    uint64_t missed;                    /* Pings that timed out */
+    uint64_t dead;                      /* Sessions declared dead */
+    uint64_t deferred;                  /* Expiries pushed back by traffic */
+} ws_heartbeat_stats_t;
+
+/* Scheduler context; set the optional fields before adding sessions */
+struct ws_heartbeat {
+    timer_wheel_t wheel;
+    uint64_t now_ms;                    /* Time of the current advance() */
+    uint32_t idle_ms;                   /* Quiet time before a ping */
+    uint32_t timeout_ms;                /* Time a ping has to be answered */
+    uint32_t max_missed;                /* Misses before the peer is dead */
+    ws_heartbeat_ping_cb on_ping;
+    ws_heartbeat_dead_cb on_dead;
+    size_t sessions;
+    ws_heartbeat_stats_t stats;
+    latency_hist_t rtt;                 /* Pong round trips, ns */
+};
+
+/* Monotonic clock in milliseconds */
+uint64_t ws_heartbeat_now_ms(void);
+
+/* Initialize a scheduler with the default intervals */
+int ws_heartbeat_init(ws_heartbeat_t *hb, ws_heartbeat_ping_cb on_ping,
+                      ws_heartbeat_dead_cb on_dead, uint64_t now_ms);
+
+/* Start watching a session; the first ping is due idle_ms after now_ms */
+int ws_heartbeat_add(ws_heartbeat_t *hb, ws_heartbeat_session_t *session,
+                     void *user_data, uint64_t now_ms);
+
+/* Stop watching a session */
+void ws_heartbeat_remove(ws_heartbeat_session_t *session);
+
+/* Note data sent to / received from the peer */
+void ws_heartbeat_sent(ws_heartbeat_session_t *session, uint64_t now_ms);
+void ws_heartbeat_received(ws_heartbeat_session_t *session, uint64_t now_ms);
+
+/* Note a pong (protocol or application level) and record its round trip;
+ * a pong with no ping outstanding only counts as received data */
+void ws_heartbeat_pong(ws_heartbeat_session_t *session, uint64_t now_ms);
+
+/* Milliseconds until advance() may have work, -1 without sessions */
+int ws_heartbeat_next_timeout(const ws_heartbeat_t *hb, uint64_t now_ms);
+
+/* Run due deadlines: send pings, count misses, report dead peers.
+ * Returns the number of pings sent, so the caller knows to flush. */
+size_t ws_heartbeat_advance(ws_heartbeat_t *hb, uint64_t now_ms);
+
+#endif /* WS_HEARTBEAT_H */
@@ -0,0 +1,307 @@
+/*
+ * WebSocket payload masking implementation
+ * Every kernel works on a 64 byte key pattern pre-rotated by the caller's
+ * offset, so unaligned loads/stores cover the head and the remainder after
+ * the last full vector goes through the scalar kernel.
+ */
+
+#include "ws_mask.h"
+#include "cpu_dispatch.h"
+#include <stdint.h>
+#include <string.h>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define WS_MASK_X86
+#include <immintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#define WS_MASK_NEON
+#include <arm_neon.h>
+#endif
+
+/* Key pattern length; a multiple of every vector width */
+#define WS_MASK_KEY_LEN 64
+
+/* Below this, 256/512 bit kernels lose to SSE2 (setup + vzeroupper) */
+#define WS_MASK_WIDE_MIN 256
+
+typedef void (*ws_mask_kernel)(unsigned char *dst, const unsigned char *src, size_t len,
+                               const unsigned char *key);
+
+/* Portable kernel: 8 bytes per step, then single bytes */
+static void ws_mask_scalar(unsigned char *dst, const unsigned char *src, size_t len,
+                           const unsigned char *key)
+{
+    uint64_t k, word;
+    size_t i;
+
+    memcpy(&k, key, sizeof(k));
+
+    for (i = 0; i + 8 <= len; i += 8) {
+        memcpy(&word, src + i, sizeof(word));
+        word ^= k;
+        memcpy(dst + i, &word, sizeof(word));
+    }
+
+    for (; i < len; i++) {
+        dst[i] = src[i] ^ key[i & 3];
+    }
+}
+
+#if defined(WS_MASK_X86)
+
+__attribute__((target("sse2")))
+static void ws_mask_sse2(unsigned char *dst, const unsigned char *src, size_t len,
+                         const unsigned char *key)
+{
+    __m128i k = _mm_loadu_si128((const __m128i *) key);
+    size_t i;
+
+    for (i = 0; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_xor_si128(v, k));
+    }
+
+    ws_mask_scalar(dst + i, src + i, len - i, key);
+}
+
+__attribute__((target("avx2")))
+static void ws_mask_avx2(unsigned char *dst, const unsigned char *src, size_t len,
+                         const unsigned char *key)
+{
+    __m256i k = _mm256_loadu_si256((const __m256i *) key);
+    size_t i;
+
+    for (i = 0; i + 64 <= len; i += 64) {
+        __m256i a = _mm256_loadu_si256((const __m256i *)(src + i));
+        __m256i b = _mm256_loadu_si256((const __m256i *)(src + i + 32));
+        _mm256_storeu_si256((__m256i *)(dst + i), _mm256_xor_si256(a, k));
+        _mm256_storeu_si256((__m256i *)(dst + i + 32), _mm256_xor_si256(b, k));
+    }
+
+    if (i + 32 <= len) {
+        __m256i a = _mm256_loadu_si256((const __m256i *)(src + i));
+        _mm256_storeu_si256((__m256i *)(dst + i), _mm256_xor_si256(a, k));
+        i += 32;
+    }
+
+    if (i + 16 <= len) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_xor_si128(v, _mm256_castsi256_si128(k)));
+        i += 16;
+    }
+
+    /* GCC may turn the tail into a jump without its own vzeroupper; dirty
+     * upper halves make the following SSE code pay transition stalls */
+    _mm256_zeroupper();
+    ws_mask_scalar(dst + i, src + i, len - i, key);
+}
+
+__attribute__((target("avx512f")))
+static void ws_mask_avx512(unsigned char *dst, const unsigned char *src, size_t len,
+                           const unsigned char *key)
+{
+    __m512i k = _mm512_loadu_si512((const void *) key);
+    size_t i;
+
+    for (i = 0; i + 64 <= len; i += 64) {
+        __m512i v = _mm512_loadu_si512((const void *)(src + i));
+        _mm512_storeu_si512((void *)(dst + i), _mm512_xor_si512(v, k));
+    }
+
+    /* AVX-512F implies AVX2: finish with the narrower vectors */
+    ws_mask_avx2(dst + i, src + i, len - i, key);
+}
+
+#endif /* WS_MASK_X86 */
+
+#if defined(WS_MASK_NEON)
+
+static void ws_mask_neon(unsigned char *dst, const unsigned char *src, size_t len,
+                         const unsigned char *key)
+{
+    uint8x16_t k = vld1q_u8(key);
+    size_t i;
+
+    for (i = 0; i + 16 <= len; i += 16) {
+        vst1q_u8(dst + i, veorq_u8(vld1q_u8(src + i), k));
+    }
+
+    ws_mask_scalar(dst + i, src + i, len - i, key);
+}
+
+#endif /* WS_MASK_NEON */
+
+/* Kernels of one implementation */
+typedef struct {
+    ws_mask_impl_t impl;
+    ws_mask_kernel fn;                  /* WS_MASK_WIDE_MIN bytes and more */
+    ws_mask_kernel short_fn;            /* Shorter payloads */
+} ws_mask_kernels_t;
+
+/* Wide kernels hand short payloads to SSE2 */
+static const ws_mask_kernels_t ws_mask_kernels[] = {
+    { WS_MASK_IMPL_SCALAR, ws_mask_scalar, ws_mask_scalar },
+#if defined(WS_MASK_X86)
+    { WS_MASK_IMPL_SSE2, ws_mask_sse2, ws_mask_sse2 },
+    { WS_MASK_IMPL_AVX2, ws_mask_avx2, ws_mask_sse2 },
+    { WS_MASK_IMPL_AVX512, ws_mask_avx512, ws_mask_sse2 },
+#endif
+#if defined(WS_MASK_NEON)
+    { WS_MASK_IMPL_NEON, ws_mask_neon, ws_mask_neon },
+#endif
+};
+
+static cpu_dispatch_t ws_mask_dispatch = CPU_DISPATCH_INIT;
+
+/* Whether the CPU and build support an implementation */
+static int ws_mask_supported(ws_mask_impl_t impl)
+{
+    switch (impl) {
+    case WS_MASK_IMPL_SCALAR:
+        return 1;
+#if defined(WS_MASK_X86)
+    case WS_MASK_IMPL_SSE2:
+        return __builtin_cpu_supports("sse2");
+    case WS_MASK_IMPL_AVX2:
+        return __builtin_cpu_supports("avx2");
+    case WS_MASK_IMPL_AVX512:
+        return __builtin_cpu_supports("avx512f");
+#endif
+#if defined(WS_MASK_NEON)
+    case WS_MASK_IMPL_NEON:
+        return 1;
+#endif
+    default:
+        return 0;
+    }
+}
+
+/* Kernels of a supported implementation */
+static const ws_mask_kernels_t *ws_mask_kernels_for(ws_mask_impl_t impl)
+{
+    size_t i;
+
+    for (i = 0; i < sizeof(ws_mask_kernels) / sizeof(ws_mask_kernels[0]); i++) {
+        if (ws_mask_kernels[i].impl == impl) {
+            return &ws_mask_kernels[i];
+        }
+    }
+
+    return &ws_mask_kernels[0];
+}
+
+/* Best implementation for this CPU */
+static ws_mask_impl_t ws_mask_detect(void)
+{
+    static const ws_mask_impl_t order[] = {
+        WS_MASK_IMPL_AVX512, WS_MASK_IMPL_AVX2, WS_MASK_IMPL_SSE2, WS_MASK_IMPL_NEON
+    };
+    size_t i;
+
+#if defined(WS_MASK_X86)
+    __builtin_cpu_init();
+#endif
+
+    for (i = 0; i < sizeof(order) / sizeof(order[0]); i++) {
+        if (ws_mask_supported(order[i])) {
+            return order[i];
+        }
+    }
+
+    return WS_MASK_IMPL_SCALAR;
+}
+
+/* First use: default to the best kernels */
+static void ws_mask_probe(void)
+{
+    cpu_dispatch_offer(&ws_mask_dispatch, ws_mask_kernels_for(ws_mask_detect()));
+}
+
+/* Kernels in use */
+static const ws_mask_kernels_t *ws_mask_kernels_get(void)
+{
+    return (const ws_mask_kernels_t *) cpu_dispatch_get(&ws_mask_dispatch, ws_mask_probe);
+}
+
+/* Force a kernel */
+int ws_mask_set_impl(ws_mask_impl_t impl)
+{
+    if (impl == WS_MASK_IMPL_AUTO) {
+        impl = ws_mask_detect();
+    } else if (!ws_mask_supported(impl)) {
+        return WS_MASK_ERR_UNSUPPORTED;
+    }
+
+    cpu_dispatch_set(&ws_mask_dispatch, ws_mask_kernels_for(impl));
+
+    return WS_MASK_OK;
+}
+
+/* Kernel currently in use */
+ws_mask_impl_t ws_mask_get_impl(void)
+{
+    return ws_mask_kernels_get()->impl;
+}
+
+/* Printable kernel name */
+const char *ws_mask_impl_name(ws_mask_impl_t impl)
+{
+    switch (impl) {
+    case WS_MASK_IMPL_AUTO:
+        return "auto";
+    case WS_MASK_IMPL_SCALAR:
+        return "scalar";
+    case WS_MASK_IMPL_SSE2:
+        return "sse2";
+    case WS_MASK_IMPL_AVX2:
+        return "avx2";
+    case WS_MASK_IMPL_AVX512:
+        return "avx512";
+    case WS_MASK_IMPL_NEON:
+        return "neon";
+    default:
+        return "unknown";
+    }
+}
+
+/* XOR-mask a payload fragment */
+size_t ws_mask_apply(void *dst, const void *src, size_t len,
+                     const unsigned char mask[4], size_t offset)
+{
+    const ws_mask_kernels_t *kernels;
+    unsigned char key[WS_MASK_KEY_LEN];
+    unsigned char rotated[4];
+    size_t i;
+
+    if (len == 0) {
+        return offset & 3;
+    }
+
+    for (i = 0; i < 4; i++) {
+        rotated[i] = mask[(offset + i) & 3];
+    }
+
+    /* Short payloads: skip dispatch and the full key pattern */
+    if (len < 16) {
+        unsigned char *d = (unsigned char *) dst;
+        const unsigned char *s = (const unsigned char *) src;
+
+        for (i = 0; i < len; i++) {
+            d[i] = s[i] ^ rotated[i & 3];
+        }
+        return (offset + len) & 3;
+    }
+
+    for (i = 0; i < WS_MASK_KEY_LEN; i += 4) {
+        memcpy(key + i, rotated, 4);
+    }
+
+    kernels = ws_mask_kernels_get();
+    if (len < WS_MASK_WIDE_MIN) {
+        kernels->short_fn((unsigned char *) dst, (const unsigned char *) src, len, key);
+    } else {
+        kernels->fn((unsigned char *) dst, (const unsigned char *) src, len, key);
+    }
+
+    return (offset + len) & 3;
+}
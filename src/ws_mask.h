@@ -0,0 +1,45 @@
+/*
+ * WebSocket payload masking
+ * XOR-mask kernel (RFC 6455 section 5.3) with SSE2, AVX2, AVX-512 and
+ * NEON variants picked at runtime, plus a portable scalar fallback.
+ */
+
+#ifndef WS_MASK_H
+#define WS_MASK_H
+
+#include <stddef.h>
+
+/* Error codes */
+#define WS_MASK_OK                          0
+#define WS_MASK_ERR_UNSUPPORTED            -1
+
+/* Kernel variants */
+typedef enum {
+    WS_MASK_IMPL_AUTO = 0,      /* Widest vectors available, probed on first use */
+    WS_MASK_IMPL_SCALAR,
+    WS_MASK_IMPL_SSE2,
+    WS_MASK_IMPL_AVX2,
+    WS_MASK_IMPL_AVX512,
+    WS_MASK_IMPL_NEON
+} ws_mask_impl_t;
+
+/* XOR len bytes of src with mask into dst (dst may equal src). offset is
+ * the position within the key of the first byte, i.e. the number of payload
+ * bytes already processed modulo 4. Returns the offset for the next call,
+ * so fragmented payloads can be processed piece by piece. */
+size_t ws_mask_apply(void *dst, const void *src, size_t len,
+                     const unsigned char mask[4], size_t offset);
+
+/* Mask with impl from now on, in every thread, e.g. to compare kernels in
+ * bench_ws_mask; WS_MASK_IMPL_AUTO goes back to the probed one. Safe while
+ * other threads mask. Returns WS_MASK_ERR_UNSUPPORTED if this CPU or build
+ * lacks impl. */
+int ws_mask_set_impl(ws_mask_impl_t impl);
+
+/* Kernel currently in use */
+ws_mask_impl_t ws_mask_get_impl(void);
+
+/* Printable kernel name */
+const char *ws_mask_impl_name(ws_mask_impl_t impl);
+
+#endif /* WS_MASK_H */
@@ -3,17 +3,36 @@
 # Create test_websocket executable
 add_executable(test_websocket
     src/test_websocket.c
+    src/ws_client.c
+    src/ws_handshake.c
+    src/ws_frame.c
+    src/ws_deflate.c
+    src/ws_mask.c
+    src/cpu_dispatch.c
+    src/ws_heartbeat.c
+    src/json_tok.c
+    src/timer_wheel.c
+    src/transport_tcp.c
+    src/resolver.c
+    src/conn_metrics.c
+    src/latency_hist.c
+    src/custom_rng.c
 )
 
 # Include directories for test_websocket
 target_include_directories(test_websocket PRIVATE
     ${CMAKE_CURRENT_SOURCE_DIR}/src
     ${WEBSOCKET_PARSER_INCLUDE_DIRS}
+    ${MBEDTLS_INCLUDE_DIRS}
 )
 
-# Link against websocket-parser library
+# Link against websocket-parser, mbedtls (wss:// and the handshake), zlib
+# (permessage-deflate) and pthreads
 target_link_libraries(test_websocket PRIVATE
     ${WEBSOCKET_PARSER_LIBRARIES}
+    ${MBEDTLS_LIBRARIES}
+    ZLIB::ZLIB
+    Threads::Threads
 )
 
 # Set output directory
@@ -4,7 +4,17 @@
 add_executable(tuya-client 
     src/main.c
     src/transport_tcp.c
+    src/resolver.c
+    src/conn_metrics.c
+    src/latency_hist.c
     src/custom_rng.c
+    src/event_loop.c
+    src/tls_arena.c
+    src/session_cache.c
+    src/https_pool.c
+    src/tls_profile.c
+    src/http_parser.c
+    src/timer_wheel.c
 )
 
 # Include directories
@@ -16,6 +26,7 @@ target_include_directories(tuya-client PRIVATE
 # Link against mbedtls libraries
 target_link_libraries(tuya-client PRIVATE 
     ${MBEDTLS_LIBRARIES}
+    Threads::Threads
 )
 
 # Platform-specific settings
@@ -0,0 +1,28 @@
+# Tuya LAN discovery tool executable configuration
+
+# Create executable
+add_executable(tuya-discover
+    src/tuya_discover.c
+    src/lan_discovery.c
+    src/tuya_codec.c
+    src/crc32.c
+    src/json_tok.c
+    src/cpu_dispatch.c
+)
+
+# Include directories
+target_include_directories(tuya-discover PRIVATE
+    ${CMAKE_CURRENT_SOURCE_DIR}/src
+    ${MBEDTLS_INCLUDE_DIRS}
+)
+
+# Link against mbedtls libraries and pthreads (kernel dispatch)
+target_link_libraries(tuya-discover PRIVATE
+    ${MBEDTLS_LIBRARIES}
+    Threads::Threads
+)
+
+# Set output directory
+set_target_properties(tuya-discover PROPERTIES
+    RUNTIME_OUTPUT_DIRECTORY ${CMAKE_BINARY_DIR}/bin
+)